@@ -0,0 +1,200 @@
+#include <string.h>
+
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+
+#include "ack_filter.hh"
+
+/**
+ * TCP flags that must agree for an ACK to replace another one.
+ */
+#define ACK_FILTER_ECN_FLAGS 0xc0
+
+/**
+ * Check whether a TCP header carries SACK blocks.
+ *
+ * @param th TCP header, including its options.
+ * @returns True if a SACK option is present or the options are malformed,
+ * false otherwise.
+ */
+static bool has_sack( struct tcphdr const * th ) {
+
+    unsigned char const *opt = (unsigned char const *) (th + 1);
+    int len = th->doff * 4 - sizeof(struct tcphdr);
+
+    while( len > 0 ) {
+        if( opt[0] == TCPOPT_EOL ) {
+            return false;
+        }
+        if( opt[0] == TCPOPT_NOP ) {
+            opt++;
+            len--;
+            continue;
+        }
+        if( len < 2 || opt[1] < 2 || opt[1] > len ) {
+            return true;
+        }
+        if( opt[0] == TCPOPT_SACK ) {
+            return true;
+        }
+        len -= opt[1];
+        opt += opt[1];
+    }
+    return false;
+}
+
+/**
+ * AckFilter class constructor
+ */
+AckFilter::AckFilter() : m_thinned(0) {
+}
+
+/**
+ * AckFilter class destructor
+ *
+ * Releases held and untransmitted ACKs.
+ */
+AckFilter::~AckFilter() {
+    for( int i = 0; i < m_held.size(); i++ ) {
+        delete m_held[i];
+    }
+    for( int i = 0; i < m_out.size(); i++ ) {
+        delete m_out[i];
+    }
+}
+
+/**
+ * Check whether a packet is a pure TCP/IPv4 ACK.
+ *
+ * A pure ACK carries no payload, and besides ACK at most the PSH and ECN
+ * flags.
+ *
+ * @param pkt Pointer to the IP packet.
+ * @param size Size of the packet.
+ * @returns True if the packet is a pure ACK, false otherwise.
+ */
+bool AckFilter::IsPureAck( unsigned char const * pkt, int size ) {
+
+    struct iphdr const *iph = (struct iphdr const *) pkt;
+    if( size < (int) sizeof(struct iphdr) || iph->version != 4
+            || iph->protocol != IPPROTO_TCP
+            || (ntohs(iph->frag_off) & (IP_MF | IP_OFFMASK)) ) {
+        return false;
+    }
+
+    int ihl = iph->ihl * 4;
+    if( size < ihl + (int) sizeof(struct tcphdr) ) {
+        return false;
+    }
+    struct tcphdr const *th = (struct tcphdr const *) (pkt + ihl);
+
+    uint8_t flags = pkt[ihl + 13];
+    return (flags & ~(TH_PUSH | ACK_FILTER_ECN_FLAGS)) == TH_ACK
+        && th->doff >= 5
+        && ntohs(iph->tot_len) == ihl + th->doff * 4
+        && size >= ihl + th->doff * 4;
+}
+
+/**
+ * Find the held ACK of a packet's flow.
+ *
+ * @param pkt Pointer to the IP packet.
+ * @param size Size of the packet.
+ * @returns The index of the held ACK, or -1 if no ACK of the packet's flow is
+ * held.
+ */
+int AckFilter::Find( unsigned char const * pkt, int size ) const {
+
+    struct iphdr const *iph = (struct iphdr const *) pkt;
+    if( m_held.empty() || size < (int) sizeof(struct iphdr)
+            || iph->version != 4 || iph->protocol != IPPROTO_TCP
+            || size < iph->ihl * 4 + 4 ) {
+        return -1;
+    }
+    unsigned char const *ports = pkt + iph->ihl * 4;
+
+    for( int i = 0; i < m_held.size(); i++ ) {
+        struct iphdr const *hiph = (struct iphdr const *) m_held[i]->data();
+        unsigned char const *hports = m_held[i]->data() + hiph->ihl * 4;
+        if( iph->saddr == hiph->saddr && iph->daddr == hiph->daddr
+                && memcmp( ports, hports, 4 ) == 0 ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Move a held ACK to the output list.
+ *
+ * @param idx Index of the held ACK.
+ */
+void AckFilter::Output( int idx ) {
+    m_out.push_back( m_held[idx] );
+    m_held.erase( m_held.begin() + idx );
+}
+
+/**
+ * Add a pure ACK.
+ *
+ * The ACK replaces the held ACK of its flow if it acknowledges more data and
+ * the held ACK carries no further information. Otherwise, the held ACK is
+ * output and the new one is held instead. If ACK_FILTER_MAX_FLOWS ACKs are
+ * held already, the oldest one is output.
+ *
+ * @param pkt Pointer to the pure ACK, see AckFilter::IsPureAck(). Copied.
+ * @param size Size of the ACK.
+ */
+void AckFilter::Add( unsigned char const * pkt, int size ) {
+
+    int idx = Find( pkt, size );
+    if( idx >= 0 ) {
+        Buffer *held = m_held[idx];
+        struct iphdr const *iph = (struct iphdr const *) pkt;
+        struct tcphdr const *th = (struct tcphdr const *) (pkt + iph->ihl * 4);
+        struct iphdr const *hiph = (struct iphdr const *) held->data();
+        struct tcphdr const *hth =
+            (struct tcphdr const *) (held->data() + hiph->ihl * 4);
+
+        int32_t acked = ntohl(th->ack_seq) - ntohl(hth->ack_seq);
+        uint8_t ecn = ((uint8_t const *) th)[13] ^ ((uint8_t const *) hth)[13];
+        if( acked > 0 && !(ecn & ACK_FILTER_ECN_FLAGS) && !has_sack(hth) ) {
+            held->assign( pkt, pkt + size );
+            m_thinned++;
+            return;
+        }
+        Output(idx);
+    }
+
+    if( m_held.size() >= ACK_FILTER_MAX_FLOWS ) {
+        Output(0);
+    }
+    m_held.push_back( new Buffer( pkt, pkt + size ) );
+}
+
+/**
+ * Output the held ACK of a packet's flow, if any.
+ *
+ * Called for packets other than pure ACKs, which must not overtake the held
+ * ACK of their flow.
+ *
+ * @param pkt Pointer to the IP packet.
+ * @param size Size of the packet.
+ */
+void AckFilter::Release( unsigned char const * pkt, int size ) {
+
+    int idx = Find( pkt, size );
+    if( idx >= 0 ) {
+        Output(idx);
+    }
+}
+
+/**
+ * Output all held ACKs.
+ */
+void AckFilter::Flush() {
+    for( int i = 0; i < m_held.size(); i++ ) {
+        m_out.push_back( m_held[i] );
+    }
+    m_held.clear();
+}
@@ -0,0 +1,86 @@
+/** @file ack_filter.hh
+ * AckFilter class definition
+ */
+
+#ifndef _ACK_FILTER_HH_
+#define _ACK_FILTER_HH_
+
+#include <cstdint>
+#include <vector>
+
+#include "common.hh"
+
+/**
+ * Maximum number of TCP flows the AckFilter holds an ACK of at once.
+ */
+#define ACK_FILTER_MAX_FLOWS 16
+
+/**
+ * AckFilter class
+ *
+ * Thins out pure TCP ACKs on the transmission path. While packets are received
+ * from the client in a burst, the most recent pure ACK of every TCP/IPv4 flow
+ * is held back. A newer ACK of the same flow acknowledging more data replaces
+ * the held one, which is dropped, since TCP ACKs are cumulative. Held ACKs are
+ * output at the end of the burst, see AckFilter::Flush(), or right before the
+ * next data packet of their flow, see AckFilter::Release().
+ *
+ * ACKs carrying information beyond their acknowledgment number are never
+ * dropped: Duplicate ACKs, which signal loss to the sender, ACKs with SACK
+ * blocks, and ACKs differing in their ECN flags.
+ *
+ * ACKs to be transmitted are collected in an output list.
+ *
+ * @see LinkManager
+ */
+class AckFilter {
+
+    // Held ACKs, oldest first
+    std::vector<Buffer *> m_held;
+
+    // ACKs to be transmitted
+    std::vector<Buffer *> m_out;
+
+    // Number of ACKs dropped
+    uint64_t              m_thinned;
+
+    AckFilter( AckFilter const & ) = delete;
+    AckFilter & operator=( AckFilter const & ) = delete;
+
+    int Find( unsigned char const * pkt, int size ) const;
+    void Output( int idx );
+
+    public:
+
+    AckFilter();
+    ~AckFilter();
+
+    static bool IsPureAck( unsigned char const * pkt, int size );
+
+    void Add( unsigned char const * pkt, int size );
+    void Release( unsigned char const * pkt, int size );
+    void Flush();
+
+    /**
+     * Getter for the ACKs to be transmitted.
+     *
+     * @returns The ACKs, in the order they are to be transmitted.
+     */
+    std::vector<Buffer *> const & Out() const { return m_out; }
+
+    /**
+     * Forget the transmitted ACKs.
+     *
+     * The ACKs themselves are not released, this is left to the caller.
+     */
+    void ClearOut() { m_out.clear(); }
+
+    /**
+     * Getter for the number of ACKs dropped.
+     *
+     * @returns The number of ACKs that were replaced by newer ones.
+     */
+    uint64_t const Thinned() const { return m_thinned; }
+};
+
+#endif /* _ACK_FILTER_HH_ */
@@ -0,0 +1,96 @@
+/** @file buffer_budget.hh
+ * BufferBudget class definition
+ */
+
+#ifndef _BUFFER_BUDGET_HH_
+#define _BUFFER_BUDGET_HH_
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Default size of the BufferBudget in bytes.
+ */
+#define BUFFER_BUDGET_DEFAULT (64 * 1024 * 1024)
+
+/**
+ * BufferBudget class
+ *
+ * Process-wide limit of the memory taken by received packets waiting for
+ * their delivery, i.e. packets held for reordering by the PacketPools and
+ * packets queued for the client by the LinkManager. Packets that would exceed
+ * the budget are dropped by their holder, so the memory used under overload
+ * stays predictable.
+ *
+ * @see PacketPool
+ * @see LinkManager
+ */
+class BufferBudget {
+
+    /**
+     * Budget in bytes.
+     *
+     * @returns Reference to the budget.
+     */
+    static std::atomic<int64_t> & Limit() {
+        static std::atomic<int64_t> limit(BUFFER_BUDGET_DEFAULT);
+        return limit;
+    }
+
+    /**
+     * Bytes taken from the budget.
+     *
+     * @returns Reference to the bytes taken.
+     */
+    static std::atomic<int64_t> & Taken() {
+        static std::atomic<int64_t> taken(0);
+        return taken;
+    }
+
+    public:
+
+    /**
+     * Set the budget.
+     *
+     * @param bytes Budget in bytes.
+     */
+    static void SetLimit(int64_t bytes) {
+        Limit() = bytes;
+    }
+
+    /**
+     * Take bytes from the budget.
+     *
+     * @param bytes Number of bytes to be taken.
+     * @param force Whether to take the bytes even if the budget is exceeded,
+     * for packets that are handed on right away.
+     * @returns True if the bytes were taken, false if they exceed the budget.
+     */
+    static bool Acquire(int64_t bytes, bool force = false) {
+        if(Taken().fetch_add(bytes) + bytes > Limit() && !force) {
+            Taken() -= bytes;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Return bytes to the budget.
+     *
+     * @param bytes Number of bytes taken by BufferBudget::Acquire() before.
+     */
+    static void Release(int64_t bytes) {
+        Taken() -= bytes;
+    }
+
+    /**
+     * Getter for the bytes taken from the budget.
+     *
+     * @returns Number of bytes.
+     */
+    static int64_t Used() {
+        return Taken();
+    }
+};
+
+#endif /* _BUFFER_BUDGET_HH_ */
@@ -0,0 +1,127 @@
+/** @file checksum.hh
+ * Internet checksum helpers
+ */
+
+#ifndef _CHECKSUM_HH_
+#define _CHECKSUM_HH_
+
+#include <cstdint>
+#include <string.h>
+
+#include <netinet/in.h>
+#include <netinet/ip.h>
+
+/**
+ * Add a buffer to a 32 bit one's complement accumulator.
+ *
+ * @param buf Pointer to the data.
+ * @param len Number of bytes in the buffer.
+ * @param sum Accumulator to add to.
+ * @returns The new accumulator.
+ */
+inline uint32_t csum_add( unsigned char const * buf, int len, uint32_t sum ) {
+
+    uint64_t acc = sum;
+
+    while( len >= 4 ) {
+        uint32_t w;
+        memcpy( &w, buf, 4 );
+        acc += w;
+        buf += 4;
+        len -= 4;
+    }
+    if( len >= 2 ) {
+        uint16_t w;
+        memcpy( &w, buf, 2 );
+        acc += w;
+        buf += 2;
+        len -= 2;
+    }
+    if( len ) {
+        uint16_t w = 0;
+        memcpy( &w, buf, 1 );
+        acc += w;
+    }
+
+    // Fold to 32 bits
+    acc = (acc & 0xffffffff) + (acc >> 32);
+    acc = (acc & 0xffffffff) + (acc >> 32);
+    return (uint32_t) acc;
+}
+
+/**
+ * Fold a 32 bit accumulator to a 16 bit checksum.
+ *
+ * @param sum Accumulator.
+ * @returns The complemented checksum, in network byte order.
+ */
+inline uint16_t csum_fold( uint32_t sum ) {
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t) ~sum;
+}
+
+/**
+ * Sum of the TCP/UDP pseudo header of an IPv4 packet.
+ *
+ * @param iph Pointer to the IP header.
+ * @param l4_len Length of the transport header and payload in bytes.
+ * @returns Accumulator containing the pseudo header.
+ */
+inline uint32_t csum_pseudo( struct iphdr const * iph, int l4_len ) {
+
+    uint32_t sum = 0;
+    sum = csum_add( (unsigned char const *) &iph->saddr, 4, sum );
+    sum = csum_add( (unsigned char const *) &iph->daddr, 4, sum );
+    sum += htons( iph->protocol );
+    sum += htons( l4_len );
+    return sum;
+}
+
+/**
+ * Offset of the checksum field within a transport header.
+ *
+ * @param protocol IP protocol number.
+ * @returns The offset in bytes, or -1 if the protocol is not supported.
+ */
+inline int csum_l4_offset( uint8_t protocol ) {
+    switch( protocol ) {
+        case IPPROTO_TCP: return 16;
+        case IPPROTO_UDP: return 6;
+        default:          return -1;
+    }
+}
+
+/**
+ * Compute the transport layer checksum of an IPv4 packet in place.
+ *
+ * Used for packets whose checksum was left to be offloaded, e.g. GSO
+ * packets. Packets of other protocols than TCP and UDP are left untouched.
+ *
+ * @param pkt Pointer to the IP packet.
+ * @param len Length of the packet in bytes.
+ */
+inline void csum_l4_complete( unsigned char * pkt, int len ) {
+
+    struct iphdr *iph = (struct iphdr *) pkt;
+    if( len < (int) sizeof(struct iphdr) || iph->version != 4 ) {
+        return;
+    }
+
+    int ihl = iph->ihl * 4;
+    int off = csum_l4_offset(iph->protocol);
+    if( off < 0 || len < ihl + off + 2 ) {
+        return;
+    }
+
+    unsigned char *l4 = pkt + ihl;
+    memset( l4 + off, 0, 2 );
+    uint16_t csum = csum_fold(
+            csum_add( l4, len - ihl, csum_pseudo(iph, len - ihl) ) );
+    if( iph->protocol == IPPROTO_UDP && csum == 0 ) {
+        csum = 0xffff;
+    }
+    memcpy( l4 + off, &csum, 2 );
+}
+
+#endif /* _CHECKSUM_HH_ */
@@ -0,0 +1,471 @@
+#include <string.h>
+
+#include <utility>
+
+#include <openssl/kdf.h>
+#include <openssl/rand.h>
+
+#include "cipher.hh"
+
+/**
+ * Size of the additional authenticated data taken from the AlaggHeader.
+ */
+#define CIPHER_AAD_LEN 7
+
+/**
+ * Context of the key derivation, binding the packet keys to this use of the
+ * pre-shared key.
+ */
+#define CIPHER_HKDF_INFO "alagg aes-256-gcm packet key"
+
+/**
+ * Cipher class constructor
+ *
+ * Sets up the contexts and derives the first key of encrypted packets. Exits
+ * if the cipher is not available.
+ *
+ * @param key Pre-shared key of CIPHER_KEY_LEN bytes.
+ */
+Cipher::Cipher( std::vector<unsigned char> const & key )
+        : m_key(key)
+        , m_enc(EVP_CIPHER_CTX_new())
+        , m_salt(0)
+        , m_counter(0) {
+
+    DecKey *dec[] = { &m_dec, &m_dec_prev, &m_dec_next };
+    bool ok = true;
+    for( int i = 0; i < 3; i++ ) {
+        memset( dec[i], 0, sizeof(DecKey) );
+        dec[i]->m_ctx = EVP_CIPHER_CTX_new();
+        ok = ok && dec[i]->m_ctx
+            && EVP_DecryptInit_ex( dec[i]->m_ctx, EVP_aes_256_gcm(), nullptr,
+                                   nullptr, nullptr );
+    }
+
+    if( !ok || !m_enc || key.size() != CIPHER_KEY_LEN
+            || !EVP_EncryptInit_ex( m_enc, EVP_aes_256_gcm(), nullptr,
+                                    nullptr, nullptr )
+            || !Rekey() ) {
+        std::cerr << "ERROR: Failed to set up AES-256-GCM" << std::endl;
+        exit(1);
+    }
+    errno = 0;
+}
+
+/**
+ * Cipher class destructor
+ */
+Cipher::~Cipher() {
+    EVP_CIPHER_CTX_free( m_enc );
+    EVP_CIPHER_CTX_free( m_dec.m_ctx );
+    EVP_CIPHER_CTX_free( m_dec_prev.m_ctx );
+    EVP_CIPHER_CTX_free( m_dec_next.m_ctx );
+}
+
+/**
+ * Set up the key of a salt.
+ *
+ * The key is derived from the pre-shared key and the salt by HKDF-SHA256.
+ *
+ * @param salt Salt of the key, as carried by the nonce.
+ * @param ctx Context the key schedule is set up in.
+ * @param encrypt Whether the context encrypts or decrypts.
+ * @returns True on success, false otherwise.
+ */
+bool Cipher::Derive( uint64_t salt, EVP_CIPHER_CTX * ctx,
+                     bool encrypt ) const {
+
+    unsigned char key[CIPHER_KEY_LEN];
+    size_t key_len = sizeof(key);
+    EVP_PKEY_CTX *kdf = EVP_PKEY_CTX_new_id( EVP_PKEY_HKDF, nullptr );
+    bool ok = kdf
+        && EVP_PKEY_derive_init( kdf ) > 0
+        && EVP_PKEY_CTX_set_hkdf_md( kdf, EVP_sha256() ) > 0
+        && EVP_PKEY_CTX_set1_hkdf_salt( kdf, (unsigned char *) &salt,
+                                        sizeof(salt) ) > 0
+        && EVP_PKEY_CTX_set1_hkdf_key( kdf, m_key.data(), m_key.size() ) > 0
+        && EVP_PKEY_CTX_add1_hkdf_info( kdf,
+                (unsigned char *) CIPHER_HKDF_INFO,
+                sizeof(CIPHER_HKDF_INFO) - 1 ) > 0
+        && EVP_PKEY_derive( kdf, key, &key_len ) > 0;
+    EVP_PKEY_CTX_free( kdf );
+
+    if( ok ) {
+        ok = encrypt
+            ? EVP_EncryptInit_ex( ctx, nullptr, nullptr, key, nullptr )
+            : EVP_DecryptInit_ex( ctx, nullptr, nullptr, key, nullptr );
+    }
+    OPENSSL_cleanse( key, sizeof(key) );
+    return ok;
+}
+
+/**
+ * Draw a new salt for encrypted packets, and set up its key.
+ *
+ * @returns True on success, false otherwise.
+ */
+bool Cipher::Rekey() {
+
+    // 0 stands for no key on the receiving side
+    do {
+        if( RAND_bytes( (unsigned char *) &m_salt, sizeof(m_salt) ) != 1 ) {
+            return false;
+        }
+    } while( !m_salt );
+    if( !Derive( m_salt, m_enc, true ) ) {
+        return false;
+    }
+    m_counter = 0;
+    return true;
+}
+
+/**
+ * Get the additional authenticated data of a packet.
+ *
+ * @param header Header of the packet. Only the fields that are the same for
+ * all fragments and copies of the packet are used.
+ * @param aad Buffer of CIPHER_AAD_LEN bytes the data is stored in.
+ */
+void Cipher::Aad( AlaggHeader const & header, unsigned char * aad ) {
+    aad[0] = header.m_tunnel;
+    aad[1] = header.m_class;
+    aad[2] = header.m_flags & (ALAGG_FLAG_UNORDERED | ALAGG_FLAG_SYNC
+                               | ALAGG_FLAG_PROBE | ALAGG_FLAG_REPORT
+                               | ALAGG_FLAG_NACK);
+    memcpy( aad + 3, &header.m_seq, sizeof(alagg_seq_t) );
+    memcpy( aad + 5, &header.m_epoch, sizeof(header.m_epoch) );
+}
+
+/**
+ * Encrypt a packet.
+ *
+ * Must only be called by the transmitting thread.
+ *
+ * @param header Header the packet is sent with, see Cipher::Aad().
+ * @param in Pointer to the packet.
+ * @param len Size of the packet.
+ * @param out Buffer of len + CIPHER_OVERHEAD bytes the encrypted packet is
+ * stored in.
+ * @returns The size of the encrypted packet, or -1 on failure.
+ */
+int Cipher::Seal( AlaggHeader const & header, unsigned char const * in,
+                  int len, unsigned char * out ) {
+
+    // A new key before the nonces of the current one run out
+    if( m_counter == UINT32_MAX && !Rekey() ) {
+        return -1;
+    }
+
+    unsigned char aad[CIPHER_AAD_LEN];
+    Aad( header, aad );
+    memcpy( out, &m_salt, sizeof(m_salt) );
+    memcpy( out + sizeof(m_salt), &m_counter, sizeof(m_counter) );
+    m_counter++;
+
+    int n;
+    unsigned char *ct = out + CIPHER_NONCE_LEN;
+    if( !EVP_EncryptInit_ex( m_enc, nullptr, nullptr, nullptr, out )
+            || !EVP_EncryptUpdate( m_enc, nullptr, &n, aad, sizeof(aad) )
+            || !EVP_EncryptUpdate( m_enc, ct, &n, in, len )
+            || !EVP_EncryptFinal_ex( m_enc, ct + len, &n )
+            || !EVP_CIPHER_CTX_ctrl( m_enc, EVP_CTRL_GCM_GET_TAG,
+                                     CIPHER_TAG_LEN, ct + len ) ) {
+        return -1;
+    }
+    return len + CIPHER_OVERHEAD;
+}
+
+/**
+ * Encrypt a frame, from any thread.
+ *
+ * Like Cipher::Seal(), but serialized, so the Cipher may be used by several
+ * threads. Must not be mixed with Cipher::Seal().
+ *
+ * @param header Header the frame is sent with, see Cipher::Aad().
+ * @param in Pointer to the payload.
+ * @param len Size of the payload.
+ * @param out Buffer of len + CIPHER_OVERHEAD bytes the encrypted payload is
+ * stored in.
+ * @returns The size of the encrypted payload, or -1 on failure.
+ */
+int Cipher::SealShared( AlaggHeader const & header, unsigned char const * in,
+                        int len, unsigned char * out ) {
+    std::lock_guard<std::mutex> lock(m_enc_lock);
+    return Seal( header, in, len, out );
+}
+
+/**
+ * Draw a new salt for frames sealed by Cipher::SealShared(), e.g. once the
+ * remote aggregator started a new session, so it accepts the salt by its
+ * counters starting over. Keeps the current salt on failure.
+ */
+void Cipher::Restart() {
+    std::lock_guard<std::mutex> lock(m_enc_lock);
+    uint64_t salt = m_salt;
+    uint32_t counter = m_counter;
+    if( !Rekey() ) {
+        m_salt = salt;
+        m_counter = counter;
+        Derive( m_salt, m_enc, true );
+    }
+    errno = 0;
+}
+
+/**
+ * Decrypt and authenticate a packet with a key.
+ *
+ * @param ctx Context holding the key.
+ * @param aad Additional authenticated data of CIPHER_AAD_LEN bytes.
+ * @param in Pointer to the nonce, followed by the ciphertext and the tag.
+ * @param len Size of the ciphertext.
+ * @param out Buffer of len bytes the packet is stored in.
+ * @returns The size of the packet, or -1 if it is not authentic.
+ */
+int Cipher::Decrypt( EVP_CIPHER_CTX * ctx, unsigned char const * aad,
+                     unsigned char const * in, int len,
+                     unsigned char * out ) {
+
+    unsigned char tag[CIPHER_TAG_LEN];
+    memcpy( tag, in + CIPHER_NONCE_LEN + len, CIPHER_TAG_LEN );
+
+    int n;
+    if( !EVP_DecryptInit_ex( ctx, nullptr, nullptr, nullptr, in )
+            || !EVP_DecryptUpdate( ctx, nullptr, &n, aad, CIPHER_AAD_LEN )
+            || !EVP_CIPHER_CTX_ctrl( ctx, EVP_CTRL_GCM_SET_TAG,
+                                     CIPHER_TAG_LEN, tag ) ) {
+        return -1;
+    }
+
+    if( !EVP_DecryptUpdate( ctx, out, &n, in + CIPHER_NONCE_LEN, len )
+            || EVP_DecryptFinal_ex( ctx, out + len, &n ) <= 0 ) {
+        return -1;
+    }
+    return len;
+}
+
+/**
+ * Check whether a counter was not used by an authenticated packet yet.
+ *
+ * @param key Key of the packet's salt.
+ * @param counter Counter of the packet's nonce.
+ * @returns True if the counter is ahead of the window, or within it and not
+ * marked. False if it was marked, or is older than the window.
+ */
+bool Cipher::Fresh( DecKey const & key, uint32_t counter ) {
+
+    if( counter > key.m_top ) {
+        return true;
+    }
+    if( key.m_top - counter >= CIPHER_REPLAY_WINDOW ) {
+        return false;
+    }
+    uint64_t word = key.m_words[(counter / 64) % CIPHER_REPLAY_WORDS];
+    return !(word & (1ULL << (counter % 64)));
+}
+
+/**
+ * Mark the counter of an authenticated packet.
+ *
+ * Counters ahead of the window slide it forward, clearing the bits of the
+ * counters skipped.
+ *
+ * @param key Key of the packet's salt.
+ * @param counter Counter of the packet's nonce.
+ */
+void Cipher::Mark( DecKey & key, uint32_t counter ) {
+
+    if( counter > key.m_top ) {
+        if( counter - key.m_top >= CIPHER_REPLAY_WINDOW ) {
+            Clear( key, 0 );
+        } else {
+            for( uint32_t c = key.m_top + 1; c != counter + 1; c++ ) {
+                key.m_words[(c / 64) % CIPHER_REPLAY_WORDS] &=
+                    ~(1ULL << (c % 64));
+            }
+        }
+        key.m_top = counter;
+    }
+    key.m_words[(counter / 64) % CIPHER_REPLAY_WORDS] |= 1ULL << (counter % 64);
+}
+
+/**
+ * Set all words of a window.
+ *
+ * @param key Key of the window.
+ * @param word Value of every word, 0 to mark no counter, ~0 to mark all.
+ */
+void Cipher::Clear( DecKey & key, uint64_t word ) {
+    for( int i = 0; i < CIPHER_REPLAY_WORDS; i++ ) {
+        key.m_words[i] = word;
+    }
+}
+
+/**
+ * Find the key of a current or previous salt.
+ *
+ * @param salt Salt of a packet's nonce.
+ * @returns The key, or nullptr if the salt is not known.
+ */
+Cipher::DecKey * Cipher::Find( uint64_t salt ) {
+
+    if( m_dec.m_salt && salt == m_dec.m_salt ) {
+        return &m_dec;
+    }
+    if( m_dec_prev.m_salt && salt == m_dec_prev.m_salt ) {
+        return &m_dec_prev;
+    }
+    return nullptr;
+}
+
+/**
+ * Derive the key of a new salt, unless derived before.
+ *
+ * The key is kept until another salt is derived, so packets forged with the
+ * same salt do not cost another derivation.
+ *
+ * @param salt The new salt.
+ * @returns True on success, false otherwise.
+ */
+bool Cipher::DeriveNext( uint64_t salt ) {
+
+    if( salt == m_dec_next.m_salt ) {
+        return true;
+    }
+    m_dec_next.m_salt = 0;
+    if( !Derive( salt, m_dec_next.m_ctx, false ) ) {
+        return false;
+    }
+    m_dec_next.m_salt = salt;
+    return true;
+}
+
+/**
+ * Make the new salt the current one, with an empty window. The current salt
+ * becomes the previous one.
+ */
+void Cipher::Adopt() {
+    std::swap( m_dec_prev, m_dec_next );
+    std::swap( m_dec_prev, m_dec );
+    m_dec_next.m_salt = 0;
+    m_dec.m_top = 0;
+    Clear( m_dec, 0 );
+}
+
+/**
+ * Decrypt and authenticate a packet.
+ *
+ * The key is selected by the salt of the packet's nonce, and packets whose
+ * counter was used before or is older than the salt's window are rejected.
+ * A new salt is only accepted if the counter is within its first window, and
+ * replaces the previous one once the packet is authenticated, so forged
+ * packets do not evict the keys in use. Must only be called by the receiving
+ * thread.
+ *
+ * @param header Header the packet was received with, see Cipher::Aad().
+ * @param in Pointer to the encrypted packet.
+ * @param len Size of the encrypted packet.
+ * @param out Buffer of len - CIPHER_OVERHEAD bytes the packet is stored in,
+ * not overlapping the encrypted packet.
+ * @returns The size of the packet, or -1 if it is not authentic or replayed.
+ */
+int Cipher::Open( AlaggHeader const & header, unsigned char const * in,
+                  int len, unsigned char * out ) {
+
+    len -= CIPHER_OVERHEAD;
+    if( len < 0 ) {
+        return -1;
+    }
+
+    unsigned char aad[CIPHER_AAD_LEN];
+    Aad( header, aad );
+    uint64_t salt;
+    uint32_t counter;
+    memcpy( &salt, in, sizeof(salt) );
+    memcpy( &counter, in + sizeof(salt), sizeof(counter) );
+
+    DecKey *key = Find( salt );
+    if( key ) {
+        if( !Fresh( *key, counter )
+                || Decrypt( key->m_ctx, aad, in, len, out ) < 0 ) {
+            return -1;
+        }
+        Mark( *key, counter );
+        return len;
+    }
+
+    if( counter >= CIPHER_REPLAY_WINDOW || !salt || !DeriveNext( salt )
+            || Decrypt( m_dec_next.m_ctx, aad, in, len, out ) < 0 ) {
+        return -1;
+    }
+    Adopt();
+    Mark( m_dec, counter );
+    return len;
+}
+
+/**
+ * Decrypt and authenticate a handshake.
+ *
+ * Unlike Cipher::Open(), handshakes are accepted with any counter and are not
+ * checked against the windows, and the key of a new salt is not adopted. A
+ * handshake is only trusted once it answered a challenge, see Cipher::Trust().
+ * Must only be called by the receiving thread.
+ *
+ * @param header Header the handshake was received with, see Cipher::Aad().
+ * @param in Pointer to the encrypted handshake.
+ * @param len Size of the encrypted handshake.
+ * @param out Buffer of len - CIPHER_OVERHEAD bytes the handshake is stored in,
+ * not overlapping the encrypted handshake.
+ * @returns The size of the handshake, or -1 if it is not authentic.
+ */
+int Cipher::OpenSync( AlaggHeader const & header, unsigned char const * in,
+                      int len, unsigned char * out ) {
+
+    len -= CIPHER_OVERHEAD;
+    if( len < 0 ) {
+        return -1;
+    }
+
+    unsigned char aad[CIPHER_AAD_LEN];
+    Aad( header, aad );
+    uint64_t salt;
+    memcpy( &salt, in, sizeof(salt) );
+
+    DecKey *key = Find( salt );
+    if( key ) {
+        return Decrypt( key->m_ctx, aad, in, len, out );
+    }
+    if( !salt || !DeriveNext( salt ) ) {
+        return -1;
+    }
+    return Decrypt( m_dec_next.m_ctx, aad, in, len, out );
+}
+
+/**
+ * Trust the salt of a handshake opened by Cipher::OpenSync(), once it proved
+ * fresh by answering a challenge.
+ *
+ * A new salt is adopted with a window taking all counters up to the
+ * handshake's as used, so packets sent before it are rejected. Must only be
+ * called by the receiving thread.
+ *
+ * @param in Pointer to the encrypted handshake.
+ */
+void Cipher::Trust( unsigned char const * in ) {
+
+    uint64_t salt;
+    uint32_t counter;
+    memcpy( &salt, in, sizeof(salt) );
+    memcpy( &counter, in + sizeof(salt), sizeof(counter) );
+
+    DecKey *key = Find( salt );
+    if( key ) {
+        Mark( *key, counter );
+        return;
+    }
+    if( !salt || salt != m_dec_next.m_salt ) {
+        return;
+    }
+    Adopt();
+    m_dec.m_top = counter;
+    Clear( m_dec, ~0ULL );
+}
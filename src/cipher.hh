@@ -0,0 +1,150 @@
+/** @file cipher.hh
+ * Cipher class definition
+ */
+
+#ifndef _CIPHER_HH_
+#define _CIPHER_HH_
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <openssl/evp.h>
+
+#include "common.hh"
+#include "link.hh"
+
+/**
+ * Size of the pre-shared key in bytes, selecting AES-256-GCM.
+ */
+#define CIPHER_KEY_LEN 32
+
+/**
+ * Size of the nonce preceding every encrypted packet.
+ */
+#define CIPHER_NONCE_LEN 12
+
+/**
+ * Size of the authentication tag following every encrypted packet.
+ */
+#define CIPHER_TAG_LEN 16
+
+/**
+ * Number of bytes encryption adds to a packet.
+ */
+#define CIPHER_OVERHEAD (CIPHER_NONCE_LEN + CIPHER_TAG_LEN)
+
+/**
+ * Number of 64 bit words of the window of nonce counters of a salt.
+ */
+#define CIPHER_REPLAY_WORDS 64
+
+/**
+ * Number of nonce counters tracked per salt. A new salt is only accepted by a
+ * packet whose counter is within the first window.
+ */
+#define CIPHER_REPLAY_WINDOW (CIPHER_REPLAY_WORDS * 64)
+
+/**
+ * Cipher class
+ *
+ * Encrypts and authenticates the packets of a Tunnel with AES-256-GCM and a
+ * pre-shared key. Packets are encrypted once before they are fragmented and
+ * replicated, and decrypted once after reassembly, so the cost does not grow
+ * with the number of Links.
+ *
+ * An encrypted packet carries its nonce, the ciphertext and the tag. The
+ * nonce is made of a random 64-bit salt and a 32-bit counter. Packets are not
+ * encrypted with the pre-shared key itself, but with a key derived from it and
+ * the salt by HKDF-SHA256. A new salt, and with it a new key, is drawn when
+ * the Cipher is created and before the counter wraps. Since every key is only
+ * used with the nonces of its own counter, nonces are not reused under a key
+ * unless two random salts collide, which is unlikely within 2^32 keys.
+ * The receiver keeps the keys of the current and the previous salt, the latter
+ * for packets still in flight. Per salt, a sliding window of the counters of
+ * the packets authenticated rejects replayed packets and packets older than
+ * the window. Since counters do not wrap, this also rejects old packets whose
+ * 16-bit sequence numbers wrapped around. A packet of a new salt is only
+ * accepted if its counter is within the first window, as after the sender
+ * drew the salt, and only then the key is derived. Handshakes are the
+ * exception, since they may be sent long after the salt was drawn: they are
+ * opened with any counter, but their salt is only adopted once the handshake
+ * proved fresh, see Cipher::Trust().
+ * The tunnel id, traffic class, sequence number, epoch and the flags telling
+ * the kind of frame, e.g. ALAGG_FLAG_UNORDERED or ALAGG_FLAG_NACK, of the
+ * AlaggHeader are authenticated as well, so the ReplayWindow can trust the
+ * sequence number of authenticated packets, and frames cannot pass for
+ * another kind.
+ *
+ * The key schedules are set up once, and AES-NI, VAES and AVX2 are used by
+ * OpenSSL where available. Packets are encrypted by the transmitting thread
+ * and decrypted by the receiving thread, each on its own context. Probes,
+ * reports and NACKs are sent by both threads, and sealed by a Cipher of their
+ * own using Cipher::SealShared().
+ *
+ * @see Tunnel
+ * @see ReplayWindow
+ */
+class Cipher {
+
+    /**
+     * Key of a salt of decrypted packets, and the window of the counters of
+     * the packets authenticated with it.
+     */
+    struct DecKey {
+        EVP_CIPHER_CTX *m_ctx;
+        uint64_t        m_salt;
+        uint32_t        m_top;
+        uint64_t        m_words[CIPHER_REPLAY_WORDS];
+    };
+
+    // Pre-shared key the packet keys are derived from
+    std::vector<unsigned char> m_key;
+
+    // Key of encrypted packets, and the salt and counter of the next nonce
+    EVP_CIPHER_CTX *m_enc;
+    uint64_t        m_salt;
+    uint32_t        m_counter;
+    // Serializes encryption by several threads, see Cipher::SealShared()
+    std::mutex      m_enc_lock;
+
+    // Keys of the current and previous salt of decrypted packets, and a key
+    // derived for a new salt, adopted once its packet is authenticated
+    DecKey          m_dec;
+    DecKey          m_dec_prev;
+    DecKey          m_dec_next;
+
+    Cipher( Cipher const & ) = delete;
+    Cipher & operator=( Cipher const & ) = delete;
+
+    static void Aad( AlaggHeader const & header, unsigned char * aad );
+    bool Derive( uint64_t salt, EVP_CIPHER_CTX * ctx, bool encrypt ) const;
+    bool Rekey();
+    static int Decrypt( EVP_CIPHER_CTX * ctx, unsigned char const * aad,
+                        unsigned char const * in, int len,
+                        unsigned char * out );
+    static bool Fresh( DecKey const & key, uint32_t counter );
+    static void Mark( DecKey & key, uint32_t counter );
+    static void Clear( DecKey & key, uint64_t word );
+    DecKey * Find( uint64_t salt );
+    bool DeriveNext( uint64_t salt );
+    void Adopt();
+
+    public:
+
+    Cipher( std::vector<unsigned char> const & key );
+    ~Cipher();
+
+    int Seal( AlaggHeader const & header, unsigned char const * in, int len,
+              unsigned char * out );
+    int SealShared( AlaggHeader const & header, unsigned char const * in,
+                    int len, unsigned char * out );
+    void Restart();
+    int Open( AlaggHeader const & header, unsigned char const * in, int len,
+              unsigned char * out );
+    int OpenSync( AlaggHeader const & header, unsigned char const * in,
+                  int len, unsigned char * out );
+    void Trust( unsigned char const * in );
+};
+
+#endif /* _CIPHER_HH_ */
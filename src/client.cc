@@ -3,6 +3,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <cstddef>
 
 #include <linux/if_packet.h>
 #include <net/ethernet.h>
@@ -11,32 +13,31 @@
 #include <net/if.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
+#include <netinet/tcp.h>
 
 #include "client.hh"
 
 /**
- * Client class constructor.
+ * Open a packet socket for delivery to the client application(s).
  *
- * Opens an IP-layer socket for communication with the client application(s).
  * The socket is bound to the loopback interface and made non-blocking.
+ *
+ * @param type SOCK_DGRAM to send IP packets, SOCK_RAW to send ethernet frames.
+ * @returns The socket's file descriptor.
  */
-Client::Client() {
-
-    /*
-     * Prepare socket for client connection
-     */
+static int open_client_socket( int type ) {
 
     struct ifreq ifr;
     struct sockaddr_ll sll;
 
     // We want IP packets, including headers
-    m_socket = socket( AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP) );
+    int sock = socket( AF_PACKET, type, htons(ETH_P_IP) );
     assert_perror(errno);
 
     // Get interface index
     memset( &ifr, 0, sizeof( ifr) );
     strncpy( ifr.ifr_name, IFNAME_LOOPBACK, IFNAMSIZ - 1 );
-    ioctl( m_socket, SIOCGIFINDEX, &ifr );
+    ioctl( sock, SIOCGIFINDEX, &ifr );
     assert_perror(errno);
     memset( &sll, 0, sizeof( sll) );
     sll.sll_family = AF_PACKET;
@@ -44,14 +45,27 @@ Client::Client() {
     sll.sll_protocol = htons(ETH_P_IP);
 
     // Bind the raw socket to the interface specified
-    bind( m_socket, (struct sockaddr *)&sll, sizeof(sll) );
+    bind( sock, (struct sockaddr *)&sll, sizeof(sll) );
     assert_perror(errno);
 
     // Make socket non-blocking
-    int fdflags = fcntl( m_socket, F_GETFL );
+    int fdflags = fcntl( sock, F_GETFL );
     assert_perror(errno);
-    fcntl( m_socket, F_SETFL, fdflags | O_NONBLOCK );
+    fcntl( sock, F_SETFL, fdflags | O_NONBLOCK );
     assert_perror(errno);
+
+    return sock;
+}
+
+/**
+ * Client class constructor.
+ *
+ * Opens an IP-layer socket for communication with the client application(s).
+ * The socket is bound to the loopback interface and made non-blocking.
+ */
+Client::Client()
+        : m_socket(open_client_socket(SOCK_DGRAM))
+        , m_vnet_hdr(false) {
 }
 
 /**
@@ -63,6 +77,69 @@ Client::~Client() {
     close(m_socket);
 }
 
+/**
+ * Prefix delivered packets with a VnetPrefix.
+ *
+ * This allows super-packets merged by the Gro to be delivered as GSO packets,
+ * see Client::Prefix(). Since only raw packet sockets support
+ * PACKET_VNET_HDR, the IP-layer socket is replaced by a raw one. Must be
+ * enabled before any packets are sent.
+ *
+ * @return True if enabled, false if not supported by the kernel.
+ */
+bool Client::EnableVnetHdr() {
+
+    int sock = open_client_socket(SOCK_RAW);
+
+    int one = 1;
+    if( setsockopt( sock, SOL_PACKET, PACKET_VNET_HDR,
+                    &one, sizeof(one) ) == -1 ) {
+        errno = 0;
+        close(sock);
+        return false;
+    }
+
+    close(m_socket);
+    m_socket = sock;
+    m_vnet_hdr = true;
+    return true;
+}
+
+/**
+ * Fill the VnetPrefix of a packet.
+ *
+ * Super-packets are described as TCPv4 GSO packets whose TCP checksum is yet
+ * to be completed, other packets get an empty VirtioNetHdr. The ethernet
+ * header carries no addresses, as usual on the loopback interface.
+ *
+ * @param buf Packet.
+ * @param gso_size GSO segment size of a super-packet, 0 for other packets.
+ * @param prefix Prefix to be filled.
+ * @see Gro
+ */
+void Client::Prefix( Buffer const * buf, uint16_t gso_size,
+                     VnetPrefix & prefix ) const {
+
+    memset( &prefix, 0, sizeof(prefix) );
+    prefix.m_eth.ether_type = htons(ETH_P_IP);
+    if( !gso_size ) {
+        return;
+    }
+
+    struct iphdr const *iph = (struct iphdr const *) buf->data();
+    struct tcphdr const *th =
+        (struct tcphdr const *) (buf->data() + iph->ihl * 4);
+
+    // Offsets count from the start of the ethernet header
+    VirtioNetHdr & hdr = prefix.m_vnet;
+    hdr.m_flags       = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    hdr.m_gso_type    = VIRTIO_NET_HDR_GSO_TCPV4;
+    hdr.m_gso_size    = gso_size;
+    hdr.m_hdr_len     = ETH_HLEN + iph->ihl * 4 + th->doff * 4;
+    hdr.m_csum_start  = ETH_HLEN + iph->ihl * 4;
+    hdr.m_csum_offset = offsetof(struct tcphdr, check);
+}
+
 /**
  * Try to receive a packet from the client.
  *
@@ -93,15 +170,88 @@ Buffer * Client::RecvPkt() {
  *
  * @param buf Pointer to the Buffer object containing the message to be
  * sent.
+ * @param gso_size GSO segment size if the packet is a super-packet merged by
+ * the Gro, 0 otherwise.
  * @return The return value of the underlying send() call.
  */
-int Client::SendPkt( Buffer const * buf ) const {
+int Client::SendPkt( Buffer const * buf, uint16_t gso_size ) const {
 
     int byte_sent;
 
-    byte_sent = send(m_socket, buf->data(), buf->size(), 0);
+    if(m_vnet_hdr) {
+        VnetPrefix prefix;
+        Prefix( buf, gso_size, prefix );
+        struct iovec iov[2] = {
+            { &prefix, sizeof(prefix) },
+            { (void *) buf->data(), buf->size() }
+        };
+        struct msghdr msg;
+        memset( &msg, 0, sizeof(msg) );
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        byte_sent = sendmsg(m_socket, &msg, 0);
+    } else {
+        byte_sent = send(m_socket, buf->data(), buf->size(), 0);
+    }
     if(byte_sent == -1)
         perror("sent()");
 
     return byte_sent;
 }
+
+/**
+ * Send several packets to the client at once.
+ *
+ * The packets are handed to the kernel by a single sendmmsg() call. Packets
+ * the socket rejects are dropped, just like SendPkt() does.
+ *
+ * @param bufs Array of pointers to the Buffer objects to be sent.
+ * @param count Number of packets, at most CLIENT_TX_BATCH_MAX.
+ * @param gso_sizes Array of the packets' GSO segment sizes, see
+ * Client::SendPkt(), or nullptr if none of the packets is a super-packet.
+ * @return The number of packets sent or dropped, less than count if the
+ * socket's buffer is full.
+ */
+int Client::SendPkts( Buffer * const * bufs, int count,
+                      uint16_t const * gso_sizes ) const {
+
+    struct mmsghdr msgs[CLIENT_TX_BATCH_MAX];
+    struct iovec iovs[2 * CLIENT_TX_BATCH_MAX];
+    VnetPrefix prefixes[CLIENT_TX_BATCH_MAX];
+
+    count = std::min( count, CLIENT_TX_BATCH_MAX );
+    memset( msgs, 0, count * sizeof(struct mmsghdr) );
+    for( int i = 0; i < count; i++ ) {
+        struct iovec *iov = &iovs[2 * i];
+        int iovlen = 0;
+        if(m_vnet_hdr) {
+            Prefix( bufs[i], gso_sizes ? gso_sizes[i] : 0, prefixes[i] );
+            iov[iovlen].iov_base = &prefixes[i];
+            iov[iovlen].iov_len  = sizeof(prefixes[i]);
+            iovlen++;
+        }
+        iov[iovlen].iov_base = (void *) bufs[i]->data();
+        iov[iovlen].iov_len  = bufs[i]->size();
+        iovlen++;
+        msgs[i].msg_hdr.msg_iov    = iov;
+        msgs[i].msg_hdr.msg_iovlen = iovlen;
+    }
+
+    // Skip packets the socket rejects, e.g. if they are too large
+    int sent = 0;
+    while( sent < count ) {
+        int n = sendmmsg( m_socket, msgs + sent, count - sent, 0 );
+        if( n < 0 ) {
+            if( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                errno = 0;
+                break;
+            }
+            perror("sendmmsg()");
+            errno = 0;
+            n = 1;
+        }
+        sent += n;
+    }
+
+    return sent;
+}
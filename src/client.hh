@@ -7,11 +7,57 @@
 
 #include <vector>
 
+#include <sys/socket.h>
+
 #include <netinet/ip.h>
+#include <net/ethernet.h>
 
 #include "common.hh"
 #include "nfqueue.hh"
 
+/**
+ * Maximum number of packets delivered to the client by a single sendmmsg()
+ * call.
+ */
+#define CLIENT_TX_BATCH_MAX 1024
+
+/**
+ * Header prefixing packets sent on a packet socket with PACKET_VNET_HDR.
+ *
+ * Mirrors struct virtio_net_hdr, as linux/virtio_net.h cannot be included
+ * from C++. Fields are in host byte order.
+ */
+struct VirtioNetHdr {
+    uint8_t  m_flags;
+    uint8_t  m_gso_type;
+    uint16_t m_hdr_len;
+    uint16_t m_gso_size;
+    uint16_t m_csum_start;
+    uint16_t m_csum_offset;
+};
+
+/**
+ * Prefix of packets sent with PACKET_VNET_HDR.
+ *
+ * The socket is a raw one then, so the VirtioNetHdr is followed by the
+ * loopback interface's ethernet header.
+ */
+struct VnetPrefix {
+    VirtioNetHdr        m_vnet;
+    struct ether_header m_eth;
+};
+
+/**
+ * VirtioNetHdr flag: The checksum at m_csum_start + m_csum_offset is to be
+ * completed.
+ */
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM 1
+
+/**
+ * VirtioNetHdr GSO type of TCP/IPv4 packets.
+ */
+#define VIRTIO_NET_HDR_GSO_TCPV4 1
+
 /**
  * Client class
  *
@@ -25,18 +71,39 @@ class Client : public NfqHandler {
 
     int m_socket;
 
+    // Packets are prefixed with a VnetPrefix
+    bool m_vnet_hdr;
+
     public:
 
     Client();
     ~Client();
 
+    bool EnableVnetHdr();
+    void Prefix( Buffer const * buf, uint16_t gso_size,
+                 VnetPrefix & prefix ) const;
+
+    /**
+     * Check whether packets are prefixed with a VnetPrefix.
+     *
+     * @returns True if Client::EnableVnetHdr() succeeded, false otherwise.
+     */
+    bool const VnetHdrEnabled() const { return m_vnet_hdr; }
+
     Buffer * RecvPkt();
-    int SendPkt( Buffer const * buf ) const;
+    int SendPkt( Buffer const * buf, uint16_t gso_size = 0 ) const;
+    int SendPkts( Buffer * const * bufs, int count,
+                  uint16_t const * gso_sizes = nullptr ) const;
 
     /**
      * Getter for the file descriptor used by the NfqHandler parent.
      */
     int const RxFd() const { return NfqNlFd(); }
+
+    /**
+     * Getter for the file descriptor of the socket used for delivery.
+     */
+    int const TxFd() const { return m_socket; }
 };
 
 #endif /* _CLIENT_HH_ */
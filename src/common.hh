@@ -15,14 +15,25 @@
 #include <linux/if_ether.h>
 
 #include <arpa/inet.h>
+#include <cstdint>
+#include <time.h>
+#include <string>
 #include <vector>
 
+/**
+ * Maximum size of a client packet in bytes.
+ *
+ * Unsegmented GSO packets received from netfilter may be as large as the IP
+ * total length field permits.
+ */
+#define MAX_PKT_SIZE 0xffff
+
 /**
  * Maximum length buffers used.
  *
- * May be increased if necessary.
+ * Large enough to hold a packet of MAX_PKT_SIZE plus netlink overhead.
  */
-#define BUF_SIZE    4096
+#define BUF_SIZE    (MAX_PKT_SIZE + 4096)
 
 /**
  * Name of the loopback interface
@@ -42,6 +53,16 @@
  * header
  */
 #define IP_HEADER_DST_ADDR_OFFSET 16
+/**
+ * Offset in bytes to where the IPv4 type of service, or the IPv6 traffic class,
+ * starts within the IP header
+ */
+#define IP_HEADER_TOS_OFFSET 1
+
+/**
+ * Size of a cache line in bytes.
+ */
+#define CACHE_LINE_SIZE 64
 
 /**
  * Length of a MAC address in bytes.
@@ -115,6 +136,80 @@ class IpAddress {
     struct in_addr const & Addr() const { return m_addr; }
 };
 
+/**
+ * Class to manage an IP prefix
+ *
+ * Storage class to hold an IPv4 prefix, e.g. 10.0.0.0/8, as both a
+ * human-readable string and a network address and mask. A plain address is
+ * treated as a prefix of length 32.
+ */
+class IpPrefix {
+
+    std::string m_str;
+    uint32_t    m_net;
+    uint32_t    m_mask;
+    int         m_len;
+
+    public:
+
+    /**
+     * Construct an empty IpPrefix object, matching no address.
+     */
+    IpPrefix() : m_net(0), m_mask(0xffffffff), m_len(-1) {}
+
+    /**
+     * Set the prefix.
+     *
+     * @param str Human-readable string of the form XXX.XXX.XXX.XXX/LEN
+     * @returns True if the prefix is valid, false otherwise.
+     */
+    bool Set( std::string const str ) {
+        std::string addr = str.substr( 0, str.find("/") );
+        int len = 32;
+        if( addr.size() < str.size() ) {
+            std::string l = str.substr( addr.size() + 1 );
+            if( l.empty() || l.size() > 2
+                    || l.find_first_not_of("0123456789") != std::string::npos ) {
+                return false;
+            }
+            len = atoi( l.c_str() );
+        }
+        struct in_addr a;
+        if( len > 32 || inet_aton( addr.c_str(), &a ) != 1 ) {
+            return false;
+        }
+        m_str  = str;
+        m_len  = len;
+        m_mask = len ? htonl( 0xffffffff << (32 - len) ) : 0;
+        m_net  = a.s_addr & m_mask;
+        return true;
+    }
+
+    /**
+     * Check whether an address lies within the prefix.
+     *
+     * @param addr Address in network byte order.
+     * @returns True if the address matches the prefix.
+     */
+    bool Contains( uint32_t const addr ) const {
+        return m_len >= 0 && (addr & m_mask) == m_net;
+    }
+
+    /**
+     * Getter for human-readable string.
+     *
+     * @returns The prefix as a string.
+     */
+    std::string const & Str() const { return m_str; }
+
+    /**
+     * Getter for the prefix length.
+     *
+     * @returns The number of leading bits matched.
+     */
+    int const Len() const { return m_len; }
+};
+
 /**
  * MacAddress class
  *
@@ -175,6 +270,17 @@ class MacAddress {
     std::vector<char> const Addr() const { return m_addr; }
 };
 
+/**
+ * Get the current monotonic time.
+ *
+ * @returns The time in nanoseconds.
+ */
+inline uint64_t now_nsec() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 /**
  * Prints a stream of bytes in a human-readable form.
  *
@@ -2,7 +2,9 @@
 #include <fstream>
 #include <stdlib.h>
 #include <string>
+#include <algorithm>
 
+#include "cipher.hh"
 #include "config.hh"
 
 /**
@@ -11,17 +13,45 @@
  * Reads the provided file and initializes it's members accordingly.
  *
  * @param filename Name of the configuration file to be loaded.
+ * @param exit_on_error Whether to exit if the file is invalid. Otherwise, the
+ * error is reported by Config::Ok(), e.g. when reloading the configuration of a
+ * running process.
  */
-Config::Config( std::string filename ) {
-    ReadConfig(filename);
+Config::Config( std::string filename, bool exit_on_error )
+        : m_io_engine("epoll")
+        , m_busy_poll_usec(0)
+        , m_stats_interval(0)
+        , m_client_tx_batch(32)
+        , m_gro(false)
+        , m_gro_flush_usec(0)
+        , m_ack_priority(false)
+        , m_ack_thinning(false)
+        , m_arq(false)
+        , m_checksum(false)
+        , m_compression_mbps(0)
+        , m_buffer_budget_mb(64)
+        , m_rx_drop_oldest(false)
+        , m_pacing_txtime(true)
+        , m_scheduler("replicate")
+        , m_redundancy_target(0.999) {
+    m_ok = ReadConfig(filename);
+    if( !m_ok && exit_on_error ) {
+        exit(1);
+    }
 }
 
 /**
  * Sets the configuration to match the one of the provided file.
  *
+ * Parameters before the first section header belong to a tunnel named
+ * "default". Every "[name]" header starts a new tunnel, to which the following
+ * tunnel and link parameters apply. The default tunnel is dropped if it has no
+ * links, e.g. if all tunnels are named.
+ *
  * @param filename Name of the configuration file to be loaded.
+ * @returns True if the file was read successfully, false otherwise.
  */
-void Config::ReadConfig( std::string filename ) {
+bool Config::ReadConfig( std::string filename ) {
 
     std::ifstream in;
     std::string line;
@@ -31,52 +61,486 @@ void Config::ReadConfig( std::string filename ) {
     in.open(filename.c_str());
     if( in.fail() ) {
         std::cerr << "Error opening file: \"" << filename << "\"" << std::endl;
-        exit(1);
+        return false;
     }
 
-    std::vector<std::string> peer_addresses;
-    std::vector<std::string> peer_interfaces;
+    m_tunnels.resize(1);
+    m_tunnels[0].m_name = "default";
 
     // Parse line by line
     while( std::getline( in, line ) ) {
         std::string token, value;
+        TunnelConfig &tunnel = m_tunnels.back();
+
+        // Tunnel section
+        if( line.size() > 2 && line[0] == '[' && *line.rbegin() == ']' ) {
+            m_tunnels.push_back( TunnelConfig() );
+            m_tunnels.back().m_name = line.substr( 1, line.size() - 2 );
+            continue;
+        }
 
         token = line.substr( 0, line.find(delimeter) );
         value = line.substr( line.find(delimeter)+1, *line.rbegin() );
 
-        // Dest ip
-        if( token == "destination_ip" ) {
-            m_destination_ip.SetIp(value);
+        // Destinations
+        if( token == "destination_ip" || token == "destinations" ) {
+            std::vector<std::string> prefixes = SplitList(value);
+            for( int i = 0; i < prefixes.size(); i++ ) {
+                if( prefixes[i].empty() ) {
+                    continue;
+                }
+                IpPrefix prefix;
+                if( !prefix.Set(prefixes[i]) ) {
+                    std::cerr << "ERROR: Invalid destination: "
+                        << prefixes[i] << std::endl;
+                    return false;
+                }
+                tunnel.m_destinations.push_back(prefix);
+            }
+
+        // Firewall mark
+        } else if( token == "fwmark" ) {
+            tunnel.m_fwmark = strtoul( value.c_str(), nullptr, 0 );
+
+        // Tunnel id
+        } else if( token == "tunnel_id" ) {
+            tunnel.m_id = atoi(value.c_str());
+
+        // Encryption
+        } else if( token == "encryption_key" ) {
+            if( !ParseKey(value, tunnel.m_key) ) {
+                std::cerr << "ERROR: Invalid encryption_key of tunnel "
+                    << tunnel.m_name << std::endl;
+                return false;
+            }
 
         // Link peer addr
         } else if( token == "link_peers" ) {
-            // Addresses are delimited by spaces
-            std::size_t needle = value.find(" ");
-            while( needle != std::string::npos ) {
-                m_peer_addresses.push_back( value.substr( 0, needle ) );
-                value = value.substr( needle+1, *value.rbegin() );
-                needle = value.find(" ");
-            }
-            m_peer_addresses.push_back( value );
+            tunnel.m_peer_addresses = SplitList(value);
 
         // Link if name
         } else if( token == "link_if_names" ) {
-            // Addresses are delimited by spaces
-            std::size_t needle = value.find(" ");
-            while( needle != std::string::npos ) {
-                m_if_names.push_back( value.substr( 0, needle ) );
-                value = value.substr( needle+1, *value.rbegin() );
-                needle = value.find(" ");
-            }
-            m_if_names.push_back( value );
+            tunnel.m_if_names = SplitList(value);
+
+        // Link MTUs
+        } else if( token == "link_mtus" ) {
+            std::vector<std::string> mtus = SplitList(value);
+            for( int i = 0; i < mtus.size(); i++ ) {
+                tunnel.m_mtus.push_back( atoi(mtus[i].c_str()) );
+            }
+
+        // Link backends
+        } else if( token == "link_backends" ) {
+            tunnel.m_backends = SplitList(value);
+            for( int i = 0; i < tunnel.m_backends.size(); i++ ) {
+                if( tunnel.m_backends[i] != "packet"
+                        && tunnel.m_backends[i] != "xdp" ) {
+                    std::cerr << "ERROR: Unknown link backend: "
+                        << tunnel.m_backends[i] << std::endl;
+                    return false;
+                }
+            }
+
+        // Link device queues
+        } else if( token == "link_queues" ) {
+            std::vector<std::string> queues = SplitList(value);
+            for( int i = 0; i < queues.size(); i++ ) {
+                tunnel.m_queues.push_back( atoi(queues[i].c_str()) );
+            }
+
+        // Link pacing rates
+        } else if( token == "link_rates" ) {
+            std::vector<std::string> rates = SplitList(value);
+            for( int i = 0; i < rates.size(); i++ ) {
+                tunnel.m_rates.push_back(
+                        std::max( atoi(rates[i].c_str()), 0 ) );
+            }
+        } else if( token == "pacing" ) {
+            if( value != "txtime" && value != "userspace" ) {
+                std::cerr << "ERROR: Invalid pacing: " << value << std::endl;
+                return false;
+            }
+            m_pacing_txtime = (value == "txtime");
+
+        // Traffic classes
+        } else if( token == "class_names" ) {
+            tunnel.m_class_names = SplitList(value);
+        } else if( token == "class_fwmarks" ) {
+            std::vector<std::string> marks = SplitList(value);
+            for( int i = 0; i < marks.size(); i++ ) {
+                tunnel.m_class_fwmarks.push_back(
+                        strtoul( marks[i].c_str(), nullptr, 0 ) );
+            }
+        } else if( token == "class_dscps" ) {
+            tunnel.m_class_dscps = SplitList(value);
+        } else if( token == "class_copies" ) {
+            std::vector<std::string> copies = SplitList(value);
+            for( int i = 0; i < copies.size(); i++ ) {
+                tunnel.m_class_copies.push_back(
+                        std::max( atoi(copies[i].c_str()), 0 ) );
+            }
+        } else if( token == "class_links" ) {
+            tunnel.m_class_links = SplitList(value);
+        } else if( token == "class_reorder_msec" ) {
+            std::vector<std::string> msecs = SplitList(value);
+            for( int i = 0; i < msecs.size(); i++ ) {
+                tunnel.m_class_reorder_msec.push_back(
+                        std::max( atoi(msecs[i].c_str()), 0 ) );
+            }
+
+        // Link scheduler
+        } else if( token == "scheduler" ) {
+            if( value != "replicate" && value != "ect"
+                    && value != "adaptive" ) {
+                std::cerr << "ERROR: Unknown scheduler: " << value
+                    << std::endl;
+                return false;
+            }
+            m_scheduler = value;
+        } else if( token == "redundancy_target" ) {
+            m_redundancy_target = atof(value.c_str());
+            if( m_redundancy_target <= 0 || m_redundancy_target >= 1 ) {
+                std::cerr << "ERROR: Invalid redundancy_target: " << value
+                    << std::endl;
+                return false;
+            }
+
+        // I/O engine
+        } else if( token == "io_engine" ) {
+            if( value != "epoll" && value != "uring" ) {
+                std::cerr << "ERROR: Unknown io_engine: " << value
+                    << std::endl;
+                return false;
+            }
+            m_io_engine = value;
+
+        // Low-latency mode
+        } else if( token == "busy_poll_usec" ) {
+            m_busy_poll_usec = std::max( atoi(value.c_str()), 0 );
+
+        // Statistics
+        } else if( token == "stats_interval" ) {
+            m_stats_interval = std::max( atoi(value.c_str()), 0 );
+
+        // Batched delivery
+        } else if( token == "client_tx_batch" ) {
+            m_client_tx_batch = std::max( atoi(value.c_str()), 1 );
+
+        // Receive offload
+        } else if( token == "gro" ) {
+            if( value != "on" && value != "off" ) {
+                std::cerr << "ERROR: Invalid gro: " << value << std::endl;
+                return false;
+            }
+            m_gro = (value == "on");
+        } else if( token == "gro_flush_usec" ) {
+            m_gro_flush_usec = std::max( atoi(value.c_str()), 0 );
+
+        // ACK prioritization
+        } else if( token == "ack_priority" ) {
+            if( value != "on" && value != "off" ) {
+                std::cerr << "ERROR: Invalid ack_priority: " << value
+                    << std::endl;
+                return false;
+            }
+            m_ack_priority = (value == "on");
+        } else if( token == "ack_thinning" ) {
+            if( value != "on" && value != "off" ) {
+                std::cerr << "ERROR: Invalid ack_thinning: " << value
+                    << std::endl;
+                return false;
+            }
+            m_ack_thinning = (value == "on");
+
+        // Retransmission
+        } else if( token == "arq" ) {
+            if( value != "on" && value != "off" ) {
+                std::cerr << "ERROR: Invalid arq: " << value << std::endl;
+                return false;
+            }
+            m_arq = (value == "on");
+
+        // Frame integrity
+        } else if( token == "checksum" ) {
+            if( value != "on" && value != "off" ) {
+                std::cerr << "ERROR: Invalid checksum: " << value << std::endl;
+                return false;
+            }
+            m_checksum = (value == "on");
+
+        // Compression
+        } else if( token == "compression_mbps" ) {
+            m_compression_mbps = std::max( atoi(value.c_str()), 0 );
+
+        // Overload
+        } else if( token == "buffer_budget_mb" ) {
+            m_buffer_budget_mb = std::max( atoi(value.c_str()), 1 );
+        } else if( token == "rx_queue_drop" ) {
+            if( value != "tail" && value != "oldest" ) {
+                std::cerr << "ERROR: Invalid rx_queue_drop: " << value
+                    << std::endl;
+                return false;
+            }
+            m_rx_drop_oldest = (value == "oldest");
+
+        // Thread placement
+        } else if( token == "cpus_main" ) {
+            if( !ParseCpus(value, m_cpus_main) ) {
+                return false;
+            }
+        } else if( token == "cpus_link_rx" ) {
+            if( !ParseCpus(value, m_cpus_link_rx) ) {
+                return false;
+            }
+        } else if( token == "cpus_timers" ) {
+            if( !ParseCpus(value, m_cpus_timers) ) {
+                return false;
+            }
+        }
+    }
+
+    // Only named tunnels configured
+    if( m_tunnels.size() > 1 && m_tunnels[0].m_peer_addresses.empty() ) {
+        m_tunnels.erase( m_tunnels.begin() );
+    }
+
+    for( int i = 0; i < m_tunnels.size(); i++ ) {
+        // Tunnel ids default to the tunnels' order
+        if( m_tunnels[i].m_id < 0 ) {
+            m_tunnels[i].m_id = i;
+        }
+        if( m_tunnels[i].m_id > ALAGG_MAX_TUNNEL ) {
+            std::cerr << "ERROR: Invalid tunnel_id of tunnel "
+                << m_tunnels[i].m_name << std::endl;
+            return false;
+        }
+        for( int j = 0; j < i; j++ ) {
+            if( m_tunnels[j].m_id == m_tunnels[i].m_id
+                    || m_tunnels[j].m_name == m_tunnels[i].m_name ) {
+                std::cerr << "ERROR: Duplicate tunnel "
+                    << m_tunnels[i].m_name << std::endl;
+                return false;
+            }
+        }
+        if( !CheckLinks(m_tunnels[i]) || !CheckClasses(m_tunnels[i]) ) {
+            return false;
         }
     }
 
+    return true;
+}
+
+/**
+ * Verify the link parameters of a tunnel, and apply their defaults.
+ *
+ * @param tunnel The tunnel's configuration.
+ * @returns True if the parameters are consistent, false otherwise.
+ */
+bool Config::CheckLinks( TunnelConfig & tunnel ) {
+
     // Verify number of interfaces/links
-    if( m_if_names.size() != m_peer_addresses.size() ) {
+    if( tunnel.m_if_names.size() != tunnel.m_peer_addresses.size() ) {
         std::cerr << "ERROR: Number of interfaces does not match"
             << " number of mac addresses"
             << std::endl;
-        exit(1);
+        return false;
+    }
+
+    // MTUs are optional, default to the interfaces' MTUs
+    if( tunnel.m_mtus.empty() ) {
+        tunnel.m_mtus.resize( tunnel.m_if_names.size(), 0 );
+    } else if( tunnel.m_mtus.size() != tunnel.m_if_names.size() ) {
+        std::cerr << "ERROR: Number of interfaces does not match"
+            << " number of MTUs"
+            << std::endl;
+        return false;
+    }
+
+    // Backends are optional, default to AF_PACKET sockets
+    if( tunnel.m_backends.empty() ) {
+        tunnel.m_backends.resize( tunnel.m_if_names.size(), "packet" );
+    } else if( tunnel.m_backends.size() != tunnel.m_if_names.size() ) {
+        std::cerr << "ERROR: Number of interfaces does not match"
+            << " number of backends"
+            << std::endl;
+        return false;
+    }
+
+    // Queues are optional, default to the first queue
+    if( tunnel.m_queues.empty() ) {
+        tunnel.m_queues.resize( tunnel.m_if_names.size(), 0 );
+    } else if( tunnel.m_queues.size() != tunnel.m_if_names.size() ) {
+        std::cerr << "ERROR: Number of interfaces does not match"
+            << " number of queues"
+            << std::endl;
+        return false;
+    }
+
+    // Rates are optional, default to unpaced links
+    if( tunnel.m_rates.empty() ) {
+        tunnel.m_rates.resize( tunnel.m_if_names.size(), 0 );
+    } else if( tunnel.m_rates.size() != tunnel.m_if_names.size() ) {
+        std::cerr << "ERROR: Number of interfaces does not match"
+            << " number of rates"
+            << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Verify the traffic class parameters of a tunnel, and build its classes.
+ *
+ * Every class is named, the other lists are optional. Their elements are
+ * matched to the classes by position. DSCP values and Links of a class are
+ * delimited by commas, "-" matching no DSCP value and "*" all Links.
+ *
+ * @param tunnel The tunnel's configuration.
+ * @returns True if the parameters are consistent, false otherwise.
+ */
+bool Config::CheckClasses( TunnelConfig & tunnel ) {
+
+    int n = tunnel.m_class_names.size();
+    if( n > ALAGG_MAX_CLASS ) {
+        std::cerr << "ERROR: Too many classes in tunnel " << tunnel.m_name
+            << std::endl;
+        return false;
+    }
+    if( (!tunnel.m_class_fwmarks.empty() && tunnel.m_class_fwmarks.size() != n)
+            || (!tunnel.m_class_dscps.empty()
+                && tunnel.m_class_dscps.size() != n)
+            || (!tunnel.m_class_copies.empty()
+                && tunnel.m_class_copies.size() != n)
+            || (!tunnel.m_class_links.empty()
+                && tunnel.m_class_links.size() != n)
+            || (!tunnel.m_class_reorder_msec.empty()
+                && tunnel.m_class_reorder_msec.size() != n) ) {
+        std::cerr << "ERROR: Number of classes does not match"
+            << " number of class parameters"
+            << std::endl;
+        return false;
+    }
+
+    tunnel.m_classes.clear();
+    for( int i = 0; i < n; i++ ) {
+        ClassConfig c;
+        c.m_name = tunnel.m_class_names[i];
+        if( !tunnel.m_class_fwmarks.empty() ) {
+            c.m_fwmark = tunnel.m_class_fwmarks[i];
+        }
+        if( !tunnel.m_class_copies.empty() ) {
+            c.m_copies = tunnel.m_class_copies[i];
+        }
+        if( !tunnel.m_class_reorder_msec.empty() ) {
+            c.m_reorder_msec = tunnel.m_class_reorder_msec[i];
+        }
+
+        if( !tunnel.m_class_dscps.empty() && tunnel.m_class_dscps[i] != "-" ) {
+            std::vector<std::string> dscps =
+                SplitList( tunnel.m_class_dscps[i], "," );
+            for( int j = 0; j < dscps.size(); j++ ) {
+                int dscp = atoi(dscps[j].c_str());
+                if( dscps[j].empty()
+                        || dscps[j].find_first_not_of("0123456789")
+                            != std::string::npos
+                        || dscp > 63 ) {
+                    std::cerr << "ERROR: Invalid DSCP: " << dscps[j]
+                        << std::endl;
+                    return false;
+                }
+                c.m_dscps |= (uint64_t) 1 << dscp;
+            }
+        }
+
+        if( !tunnel.m_class_links.empty() && tunnel.m_class_links[i] != "*" ) {
+            c.m_if_names = SplitList( tunnel.m_class_links[i], "," );
+            for( int j = 0; j < c.m_if_names.size(); j++ ) {
+                if( std::find( tunnel.m_if_names.begin(),
+                               tunnel.m_if_names.end(), c.m_if_names[j] )
+                        == tunnel.m_if_names.end() ) {
+                    std::cerr << "ERROR: Class " << c.m_name
+                        << " uses unknown link " << c.m_if_names[j]
+                        << std::endl;
+                    return false;
+                }
+            }
+        }
+
+        tunnel.m_classes.push_back(c);
+    }
+
+    return true;
+}
+
+/**
+ * Split a list of values delimited by spaces.
+ *
+ * @param value String containing the list.
+ * @param delimiter Single character delimiting the values, if not a space.
+ * @returns A vector of strings containing the list's elements.
+ */
+std::vector<std::string> Config::SplitList( std::string value,
+                                            std::string delimiter ) {
+
+    std::vector<std::string> list;
+
+    // Values are delimited by the delimiter
+    std::size_t needle = value.find(delimiter);
+    while( needle != std::string::npos ) {
+        list.push_back( value.substr( 0, needle ) );
+        value = value.substr( needle+1, *value.rbegin() );
+        needle = value.find(delimiter);
+    }
+    list.push_back( value );
+
+    return list;
+}
+
+/**
+ * Parse a list of CPU numbers delimited by spaces.
+ *
+ * @param value String containing the list, may be empty.
+ * @param cpus Vector the CPU numbers are stored in.
+ * @returns True if all CPU numbers are valid, false otherwise.
+ */
+bool Config::ParseCpus( std::string value, std::vector<int> & cpus ) {
+
+    std::vector<std::string> list = SplitList(value);
+    cpus.clear();
+
+    for( int i = 0; i < list.size(); i++ ) {
+        if( list[i].empty() ) {
+            continue;
+        }
+        if( list[i].find_first_not_of("0123456789") != std::string::npos ) {
+            std::cerr << "ERROR: Invalid CPU: " << list[i] << std::endl;
+            return false;
+        }
+        cpus.push_back( atoi(list[i].c_str()) );
+    }
+
+    return true;
+}
+
+/**
+ * Parse a pre-shared key given as hexadecimal digits.
+ *
+ * @param value String containing 2 * CIPHER_KEY_LEN hexadecimal digits.
+ * @param key Vector the key is stored in.
+ * @returns True if the key is valid, false otherwise.
+ */
+bool Config::ParseKey( std::string value, std::vector<unsigned char> & key ) {
+
+    if( value.size() != 2 * CIPHER_KEY_LEN
+            || value.find_first_not_of("0123456789abcdefABCDEF")
+                != std::string::npos ) {
+        return false;
+    }
+
+    key.clear();
+    for( int i = 0; i < value.size(); i += 2 ) {
+        key.push_back( strtoul( value.substr(i, 2).c_str(), nullptr, 16 ) );
     }
+    return true;
 }
@@ -9,6 +9,74 @@
 #include <vector>
 
 #include "common.hh"
+#include "link.hh"
+
+/**
+ * Configuration of a traffic class of a tunnel.
+ *
+ * Packets of a class are numbered and reordered separately from the tunnel's
+ * other packets, and sent according to the class's own policy.
+ */
+struct ClassConfig {
+    // Name of the class
+    std::string              m_name;
+    // Firewall mark of the packets, 0 if unused
+    uint32_t                 m_fwmark;
+    // Bitmap of the DSCP values of the packets
+    uint64_t                 m_dscps;
+    // Number of Links every packet is sent on, 0 for all Links
+    int                      m_copies;
+    // Interfaces of the Links the packets are sent on, empty for all Links
+    std::vector<std::string> m_if_names;
+    // Time out-of-order packets are held at most in milliseconds
+    int                      m_reorder_msec;
+
+    ClassConfig() : m_fwmark(0), m_dscps(0), m_copies(0),
+                    m_reorder_msec(ALAGG_REORDER_TTL) {}
+};
+
+/**
+ * Configuration of a single tunnel.
+ *
+ * A tunnel carries the traffic destined for its destination prefixes, or
+ * marked with its firewall mark, over its own set of links to a single remote
+ * aggregator.
+ */
+struct TunnelConfig {
+    // Name of the tunnel, as given by its section header
+    std::string              m_name;
+    // Tunnel id carried in the AlaggHeader, must match on both ends
+    int                      m_id;
+    // Destination prefixes of the traffic carried
+    std::vector<IpPrefix>    m_destinations;
+    // Firewall mark of the traffic carried, 0 if unused
+    uint32_t                 m_fwmark;
+
+    // Link peers' addresses, interface names, MTUs, backends, queues and
+    // pacing rates in Mbit/s
+    std::vector<std::string> m_peer_addresses;
+    std::vector<std::string> m_if_names;
+    std::vector<int>         m_mtus;
+    std::vector<std::string> m_backends;
+    std::vector<int>         m_queues;
+    std::vector<int>         m_rates;
+
+    // Traffic classes' names, firewall marks, DSCP values, copies, Links and
+    // reorder timeouts, as configured
+    std::vector<std::string> m_class_names;
+    std::vector<uint32_t>    m_class_fwmarks;
+    std::vector<std::string> m_class_dscps;
+    std::vector<int>         m_class_copies;
+    std::vector<std::string> m_class_links;
+    std::vector<int>         m_class_reorder_msec;
+    // Traffic classes, in the order of their ids starting at 1
+    std::vector<ClassConfig> m_classes;
+
+    // Pre-shared key encrypting the traffic, empty if unencrypted
+    std::vector<unsigned char> m_key;
+
+    TunnelConfig() : m_id(-1), m_fwmark(0) {}
+};
 
 /**
  * Config class
@@ -17,41 +85,197 @@
  */
 class Config {
 
-    IpAddress m_destination_ip;
-    std::vector<std::string> m_peer_addresses;
-    std::vector<std::string> m_if_names;
+    std::vector<TunnelConfig> m_tunnels;
+    std::string              m_io_engine;
+    int                      m_busy_poll_usec;
+    int                      m_stats_interval;
+    int                      m_client_tx_batch;
+    bool                     m_gro;
+    int                      m_gro_flush_usec;
+    bool                     m_ack_priority;
+    bool                     m_ack_thinning;
+    bool                     m_arq;
+    bool                     m_checksum;
+    int                      m_compression_mbps;
+    int                      m_buffer_budget_mb;
+    bool                     m_rx_drop_oldest;
+    bool                     m_pacing_txtime;
+    std::string              m_scheduler;
+    double                   m_redundancy_target;
+    std::vector<int>         m_cpus_main;
+    std::vector<int>         m_cpus_link_rx;
+    std::vector<int>         m_cpus_timers;
+    bool                     m_ok;
 
-    void ReadConfig( std::string filename );
+    bool ReadConfig( std::string filename );
+    static bool CheckLinks( TunnelConfig & tunnel );
+    static bool CheckClasses( TunnelConfig & tunnel );
+    static std::vector<std::string> SplitList( std::string value,
+                                               std::string delimiter = " " );
+    static bool ParseCpus( std::string value, std::vector<int> & cpus );
+    static bool ParseKey( std::string value,
+                          std::vector<unsigned char> & key );
 
     public:
 
-        Config( std::string filename );
+        Config( std::string filename, bool exit_on_error = true );
+
+        /**
+         * Check whether the configuration file was read successfully.
+         *
+         * @returns True if the configuration is valid, false otherwise.
+         */
+        bool const Ok() const { return m_ok; }
+
+        /**
+         * Getter for the tunnels.
+         *
+         * @returns A vector of the tunnels' configurations, in the order of
+         * the configuration file.
+         */
+        std::vector<TunnelConfig> const & Tunnels() const { return m_tunnels; }
+
+        /**
+         * Getter for the I/O engine driving the data path.
+         *
+         * @returns Either "epoll" or "uring".
+         */
+        std::string const & IoEngine() const { return m_io_engine; }
+
+        /**
+         * Getter for the busy polling time of the low-latency mode.
+         *
+         * @returns Time to spin before blocking in microseconds, 0 if the
+         * low-latency mode is disabled.
+         */
+        int const BusyPollUsec() const { return m_busy_poll_usec; }
+
+        /**
+         * Getter for the interval of statistics reports.
+         *
+         * @returns Interval in seconds, 0 if no statistics are reported.
+         */
+        int const StatsInterval() const { return m_stats_interval; }
+
+        /**
+         * Getter for the batch size of packet delivery to the client.
+         *
+         * @returns Maximum number of packets per sendmmsg() call.
+         */
+        int const ClientTxBatch() const { return m_client_tx_batch; }
+
+        /**
+         * Check whether TCP segments are merged before delivery to the
+         * client.
+         *
+         * @returns True if the receive offload stage is enabled, false
+         * otherwise.
+         */
+        bool const GroEnabled() const { return m_gro; }
+
+        /**
+         * Getter for the flush timeout of the receive offload stage.
+         *
+         * @returns Time segments are held at most in microseconds, 0 if only
+         * segments delivered together are merged.
+         */
+        int const GroFlushUsec() const { return m_gro_flush_usec; }
+
+        /**
+         * Check whether pure TCP ACKs bypass reordering and are sent ahead
+         * of data.
+         *
+         * @returns True if ACK prioritization is enabled, false otherwise.
+         */
+        bool const AckPriority() const { return m_ack_priority; }
+
+        /**
+         * Check whether superseded pure TCP ACKs are dropped before
+         * transmission.
+         *
+         * @returns True if ACK thinning is enabled, false otherwise.
+         */
+        bool const AckThinning() const { return m_ack_thinning; }
+
+        /**
+         * Check whether lost packets are retransmitted upon request of the
+         * remote aggregator.
+         *
+         * @returns True if ARQ is enabled, false otherwise.
+         */
+        bool const Arq() const { return m_arq; }
+
+        /**
+         * Check whether frames carry a CRC32C trailer.
+         *
+         * @returns True if frame checksums are enabled, false otherwise.
+         */
+        bool const Checksum() const { return m_checksum; }
+
+        /**
+         * Getter for the line rate below which Links compress packets.
+         *
+         * @returns Rate in Mbit/s, 0 if compression is disabled.
+         */
+        int const CompressionMbps() const { return m_compression_mbps; }
+
+        /**
+         * Getter for the memory budget of received packets.
+         *
+         * @returns Budget in MiB.
+         */
+        int const BufferBudgetMb() const { return m_buffer_budget_mb; }
+
+        /**
+         * Check whether a full delivery queue drops its oldest packet.
+         *
+         * @returns True if the oldest packet is dropped, false if the new
+         * one is.
+         */
+        bool const RxDropOldest() const { return m_rx_drop_oldest; }
+
+        /**
+         * Check whether paced Links hand departure times to the kernel.
+         *
+         * @returns True if SO_TXTIME is used, false if frames are paced in
+         * user space.
+         */
+        bool const PacingTxTime() const { return m_pacing_txtime; }
+
+        /**
+         * Getter for the distribution of packets over the links.
+         *
+         * @returns "replicate", "ect" or "adaptive".
+         */
+        std::string const & Scheduler() const { return m_scheduler; }
+
+        /**
+         * Getter for the delivery target of the adaptive scheduler.
+         *
+         * @returns Share of packets to be delivered, between 0 and 1.
+         */
+        double const RedundancyTarget() const { return m_redundancy_target; }
 
         /**
-         * Getter for proxy destination IP
+         * Getter for the CPUs the main thread is pinned to.
          *
-         * @returns An IpAddress object containing the proxy's destination IP.
+         * @returns A vector of CPU numbers, empty if unpinned.
          */
-        IpAddress const & ClientIp() const { return m_destination_ip; }
+        std::vector<int> const & CpusMain() const { return m_cpus_main; }
 
         /**
-         * Getter for link peer addresses.
+         * Getter for the CPUs the Link reception thread is pinned to.
          *
-         * @returns A vector of strings containing the peers' MAC addresses
+         * @returns A vector of CPU numbers, empty if unpinned.
          */
-        std::vector<std::string> const PeerAddresses() const {
-            return m_peer_addresses;
-        }
+        std::vector<int> const & CpusLinkRx() const { return m_cpus_link_rx; }
 
         /**
-         * Getter for names of interfaces to bind to.
+         * Getter for the CPUs the Timer threads are pinned to.
          *
-         * @returns A vector of strings containing the interface names
-         * corresponding the the peers
+         * @returns A vector of CPU numbers, empty if unpinned.
          */
-        std::vector<std::string> const IfNames() const {
-            return m_if_names;
-        }
+        std::vector<int> const & CpusTimers() const { return m_cpus_timers; }
 };
 
 #endif /* _CONFIG_HH_ */
@@ -0,0 +1,130 @@
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include "crc32c.hh"
+
+/**
+ * Castagnoli polynomial, bit-reversed.
+ */
+#define CRC32C_POLY 0x82f63b78
+
+/**
+ * Lookup tables of the slice-by-8 implementation.
+ *
+ * Table k holds the CRC of every byte value followed by k zero bytes, so eight
+ * bytes are folded in at once.
+ */
+struct Crc32cTables {
+    uint32_t m_table[8][256];
+
+    Crc32cTables() {
+        for( int i = 0; i < 256; i++ ) {
+            uint32_t crc = i;
+            for( int j = 0; j < 8; j++ ) {
+                crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+            }
+            m_table[0][i] = crc;
+        }
+        for( int i = 0; i < 256; i++ ) {
+            for( int k = 1; k < 8; k++ ) {
+                uint32_t prev = m_table[k - 1][i];
+                m_table[k][i] = (prev >> 8) ^ m_table[0][prev & 0xff];
+            }
+        }
+    }
+};
+
+/**
+ * Update a CRC32C with the slice-by-8 algorithm.
+ *
+ * @param crc Inverted CRC of the preceding data.
+ * @param p Pointer to the data.
+ * @param len Number of bytes.
+ * @returns The inverted CRC including the data.
+ */
+static uint32_t crc32c_sw( uint32_t crc, unsigned char const * p, int len ) {
+
+    static Crc32cTables const tables;
+    uint32_t const (*t)[256] = tables.m_table;
+
+    while( len >= 8 ) {
+        uint32_t lo, hi;
+        memcpy( &lo, p, 4 );
+        memcpy( &hi, p + 4, 4 );
+        lo ^= crc;
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff]
+            ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+            ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff]
+            ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while( len-- > 0 ) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+/**
+ * Update a CRC32C with the SSE4.2 crc32 instruction.
+ *
+ * @param crc Inverted CRC of the preceding data.
+ * @param p Pointer to the data.
+ * @param len Number of bytes.
+ * @returns The inverted CRC including the data.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw( uint32_t crc, unsigned char const * p, int len ) {
+
+    uint64_t crc64 = crc;
+    while( len >= 8 ) {
+        uint64_t w;
+        memcpy( &w, p, 8 );
+        crc64 = _mm_crc32_u64( crc64, w );
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t) crc64;
+    while( len-- > 0 ) {
+        crc = _mm_crc32_u8( crc, *p++ );
+    }
+    return crc;
+}
+
+/**
+ * Check whether the CPU implements the SSE4.2 crc32 instruction.
+ *
+ * @returns True if supported, false otherwise.
+ */
+static bool has_sse42() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+#endif
+
+/**
+ * Compute the CRC32C (Castagnoli) of a buffer.
+ *
+ * The SSE4.2 crc32 instruction is used if the CPU supports it, and a
+ * slice-by-8 table lookup otherwise. Both yield the same result.
+ *
+ * @param crc CRC of the preceding data, 0 for the start of the data.
+ * @param data Pointer to the data.
+ * @param len Number of bytes.
+ * @returns The CRC of the preceding data and the buffer.
+ */
+uint32_t crc32c( uint32_t crc, void const * data, int len ) {
+
+    unsigned char const *p = (unsigned char const *) data;
+#if defined(__x86_64__)
+    static bool const hw = has_sse42();
+    if( hw ) {
+        return ~crc32c_hw( ~crc, p, len );
+    }
+#endif
+    return ~crc32c_sw( ~crc, p, len );
+}
@@ -0,0 +1,12 @@
+/** @file crc32c.hh
+ * CRC32C helpers
+ */
+
+#ifndef _CRC32C_HH_
+#define _CRC32C_HH_
+
+#include <cstdint>
+
+uint32_t crc32c( uint32_t crc, void const * data, int len );
+
+#endif /* _CRC32C_HH_ */
@@ -0,0 +1,68 @@
+#include <string.h>
+
+#include "defragmenter.hh"
+#include "link.hh"
+
+/**
+ * Add a received frame to the Defragmenter.
+ *
+ * Unfragmented packets are returned as they are. Fragments are copied into the
+ * packet under reassembly, and the frame is freed. Once the last fragment was
+ * added, the reassembled packet is returned.
+ *
+ * @param p Pointer to the received frame. Ownership is taken.
+ * @param size Size of the received frame. Set to the size of the returned
+ * packet.
+ * @returns A pointer to a complete packet, or nullptr if reassembly is still in
+ * progress or the fragment was dropped.
+ */
+AlaggPacket * Defragmenter::Add( AlaggPacket * p, int * size ) {
+
+    AlaggHeader &h = p->m_header;
+    int payload_size = *size - sizeof(AlaggHeader);
+
+    // Not fragmented
+    if( h.m_frag_off == 0 && !(h.m_flags & ALAGG_FLAG_MF) ) {
+        return p;
+    }
+
+    if( h.m_frag_off == 0 ) {
+
+        // First fragment, start reassembly
+        if( !m_pkt ) {
+            m_pkt = (AlaggPacket *) malloc(sizeof(AlaggHeader) + MAX_PKT_SIZE);
+        }
+        memcpy( m_pkt, p, *size );
+        m_size = *size;
+
+    } else if( m_size == 0
+            || h.m_seq != m_pkt->m_header.m_seq
+            || h.m_class != m_pkt->m_header.m_class
+            || h.m_frag_off != m_size - sizeof(AlaggHeader)
+            || h.m_frag_off + payload_size > MAX_PKT_SIZE ) {
+
+        // Fragment does not continue the current packet
+        m_size = 0;
+        free(p);
+        return nullptr;
+
+    } else {
+        memcpy( ((unsigned char *) m_pkt) + m_size, p->m_payload, payload_size );
+        m_size += payload_size;
+    }
+
+    bool last = !(h.m_flags & ALAGG_FLAG_MF);
+    free(p);
+    if( !last ) {
+        return nullptr;
+    }
+
+    // Reassembly complete, hand over the packet
+    AlaggPacket *pkt = (AlaggPacket *) realloc(m_pkt, m_size);
+    pkt->m_header.m_flags &= ~ALAGG_FLAG_MF;
+    pkt->m_header.m_frag_off = 0;
+    *size = m_size;
+    m_pkt = nullptr;
+    m_size = 0;
+    return pkt;
+}
@@ -0,0 +1,56 @@
+/** @file defragmenter.hh
+ * Defragmenter class definition
+ */
+
+#ifndef _DEFRAGMENTER_HH_
+#define _DEFRAGMENTER_HH_
+
+#include <stdlib.h>
+
+#include "common.hh"
+
+struct AlaggPacket;
+
+/**
+ * Defragmenter class
+ *
+ * Reassembles packets that were fragmented by LinkManager::Send() because they
+ * exceed a Link's MTU. Every Link owns a Defragmenter.
+ *
+ * Fragments of a packet carry the same sequence number and are sent
+ * back-to-back on the same link, so they are expected to be received in order.
+ * Only a single packet is reassembled at a time. A fragment that does not
+ * continue the packet under reassembly discards it, and the remaining copies
+ * on other links may still deliver the packet.
+ *
+ * @see LinkManager
+ * @see Link
+ */
+class Defragmenter {
+
+    // Packet under reassembly, including the AlaggHeader
+    AlaggPacket *m_pkt;
+    // Number of bytes reassembled, including the AlaggHeader
+    int          m_size;
+
+    Defragmenter( Defragmenter const & ) = delete;
+    Defragmenter & operator=( Defragmenter const & ) = delete;
+
+    public:
+
+    /**
+     * Defragmenter class constructor
+     */
+    Defragmenter() : m_pkt(nullptr), m_size(0) {}
+
+    /**
+     * Defragmenter class destructor
+     *
+     * Frees a partially reassembled packet.
+     */
+    ~Defragmenter() { free(m_pkt); }
+
+    AlaggPacket * Add( AlaggPacket * p, int * size );
+};
+
+#endif /* _DEFRAGMENTER_HH_ */
@@ -0,0 +1,305 @@
+#include <string.h>
+#include <time.h>
+
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+
+#include "checksum.hh"
+#include "gro.hh"
+
+/**
+ * Get the TCP header of a TCP/IPv4 packet.
+ *
+ * @param pkt Packet.
+ * @returns Pointer to the TCP header, or nullptr if the packet is no complete
+ * TCP/IPv4 packet.
+ */
+static struct tcphdr * tcp_header( Buffer const * pkt ) {
+
+    struct iphdr const *iph = (struct iphdr const *) pkt->data();
+    if( pkt->size() < sizeof(struct iphdr) || iph->version != 4
+            || iph->protocol != IPPROTO_TCP ) {
+        return nullptr;
+    }
+
+    int ihl = iph->ihl * 4;
+    if( pkt->size() < ihl + sizeof(struct tcphdr) ) {
+        return nullptr;
+    }
+    return (struct tcphdr *) (pkt->data() + ihl);
+}
+
+/**
+ * Check whether a packet is a TCP/IPv4 data segment that can be merged.
+ *
+ * The IP header must carry no options and the packet must not be fragmented.
+ * Besides ACK and PSH, no TCP flags may be set. Both the IP header checksum
+ * and the TCP checksum must be valid.
+ *
+ * @param pkt Packet.
+ * @param payload_len Set to the length of the TCP payload in bytes.
+ * @returns True if the packet can be merged, false otherwise.
+ */
+static bool mergeable( Buffer const * pkt, int & payload_len ) {
+
+    struct tcphdr const *th = tcp_header(pkt);
+    if( !th ) {
+        return false;
+    }
+
+    struct iphdr const *iph = (struct iphdr const *) pkt->data();
+    if( iph->ihl != 5 || ntohs(iph->tot_len) != pkt->size()
+            || (ntohs(iph->frag_off) & (IP_MF | IP_OFFMASK)) ) {
+        return false;
+    }
+
+    uint8_t flags = ((uint8_t const *) th)[13];
+    if( (flags & ~(TH_ACK | TH_PUSH)) || !(flags & TH_ACK) ) {
+        return false;
+    }
+
+    int hlen = sizeof(struct iphdr) + th->doff * 4;
+    payload_len = (int) pkt->size() - hlen;
+    if( th->doff < 5 || payload_len <= 0 ) {
+        return false;
+    }
+
+    int l4_len = pkt->size() - sizeof(struct iphdr);
+    return csum_fold( csum_add( pkt->data(), sizeof(struct iphdr), 0 ) ) == 0
+        && csum_fold( csum_add( (unsigned char const *) th, l4_len,
+                                csum_pseudo(iph, l4_len) ) ) == 0;
+}
+
+/**
+ * Gro class constructor
+ *
+ * @param timeout_usec Time for which segments are held at most, in
+ * microseconds. If 0, all segments are output by every call to Gro::Flush().
+ */
+Gro::Gro( int timeout_usec )
+        : m_timeout_nsec( (uint64_t) timeout_usec * 1000 )
+        , m_stat_segs(0)
+        , m_stat_pkts(0) {
+}
+
+/**
+ * Gro class destructor
+ *
+ * Releases held segments and undelivered packets.
+ */
+Gro::~Gro() {
+    for( int i = 0; i < m_flows.size(); i++ ) {
+        delete m_flows[i].m_pkt;
+    }
+    for( int i = 0; i < m_out.size(); i++ ) {
+        delete m_out[i];
+    }
+}
+
+/**
+ * Find the held flow a packet belongs to.
+ *
+ * @param pkt Packet.
+ * @returns The index of the flow, or -1 if no segments of the packet's flow
+ * are held.
+ */
+int Gro::Find( Buffer const * pkt ) const {
+
+    struct tcphdr const *th = tcp_header(pkt);
+    if( !th ) {
+        return -1;
+    }
+
+    struct iphdr const *iph = (struct iphdr const *) pkt->data();
+    for( int i = 0; i < m_flows.size(); i++ ) {
+        struct iphdr const *fiph =
+            (struct iphdr const *) m_flows[i].m_pkt->data();
+        struct tcphdr const *fth = (struct tcphdr const *) (fiph + 1);
+        if( iph->saddr == fiph->saddr && iph->daddr == fiph->daddr
+                && th->source == fth->source && th->dest == fth->dest ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Merge a segment into a held flow.
+ *
+ * The segment must continue the flow's sequence space and its headers must
+ * match the flow's, except for the PSH flag, which is carried over. The flow
+ * is output right away if it cannot grow any further.
+ *
+ * @param idx Index of the flow.
+ * @param pkt Mergeable segment of the flow. Released if merged.
+ * @returns True if the segment was merged, false otherwise.
+ */
+bool Gro::Append( int idx, Buffer * pkt ) {
+
+    Flow & flow = m_flows[idx];
+    struct iphdr *fiph = (struct iphdr *) flow.m_pkt->data();
+    struct tcphdr *fth = (struct tcphdr *) (fiph + 1);
+    struct iphdr const *iph = (struct iphdr const *) pkt->data();
+    struct tcphdr const *th = (struct tcphdr const *) (iph + 1);
+
+    int hlen = sizeof(struct iphdr) + th->doff * 4;
+    int payload_len = pkt->size() - hlen;
+    uint8_t flags = ((uint8_t const *) th)[13];
+
+    if( iph->tos != fiph->tos || iph->ttl != fiph->ttl
+            || iph->frag_off != fiph->frag_off
+            || th->doff != fth->doff
+            || memcmp( th + 1, fth + 1, th->doff * 4 - sizeof(*th) )
+            || th->ack_seq != fth->ack_seq || th->window != fth->window
+            || (flags & ~TH_PUSH) != ((uint8_t const *) fth)[13]
+            || ntohl(th->seq) != flow.m_next_seq
+            || payload_len > flow.m_gso_size
+            || flow.m_pkt->size() + payload_len > MAX_PKT_SIZE ) {
+        return false;
+    }
+
+    if( flags & TH_PUSH ) {
+        ((uint8_t *) fth)[13] |= TH_PUSH;
+    }
+
+    // Grow the super-packet in place from now on
+    if( flow.m_segs == 1 ) {
+        flow.m_pkt->reserve(MAX_PKT_SIZE);
+    }
+    flow.m_pkt->insert( flow.m_pkt->end(), pkt->begin() + hlen, pkt->end() );
+    flow.m_segs++;
+    flow.m_next_seq += payload_len;
+    delete pkt;
+
+    if( (flags & TH_PUSH) || payload_len < flow.m_gso_size
+            || flow.m_pkt->size() + flow.m_gso_size > MAX_PKT_SIZE ) {
+        Output(idx);
+    }
+
+    return true;
+}
+
+/**
+ * Output a held flow.
+ *
+ * If segments were merged, the IP header is updated to the super-packet's
+ * length, and the TCP checksum is replaced by the pseudo header sum, to be
+ * completed by the kernel.
+ *
+ * @param idx Index of the flow.
+ */
+void Gro::Output( int idx ) {
+
+    Flow flow = m_flows[idx];
+    m_flows.erase( m_flows.begin() + idx );
+
+    if( flow.m_segs == 1 ) {
+        Output( flow.m_pkt, 0 );
+        return;
+    }
+
+    struct iphdr *iph = (struct iphdr *) flow.m_pkt->data();
+    struct tcphdr *th = (struct tcphdr *) (iph + 1);
+    int l4_len = flow.m_pkt->size() - sizeof(struct iphdr);
+
+    iph->tot_len = htons( flow.m_pkt->size() );
+    iph->check = 0;
+    iph->check = csum_fold( csum_add( flow.m_pkt->data(),
+                                      sizeof(struct iphdr), 0 ) );
+    th->check = ~csum_fold( csum_pseudo(iph, l4_len) );
+
+    m_stat_segs += flow.m_segs;
+    m_stat_pkts++;
+    Output( flow.m_pkt, flow.m_gso_size );
+}
+
+/**
+ * Append a packet to the output list.
+ *
+ * @param pkt Packet.
+ * @param gso_size GSO segment size, 0 if the packet is no super-packet.
+ */
+void Gro::Output( Buffer * pkt, uint16_t gso_size ) {
+    m_out.push_back(pkt);
+    m_out_gso_sizes.push_back(gso_size);
+}
+
+/**
+ * Add a packet.
+ *
+ * Mergeable segments are merged into the held segments of their flow, or
+ * start a new flow. If GRO_MAX_FLOWS flows are held already, the oldest one
+ * is output. Any other packet is output right away, after the held segments
+ * of its flow, if any.
+ *
+ * @param pkt Packet received from the links. Owned by the Gro afterwards.
+ */
+void Gro::Add( Buffer * pkt ) {
+
+    int payload_len = 0;
+    bool ok = mergeable(pkt, payload_len);
+
+    int idx = Find(pkt);
+    if( idx >= 0 ) {
+        if( ok && Append(idx, pkt) ) {
+            return;
+        }
+        Output(idx);
+    }
+
+    // Nothing to merge a PSH segment with
+    struct tcphdr const *th = ok ? tcp_header(pkt) : nullptr;
+    if( !th || th->psh ) {
+        Output( pkt, 0 );
+        return;
+    }
+
+    if( m_flows.size() >= GRO_MAX_FLOWS ) {
+        Output(0);
+    }
+
+    Flow flow;
+    flow.m_pkt        = pkt;
+    flow.m_segs       = 1;
+    flow.m_gso_size   = payload_len;
+    flow.m_next_seq   = ntohl(th->seq) + payload_len;
+    flow.m_start_nsec = m_timeout_nsec ? now_nsec() : 0;
+    m_flows.push_back(flow);
+}
+
+/**
+ * Output held flows.
+ *
+ * @param all If true, all flows are output. Otherwise, only flows held for
+ * the flush timeout are.
+ */
+void Gro::Flush( bool all ) {
+
+    if( m_flows.empty() ) {
+        return;
+    }
+
+    uint64_t now = (all || !m_timeout_nsec) ? 0 : now_nsec();
+    while( !m_flows.empty()
+            && (all || now - m_flows[0].m_start_nsec >= m_timeout_nsec) ) {
+        Output(0);
+    }
+}
+
+/**
+ * Get the time until the oldest held flow is due to be flushed.
+ *
+ * @returns The time in microseconds, rounded up, or -1 if no flows are held.
+ */
+int Gro::NextTimeoutUsec() const {
+
+    if( m_flows.empty() ) {
+        return -1;
+    }
+
+    uint64_t elapsed = now_nsec() - m_flows[0].m_start_nsec;
+    if( elapsed >= m_timeout_nsec ) {
+        return 0;
+    }
+    return (m_timeout_nsec - elapsed + 999) / 1000;
+}
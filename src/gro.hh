@@ -0,0 +1,135 @@
+/** @file gro.hh
+ * Gro class definition
+ */
+
+#ifndef _GRO_HH_
+#define _GRO_HH_
+
+#include <cstdint>
+#include <vector>
+
+#include "common.hh"
+
+/**
+ * Maximum number of TCP flows the Gro holds segments of at once.
+ */
+#define GRO_MAX_FLOWS 8
+
+/**
+ * Gro class
+ *
+ * A software receive offload stage between the PacketPool and the Client.
+ * Consecutive in-order segments of the same TCP/IPv4 flow are merged into a
+ * single super-packet, which the Client hands to the kernel as a GSO packet,
+ * see Client::EnableVnetHdr(). The receiving host's stack then processes a
+ * single packet instead of many MTU-sized ones.
+ *
+ * Like the kernel's GRO, only plain data segments are merged: The IP header
+ * must carry no options and must not be fragmented, and the segments must
+ * agree on everything but their sequence numbers, payloads and PSH flags.
+ * Each segment's TCP checksum is verified before it is merged, since the
+ * merged packet's checksum is left to be completed by the kernel. All other
+ * packets pass unchanged, after any held segments of their flow.
+ *
+ * A flow is output as soon as a segment shorter than the first one or a
+ * segment carrying PSH is merged, or the super-packet cannot grow any
+ * further. Otherwise, its segments are held until the next call to
+ * Gro::Flush(), at most for the flush timeout.
+ *
+ * Packets to be delivered are collected in an output list, together with
+ * their GSO segment sizes.
+ *
+ * @see Client
+ * @see LinkAggregator
+ */
+class Gro {
+
+    /**
+     * A TCP flow segments are held of.
+     */
+    struct Flow {
+        // Super-packet, starting with the first segment's headers
+        Buffer  *m_pkt;
+        // Number of merged segments
+        int      m_segs;
+        // Payload size of the first segment
+        int      m_gso_size;
+        // Sequence number expected next, in host byte order
+        uint32_t m_next_seq;
+        // Time the first segment was held at
+        uint64_t m_start_nsec;
+    };
+
+    // Held flows, oldest first
+    std::vector<Flow>     m_flows;
+    uint64_t              m_timeout_nsec;
+
+    // Packets to be delivered and their GSO segment sizes
+    std::vector<Buffer *> m_out;
+    std::vector<uint16_t> m_out_gso_sizes;
+
+    // Statistics
+    uint64_t              m_stat_segs;
+    uint64_t              m_stat_pkts;
+
+    Gro( Gro const & ) = delete;
+    Gro & operator=( Gro const & ) = delete;
+
+    int Find( Buffer const * pkt ) const;
+    bool Append( int idx, Buffer * pkt );
+    void Output( int idx );
+    void Output( Buffer * pkt, uint16_t gso_size );
+
+    public:
+
+    Gro( int timeout_usec );
+    ~Gro();
+
+    void Add( Buffer * pkt );
+    void Flush( bool all );
+    int NextTimeoutUsec() const;
+
+    /**
+     * Getter for the packets to be delivered.
+     *
+     * @returns The packets, in the order they are to be delivered.
+     */
+    std::vector<Buffer *> const & Out() const { return m_out; }
+
+    /**
+     * Getter for the GSO segment sizes of the packets to be delivered.
+     *
+     * @returns The segment sizes, 0 for packets that were not merged.
+     */
+    std::vector<uint16_t> const & OutGsoSizes() const {
+        return m_out_gso_sizes;
+    }
+
+    /**
+     * Forget the delivered packets.
+     *
+     * The packets themselves are not released, this is left to the caller.
+     */
+    void ClearOut() {
+        m_out.clear();
+        m_out_gso_sizes.clear();
+    }
+
+    /**
+     * Take the merge statistics.
+     *
+     * The statistics are reset, so every call returns the statistics
+     * accumulated since the previous one.
+     *
+     * @param segs Set to the number of segments merged.
+     * @param pkts Set to the number of super-packets they were merged into.
+     */
+    void TakeStats( uint64_t & segs, uint64_t & pkts ) {
+        segs = m_stat_segs;
+        pkts = m_stat_pkts;
+        m_stat_segs = 0;
+        m_stat_pkts = 0;
+    }
+};
+
+#endif /* _GRO_HH_ */
@@ -1,4 +1,7 @@
 #include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstddef>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,11 +12,150 @@
 
 #include <net/if.h>
 #include <sys/ioctl.h>
+#include <linux/filter.h>
 
 #include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/net_tstamp.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/pkt_sched.h>
 
+#include "cipher.hh"
+#include "crc32c.hh"
 #include "link.hh"
 
+/**
+ * Check whether a queueing discipline holds frames until their departure time.
+ *
+ * @param kind Name of the queueing discipline.
+ * @returns True for fq and etf, false otherwise.
+ */
+static bool qdisc_paces( char const * kind ) {
+    return !strcmp( kind, "fq" ) || !strcmp( kind, "etf" );
+}
+
+/**
+ * Check whether the departure times of frames are honored on an interface.
+ *
+ * SO_TXTIME is accepted by every socket, but only fq and etf hold frames
+ * until their departure time, other queueing disciplines send them right
+ * away. The interface's queueing disciplines are dumped via rtnetlink. The
+ * root must be fq or etf, or mq with fq or etf on all of its queues.
+ *
+ * @param if_index Index of the interface.
+ * @returns True if departure times are honored, false otherwise or if the
+ * queueing disciplines cannot be read.
+ */
+static bool if_honors_txtime( int if_index ) {
+
+    int sock = socket( AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE );
+    if( sock < 0 ) {
+        errno = 0;
+        return false;
+    }
+
+    struct {
+        struct nlmsghdr nh;
+        struct tcmsg    tc;
+    } req;
+    memset( &req, 0, sizeof(req) );
+    req.nh.nlmsg_len   = NLMSG_LENGTH(sizeof(struct tcmsg));
+    req.nh.nlmsg_type  = RTM_GETQDISC;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.tc.tcm_family  = AF_UNSPEC;
+    req.tc.tcm_ifindex = if_index;
+    if( send( sock, &req, req.nh.nlmsg_len, 0 ) < 0 ) {
+        close(sock);
+        errno = 0;
+        return false;
+    }
+
+    // Parents and kinds of the interface's queueing disciplines
+    std::vector<std::pair<uint32_t, std::string>> qdiscs;
+    std::string root;
+    uint32_t root_handle = 0;
+    char buf[8192] __attribute__ ((aligned(__alignof__(struct nlmsghdr))));
+    bool done = false;
+    while( !done ) {
+        int len = recv( sock, buf, sizeof(buf), 0 );
+        if( len <= 0 ) {
+            break;
+        }
+        for( struct nlmsghdr *nh = (struct nlmsghdr *) buf;
+                NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len) ) {
+            if( nh->nlmsg_type == NLMSG_DONE
+                    || nh->nlmsg_type == NLMSG_ERROR ) {
+                done = true;
+                break;
+            }
+            struct tcmsg *tc = (struct tcmsg *) NLMSG_DATA(nh);
+            if( nh->nlmsg_type != RTM_NEWQDISC
+                    || tc->tcm_ifindex != if_index ) {
+                continue;
+            }
+            char const *kind = "";
+            int alen = nh->nlmsg_len - NLMSG_LENGTH(sizeof(*tc));
+            for( struct rtattr *rta = (struct rtattr *) ((char *) tc
+                        + NLMSG_ALIGN(sizeof(*tc)));
+                    RTA_OK(rta, alen); rta = RTA_NEXT(rta, alen) ) {
+                if( rta->rta_type == TCA_KIND ) {
+                    kind = (char const *) RTA_DATA(rta);
+                }
+            }
+            if( tc->tcm_parent == TC_H_ROOT ) {
+                root = kind;
+                root_handle = tc->tcm_handle;
+            } else {
+                qdiscs.push_back( std::make_pair( tc->tcm_parent,
+                                                  std::string(kind) ) );
+            }
+        }
+    }
+    close(sock);
+    errno = 0;
+
+    if( qdisc_paces( root.c_str() ) ) {
+        return true;
+    }
+    if( root != "mq" ) {
+        return false;
+    }
+    int queues = 0;
+    for( int i = 0; i < qdiscs.size(); i++ ) {
+        if( TC_H_MAJ(qdiscs[i].first) != TC_H_MAJ(root_handle) ) {
+            continue;
+        }
+        if( !qdisc_paces( qdiscs[i].second.c_str() ) ) {
+            return false;
+        }
+        queues++;
+    }
+    return queues > 0;
+}
+
+/**
+ * Get the speed of a network interface.
+ *
+ * @param ifname Name of the interface.
+ * @returns The speed in Mbit/s, or LINK_DEFAULT_SPEED if the interface does
+ * not report it.
+ */
+static int if_speed( std::string const & ifname ) {
+
+    std::ifstream in( "/sys/class/net/" + ifname + "/speed" );
+    int speed = 0;
+    errno = 0;
+
+    if( !(in >> speed) || speed <= 0 ) {
+        errno = 0;
+        return LINK_DEFAULT_SPEED;
+    }
+
+    return speed;
+}
+
 /**
  * Link class constructor
  *
@@ -26,16 +168,53 @@
  *
  * @param ifname Name of the interface to be bound to.
  * @param mac_addr_str String containing the peer's MAC address.
+ * @param mtu MTU to be used on the link. If 0, the interface's MTU is used.
+ * @param tunnel Id of the tunnel carried. Frames of other tunnels are dropped.
  */
 Link::Link( std::string const ifname,
-        std::string const mac_addr_str )
+        std::string const mac_addr_str,
+        int const mtu,
+        int const tunnel )
         : m_peer_addr(mac_addr_str)
-        , m_if_name(ifname) {
+        , m_if_name(ifname)
+        , m_mtu(mtu)
+        , m_numa_node(if_numa_node(ifname))
+        , m_rx_buf(nullptr)
+        , m_rx_buf_size(0)
+        , m_duplicates(0)
+        , m_checksum(false)
+        , m_corrupt(0)
+        , m_tx_queued_bytes(0)
+        , m_tx_drops(0)
+        , m_compress(false)
+        , m_tx_compressed(0)
+        , m_rate_bps(0)
+        , m_txtime(false)
+        , m_next_tx_nsec(0)
+        , m_speed_bps((uint64_t) if_speed(ifname) * 1000000)
+        , m_busy_nsec(0)
+        , m_owd_nsec(0)
+        , m_tx_packets(0)
+        , m_rx_packets(0)
+        , m_rx_first(0)
+        , m_has_report(false)
+        , m_measured(false)
+        , m_loss_ppm(1000000)
+        , m_first_ppm(0)
+        , m_rank(0)
+        , m_classes(1)
+        , m_up(true)
+        , m_tunnel(tunnel)
+        , m_tx_header(nullptr)
+        , m_cipher(nullptr) {
 
     // Create the socket
     m_socket = socket( AF_PACKET, SOCK_RAW, htons(ETH_P_ALAGG) );
     assert_perror(errno);
 
+    // Filter out frames of other peers as soon as possible
+    AttachFilter();
+
     // Get interface index
     struct ifreq ifr;
     struct sockaddr_ll sll;
@@ -48,6 +227,7 @@ Link::Link( std::string const ifname,
     ioctl( m_socket, SIOCGIFINDEX, &ifr );
     assert_perror(errno);
     sll.sll_ifindex = ifr.ifr_ifindex;
+    m_if_index = ifr.ifr_ifindex;
 
     // Get hardware address
     ioctl( m_socket, SIOCGIFHWADDR, &ifr );
@@ -63,13 +243,798 @@ Link::Link( std::string const ifname,
             ifr.ifr_hwaddr.sa_data[5] );
     m_own_addr.SetAddr( std::string(tmp) );
 
+    // Get MTU, unless configured
+    if( m_mtu == 0 ) {
+        ioctl( m_socket, SIOCGIFMTU, &ifr );
+        assert_perror(errno);
+        m_mtu = ifr.ifr_mtu;
+    }
+    if( MaxPayload() <= 0 ) {
+        std::cerr << "ERROR: MTU of " << m_mtu << " too small on "
+            << ifname << std::endl;
+        exit(1);
+    }
+
     // Bind the raw socket to the interface specified
     bind( m_socket, (struct sockaddr *)&sll, sizeof(sll) );
     assert_perror(errno);
 
+    // Priority socket, bound to no protocol, so it does not receive
+    m_prio_socket = socket( AF_PACKET, SOCK_RAW, 0 );
+    assert_perror(errno);
+    sll.sll_protocol = 0;
+    bind( m_prio_socket, (struct sockaddr *)&sll, sizeof(sll) );
+    assert_perror(errno);
+    int priority = LINK_TX_PRIORITY;
+    setsockopt( m_prio_socket, SOL_SOCKET, SO_PRIORITY,
+            &priority, sizeof(priority) );
+    assert_perror(errno);
+    fcntl( m_prio_socket, F_SETFL, O_NONBLOCK );
+    assert_perror(errno);
+
+    // Enlarge the receive buffer, exceeding rmem_max if permitted
+    int rcvbuf = LINK_RCVBUF_SIZE;
+    if( setsockopt( m_socket, SOL_SOCKET, SO_RCVBUFFORCE,
+                &rcvbuf, sizeof(rcvbuf) ) < 0 ) {
+        setsockopt( m_socket, SOL_SOCKET, SO_RCVBUF,
+                &rcvbuf, sizeof(rcvbuf) );
+    }
+    errno = 0;
+
     // Make socket non-blocking
     int fdflags = fcntl( m_socket, F_GETFL );
     assert_perror(errno);
     fcntl( m_socket, F_SETFL, fdflags | O_NONBLOCK );
     assert_perror(errno);
+
+    // Drop frames queued before the filter was attached and the socket bound
+    while( recv( m_socket, nullptr, 0, MSG_TRUNC ) >= 0 );
+    errno = 0;
+
+    // Prepare the header of transmitted frames
+    if( posix_memalign( (void **) &m_tx_header, CACHE_LINE_SIZE,
+                sizeof(AlaggHeader) ) != 0 ) {
+        std::cerr << "ERROR: Could not allocate header template" << std::endl;
+        exit(1);
+    }
+    memset( m_tx_header, 0, sizeof(AlaggHeader) );
+    memcpy( m_tx_header->m_eth_header.ether_shost,
+            m_own_addr.Addr().data(), MAC_ADDRLEN );
+    memcpy( m_tx_header->m_eth_header.ether_dhost,
+            m_peer_addr.Addr().data(), MAC_ADDRLEN );
+    m_tx_header->m_eth_header.ether_type = ETH_P_ALAGG;
+    m_tx_header->m_tunnel = m_tunnel;
+
+    SetUp( ReadCarrier() );
+}
+
+/**
+ * Read whether the interface is up and has carrier.
+ *
+ * @returns True if the interface is up and running, false otherwise, e.g. if
+ * the interface was removed.
+ */
+bool Link::ReadCarrier() {
+
+    struct ifreq ifr;
+    memset( &ifr, 0, sizeof(ifr) );
+    strncpy( ifr.ifr_name, m_if_name.c_str(), IFNAMSIZ - 1 );
+    if( ioctl( m_socket, SIOCGIFFLAGS, &ifr ) < 0 ) {
+        errno = 0;
+        return false;
+    }
+
+    return (ifr.ifr_flags & IFF_UP) && (ifr.ifr_flags & IFF_RUNNING);
+}
+
+/**
+ * Attach a socket filter.
+ *
+ * A classic BPF program is attached to the socket, so the kernel drops frames
+ * not sent by the peer or belonging to another tunnel, as well as frames too
+ * short to carry an AlaggHeader, before they are queued to the socket. It is
+ * equivalent to
+ *
+ *     if( len >= sizeof(AlaggHeader) && eth->ether_shost == peer
+ *             && hdr->m_tunnel == tunnel )
+ *         accept;
+ *     drop;
+ *
+ * Failing to attach the filter is not fatal, since received frames are checked
+ * in user space as well.
+ */
+void Link::AttachFilter() {
+
+    std::vector<char> const & mac = m_peer_addr.Addr();
+    uint32_t mac_hi = (uint32_t) (unsigned char) mac[0] << 24
+                    | (uint32_t) (unsigned char) mac[1] << 16
+                    | (uint32_t) (unsigned char) mac[2] << 8
+                    | (uint32_t) (unsigned char) mac[3];
+    uint32_t mac_lo = (uint32_t) (unsigned char) mac[4] << 8
+                    | (uint32_t) (unsigned char) mac[5];
+
+    struct sock_filter code[] = {
+        // A = len; if( A < sizeof(AlaggHeader) ) goto drop
+        BPF_STMT( BPF_LD | BPF_W | BPF_LEN, 0 ),
+        BPF_JUMP( BPF_JMP | BPF_JGE | BPF_K, sizeof(AlaggHeader), 0, 7 ),
+        // Source address, loaded in network byte order
+        BPF_STMT( BPF_LD | BPF_W | BPF_ABS, ETH_ALEN ),
+        BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, mac_hi, 0, 5 ),
+        BPF_STMT( BPF_LD | BPF_H | BPF_ABS, ETH_ALEN + 4 ),
+        BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, mac_lo, 0, 3 ),
+        // Tunnel id
+        BPF_STMT( BPF_LD | BPF_B | BPF_ABS, offsetof(AlaggHeader, m_tunnel) ),
+        BPF_JUMP( BPF_JMP | BPF_JEQ | BPF_K, m_tunnel, 0, 1 ),
+        // accept: return the whole frame
+        BPF_STMT( BPF_RET | BPF_K, 0xffffffff ),
+        // drop
+        BPF_STMT( BPF_RET | BPF_K, 0 ),
+    };
+
+    struct sock_fprog prog;
+    prog.len    = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    if( setsockopt( m_socket, SOL_SOCKET, SO_ATTACH_FILTER,
+                &prog, sizeof(prog) ) < 0 ) {
+        perror("setsockopt(SO_ATTACH_FILTER)");
+    }
+    errno = 0;
+}
+
+/**
+ * Enable busy polling on the link's socket.
+ *
+ * Blocking reception, as well as epoll on the socket, spin on the device's
+ * receive queue for up to the given time before sleeping. Busy polling is
+ * preferred over interrupt driven processing, if the device supports deferring
+ * its interrupts.
+ *
+ * @param usec Time to spin in microseconds. 0 disables busy polling.
+ * @param budget Maximum number of frames processed per busy poll.
+ * @returns True if busy polling was enabled, false otherwise. Setting
+ * SO_BUSY_POLL requires CAP_NET_ADMIN when raising the system default.
+ */
+bool Link::SetBusyPoll( int usec, int budget ) {
+
+    int prefer = usec > 0;
+    bool ok = setsockopt( m_socket, SOL_SOCKET, SO_BUSY_POLL,
+            &usec, sizeof(usec) ) == 0;
+    setsockopt( m_socket, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+            &prefer, sizeof(prefer) );
+    if( usec > 0 ) {
+        setsockopt( m_socket, SOL_SOCKET, SO_BUSY_POLL_BUDGET,
+                &budget, sizeof(budget) );
+    }
+    errno = 0;
+
+    return ok;
+}
+
+/**
+ * Set the size of the socket's reception buffer.
+ *
+ * The buffer is allocated on the interface's NUMA node.
+ *
+ * @param size Size in bytes, fitting the largest frame to be received.
+ */
+void Link::SetRxBufSize( int size ) {
+
+    numa_free( m_rx_buf, m_rx_buf_size );
+    m_rx_buf = (unsigned char *) numa_alloc( size, m_numa_node );
+    if( !m_rx_buf ) {
+        exit(1);
+    }
+    m_rx_buf_size = size;
+}
+
+/**
+ * Receive frames through the socket.
+ *
+ * Frames are received until no more data is available (EAGAIN, EWOULDBLOCK)
+ * or the budget is exhausted. Truncated frames are dropped. The error
+ * reported once the interface went down (ENETDOWN) is skipped.
+ *
+ * @param budget Maximum number of frames to be received.
+ * @param handler Handler called for every frame.
+ * @returns The number of frames received.
+ */
+int Link::RecvSocket( int budget, FrameHandler const & handler ) {
+
+    int n;
+
+    for( n = 0; n < budget; n++ ) {
+
+        int byte_rcvd = recv( m_socket, m_rx_buf, m_rx_buf_size, MSG_TRUNC );
+        if( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) {
+            // No data avilable
+            errno = 0;
+            break;
+        }
+        if( errno == ENETDOWN ) {
+            errno = 0;
+            continue;
+        }
+        assert_perror(errno);
+
+        if( byte_rcvd > m_rx_buf_size ) {
+            // Truncated frame
+            continue;
+        }
+
+        handler( m_rx_buf, byte_rcvd );
+    }
+
+    return n;
+}
+
+/**
+ * Transmit a frame on a socket.
+ *
+ * The frame is gathered from its pieces by sendmsg(), so the payload is not
+ * copied. Transmission errors are ignored.
+ *
+ * @param sock Socket to transmit on.
+ * @param iov Pieces of the frame.
+ * @param iovcnt Number of pieces.
+ * @param txtime Departure time of the frame on CLOCK_MONOTONIC in
+ * nanoseconds, passed as SCM_TXTIME. 0 if the frame departs right away.
+ * @returns The number of bytes sent, or the negated errno value on failure.
+ */
+static int send_frame( int sock, struct iovec * iov, int iovcnt,
+                       uint64_t txtime ) {
+
+    struct msghdr msg;
+    memset( &msg, 0, sizeof(msg) );
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = iovcnt;
+
+    char control[CMSG_SPACE(sizeof(uint64_t))];
+    if( txtime ) {
+        memset( control, 0, sizeof(control) );
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type  = SCM_TXTIME;
+        cmsg->cmsg_len   = CMSG_LEN(sizeof(uint64_t));
+        memcpy( CMSG_DATA(cmsg), &txtime, sizeof(uint64_t) );
+    }
+
+    int ret = sendmsg( sock, &msg, 0 );
+    if( ret < 0 ) {
+        ret = -errno;
+    }
+    errno = 0;
+
+    return ret;
+}
+
+/**
+ * Transmit a frame on a socket, gathered from its header, payload and
+ * trailer, if any.
+ *
+ * @param sock Socket to transmit on.
+ * @param header Header of the frame.
+ * @param payload Pointer to the payload.
+ * @param len Size of the payload.
+ * @param txtime Departure time of the frame, 0 if it departs right away.
+ * @returns The number of bytes sent, or the negated errno value on failure.
+ * @see Link::Trailer()
+ */
+int Link::SendTo( int sock, AlaggHeader const & header,
+                  void const * payload, int len, uint64_t txtime ) {
+
+    unsigned char trailer[ALAGG_TRAILER_MAX];
+    struct iovec iov[3];
+    iov[0].iov_base = (void *) &header;
+    iov[0].iov_len  = sizeof(AlaggHeader);
+    iov[1].iov_base = (void *) payload;
+    iov[1].iov_len  = len;
+    iov[2].iov_base = trailer;
+    iov[2].iov_len  = Trailer( header, payload, len, trailer );
+
+    return send_frame( sock, iov, iov[2].iov_len ? 3 : 2, txtime );
+}
+
+/**
+ * Build the trailer of a frame.
+ *
+ * With checksums enabled, see Link::SetChecksum(), the trailer holds the
+ * CRC32C of the frame after the ethernet header, in network byte order. Frames
+ * shorter than the minimum ethernet frame size are padded with zeros before
+ * the CRC32C, so it is always found at the end of the frame, even though the
+ * link layer pads short frames. The byte preceding the CRC32C holds the size
+ * of the padding, so the receiver can strip it.
+ *
+ * @param header Header of the frame.
+ * @param payload Pointer to the payload.
+ * @param len Size of the payload.
+ * @param trailer Buffer of ALAGG_TRAILER_MAX bytes the trailer is stored in.
+ * @returns The size of the trailer, 0 if checksums are disabled.
+ */
+int Link::Trailer( AlaggHeader const & header, void const * payload, int len,
+                   unsigned char * trailer ) const {
+
+    if( !m_checksum ) {
+        return 0;
+    }
+
+    int size = sizeof(AlaggHeader) + len + ALAGG_TRAILER_MIN;
+    int pad = size < ETH_ZLEN ? ETH_ZLEN - size : 0;
+    memset( trailer, 0, pad );
+    trailer[pad] = pad;
+
+    uint32_t crc = crc32c( 0, (unsigned char const *) &header
+                           + sizeof(struct ether_header),
+                           sizeof(AlaggHeader) - sizeof(struct ether_header) );
+    crc = crc32c( crc, payload, len );
+    crc = htonl( crc32c( crc, trailer, pad + 1 ) );
+    memcpy( trailer + pad + 1, &crc, ALAGG_CHECKSUM_LEN );
+    return pad + ALAGG_TRAILER_MIN;
+}
+
+/**
+ * Verify the trailer of a received frame.
+ *
+ * Frames with a mismatching CRC32C are counted, see Link::Corrupt(), so they
+ * can be dropped before they are taken for a packet's only copy. A good copy
+ * received on another Link is still accepted.
+ *
+ * @param frame Pointer to the received frame.
+ * @param len Size of the frame.
+ * @returns The size of the frame without the trailer, or -1 if it is corrupt.
+ * The size is returned unchanged if checksums are disabled.
+ */
+int Link::Verify( unsigned char const * frame, int len ) {
+
+    if( !m_checksum ) {
+        return len;
+    }
+
+    len -= ALAGG_CHECKSUM_LEN;
+    if( len < (int) sizeof(AlaggHeader) + 1 ) {
+        CountCorrupt();
+        return -1;
+    }
+
+    uint32_t crc;
+    memcpy( &crc, frame + len, ALAGG_CHECKSUM_LEN );
+    if( ntohl(crc) != crc32c( 0, frame + sizeof(struct ether_header),
+                              len - sizeof(struct ether_header) ) ) {
+        CountCorrupt();
+        return -1;
+    }
+
+    len -= 1 + frame[len - 1];
+    if( len < (int) sizeof(AlaggHeader) ) {
+        CountCorrupt();
+        return -1;
+    }
+    return len;
+}
+
+/**
+ * Transmit a frame.
+ *
+ * The frame is gathered from the header and the payload by sendmsg(), so the
+ * payload is not copied. Transmission errors are ignored. The frame is not
+ * paced.
+ *
+ * @param header Header of the frame, usually based on Link::TxHeader().
+ * @param payload Pointer to the payload.
+ * @param len Size of the payload.
+ * @returns The number of bytes sent, or the negated errno value on failure.
+ */
+int Link::SendFrame( AlaggHeader const & header,
+                     void const * payload, int len ) {
+    return SendTo( m_socket, header, payload, len, 0 );
+}
+
+/**
+ * Transmit a frame ahead of regular frames.
+ *
+ * Like Link::SendFrame(), but the frame is sent on the priority socket, see
+ * Link::PrioSocket(). Kernel bypasses are not used. The frame departs right
+ * away, but is accounted by the pacing of the Link.
+ *
+ * @param header Header of the frame, usually based on Link::TxHeader().
+ * @param payload Pointer to the payload.
+ * @param len Size of the payload.
+ * @returns The number of bytes sent, or the negated errno value on failure.
+ */
+int Link::SendPrioFrame( AlaggHeader const & header,
+                         void const * payload, int len ) {
+    if( m_rate_bps ) {
+        Pace( sizeof(AlaggHeader) + len, now_nsec() );
+    }
+    return SendTo( m_prio_socket, header, payload, len, 0 );
+}
+
+/**
+ * Transmit a frame on the priority socket, bypassing pacing.
+ *
+ * Unlike Link::SendPrioFrame(), the Link's transmission state is not touched,
+ * so frames can be sent by any thread, e.g. by the thread receiving on the
+ * Link. Used for frames that are small or rare, such as NACKs and
+ * retransmissions.
+ *
+ * @param header Header of the frame, usually based on Link::TxHeader().
+ * @param payload Pointer to the payload.
+ * @param len Size of the payload.
+ * @returns The return value of the send call.
+ */
+int Link::SendControlFrame( AlaggHeader const & header,
+                            void const * payload, int len ) {
+    return SendTo( m_prio_socket, header, payload, len, 0 );
+}
+
+/**
+ * Pace the Link's transmission.
+ *
+ * With SO_TXTIME, every frame is handed to the kernel with a departure time,
+ * and the fq or etf queueing discipline holds it until then. Otherwise, or if
+ * SO_TXTIME is not supported, or the interface's queueing discipline would
+ * ignore the departure times, frames are held in the Link's transmit queue
+ * instead, and up to LINK_PACING_BURST_NSEC worth of frames are sent at
+ * once, like by a token bucket.
+ *
+ * @param mbps Rate in Mbit/s. 0 disables pacing.
+ * @param txtime Whether to use SO_TXTIME.
+ * @returns False if SO_TXTIME was requested but is not supported or not
+ * honored by the interface's queueing discipline, true otherwise.
+ * @see Link::QueueFrame()
+ */
+bool Link::SetRate( int mbps, bool txtime ) {
+
+    m_rate_bps = (uint64_t) std::max(mbps, 0) * 1000000;
+    m_txtime = false;
+    m_next_tx_nsec = 0;
+    if( !m_rate_bps || !txtime ) {
+        return true;
+    }
+
+    if( !if_honors_txtime( m_if_index ) ) {
+        return false;
+    }
+
+    struct sock_txtime cfg;
+    memset( &cfg, 0, sizeof(cfg) );
+    cfg.clockid = CLOCK_MONOTONIC;
+    if( setsockopt( m_socket, SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg) ) ) {
+        errno = 0;
+        return false;
+    }
+    m_txtime = true;
+    return true;
+}
+
+/**
+ * Account a frame to the Link's rate.
+ *
+ * Frames are scheduled back to back on a virtual clock, including the
+ * ethernet framing overhead, see LINK_WIRE_OVERHEAD. Without SO_TXTIME, the
+ * clock may lag behind by LINK_PACING_BURST_NSEC, so late timer expirations
+ * are caught up on, like by a token bucket.
+ *
+ * @param size Size of the frame.
+ * @param now Current monotonic time in nanoseconds.
+ * @returns The departure time of the frame.
+ */
+uint64_t Link::Pace( int size, uint64_t now ) {
+
+    uint64_t earliest = m_txtime ? now : now - LINK_PACING_BURST_NSEC;
+    uint64_t departure = std::max(m_next_tx_nsec, earliest);
+    m_next_tx_nsec = departure + TxNsec(size);
+    return departure;
+}
+
+/**
+ * Get the time until which transmission is held back by pacing.
+ *
+ * @returns The monotonic time in nanoseconds at which the next frame may be
+ * sent, or 0 if it may be sent right away, or if the kernel paces the Link.
+ */
+uint64_t const Link::PacedUntil() const {
+
+    if( !m_rate_bps || m_txtime ) {
+        return 0;
+    }
+    uint64_t now = now_nsec();
+    if( m_next_tx_nsec <= now + LINK_PACING_BURST_NSEC ) {
+        return 0;
+    }
+    return m_next_tx_nsec - LINK_PACING_BURST_NSEC;
+}
+
+/**
+ * Transmit a frame, queueing it while the socket buffer is full.
+ *
+ * The frame is sent right away if no frames are queued. If the socket buffer
+ * is full, or earlier frames are still queued, the frame is copied to the
+ * end of the queue, to be sent by Link::FlushTxQueue() once the socket becomes
+ * writable. Frames are dropped if the queue holds LINK_TX_QUEUE_LEN frames
+ * already, or if the kernel fails to send them, e.g. because the interface's
+ * queueing discipline is full. Dropped frames are counted, see
+ * Link::TxDrops().
+ *
+ * Paced Links also queue frames that are not due yet, see Link::SetRate() and
+ * Link::PacedUntil().
+ *
+ * @param header Header of the frame, usually based on Link::TxHeader().
+ * @param payload Pointer to the payload.
+ * @param len Size of the payload.
+ * @returns True if the frame was sent or queued, false if it was dropped.
+ */
+bool Link::QueueFrame( AlaggHeader const & header,
+                       void const * payload, int len ) {
+
+    if( m_tx_queue.empty() && !PacedUntil() ) {
+        uint64_t next = m_next_tx_nsec;
+        uint64_t txtime = 0;
+        if( m_rate_bps ) {
+            txtime = Pace( sizeof(AlaggHeader) + len, now_nsec() );
+        }
+        int ret = SendTo( m_socket, header, payload, len,
+                              m_txtime ? txtime : 0 );
+        if( ret >= 0 ) {
+            return true;
+        }
+        m_next_tx_nsec = next;
+        if( ret != -EAGAIN && ret != -EWOULDBLOCK ) {
+            m_tx_drops++;
+            return false;
+        }
+    }
+
+    if( m_tx_queue.size() >= LINK_TX_QUEUE_LEN ) {
+        m_tx_drops++;
+        return false;
+    }
+
+    unsigned char trailer[ALAGG_TRAILER_MAX];
+    int trailer_len = Trailer( header, payload, len, trailer );
+    Buffer *frame = new Buffer( sizeof(AlaggHeader) + len + trailer_len );
+    memcpy( frame->data(), &header, sizeof(AlaggHeader) );
+    memcpy( frame->data() + sizeof(AlaggHeader), payload, len );
+    memcpy( frame->data() + sizeof(AlaggHeader) + len, trailer, trailer_len );
+    m_tx_queue.push_back( frame );
+    m_tx_queued_bytes += frame->size();
+    return true;
+}
+
+/**
+ * Transmit queued frames.
+ *
+ * Frames are sent in order until the socket buffer is full again, or until
+ * the next frame is not due yet on a paced Link. Frames the kernel fails to
+ * send are dropped.
+ *
+ * @returns True if the queue was emptied, false if frames are left, to be
+ * sent once the socket becomes writable again, or at Link::PacedUntil().
+ * @see Link::QueueFrame()
+ */
+bool Link::FlushTxQueue() {
+
+    while( !m_tx_queue.empty() ) {
+        if( PacedUntil() ) {
+            return false;
+        }
+
+        Buffer *frame = m_tx_queue.front();
+        uint64_t next = m_next_tx_nsec;
+        uint64_t txtime = 0;
+        if( m_rate_bps ) {
+            txtime = Pace( frame->size(), now_nsec() );
+        }
+
+        struct iovec iov;
+        iov.iov_base = frame->data();
+        iov.iov_len  = frame->size();
+        int ret = send_frame( m_socket, &iov, 1, m_txtime ? txtime : 0 );
+        if( ret == -EAGAIN || ret == -EWOULDBLOCK ) {
+            m_next_tx_nsec = next;
+            return false;
+        }
+        if( ret < 0 ) {
+            m_tx_drops++;
+        }
+        m_tx_queue.pop_front();
+        m_tx_queued_bytes -= frame->size();
+        delete frame;
+    }
+
+    return true;
+}
+
+/**
+ * Estimate the arrival time of a frame at the remote aggregator.
+ *
+ * The frame departs once the frames scheduled before it, see
+ * Link::Schedule(), and the frames in the transmit queue are transmitted at
+ * the Link's line rate, whichever takes longer. It arrives after its own
+ * transmission time plus the measured one-way delay.
+ *
+ * @param size Size of the frame.
+ * @param now Current monotonic time in nanoseconds.
+ * @returns The estimated arrival time, on the local CLOCK_MONOTONIC.
+ */
+uint64_t const Link::ExpectedArrival( int size, uint64_t now ) const {
+
+    uint64_t departure = std::max(m_busy_nsec, now);
+    if( m_tx_queued_bytes ) {
+        departure = std::max(departure, now + TxNsec(m_tx_queued_bytes));
+    }
+    return departure + TxNsec(size) + OneWayDelay();
+}
+
+/**
+ * Schedule a frame for transmission on the Link.
+ *
+ * Accounts the frame's transmission time, see Link::ExpectedArrival().
+ *
+ * @param size Size of the frame.
+ * @param now Current monotonic time in nanoseconds.
+ */
+void Link::Schedule( int size, uint64_t now ) {
+    m_busy_nsec = std::max(m_busy_nsec, now) + TxNsec(size);
+}
+
+/**
+ * Send a probe.
+ *
+ * The probe carries the current time, and is sent on the priority socket, so
+ * its echo measures the Link's delay rather than the queueing of its frames.
+ *
+ * @see ALAGG_FLAG_PROBE
+ */
+void Link::SendProbe() {
+
+    AlaggHeader header = TxHeader();
+    header.m_flags = ALAGG_FLAG_PROBE;
+
+    AlaggProbe probe;
+    probe.m_tx_nsec = now_nsec();
+    probe.m_echo    = 0;
+    unsigned char sealed[sizeof(probe) + CIPHER_OVERHEAD];
+    int len = SealControl( header, &probe, sizeof(probe), sealed );
+    if( len >= 0 ) {
+        SendTo( m_prio_socket, header, sealed, len, 0 );
+    }
+}
+
+/**
+ * Prepare the payload of a probe, report or NACK frame.
+ *
+ * With a Cipher set, see Link::SetCipher(), the payload is sealed, so the
+ * remote aggregator can tell forged and replayed control frames. Otherwise it
+ * is copied as is. May be called by any thread.
+ *
+ * @param header Header the frame is sent with.
+ * @param payload Pointer to the payload.
+ * @param len Size of the payload.
+ * @param out Buffer of len + CIPHER_OVERHEAD bytes the payload is stored in.
+ * @returns The size of the payload stored, or -1 on failure.
+ */
+int Link::SealControl( AlaggHeader const & header, void const * payload,
+                       int len, unsigned char * out ) {
+    if( !m_cipher ) {
+        memcpy( out, payload, len );
+        return len;
+    }
+    return m_cipher->SealShared( header, (unsigned char const *) payload,
+                                 len, out );
+}
+
+/**
+ * Handle a probe received on the Link.
+ *
+ * The frame must have been opened already, if probes are sealed, see
+ * Link::SetCipher(). Probes are echoed right away on the priority socket,
+ * sealed likewise. Echoes of the Link's own probes update the one-way delay,
+ * as half the round trip time, smoothed by an exponentially weighted moving
+ * average with a weight of 1/8.
+ *
+ * @param frame Pointer to the received frame, flagged ALAGG_FLAG_PROBE.
+ * @param len Size of the frame.
+ */
+void Link::OnProbe( unsigned char const * frame, int len ) {
+
+    if( len < (int) (sizeof(AlaggHeader) + sizeof(AlaggProbe)) ) {
+        return;
+    }
+
+    AlaggProbe probe;
+    memcpy( &probe, frame + sizeof(AlaggHeader), sizeof(probe) );
+
+    if( !probe.m_echo ) {
+        AlaggHeader header = TxHeader();
+        header.m_flags = ALAGG_FLAG_PROBE;
+        probe.m_echo = 1;
+        unsigned char sealed[sizeof(probe) + CIPHER_OVERHEAD];
+        len = SealControl( header, &probe, sizeof(probe), sealed );
+        if( len >= 0 ) {
+            SendTo( m_prio_socket, header, sealed, len, 0 );
+        }
+        return;
+    }
+
+    uint64_t now = now_nsec();
+    if( probe.m_tx_nsec > now ) {
+        return;
+    }
+    uint64_t sample = (now - probe.m_tx_nsec) / 2;
+    uint64_t owd = m_owd_nsec.load(std::memory_order_relaxed);
+    owd = owd ? owd - owd / 8 + sample / 8 : sample;
+    m_owd_nsec.store( std::max(owd, (uint64_t) 1), std::memory_order_relaxed );
+}
+
+/**
+ * Handle a report received on the Link.
+ *
+ * The frame must have been opened already, if reports are sealed, see
+ * Link::SetCipher(). Requests are answered right away on the priority socket,
+ * with the Link's reception counters, sealed likewise. Since requests are
+ * sent in line with the packets, the answer covers all packets sent before the
+ * request that were not lost.
+ *
+ * Answers to the Link's own requests update the loss and the share of first
+ * arrivals, each over the packets since the previous answer used, smoothed by
+ * an exponentially weighted moving average with a weight of 1/4, starting
+ * from the first measurement. Answers are
+ * accumulated until they cover LINK_REPORT_MIN_PACKETS packets sent. The
+ * counters restart if the remote aggregator's counters went back, e.g. after a
+ * restart.
+ *
+ * @param frame Pointer to the received frame, flagged ALAGG_FLAG_REPORT.
+ * @param len Size of the frame.
+ */
+void Link::OnReport( unsigned char const * frame, int len ) {
+
+    if( len < (int) (sizeof(AlaggHeader) + sizeof(AlaggReport)) ) {
+        return;
+    }
+
+    AlaggReport report;
+    memcpy( &report, frame + sizeof(AlaggHeader), sizeof(report) );
+
+    if( !report.m_echo ) {
+        AlaggHeader header = TxHeader();
+        header.m_flags = ALAGG_FLAG_REPORT;
+        report.m_rx_packets = m_rx_packets;
+        report.m_rx_first   = m_rx_first;
+        report.m_echo       = 1;
+        unsigned char sealed[sizeof(report) + CIPHER_OVERHEAD];
+        len = SealControl( header, &report, sizeof(report), sealed );
+        if( len >= 0 ) {
+            SendTo( m_prio_socket, header, sealed, len, 0 );
+        }
+        return;
+    }
+
+    int32_t sent  = report.m_tx_packets - m_report.m_tx_packets;
+    int32_t rcvd  = report.m_rx_packets - m_report.m_rx_packets;
+    int32_t first = report.m_rx_first - m_report.m_rx_first;
+    if( !m_has_report || rcvd < 0 || first < 0 ) {
+        m_report = report;
+        m_has_report = true;
+        return;
+    }
+    if( sent < LINK_REPORT_MIN_PACKETS ) {
+        return;
+    }
+    m_report = report;
+
+    uint32_t loss = rcvd < sent
+        ? (uint64_t) (sent - rcvd) * 1000000 / sent : 0;
+    uint32_t share = rcvd > 0
+        ? (uint64_t) std::min(first, rcvd) * 1000000 / rcvd : 0;
+    if( m_measured ) {
+        uint32_t old = m_loss_ppm.load(std::memory_order_relaxed);
+        loss = old - old / 4 + loss / 4;
+        old = m_first_ppm.load(std::memory_order_relaxed);
+        share = rcvd > 0 ? old - old / 4 + share / 4 : old;
+    }
+    m_loss_ppm.store( loss, std::memory_order_relaxed );
+    m_first_ppm.store( share, std::memory_order_relaxed );
+    m_measured = true;
 }
@@ -5,7 +5,10 @@
 #ifndef _LINK_HH_
 #define _LINK_HH_
 
+#include <atomic>
 #include <cstdint>
+#include <deque>
+#include <functional>
 #include <string>
 #include <unistd.h>
 #include <limits.h>
@@ -13,6 +16,8 @@
 #include <net/ethernet.h>
 
 #include "common.hh"
+#include "defragmenter.hh"
+#include "placement.hh"
 
 /**
  * Defintion of the Alagg protocol's ethernet type.
@@ -42,15 +47,199 @@ typedef uint16_t alagg_seq_t;
  */
 #define ALAGG_REORDER_TTL 50
 
+/**
+ * Size of the CRC32C trailer of frames, see Link::SetChecksum().
+ */
+#define ALAGG_CHECKSUM_LEN 4
+
+/**
+ * Minimum size of the trailer of frames, the CRC32C and the size of the
+ * padding preceding it.
+ */
+#define ALAGG_TRAILER_MIN (ALAGG_CHECKSUM_LEN + 1)
+
+/**
+ * Maximum size of the trailer of frames, padding short frames to the minimum
+ * ethernet frame size before the CRC32C.
+ */
+#define ALAGG_TRAILER_MAX (ETH_ZLEN + ALAGG_CHECKSUM_LEN)
+
+/**
+ * Size of the Link sockets' receive buffers in bytes.
+ *
+ * Fragmented packets arrive in bursts of up to MAX_PKT_SIZE, which must fit
+ * into the socket buffer, even on links with large MTUs.
+ */
+#define LINK_RCVBUF_SIZE (4 * 1024 * 1024)
+
+/**
+ * Maximum number of frames queued on a Link while its socket buffer is full.
+ */
+#define LINK_TX_QUEUE_LEN 512
+
+/**
+ * Number of frames queued on a Link from which on it counts as congested.
+ *
+ * Leaves room for the fragments of a packet of MAX_PKT_SIZE.
+ */
+#define LINK_TX_QUEUE_HIGH (LINK_TX_QUEUE_LEN * 3 / 4)
+
+/**
+ * Time worth of frames a paced Link sends at once without SO_TXTIME, in
+ * nanoseconds.
+ */
+#define LINK_PACING_BURST_NSEC 1000000
+
+/**
+ * Bytes per frame on the wire beyond the frame itself: preamble, frame check
+ * sequence and interframe gap.
+ */
+#define LINK_WIRE_OVERHEAD 24
+
+/**
+ * Priority of frames sent on the Links' priority sockets.
+ *
+ * Corresponds to TC_PRIO_INTERACTIVE, which priority-aware queueing
+ * disciplines such as pfifo_fast or prio serve first.
+ */
+#define LINK_TX_PRIORITY 6
+
+/**
+ * Socket options for busy polling, missing in older C library headers.
+ */
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
+/**
+ * Highest tunnel id carried in the AlaggHeader.
+ */
+#define ALAGG_MAX_TUNNEL UINT8_MAX
+
+/**
+ * Highest traffic class id carried in the AlaggHeader. Class 0 is the tunnel's
+ * default class.
+ */
+#define ALAGG_MAX_CLASS 31
+
+/**
+ * Alagg header flag indicating that further fragments of the packet follow.
+ */
+#define ALAGG_FLAG_MF 0x01
+
+/**
+ * Alagg header flag indicating that the packet bypasses reordering.
+ *
+ * Such packets are numbered in a sequence space of their own, are never
+ * fragmented, and are delivered as soon as they are received.
+ */
+#define ALAGG_FLAG_UNORDERED 0x02
+
+/**
+ * Alagg header flag indicating a probe, carrying an AlaggProbe.
+ *
+ * Probes are no packets of the tunnel. They are echoed by the remote
+ * aggregator on the Link they were received on, to measure the Link's delay.
+ */
+#define ALAGG_FLAG_PROBE 0x04
+
+/**
+ * Alagg header flag indicating a report, carrying an AlaggReport.
+ *
+ * Reports are no packets of the tunnel. Requests are sent in line with the
+ * Link's frames, and answered by the remote aggregator with the number of
+ * packets received on the Link before the request, to measure the Link's
+ * loss.
+ */
+#define ALAGG_FLAG_REPORT 0x08
+
+/**
+ * Alagg header flag indicating a negative acknowledgement, carrying an
+ * AlaggNack.
+ *
+ * NACKs are no packets of the tunnel. They report packets of the traffic class
+ * in the header missing at the receiving aggregator, which are sent again if
+ * still buffered, see RetransmitBuffer.
+ */
+#define ALAGG_FLAG_NACK 0x10
+
+/**
+ * Alagg header flag indicating a packet compressed into an LZ4 block.
+ *
+ * Set on all fragments of the packet. The packet is decompressed after
+ * reassembly.
+ */
+#define ALAGG_FLAG_COMPRESSED 0x20
+
+/**
+ * Alagg header flag indicating a session handshake, carrying an AlaggSync.
+ *
+ * Handshakes are no packets of the tunnel. Every aggregator numbers its
+ * packets from 1 in a new session, told apart by the epoch in the header.
+ * Packets of another epoch than the remote aggregator's known one are dropped,
+ * and make the aggregator request the remote aggregator's session with a
+ * fresh random challenge. The remote aggregator answers at once, echoing the
+ * challenge along with its epoch and next sequence numbers. Only an answer
+ * echoing the pending challenge switches to the remote aggregator's session,
+ * so replayed frames of old sessions cannot.
+ */
+#define ALAGG_FLAG_SYNC 0x40
+
+/**
+ * Number of consecutive sequence numbers a NACK reports at most.
+ */
+#define ALAGG_NACK_SPAN 64
+
+/**
+ * Number of packets that must arrive after a missing packet before it is
+ * reported, so packets merely reordered by the Links are rarely retransmitted.
+ */
+#define ALAGG_NACK_REORDER 3
+
+/**
+ * Minimum number of packets a Link's loss and first arrivals are measured
+ * over, see Link::OnReport().
+ */
+#define LINK_REPORT_MIN_PACKETS 16
+
+/**
+ * Interval of probes sent on every Link in milliseconds.
+ */
+#define LINK_PROBE_INTERVAL_MSEC 100
+
+/**
+ * Interval of session handshake requests in milliseconds, repeated until
+ * answered.
+ */
+#define LINK_SYNC_INTERVAL_MSEC 100
+
+/**
+ * Line rate assumed for Links whose interface does not report its speed, in
+ * Mbit/s.
+ */
+#define LINK_DEFAULT_SPEED 1000
+
 /**
  * ALAGG Header definition
  *
- * The header consists of the standard ethernet header plus a packet sequence
- * number.
+ * The header consists of the standard ethernet header plus the id of the
+ * tunnel the packet belongs to, a packet sequence number within the tunnel's
+ * traffic class, flags, the offset of the carried fragment within the original
+ * packet, the id of the traffic class and the epoch of the sender's session,
+ * see ALAGG_FLAG_SYNC. Unfragmented packets have a fragment offset of 0 and no
+ * ALAGG_FLAG_MF flag set.
  */
 struct __attribute__ ((__packed__)) AlaggHeader {
     struct ether_header m_eth_header;
+    uint8_t     m_tunnel;
     alagg_seq_t m_seq;
+    uint8_t     m_flags;
+    uint16_t    m_frag_off;
+    uint8_t     m_class;
+    uint16_t    m_epoch;
 };
 
 /**
@@ -63,37 +252,216 @@ struct __attribute__ ((__packed__)) AlaggPacket {
     char m_payload[0];
 };
 
+/**
+ * ALAGG Probe definition
+ *
+ * Payload of a probe frame, see ALAGG_FLAG_PROBE.
+ */
+struct __attribute__ ((__packed__)) AlaggProbe {
+    // Time the probe was sent at, on the sender's CLOCK_MONOTONIC
+    uint64_t    m_tx_nsec;
+    // 0 for a probe, 1 for its echo
+    uint8_t     m_echo;
+};
+
+/**
+ * ALAGG Report definition
+ *
+ * Payload of a report frame, see ALAGG_FLAG_REPORT. The counters wrap around.
+ */
+struct __attribute__ ((__packed__)) AlaggReport {
+    // Packets the requesting side sent on the Link before the request
+    uint32_t    m_tx_packets;
+    // Packets the answering side received on the Link, and how many of them
+    // arrived before their copies on other Links
+    uint32_t    m_rx_packets;
+    uint32_t    m_rx_first;
+    // 0 for a request, 1 for its answer
+    uint8_t     m_echo;
+};
+
+/**
+ * ALAGG NACK definition
+ *
+ * Payload of a NACK frame, see ALAGG_FLAG_NACK.
+ */
+struct __attribute__ ((__packed__)) AlaggNack {
+    // First sequence number reported
+    alagg_seq_t m_first;
+    // Bitmap of the missing packets, bit i reporting m_first + i
+    uint64_t    m_missing;
+};
+
+/**
+ * Maximum size of the payload of probe, report and NACK frames.
+ */
+#define ALAGG_CONTROL_MAX 32
+
+/**
+ * ALAGG Sync definition
+ *
+ * Payload of a session handshake frame, see ALAGG_FLAG_SYNC. Only the
+ * sequence numbers given are sent, classes beyond them start at 1.
+ */
+struct __attribute__ ((__packed__)) AlaggSync {
+    // Challenge of the sender's request for the receiver's session, 0 if the
+    // sender knows it
+    uint64_t    m_challenge;
+    // Challenge of the receiver's request answered, 0 if none
+    uint64_t    m_echo;
+    // Number of sequence numbers following
+    uint8_t     m_count;
+    // Next sequence number of the unordered packets, then of every traffic
+    // class by id, starting with the default class 0
+    alagg_seq_t m_seqs[ALAGG_MAX_CLASS + 2];
+};
+
+class Cipher;
+
 /**
  * Link class
  *
  * Class to manage communication on aggregated links. The communication takes
  * place in the data link layer, and link sockets are bound to specific
  * interfaces.
+ *
+ * Frames are received and transmitted through a raw AF_PACKET socket.
+ * Subclasses may add a path bypassing the kernel's network stack, see
+ * Link::BypassFd(). The AF_PACKET socket is kept open in that case, receiving
+ * the frames not taken by the bypass.
  */
 class Link {
 
+    public:
+
+    /**
+     * Handler of received frames. Called with a pointer to the frame and its
+     * size. The frame is only valid during the call.
+     */
+    typedef std::function<void(unsigned char const *, int)> FrameHandler;
+
+    protected:
+
     // Socket fd
     int         m_socket;
+    // Transmit-only socket for frames sent with LINK_TX_PRIORITY
+    int         m_prio_socket;
+    // Index of the interface
+    int         m_if_index;
     // Peer's MAC address
     MacAddress  m_peer_addr;
     // Local MAC address
     MacAddress  m_own_addr;
     // Name of the interface, e.g. eth0
     std::string m_if_name;
+    // Link layer MTU in bytes
+    int         m_mtu;
+    // NUMA node of the interface's device
+    int         m_numa_node;
+    // Reassembly of fragmented packets received on this link
+    Defragmenter m_defrag;
+    // Reception buffer of the socket, on the interface's NUMA node
+    unsigned char *m_rx_buf;
+    int         m_rx_buf_size;
+    // Number of duplicate frames received
+    std::atomic<uint64_t> m_duplicates;
+    // Whether frames carry a CRC32C trailer, and the number of corrupt frames
+    // received
+    bool        m_checksum;
+    std::atomic<uint64_t> m_corrupt;
+    // Frames waiting for the socket buffer, oldest first, and their size
+    std::deque<Buffer *> m_tx_queue;
+    int         m_tx_queued_bytes;
+    // Number of frames dropped on transmission
+    uint64_t    m_tx_drops;
+    // Whether packets are compressed, and the number of packets sent
+    // compressed
+    bool        m_compress;
+    uint64_t    m_tx_compressed;
+    // Pacing rate in bit/s, 0 if unpaced
+    uint64_t    m_rate_bps;
+    // Whether the kernel paces the frames, using SO_TXTIME
+    bool        m_txtime;
+    // Departure time of the next frame, on CLOCK_MONOTONIC
+    uint64_t    m_next_tx_nsec;
+    // Speed of the interface in bit/s
+    uint64_t    m_speed_bps;
+    // Time the frames scheduled so far are expected to be transmitted at
+    uint64_t    m_busy_nsec;
+    // Smoothed one-way delay measured by probes, 0 if not measured yet
+    std::atomic<uint64_t> m_owd_nsec;
+    // Packets sent, and packets received and received first, on the Link
+    uint32_t    m_tx_packets;
+    uint32_t    m_rx_packets;
+    uint32_t    m_rx_first;
+    // Last answer to a report request the measurement started from
+    AlaggReport m_report;
+    bool        m_has_report;
+    bool        m_measured;
+    // Smoothed loss and share of first arrivals, in parts per million
+    std::atomic<uint32_t> m_loss_ppm;
+    std::atomic<uint32_t> m_first_ppm;
+    // Position in the order of Links the packets' copies are sent on
+    int         m_rank;
+    // Bitmap of the ids of the traffic classes carried
+    uint32_t    m_classes;
+    // Whether the interface is up and has carrier
+    std::atomic<bool> m_up;
+    // Id of the tunnel carried
+    uint8_t     m_tunnel;
+    // Header of transmitted frames, on its own cache line
+    AlaggHeader *m_tx_header;
+    // Sealing of probes and reports, nullptr if they are sent in the clear
+    Cipher      *m_cipher;
+
+    void AttachFilter();
+    uint64_t Pace( int size, uint64_t now );
+    int SendTo( int sock, AlaggHeader const & header,
+                void const * payload, int len, uint64_t txtime );
+
+    /**
+     * Get the time a frame occupies the Link.
+     *
+     * @param size Size of the frame.
+     * @returns The transmission time in nanoseconds at Link::LineRate(),
+     * including LINK_WIRE_OVERHEAD.
+     */
+    uint64_t const TxNsec( int size ) const {
+        return (uint64_t) (size + LINK_WIRE_OVERHEAD) * 8 * 1000000000
+            / LineRate();
+    }
 
     public:
 
+    /**
+     * Get the line rate used to estimate transmission times.
+     * @returns The pacing rate if paced, the interface's speed otherwise, in
+     * bit/s.
+     */
+    uint64_t const LineRate() const {
+        return m_rate_bps ? m_rate_bps : m_speed_bps;
+    }
+
     Link( std::string const ifname,
-       std::string const mac_addr_str );
+       std::string const mac_addr_str,
+       int const mtu = 0,
+       int const tunnel = 0 );
 
     /**
      * Link class deconstructor
      *
-     * Closes the associated socket.
+     * Closes the associated socket and releases the reception buffer and
+     * the frames still queued for transmission.
      */
-    ~Link() {
+    virtual ~Link() {
+        for( int i = 0; i < m_tx_queue.size(); i++ ) {
+            delete m_tx_queue[i];
+        }
         close(m_socket);
+        close(m_prio_socket);
         m_socket = 0;
+        numa_free(m_rx_buf, m_rx_buf_size);
+        free(m_tx_header);
     }
 
     /**
@@ -102,6 +470,17 @@ class Link {
      */
     int const Socket() const { return m_socket; }
 
+    /**
+     * Getter for the priority socket.
+     *
+     * Frames sent on this socket are queued with LINK_TX_PRIORITY, ahead of
+     * the frames sent on the regular socket by priority-aware queueing
+     * disciplines. The socket does not receive.
+     *
+     * @returns The priority socket's file descriptor.
+     */
+    int const PrioSocket() const { return m_prio_socket; }
+
     /**
      * Getter for the peer's MAC address.
      * @returns MacAddress object.
@@ -119,6 +498,333 @@ class Link {
      * @returns String containing the interfaces name.
      */
     std::string const IfName() const { return m_if_name; }
+
+    /**
+     * Getter for the id of the tunnel carried.
+     * @returns The tunnel id.
+     */
+    int const Tunnel() const { return m_tunnel; }
+
+    /**
+     * Getter for the header template of transmitted frames.
+     *
+     * The ethernet addresses, type, tunnel id and epoch are filled in, the
+     * sequence number, flags and fragment offset are left to the sender.
+     *
+     * @returns The header template.
+     */
+    AlaggHeader const & TxHeader() const { return *m_tx_header; }
+
+    /**
+     * Getter for the index of the interface bound to.
+     * @returns The interface index.
+     */
+    int const IfIndex() const { return m_if_index; }
+
+    /**
+     * Check whether the link is usable.
+     * @returns True if the interface is up and has carrier, false otherwise.
+     */
+    bool const Up() const { return m_up.load(std::memory_order_relaxed); }
+
+    /**
+     * Set whether the link is usable, e.g. on carrier changes.
+     * @param up True if the interface is up and has carrier.
+     */
+    void SetUp( bool up ) { m_up.store(up, std::memory_order_relaxed); }
+
+    bool ReadCarrier();
+
+    /**
+     * Getter for the link's MTU.
+     * @returns The MTU in bytes.
+     */
+    int const Mtu() const { return m_mtu; }
+
+    /**
+     * Getter for the NUMA node of the link's interface.
+     * @returns The NUMA node, or NUMA_NODE_ANY if unknown.
+     */
+    int const NumaNode() const { return m_numa_node; }
+
+    /**
+     * Getter for the maximum frame size on this link.
+     * @returns Size of the largest frame, including the ethernet header.
+     */
+    int const MaxFrameSize() const {
+        return m_mtu + sizeof(struct ether_header);
+    }
+
+    /**
+     * Getter for the maximum payload carried by a single frame.
+     *
+     * Packets exceeding this size are fragmented before transmission.
+     *
+     * @returns Payload size in bytes.
+     */
+    int const MaxPayload() const {
+        return MaxFrameSize() - sizeof(AlaggHeader)
+            - (m_checksum ? ALAGG_TRAILER_MIN : 0);
+    }
+
+    /**
+     * Getter for the link's Defragmenter.
+     * @returns Reference to the Defragmenter.
+     */
+    Defragmenter & Defrag() { return m_defrag; }
+
+    /**
+     * Count a duplicate frame received on this link.
+     */
+    void CountDuplicate() {
+        m_duplicates.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Getter for the number of duplicate frames received on this link.
+     * @returns The number of duplicates.
+     */
+    uint64_t const Duplicates() const {
+        return m_duplicates.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Enable the CRC32C trailer of frames.
+     *
+     * Frames sent carry a CRC32C of the frame after the ethernet header, and
+     * frames received without a valid one are dropped, see Link::Verify().
+     * Must be set before transmission and reception start.
+     *
+     * @param enable Whether frames carry a trailer.
+     */
+    void SetChecksum( bool enable ) { m_checksum = enable; }
+
+    /**
+     * Set the epoch of the session frames are sent in.
+     *
+     * Must be set before transmission starts.
+     *
+     * @param epoch Epoch carried in the header template, see
+     * ALAGG_FLAG_SYNC.
+     */
+    void SetEpoch( uint16_t epoch ) { m_tx_header->m_epoch = epoch; }
+
+    /**
+     * Set the Cipher sealing probes, reports and NACKs, see
+     * Link::SealControl().
+     *
+     * Must be set before transmission starts.
+     *
+     * @param cipher The Tunnel's Cipher of control frames, see
+     * Tunnel::ControlEncryption(), or nullptr to send them in the clear.
+     */
+    void SetCipher( Cipher * cipher ) { m_cipher = cipher; }
+
+    /**
+     * Getter for the number of corrupt frames received on this link.
+     * @returns The number of frames dropped for a CRC32C mismatch, or
+     * packets failing authentication, see Cipher::Open().
+     */
+    uint64_t const Corrupt() const {
+        return m_corrupt.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Count a corrupt or forged frame received on this link.
+     */
+    void CountCorrupt() {
+        m_corrupt.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    int Trailer( AlaggHeader const & header, void const * payload, int len,
+                 unsigned char * trailer ) const;
+    int Verify( unsigned char const * frame, int len );
+
+    /**
+     * Getter for the number of frames queued for transmission.
+     * @returns The number of frames waiting for the socket buffer.
+     */
+    int const TxQueued() const { return m_tx_queue.size(); }
+
+    /**
+     * Getter for the number of frames dropped on transmission.
+     * @returns The number of frames dropped, by a full queue or by the
+     * kernel.
+     */
+    uint64_t const TxDrops() const { return m_tx_drops; }
+
+    /**
+     * Enable compression if the Link is slow.
+     *
+     * @param threshold_bps Packets are compressed if the Link's line rate is
+     * below this rate in bit/s, see Link::LineRate(). 0 disables compression.
+     */
+    void SetCompression( uint64_t threshold_bps ) {
+        m_compress = LineRate() < threshold_bps;
+    }
+
+    /**
+     * Check whether packets are compressed before they are sent on the Link.
+     * @returns True if compression is enabled, false otherwise.
+     */
+    bool const Compresses() const { return m_compress; }
+
+    /**
+     * Count a packet sent compressed.
+     */
+    void CountCompressed() { m_tx_compressed++; }
+
+    /**
+     * Getter for the number of packets sent compressed.
+     * @returns The number of packets.
+     */
+    uint64_t const TxCompressed() const { return m_tx_compressed; }
+
+    /**
+     * Check whether the Link is paced.
+     * @returns True if a rate is set, false otherwise.
+     */
+    bool const Paced() const { return m_rate_bps != 0; }
+
+    /**
+     * Getter for the pacing rate.
+     * @returns The rate in Mbit/s, 0 if unpaced.
+     */
+    int const Rate() const { return m_rate_bps / 1000000; }
+
+    /**
+     * Check whether the kernel paces the Link.
+     * @returns True if frames carry an SO_TXTIME departure time, false if
+     * they are paced by the transmit queue.
+     */
+    bool const TxTime() const { return m_txtime; }
+
+    /**
+     * Getter for the measured one-way delay.
+     * @returns Half the smoothed round trip time of probes in nanoseconds, 0
+     * if not measured yet.
+     */
+    uint64_t const OneWayDelay() const {
+        return m_owd_nsec.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Count a packet sent on the Link.
+     */
+    void CountTx() { m_tx_packets++; }
+
+    /**
+     * Count a complete packet received on the Link.
+     *
+     * @param first Whether the packet arrived before its copies on other
+     * Links, rather than being a duplicate.
+     */
+    void CountRx( bool first ) {
+        m_rx_packets++;
+        if( first ) {
+            m_rx_first++;
+        }
+    }
+
+    /**
+     * Getter for the number of packets sent on the Link.
+     * @returns The number of packets, wrapping around.
+     */
+    uint32_t const TxPackets() const { return m_tx_packets; }
+
+    /**
+     * Getter for the measured loss.
+     * @returns The smoothed share of packets sent on the Link that were not
+     * received, 1 if not measured yet.
+     */
+    double const Loss() const {
+        return m_loss_ppm.load(std::memory_order_relaxed) / 1e6;
+    }
+
+    /**
+     * Getter for the measured share of first arrivals.
+     * @returns The smoothed share of packets received on the Link that
+     * arrived before their copies on other Links, 0 if not measured yet.
+     */
+    double const FirstShare() const {
+        return m_first_ppm.load(std::memory_order_relaxed) / 1e6;
+    }
+
+    /**
+     * Getter for the Link's position in the order of Links the copies of
+     * packets are sent on.
+     * @returns The rank, 0 for the Link sent on first.
+     */
+    int const Rank() const { return m_rank; }
+
+    /**
+     * Setter for the Link's position in the order of Links the copies of
+     * packets are sent on.
+     * @param rank The rank, 0 for the Link sent on first.
+     */
+    void SetRank( int rank ) { m_rank = rank; }
+
+    /**
+     * Check whether the Link carries a traffic class.
+     * @param cls Id of the class.
+     * @returns True if packets of the class may be sent on the Link, false
+     * otherwise. The default class 0 is carried by all Links.
+     */
+    bool const Carries( int cls ) const {
+        return m_classes & ((uint32_t) 1 << cls);
+    }
+
+    /**
+     * Setter for the traffic classes carried.
+     * @param classes Bitmap of the ids of the classes. The default class 0 is
+     * always carried.
+     */
+    void SetClasses( uint32_t classes ) { m_classes = classes | 1; }
+
+    bool SetRate( int mbps, bool txtime );
+    uint64_t const ExpectedArrival( int size, uint64_t now ) const;
+    void Schedule( int size, uint64_t now );
+    void SendProbe();
+    int SealControl( AlaggHeader const & header, void const * payload,
+                     int len, unsigned char * out );
+    void OnProbe( unsigned char const * frame, int len );
+    void OnReport( unsigned char const * frame, int len );
+    uint64_t const PacedUntil() const;
+    bool SetBusyPoll( int usec, int budget );
+    void SetRxBufSize( int size );
+    int RecvSocket( int budget, FrameHandler const & handler );
+
+    /**
+     * Getter for the file descriptor of the kernel bypass.
+     *
+     * The file descriptor becomes readable when frames can be received using
+     * Link::RecvFrames().
+     *
+     * @returns The file descriptor, or -1 if frames are only received through
+     * the socket.
+     */
+    virtual int const BypassFd() const { return -1; }
+
+    /**
+     * Receive frames through the kernel bypass.
+     *
+     * @param budget Maximum number of frames to be received.
+     * @param handler Handler called for every frame.
+     * @returns The number of frames received.
+     */
+    virtual int RecvFrames( int budget, FrameHandler const & handler ) {
+        return 0;
+    }
+
+    virtual int SendFrame( AlaggHeader const & header,
+                           void const * payload, int len );
+    int SendPrioFrame( AlaggHeader const & header,
+                       void const * payload, int len );
+    int SendControlFrame( AlaggHeader const & header,
+                          void const * payload, int len );
+    bool QueueFrame( AlaggHeader const & header,
+                     void const * payload, int len );
+    bool FlushTxQueue();
 };
 
 #endif /* _LINK_HH_ */
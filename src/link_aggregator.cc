@@ -4,15 +4,42 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <limits.h>
+#include <algorithm>
+
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 
 #include "link_aggregator.hh"
 
+/**
+ * Take over SIGHUP.
+ *
+ * The signal is blocked, so threads spawned afterwards inherit the blocked
+ * signal, and is received through a signalfd instead.
+ *
+ * @returns The signalfd's file descriptor.
+ */
+static int open_reload_fd() {
+
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+
+    errno = 0;
+    int fd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+    assert_perror(errno);
+    return fd;
+}
+
 /**
  * LinkAggregator class constructor
  *
  * Constructs a new LinkAggregator object. Constructs the corresponding Client
- * and LinkManager classes, and collects the file descriptors necessary to
- * perform asynchronous I/O via poll().
+ * and LinkManager classes, and registers the file descriptors necessary to
+ * perform asynchronous I/O with the Reactor. SIGHUP is blocked in all threads
+ * and handled by the main loop, see LinkAggregator::OnReload().
  *
  * @param config_filename Name of the configuration file to be used. If argument
  * is not given "default_config.cfg" is used.
@@ -21,65 +48,484 @@
  * @see LinkManager
  */
 LinkAggregator::LinkAggregator( const std::string config_filename )
-        : m_config(config_filename)
-        , m_link_manager(m_config.PeerAddresses(), m_config.IfNames())
-        , m_nfds(2) {
+        : m_reload_fd(open_reload_fd())
+        , m_config_filename(config_filename)
+        , m_config(config_filename)
+        , m_link_manager(m_config.Tunnels(), false)
+        , m_engine(nullptr)
+        , m_rx_batch(std::min(m_config.ClientTxBatch(), CLIENT_TX_BATCH_MAX))
+        , m_gro(nullptr)
+        , m_gro_timer_fd(-1)
+        , m_gro_timer_armed(false)
+        , m_stats_fd(-1)
+        , m_tx_blocked(false) {
+
+    // Thread placement
+    set_thread_name(pthread_self(), "alagg-main");
+    set_thread_affinity(pthread_self(), m_config.CpusMain());
+    Timer::SetAffinity(m_config.CpusTimers());
+
+    // Overload
+    BufferBudget::SetLimit((int64_t) m_config.BufferBudgetMb() << 20);
+    if(m_config.RxDropOldest()) {
+        m_link_manager.SetRxQueuePolicy(LinkManager::drop_oldest);
+    }
+
+    if(m_config.BusyPollUsec() > 0) {
+        m_link_manager.SetBusyPoll(m_config.BusyPollUsec());
+        m_reactor.SetSpin(m_config.BusyPollUsec());
+    }
+
+    m_link_manager.SetPacing(m_config.PacingTxTime());
+    if(m_config.Scheduler() == "ect") {
+        m_link_manager.SetScheduler(SCHEDULER_ECT);
+    } else if(m_config.Scheduler() == "adaptive") {
+        m_link_manager.SetRedundancyTarget(m_config.RedundancyTarget());
+        m_link_manager.SetScheduler(SCHEDULER_ADAPTIVE);
+    }
+    m_link_manager.SetAckPriority(m_config.AckPriority());
+    m_link_manager.SetAckThinning(m_config.AckThinning());
+    m_link_manager.SetArq(m_config.Arq());
+    m_link_manager.SetChecksum(m_config.Checksum());
+    m_link_manager.SetCompression(m_config.CompressionMbps());
 
-    m_pfds[0].fd = m_link_manager.PipeRxFd();
-    m_pfds[1].fd = m_client.RxFd();
-    m_pfds[0].events = LAGG_POLL_EVENTS;
-    m_pfds[1].events = LAGG_POLL_EVENTS;
+    if(m_config.GroEnabled()) {
+        SetupGro();
+    }
+
+    if(m_config.IoEngine() == "uring") {
+        SetupEngine();
+    }
+
+    if(!m_engine) {
+        m_link_manager.StartRecvThread(m_config.CpusLinkRx());
+        m_reactor.Add(m_client.RxFd(), EPOLLIN, [this](uint32_t) {
+            OnClientReadable();
+        });
+        m_reactor.Add(m_link_manager.PipeRxFd(), EPOLLIN, [this](uint32_t) {
+            OnLinksReadable();
+        });
+        m_reactor.Add(m_link_manager.TxFd(), EPOLLIN, [this](uint32_t) {
+            OnLinksWritable();
+        });
+        m_reactor.Add(m_reload_fd, EPOLLIN, [this](uint32_t) {
+            OnReload();
+        });
+        if(m_gro_timer_fd >= 0) {
+            m_reactor.Add(m_gro_timer_fd, EPOLLIN, [this](uint32_t) {
+                OnGroTimer();
+            });
+        }
+        if(m_config.StatsInterval() > 0) {
+            m_reactor.AddTimer(m_config.StatsInterval() * 1000, [this]() {
+                PrintStats();
+            });
+        }
+    }
 
     // Print config
     PrintConfig();
 }
 
+/**
+ * LinkAggregator class destructor
+ *
+ * Releases the UringEngine and the Gro, if any.
+ */
+LinkAggregator::~LinkAggregator() {
+    delete m_engine;
+    delete m_gro;
+    if(m_gro_timer_fd >= 0) {
+        close(m_gro_timer_fd);
+    }
+    if(m_stats_fd >= 0) {
+        close(m_stats_fd);
+    }
+    close(m_reload_fd);
+}
+
+/**
+ * Set up the UringEngine.
+ *
+ * Multishot receives are kept outstanding on the Client's netfilter socket and
+ * on the Links, and their completions are fed to the transmission and
+ * reception chains. The LinkManager's pipe is still watched, since Timers
+ * flush packets from their own threads.
+ * If io_uring is not available, the epoll based data path is used instead.
+ *
+ * @see UringEngine
+ */
+void LinkAggregator::SetupEngine() {
+
+    int tx_slot_size = 0;
+    auto links = m_link_manager.Links();
+    for( int i = 0; i < links.size(); i++ ) {
+        tx_slot_size = std::max(tx_slot_size, links[i]->MaxFrameSize());
+    }
+
+    m_engine = new UringEngine(tx_slot_size);
+    if(!m_engine->Ok()) {
+        std::cerr << "WARNING: io_uring not available, using epoll"
+            << std::endl;
+        delete m_engine;
+        m_engine = nullptr;
+        return;
+    }
+
+    // Links
+    m_link_manager.UseEngine(m_engine, [this](Buffer * buf) {
+        if(m_gro) {
+            m_gro->Add(buf);
+            return;
+        }
+        SendPktToClient(buf);
+        delete buf;
+    });
+
+    // Segments received by a batch of completions are merged, then delivered,
+    // and ACKs held while sending the batch are sent
+    m_engine->SetFlushHandler([this]() {
+        if(m_gro) {
+            m_gro->Flush(false);
+            DeliverGro();
+        }
+        m_link_manager.FlushAcks();
+    });
+    if(m_gro) {
+        if(m_gro_timer_fd >= 0) {
+            m_engine->AddPoll(m_gro_timer_fd, [this]() {
+                OnGroTimer();
+            });
+        }
+    }
+
+    // Client
+    int group = m_engine->AddBufferGroup(CLIENT_URING_BUFS, BUF_SIZE);
+    m_engine->AddRecv(m_client.RxFd(), group,
+            [this](unsigned char * msg, int len) {
+                unsigned char *pkt;
+                int pkt_len = m_client.HandleMessage((char *) msg, len, &pkt);
+                if(pkt_len > 0) {
+                    m_link_manager.Send(pkt, pkt_len, m_client.PacketMark());
+                }
+            });
+
+    // Packets flushed by Timers
+    m_engine->AddPoll(m_link_manager.PipeRxFd(), [this]() {
+        while(DeliverBatch() > 0);
+    });
+
+    // Frames queued on congested Links
+    m_engine->AddPoll(m_link_manager.TxFd(), [this]() {
+        m_link_manager.OnTxReady();
+    });
+
+    m_engine->AddPoll(m_reload_fd, [this]() {
+        OnReload();
+    });
+
+    // Statistics, timed by a timerfd in lack of the Reactor's timers
+    if(m_config.StatsInterval() > 0) {
+        errno = 0;
+        m_stats_fd = timerfd_create(CLOCK_MONOTONIC,
+                                    TFD_NONBLOCK | TFD_CLOEXEC);
+        assert_perror(errno);
+        struct itimerspec its;
+        its.it_value.tv_sec = m_config.StatsInterval();
+        its.it_value.tv_nsec = 0;
+        its.it_interval = its.it_value;
+        timerfd_settime(m_stats_fd, 0, &its, nullptr);
+        assert_perror(errno);
+        m_engine->AddPoll(m_stats_fd, [this]() {
+            uint64_t expirations;
+            if(read(m_stats_fd, &expirations, sizeof(expirations)) > 0) {
+                PrintStats();
+            }
+        });
+    }
+}
+
+/**
+ * Set up the receive offload stage.
+ *
+ * The Client is switched to prefixing packets with a VnetPrefix, so merged
+ * super-packets can be delivered as GSO packets. If segments may be held
+ * beyond a batch, a timer flushes them after gro_flush_usec.
+ * If the kernel does not support PACKET_VNET_HDR, packets are delivered
+ * unmerged.
+ *
+ * @see Gro
+ */
+void LinkAggregator::SetupGro() {
+
+    if(!m_client.EnableVnetHdr()) {
+        std::cerr << "WARNING: PACKET_VNET_HDR not supported, gro disabled"
+            << std::endl;
+        return;
+    }
+
+    m_gro = new Gro(m_config.GroFlushUsec());
+
+    if(m_config.GroFlushUsec() > 0) {
+        errno = 0;
+        m_gro_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                        TFD_NONBLOCK | TFD_CLOEXEC);
+        assert_perror(errno);
+    }
+}
+
+/**
+ * Reload the configuration on SIGHUP.
+ *
+ * Only the Link parameters of the existing tunnels are applied, i.e. Links are
+ * added and removed according to link_peers, link_if_names, link_mtus,
+ * link_backends and link_queues. An invalid configuration file is reported and
+ * ignored.
+ *
+ * @see LinkManager::Reconfigure()
+ */
+void LinkAggregator::OnReload() {
+
+    struct signalfd_siginfo info;
+    bool reload = false;
+    while( read(m_reload_fd, &info, sizeof(info)) == sizeof(info) ) {
+        reload = true;
+    }
+    errno = 0;
+    if( !reload ) {
+        return;
+    }
+
+    Config config(m_config_filename, false);
+    if( !config.Ok() ) {
+        std::cerr << "WARNING: Invalid configuration, links unchanged"
+            << std::endl;
+        return;
+    }
+
+    std::cout << "Reloading links" << std::endl;
+    m_link_manager.Reconfigure(config.Tunnels());
+}
+
 /**
  * Perform link aggregation.
  *
- * Starts the aggregation loop. In every iteration, it is poll()'d for reception
- * from the Client and the LinkManager, and the corresponding event is handled.
+ * Starts the aggregation loop. In every iteration, the Reactor waits for
+ * reception from the Client and the LinkManager, and dispatches the
+ * corresponding events.
+ * If a UringEngine is used, the engine is run instead.
  *
  * @see Client
  * @see LinkManager
+ * @see Reactor
+ * @see UringEngine
  */
 void LinkAggregator::Aggregate() {
 
+    if(m_engine) {
+        m_engine->Run();
+        return;
+    }
+
     for(;;) {
+        m_reactor.Poll(-1);
+    }
+}
+
+/**
+ * Handle reception from the Client.
+ *
+ * The netfilter queue's socket is registered edge-triggered, so packets are
+ * received until no more data is available. After LAGG_BUDGET packets, the
+ * socket is handed back to the Reactor to serve the LinkManager in between.
+ * Either way, ACKs held back for thinning are sent at the end of the burst.
+ *
+ * Reception pauses while the Links are congested, leaving packets queued in
+ * the netfilter queue, until LinkAggregator::OnLinksWritable() resumes it.
+ *
+ * @see LinkManager::FlushAcks()
+ * @see LinkManager::TxBlocked()
+ */
+void LinkAggregator::OnClientReadable() {
+
+    for( int n = 0; n < LAGG_BUDGET; n++ ) {
+        if( m_link_manager.TxBlocked() ) {
+            m_tx_blocked = true;
+            m_link_manager.FlushAcks();
+            return;
+        }
         errno = 0;
-        int nfds_rdy = poll(m_pfds, m_nfds, -1);
-        assert_perror(errno);
+        if( !TransmissionChain()
+                && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+            errno = 0;
+            m_link_manager.FlushAcks();
+            return;
+        }
+    }
 
-        if(m_pfds[1].revents & LAGG_POLL_EVENTS) {
-            TransmissionChain();
+    m_link_manager.FlushAcks();
+    m_reactor.Ready(m_client.RxFd());
+}
+
+/**
+ * Handle reception from the LinkManager.
+ *
+ * All packets ready in the LinkManager's queue are delivered in batches, see
+ * LinkAggregator::DeliverBatch(). After LAGG_BUDGET batches, the LinkManager's
+ * pipe is handed back to the Reactor to serve the Client in between.
+ */
+void LinkAggregator::OnLinksReadable() {
+
+    for( int n = 0; n < LAGG_BUDGET; n++ ) {
+        if( DeliverBatch() < m_rx_batch.size() ) {
+            return;
+        }
+    }
+
+    m_reactor.Ready(m_link_manager.PipeRxFd());
+}
+
+/**
+ * Handle writable Links.
+ *
+ * Frames queued on the Links are transmitted, and reception from the Client
+ * is resumed if it was paused and the Links are no longer congested.
+ *
+ * @see LinkManager::OnTxReady()
+ */
+void LinkAggregator::OnLinksWritable() {
+
+    m_link_manager.OnTxReady();
+
+    if( m_tx_blocked && !m_link_manager.TxBlocked() ) {
+        m_tx_blocked = false;
+        m_reactor.Ready(m_client.RxFd());
+    }
+}
+
+/**
+ * Deliver a batch of packets from the LinkManager to the Client.
+ *
+ * Up to client_tx_batch packets are taken from the LinkManager's queue at
+ * once, and sent by a single sendmmsg() call. With a UringEngine, they are
+ * queued to the engine instead, which submits them together. With a Gro, the
+ * batch is merged first.
+ *
+ * @returns The number of packets taken from the queue.
+ * @see Client::SendPkts()
+ */
+int LinkAggregator::DeliverBatch() {
+
+    int n = m_link_manager.Recv(m_rx_batch.data(), m_rx_batch.size());
+
+    if(m_gro) {
+        for( int i = 0; i < n; i++ ) {
+            m_gro->Add(m_rx_batch[i]);
         }
+        m_gro->Flush(false);
+        DeliverGro();
+        return n;
+    }
 
-        if(m_pfds[0].revents & LAGG_POLL_EVENTS) {
-            ReceptionChain();
+    if(m_engine) {
+        for( int i = 0; i < n; i++ ) {
+            SendPktToClient(m_rx_batch[i]);
         }
+    } else if(n > 0) {
+        m_client.SendPkts(m_rx_batch.data(), n);
+    }
+
+    for( int i = 0; i < n; i++ ) {
+        delete m_rx_batch[i];
     }
+    return n;
+}
+
+/**
+ * Deliver the packets output by the Gro to the Client.
+ *
+ * Super-packets are delivered along with their GSO segment size. If segments
+ * are still held afterwards, the flush timer is armed, unless it is already.
+ *
+ * @see Gro
+ */
+void LinkAggregator::DeliverGro() {
+
+    std::vector<Buffer *> const & out = m_gro->Out();
+    std::vector<uint16_t> const & gso_sizes = m_gro->OutGsoSizes();
+
+    if(m_engine) {
+        for( int i = 0; i < out.size(); i++ ) {
+            SendPktToClient(out[i], gso_sizes[i]);
+        }
+    } else {
+        for( int i = 0; i < out.size(); i += CLIENT_TX_BATCH_MAX ) {
+            int count = std::min((int) out.size() - i, CLIENT_TX_BATCH_MAX);
+            m_client.SendPkts(&out[i], count, &gso_sizes[i]);
+        }
+    }
+
+    for( int i = 0; i < out.size(); i++ ) {
+        delete out[i];
+    }
+    m_gro->ClearOut();
+
+    int usec = m_gro->NextTimeoutUsec();
+    if(m_gro_timer_fd >= 0 && usec >= 0 && !m_gro_timer_armed) {
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        usec = std::max(usec, 1);
+        its.it_value.tv_sec  = usec / 1000000;
+        its.it_value.tv_nsec = (usec % 1000000) * 1000;
+        timerfd_settime(m_gro_timer_fd, 0, &its, nullptr);
+        m_gro_timer_armed = true;
+    }
+}
+
+/**
+ * Flush the Gro's segments held for the flush timeout.
+ *
+ * The timer is armed for the oldest held flow, which may have been output in
+ * the meantime. Segments held for less than the timeout are kept, and the
+ * timer is armed again.
+ */
+void LinkAggregator::OnGroTimer() {
+
+    uint64_t expirations;
+    if( read(m_gro_timer_fd, &expirations, sizeof(expirations)) <= 0 ) {
+        errno = 0;
+        return;
+    }
+
+    m_gro_timer_armed = false;
+    m_gro->Flush(false);
+    DeliverGro();
 }
 
 /**
  * Transmission chain.
  *
  * Receives a packet from the Client class and hands it to the LinkManager
- * class.
+ * class. The packet is sent right from the netfilter queue's buffer, without
+ * being copied.
  *
+ * @returns True if a packet was received, false otherwise.
  * @see Client
  * @see LinkManager
  */
-void LinkAggregator::TransmissionChain() {
+bool LinkAggregator::TransmissionChain() {
 
-    Buffer const * buf;
+    unsigned char *pkt;
 
     // Receive from client
-    buf = RecvPktFromClient();
-    if(buf) {
+    int pkt_len = m_client.GetPacket(&pkt);
+    if(pkt_len > 0) {
         // Got packet, forward to links
-        SendOnLinks(buf);
-        delete buf;
+        m_link_manager.Send(pkt, pkt_len, m_client.PacketMark());
+        return true;
     }
+
+    return false;
 }
 
 /**
@@ -88,10 +534,11 @@ void LinkAggregator::TransmissionChain() {
  * Receives a packet from the LinkManager class and delivers it to the Client
  * class.
  *
+ * @returns True if a packet was received, false otherwise.
  * @see Client
  * @see LinkManager
  */
-void LinkAggregator::ReceptionChain() {
+bool LinkAggregator::ReceptionChain() {
 
     Buffer const * buf;
 
@@ -101,7 +548,10 @@ void LinkAggregator::ReceptionChain() {
         // Got packet, forward to client
         SendPktToClient(buf);
         delete buf;
+        return true;
     }
+
+    return false;
 }
 
 /**
@@ -123,35 +573,250 @@ Buffer const * LinkAggregator::RecvPktFromClient() {
  * Send a packet to the client via the Client class.
  *
  * @param buf A Buffer object containing the data to be sent.
+ * @param gso_size GSO segment size of a super-packet merged by the Gro, 0
+ * otherwise.
  * @returns The return value of the underlying send() call.
  * @see Client
  */
-int LinkAggregator::SendPktToClient( Buffer const * buf ) {
+int LinkAggregator::SendPktToClient( Buffer const * buf, uint16_t gso_size ) {
 
-    return m_client.SendPkt(buf);
+    if(m_engine && m_client.VnetHdrEnabled()) {
+        VnetPrefix prefix;
+        m_client.Prefix(buf, gso_size, prefix);
+        struct iovec iov[2];
+        iov[0].iov_base = &prefix;
+        iov[0].iov_len  = sizeof(prefix);
+        iov[1].iov_base = (void *) buf->data();
+        iov[1].iov_len  = buf->size();
+        return m_engine->Send(m_client.TxFd(), iov, 2);
+    }
+    if(m_engine) {
+        return m_engine->Send(m_client.TxFd(), buf->data(), buf->size());
+    }
+    return m_client.SendPkt(buf, gso_size);
 }
 
 /**
  * Print the applications configuration to stdout
  */
 void LinkAggregator::PrintConfig() const {
-    std::cout << "Proxying traffic destined for:\n";
-    std::cout << "    " << m_config.ClientIp().Str() << std::endl;
-    std::cout << "Link setup:\n";
+    std::cout << "I/O engine: " << (m_engine ? "uring" : "epoll") << std::endl;
+    std::cout << "Scheduler: " << m_config.Scheduler() << std::endl;
+    if(m_config.Scheduler() == "adaptive") {
+        std::cout << "Redundancy target: " << m_config.RedundancyTarget()
+            << std::endl;
+    }
+    if(m_config.BusyPollUsec() > 0) {
+        std::cout << "Busy polling: " << m_config.BusyPollUsec() << " usec"
+            << std::endl;
+    }
+    if(m_gro) {
+        std::cout << "Receive offload: flush after "
+            << m_config.GroFlushUsec() << " usec" << std::endl;
+    }
+    if(m_config.AckPriority() || m_config.AckThinning()) {
+        std::cout << "TCP ACKs:"
+            << (m_config.AckPriority() ? " prioritized" : "")
+            << (m_config.AckThinning() ? " thinned" : "") << std::endl;
+    }
+    if(m_config.Arq()) {
+        std::cout << "Retransmission: enabled" << std::endl;
+    }
+    if(m_config.Checksum()) {
+        std::cout << "Frame checksums: CRC32C" << std::endl;
+    }
+    if(m_config.CompressionMbps()) {
+        std::cout << "Compression: links below "
+            << m_config.CompressionMbps() << " Mbit/s" << std::endl;
+    }
+    std::cout << "Buffer budget: " << m_config.BufferBudgetMb()
+        << " MiB, full delivery queue drops the "
+        << (m_config.RxDropOldest() ? "oldest" : "new") << " packet"
+        << std::endl;
+    auto tunnels = m_link_manager.Tunnels();
     auto links = m_link_manager.Links();
-    for( int i = 0; i < links.size(); i++ ) {
-        std::cout << "    ";
-        std::cout << links[i]->OwnAddr().Str();
-        std::cout << " <--" << links[i]->IfName() << "--> ";
-        std::cout << links[i]->PeerAddr().Str();
-        std::cout << std::endl;
+    for( int t = 0; t < tunnels.size(); t++ ) {
+        std::cout << "Tunnel " << tunnels[t]->Name()
+            << " (id " << tunnels[t]->Id() << ")\n";
+        std::cout << "  Proxying traffic destined for:\n";
+        auto destinations = tunnels[t]->Destinations();
+        for( int i = 0; i < destinations.size(); i++ ) {
+            std::cout << "    " << destinations[i].Str() << std::endl;
+        }
+        if(tunnels[t]->FwMark()) {
+            std::cout << "    fwmark 0x" << std::hex << tunnels[t]->FwMark()
+                << std::dec << std::endl;
+        }
+        if(tunnels[t]->Encryption()) {
+            std::cout << "  Encrypted with AES-256-GCM" << std::endl;
+        }
+        std::cout << "  Link setup:\n";
+        for( int i = 0; i < links.size(); i++ ) {
+            if( links[i]->Tunnel() != tunnels[t]->Id() ) {
+                continue;
+            }
+            std::cout << "    ";
+            std::cout << links[i]->OwnAddr().Str();
+            std::cout << " <--" << links[i]->IfName() << "--> ";
+            std::cout << links[i]->PeerAddr().Str();
+            std::cout << " (MTU " << links[i]->Mtu();
+            XdpLink const * xdp = dynamic_cast<XdpLink const *>(links[i]);
+            if(xdp) {
+                std::cout << ", AF_XDP "
+                    << (xdp->Native() ? "native" : "generic")
+                    << (xdp->ZeroCopy() ? " zero-copy" : " copy");
+            }
+            if(links[i]->Paced()) {
+                std::cout << ", paced at " << links[i]->Rate() << " Mbit/s "
+                    << (links[i]->TxTime() ? "by SO_TXTIME" : "in user space");
+            }
+            if(links[i]->NumaNode() != NUMA_NODE_ANY) {
+                std::cout << ", NUMA node " << links[i]->NumaNode();
+            }
+            std::cout << ")";
+            std::cout << std::endl;
+        }
+        auto classes = tunnels[t]->Classes();
+        if( !classes.empty() ) {
+            std::cout << "  Traffic classes:\n";
+        }
+        for( int c = 0; c < classes.size(); c++ ) {
+            std::cout << "    " << classes[c]->Name()
+                << " (id " << classes[c]->Id() << "), ";
+            if(classes[c]->Copies()) {
+                std::cout << classes[c]->Copies() << " copies";
+            } else {
+                std::cout << "replicated";
+            }
+            std::cout << ", reorder timeout " << classes[c]->Timeout()
+                << " msec" << std::endl;
+        }
+    }
+}
+
+/**
+ * Print a single Reactor's statistics.
+ *
+ * @param name Name of the Reactor's thread.
+ * @param stats Statistics taken from the Reactor.
+ */
+static void print_reactor_stats( char const * name,
+                                 Reactor::Stats const & stats ) {
+
+    uint64_t total = stats.m_spin_nsec + stats.m_idle_nsec;
+    uint64_t spins = stats.m_spin_hits + stats.m_spin_misses;
+
+    std::cout << "    " << name << ": spin "
+        << stats.m_spin_nsec / 1000000 << " ms, idle "
+        << stats.m_idle_nsec / 1000000 << " ms";
+    if(total) {
+        std::cout << " (spin/idle " << 100 * stats.m_spin_nsec / total
+            << "%/" << 100 * stats.m_idle_nsec / total << "%)";
+    }
+    if(spins) {
+        std::cout << ", " << 100 * stats.m_spin_hits / spins
+            << "% of " << spins << " spins hit";
+    }
+    std::cout << std::endl;
+}
+
+/**
+ * Print statistics.
+ *
+ * Reports the time the main loop and the Link reception thread spent spinning
+ * and blocked since the last report, or with the "uring" I/O engine the
+ * transmissions it dropped, the segments merged by the Gro, the
+ * memory taken from the BufferBudget, the packets dropped from delivery and
+ * per Tunnel by its PacketPools' bounds, the ACKs
+ * dropped per Tunnel by ACK thinning, the packets retransmitted per Tunnel, as
+ * well as the duplicate frames received,
+ * the frames queued and the frames dropped on transmission per Link, and the
+ * Links' one-way delays measured by the ect scheduler. The adaptive scheduler
+ * adds the Tunnels' redundancy and the Links' loss, frame checksums the
+ * corrupt frames per Link, and compression the packets sent compressed per
+ * Link. Called periodically, see
+ * the stats_interval configuration parameter.
+ */
+void LinkAggregator::PrintStats() {
+    std::cout << "Statistics:\n";
+    if(m_engine) {
+        std::cout << "    uring: " << m_engine->TxDrops()
+            << " transmissions dropped" << std::endl;
+    } else {
+        print_reactor_stats("main", m_reactor.TakeStats());
+        print_reactor_stats("links", m_link_manager.RxStats());
+    }
+    if(m_gro) {
+        uint64_t segs, pkts;
+        m_gro->TakeStats(segs, pkts);
+        std::cout << "    gro: " << segs << " segments merged into " << pkts
+            << " packets" << std::endl;
     }
+    std::cout << "    buffers: " << BufferBudget::Used() / 1024 << " KiB used, "
+        << m_link_manager.RxDrops() << " packets dropped from delivery"
+        << std::endl;
+    auto tunnels = m_link_manager.Tunnels();
+    for( int t = 0; t < tunnels.size(); t++ ) {
+        std::cout << "    " << tunnels[t]->Name() << ": "
+            << tunnels[t]->BudgetDrops() << " packets dropped over budget, "
+            << tunnels[t]->WindowSkips() << " skipped by window" << std::endl;
+    }
+    if(m_config.AckThinning()) {
+        for( int t = 0; t < tunnels.size(); t++ ) {
+            std::cout << "    " << tunnels[t]->Name() << ": "
+                << tunnels[t]->Acks().Thinned() << " ACKs thinned"
+                << std::endl;
+        }
+    }
+    if(m_config.Arq()) {
+        for( int t = 0; t < tunnels.size(); t++ ) {
+            std::cout << "    " << tunnels[t]->Name() << ": "
+                << tunnels[t]->Retransmitted() << " packets retransmitted"
+                << std::endl;
+        }
+    }
+    bool adaptive = m_config.Scheduler() == "adaptive";
+    if(adaptive) {
+        for( int t = 0; t < tunnels.size(); t++ ) {
+            std::cout << "    " << tunnels[t]->Name() << ": ";
+            if(tunnels[t]->Striping()) {
+                std::cout << "striping";
+            } else {
+                std::cout << tunnels[t]->Redundancy() << " copies";
+            }
+            std::cout << ", " << tunnels[t]->OfferedRate() / 1000000
+                << " Mbit/s" << std::endl;
+        }
+    }
+    bool checksum = m_config.Checksum();
+    m_link_manager.ForEachLink([adaptive, checksum](Link const * link) {
+        std::cout << "    " << link->IfName()
+            << " (tunnel " << link->Tunnel() << "): "
+            << (link->Up() ? "" : "down, ")
+            << link->Duplicates() << " duplicates, "
+            << link->TxQueued() << " queued, "
+            << link->TxDrops() << " dropped";
+        if(link->OneWayDelay()) {
+            std::cout << ", delay " << link->OneWayDelay() / 1000 << " usec";
+        }
+        if(adaptive) {
+            std::cout << ", loss " << link->Loss() * 100 << "%";
+        }
+        if(checksum) {
+            std::cout << ", " << link->Corrupt() << " corrupt";
+        }
+        if(link->Compresses()) {
+            std::cout << ", " << link->TxCompressed() << " compressed";
+        }
+        std::cout << std::endl;
+    });
 }
 
 /**
  * Link transmission
  *
- * Send a packet on the aggregated links via LinkManager.
+ * Send a packet on the aggregated links via LinkManager. The packet's firewall
+ * mark, as received from the netfilter queue, selects its tunnel.
  *
  * @param buf Buffer object containing the data to be sent.
  * @returns The return value of the underlying send() call.
@@ -160,7 +825,7 @@ void LinkAggregator::PrintConfig() const {
  */
 int LinkAggregator::SendOnLinks( Buffer const * buf ) {
 
-    return m_link_manager.Send(buf);
+    return m_link_manager.Send(buf, m_client.PacketMark());
 }
 
 /**
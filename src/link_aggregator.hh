@@ -8,17 +8,22 @@
 #include "config.hh"
 #include "client.hh"
 #include "common.hh"
+#include "gro.hh"
 #include "link_manager.hh"
+#include "uring_engine.hh"
+#include "reactor.hh"
 
-#include <poll.h>
 #include <vector>
 
 /**
- * Definition of events that will be polled on using poll()
- *
- * The events include any incoming traffic.
+ * Maximum number of packets handled per event before other events are served.
+ */
+#define LAGG_BUDGET 64
+
+/**
+ * Number of buffers provided to the UringEngine for Client reception.
  */
-#define LAGG_POLL_EVENTS (POLLIN | POLLRDNORM | POLLRDBAND | POLLPRI)
+#define CLIENT_URING_BUFS 16
 
 /**
  * LinkAggregator class
@@ -28,6 +33,14 @@
  * LinkManager, which handles the aggregated links.
  *
  * This class mainly moves data between the LinkManager and the Client.
+ * With the "uring" I/O engine, a UringEngine drives both the Client and the
+ * LinkManager from the main thread.
+ *
+ * Optionally, a Gro merges TCP segments received over the links before they
+ * are delivered to the Client.
+ *
+ * On SIGHUP, the configuration file is read again and the LinkManager's Links
+ * are reconfigured accordingly.
  *
  * @see Config
  * @see Client
@@ -35,32 +48,61 @@
  */
 class LinkAggregator {
 
+    // signalfd receiving SIGHUP, created before any thread is spawned
+    int         m_reload_fd;
+    std::string m_config_filename;
+
     Config      m_config;
     Client      m_client;
     LinkManager m_link_manager;
+    UringEngine *m_engine;
+
+    // Event loop for Client and Link reception
+    Reactor     m_reactor;
+
+    // Packets delivered to the Client at once
+    std::vector<Buffer *> m_rx_batch;
+
+    // Receive offload, nullptr if disabled, and its flush timer
+    Gro         *m_gro;
+    int         m_gro_timer_fd;
+    bool        m_gro_timer_armed;
+
+    // Statistics timer of the "uring" I/O engine
+    int         m_stats_fd;
 
-    // Used for asynchronous I/O on Client and Link reception
-    struct pollfd m_pfds[2];
-    nfds_t        m_nfds;
+    // Whether reception from the Client is paused by congested Links
+    bool        m_tx_blocked;
 
     private:
 
     void PrintConfig() const;
+    void PrintStats();
+    void SetupEngine();
+    void SetupGro();
+    void OnReload();
+    void OnClientReadable();
+    void OnLinksReadable();
+    void OnLinksWritable();
+    int DeliverBatch();
+    void DeliverGro();
+    void OnGroTimer();
 
     public:
 
     LinkAggregator( const std::string config_filename = "default_config.cfg" );
+    ~LinkAggregator();
 
     // Main operation loop
     void Aggregate();
 
     // TX and RX chain
-    void TransmissionChain();
-    void ReceptionChain();
+    bool TransmissionChain();
+    bool ReceptionChain();
 
     // Client communication
     Buffer const * RecvPktFromClient();
-    int SendPktToClient( Buffer const * buf );
+    int SendPktToClient( Buffer const * buf, uint16_t gso_size = 0 );
 
     // Link communication
     Buffer const * RecvOnLinks();
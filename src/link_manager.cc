@@ -1,128 +1,1707 @@
+#include <stddef.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <random>
+
+#include <net/if.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
 #include "link_manager.hh"
+#include "lz4.hh"
+
+/**
+ * Draw the epoch of a session.
+ *
+ * @returns A random epoch, never 0, which stands for an unknown session.
+ */
+static uint16_t draw_epoch() {
+    std::random_device rd;
+    uint16_t epoch;
+    do {
+        epoch = rd();
+    } while(!epoch);
+    return epoch;
+}
+
+/**
+ * Link reception chain
+ *
+ * Runs the reception thread's Reactor, which dispatches readable Links to
+ * LinkManager::RecvOnLink().
+ *
+ * @param t Back-reference to the calling instance of LinkManager
+ * @see Reactor
+ */
+void LinkManager::recv_on_links(LinkManager *t) {
+
+    t->m_reactor.Poll(-1);
+}
+
+/**
+ * Receive on a readable Link.
+ *
+ * Links are registered edge-triggered, so frames are received until no more
+ * data is available. After LINK_RX_BUDGET frames, the Link is handed back to
+ * the Reactor to be continued after the other Links. Received frames are
+ * handed to LinkManager::RecvFrame().
+ *
+ * @param link The readable Link.
+ * @param bypass Whether the Link's kernel bypass is readable, rather than its
+ * socket.
+ * @see Link::RecvSocket()
+ * @see Link::RecvFrames()
+ * @see Reactor
+ */
+void LinkManager::RecvOnLink(Link * link, bool bypass) {
+
+    auto handler = [this, link](unsigned char const * frame, int len) {
+        RecvFrame(link, frame, len);
+    };
+
+    int n = bypass ? link->RecvFrames(LINK_RX_BUDGET, handler)
+                   : link->RecvSocket(LINK_RX_BUDGET, handler);
+
+    // Budget exhausted, continue later
+    if(n >= LINK_RX_BUDGET) {
+        m_reactor.Ready(bypass ? link->BypassFd() : link->Socket());
+    }
+}
+
+/**
+ * LinkManager class constructor.
+ *
+ * Initializes the tunnels and their aggregated links, and starts the Link
+ * reception thread.
+ *
+ * @param tunnels Vector of the tunnels' configurations, including their links'
+ * peer addresses, interface names, MTUs, backends ("packet" or "xdp"), device
+ * queues and pacing rates. Links whose XDP setup fails fall back to "packet".
+ * @param rx_thread Whether to start the reception thread. If not, reception is
+ * to be set up using LinkManager::StartRecvThread() or
+ * LinkManager::UseEngine().
+ *
+ * @see Link
+ * @see XdpLink
+ * @see Tunnel
+ * @see SafeQueue
+ * @see PipedThread
+ */
+LinkManager::LinkManager(std::vector<TunnelConfig> const & tunnels,
+                         bool rx_thread)
+                         : m_tunnel_ids(ALAGG_MAX_TUNNEL + 1, nullptr)
+                         , m_has_pending(false)
+                         , m_rx_running(false)
+                         , m_rx_buf_size(0)
+                         , m_busy_poll_usec(0)
+                         , m_pacing_armed_nsec(0)
+                         , m_pacing_txtime(true)
+                         , m_scheduler(SCHEDULER_REPLICATE)
+                         , m_redundancy_target(0.999)
+                         , m_redundancy_nsec(0)
+                         , m_ack_priority(false)
+                         , m_ack_thinning(false)
+                         , m_arq(false)
+                         , m_checksum(false)
+                         , m_compress_bps(0)
+                         , m_compressed_len(-1)
+                         , m_rx_overflows(0)
+                         , m_epoch(draw_epoch())
+                         , m_engine(nullptr) {
+
+    SetLimit(LINK_RX_QUEUE_LEN, drop_tail);
+
+    errno = 0;
+    m_ctl_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert_perror(errno);
+    m_tx_epfd = epoll_create1(EPOLL_CLOEXEC);
+    assert_perror(errno);
+    m_pacing_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    assert_perror(errno);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = m_pacing_fd;
+    epoll_ctl(m_tx_epfd, EPOLL_CTL_ADD, m_pacing_fd, &ev);
+    assert_perror(errno);
+    m_probe_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    assert_perror(errno);
+    ev.data.fd = m_probe_fd;
+    epoll_ctl(m_tx_epfd, EPOLL_CTL_ADD, m_probe_fd, &ev);
+    assert_perror(errno);
+    m_sync_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    assert_perror(errno);
+    ev.data.fd = m_sync_fd;
+    epoll_ctl(m_tx_epfd, EPOLL_CTL_ADD, m_sync_fd, &ev);
+    assert_perror(errno);
+
+    // Initialize tunnels
+    for( int i = 0; i < tunnels.size(); i++ ) {
+        Tunnel *tunnel = new Tunnel(tunnels[i], [this](Buffer * b) {
+            PopPacketFromPool(b);
+        });
+        m_tunnels.push_back(tunnel);
+        m_tunnel_ids[tunnel->Id()] = tunnel;
+        for( int j = 0; j < tunnel->Destinations().size(); j++ ) {
+            m_routes.push_back(std::make_pair(tunnel->Destinations()[j],
+                                              tunnel));
+        }
+    }
+    std::stable_sort(m_routes.begin(), m_routes.end(),
+            [](std::pair<IpPrefix, Tunnel *> const & a,
+               std::pair<IpPrefix, Tunnel *> const & b) {
+                return a.first.Len() > b.first.Len();
+            });
+
+    // Initialize links
+    m_specs = make_specs(tunnels);
+    for( int i = 0; i < m_specs.size(); i++ ) {
+        Link *link = CreateLink(m_specs[i]);
+        if( !link ) {
+            exit(1);
+        }
+        m_links.push_back(link);
+        m_rx_buf_size = std::max(m_rx_buf_size, link->MaxFrameSize());
+    }
+
+    // Allocate reception buffers close to the Links' devices
+    for( int i = 0; i < m_links.size(); i++ ) {
+        m_links[i]->SetRxBufSize(m_rx_buf_size);
+    }
+
+    // Request the remote aggregator's session right away
+    ArmSync();
+
+    // Start the reception thread
+    if(rx_thread) {
+        StartRecvThread();
+    }
+}
+
+/**
+ * Flatten the links of the tunnels' configurations.
+ *
+ * Every Link carries the traffic classes listing its interface, or listing no
+ * interfaces at all.
+ *
+ * @param tunnels Vector of the tunnels' configurations.
+ * @returns A vector of LinkSpec, one per Link.
+ */
+std::vector<LinkManager::LinkSpec> LinkManager::make_specs(
+        std::vector<TunnelConfig> const & tunnels) {
+
+    std::vector<LinkSpec> specs;
+    for( int t = 0; t < tunnels.size(); t++ ) {
+        TunnelConfig const & c = tunnels[t];
+        for( int i = 0; i < c.m_peer_addresses.size(); i++ ) {
+            LinkSpec spec;
+            spec.m_tunnel  = c.m_id;
+            spec.m_peer    = c.m_peer_addresses[i];
+            spec.m_if_name = c.m_if_names[i];
+            spec.m_mtu     = c.m_mtus[i];
+            spec.m_backend = c.m_backends[i];
+            spec.m_queue   = c.m_queues[i];
+            spec.m_rate    = c.m_rates[i];
+            spec.m_classes = 0;
+            for( int j = 0; j < c.m_classes.size(); j++ ) {
+                std::vector<std::string> const & ifs =
+                    c.m_classes[j].m_if_names;
+                if( ifs.empty() || std::find(ifs.begin(), ifs.end(),
+                                             spec.m_if_name) != ifs.end() ) {
+                    spec.m_classes |= (uint32_t) 1 << (j + 1);
+                }
+            }
+            specs.push_back(spec);
+        }
+    }
+    return specs;
+}
+
+/**
+ * Create a Link.
+ *
+ * XDP links whose setup fails fall back to AF_PACKET. Links with a rate are
+ * paced, falling back to pacing in user space if SO_TXTIME is not supported.
+ *
+ * @param spec Configuration of the Link.
+ * @returns The new Link, or nullptr if the interface does not exist.
+ */
+Link * LinkManager::CreateLink(LinkSpec const & spec) {
+
+    if( if_nametoindex(spec.m_if_name.c_str()) == 0 ) {
+        std::cerr << "ERROR: No such interface: " << spec.m_if_name
+            << std::endl;
+        errno = 0;
+        return nullptr;
+    }
+
+    if( spec.m_backend == "xdp" ) {
+        XdpLink *xdp = new XdpLink(spec.m_if_name, spec.m_peer,
+                                   spec.m_mtu, spec.m_queue, spec.m_tunnel);
+        if( xdp->Ok() ) {
+            if( spec.m_rate ) {
+                std::cerr << "WARNING: AF_XDP link " << spec.m_if_name
+                    << " is not paced" << std::endl;
+            }
+            xdp->SetClasses(spec.m_classes);
+            xdp->SetChecksum(m_checksum);
+            xdp->SetCompression(m_compress_bps);
+            xdp->SetEpoch(m_epoch);
+            xdp->SetCipher(m_tunnel_ids[spec.m_tunnel]->ControlEncryption());
+            return xdp;
+        }
+        std::cerr << "WARNING: AF_XDP not available on "
+            << spec.m_if_name << ", using AF_PACKET" << std::endl;
+        delete xdp;
+    }
+
+    Link *link = new Link(spec.m_if_name, spec.m_peer, spec.m_mtu,
+                          spec.m_tunnel);
+    link->SetClasses(spec.m_classes);
+    link->SetChecksum(m_checksum);
+    if( !link->SetRate(spec.m_rate, m_pacing_txtime) ) {
+        std::cerr << "WARNING: SO_TXTIME not supported on "
+            << spec.m_if_name << " or no fq qdisc, pacing in user space"
+            << std::endl;
+    }
+    link->SetCompression(m_compress_bps);
+    link->SetEpoch(m_epoch);
+    link->SetCipher(m_tunnel_ids[spec.m_tunnel]->ControlEncryption());
+    return link;
+}
+
+/**
+ * Start receiving on a Link.
+ *
+ * With a UringEngine, a multishot receive is kept outstanding on the Link,
+ * drawing from a group of buffers on the Link's NUMA node, and the Link's
+ * kernel bypass is polled. Otherwise, the Link is registered with the
+ * reception thread's Reactor, as long as it is up.
+ *
+ * @param link The Link.
+ */
+void LinkManager::RegisterLink(Link * link) {
+
+    if(m_engine) {
+        int group = m_engine->AddBufferGroup(LINK_URING_BUFS, m_rx_buf_size,
+                                             link->NumaNode());
+        m_engine->AddRecv(link->Socket(), group,
+                [this, link](unsigned char *frame, int len) {
+                    RecvFrame(link, frame, len);
+                });
+        if(link->BypassFd() >= 0) {
+            m_engine->AddPoll(link->BypassFd(), [this, link]() {
+                auto handler = [this, link](unsigned char const * frame,
+                                            int len) {
+                    RecvFrame(link, frame, len);
+                };
+                while(link->RecvFrames(LINK_RX_BUDGET, handler)
+                        >= LINK_RX_BUDGET);
+            });
+        }
+        return;
+    }
+
+    if(!link->Up()) {
+        return;
+    }
+
+    m_reactor.Add(link->Socket(), EPOLLIN, [this, link](uint32_t) {
+        RecvOnLink(link, false);
+    });
+    if(link->BypassFd() >= 0) {
+        m_reactor.Add(link->BypassFd(), EPOLLIN, [this, link](uint32_t) {
+            RecvOnLink(link, true);
+        });
+    }
+}
+
+/**
+ * Stop receiving on a Link.
+ *
+ * @param link The Link.
+ */
+void LinkManager::UnregisterLink(Link * link) {
+
+    if(m_engine) {
+        m_engine->Remove(link->Socket());
+        m_engine->Remove(link->PrioSocket());
+        if(link->BypassFd() >= 0) {
+            m_engine->Remove(link->BypassFd());
+        }
+        return;
+    }
+
+    m_reactor.Remove(link->Socket());
+    if(link->BypassFd() >= 0) {
+        m_reactor.Remove(link->BypassFd());
+    }
+}
+
+/**
+ * Watch for link events and reconfigurations.
+ *
+ * The LinkMonitor's socket and the reconfiguration eventfd are registered with
+ * the reception thread's Reactor, or polled by the UringEngine.
+ */
+void LinkManager::WatchLinks() {
+
+    auto on_monitor = [this]() {
+        bool complete = m_monitor.Recv([this](int if_index, bool up) {
+            OnLinkEvent(if_index, up);
+        });
+
+        // Events were lost, read the carrier of all Links again
+        if(!complete) {
+            for(int i = 0; i < m_links.size(); i++) {
+                OnLinkEvent(m_links[i]->IfIndex(), m_links[i]->ReadCarrier());
+            }
+        }
+    };
+
+    auto on_ctl = [this]() {
+        uint64_t value;
+        if(read(m_ctl_fd, &value, sizeof(value)) > 0) {
+            ApplyPending();
+        }
+        errno = 0;
+    };
+
+    if(m_engine) {
+        m_engine->AddPoll(m_monitor.Fd(), on_monitor);
+        m_engine->AddPoll(m_ctl_fd, on_ctl);
+    } else {
+        m_reactor.Add(m_monitor.Fd(), EPOLLIN, [on_monitor](uint32_t) {
+            on_monitor();
+        });
+        m_reactor.Add(m_ctl_fd, EPOLLIN, [on_ctl](uint32_t) {
+            on_ctl();
+        });
+    }
+}
+
+/**
+ * Handle a change of an interface's state.
+ *
+ * Links on the interface are taken out of transmission once it goes down or
+ * loses carrier, and taken back in once it returns. Without a UringEngine,
+ * they are removed from and added to the reception Reactor as well. Interfaces
+ * that are deleted and created again get a new index, so their Links remain
+ * down until they are reconfigured.
+ *
+ * @param if_index Index of the interface.
+ * @param up Whether the interface is up and has carrier.
+ */
+void LinkManager::OnLinkEvent(int if_index, bool up) {
+
+    for(int i = 0; i < m_links.size(); i++) {
+        Link *link = m_links[i];
+        if(link->IfIndex() != if_index || link->Up() == up) {
+            continue;
+        }
+
+        std::cout << "Link " << link->IfName() << (up ? " up" : " down")
+            << std::endl;
+
+        if(up) {
+            link->SetUp(true);
+            if(!m_engine) {
+                RegisterLink(link);
+            }
+        } else {
+            link->SetUp(false);
+            if(!m_engine) {
+                UnregisterLink(link);
+            }
+        }
+    }
+}
+
+/**
+ * Enable low-latency reception.
+ *
+ * Busy polling is enabled on all Links, and the reception thread spins for
+ * the same time before it blocks. Must be called before the reception thread
+ * is started.
+ *
+ * @param usec Time to spin in microseconds.
+ * @see Link::SetBusyPoll()
+ * @see Reactor::SetSpin()
+ */
+void LinkManager::SetBusyPoll(int usec) {
+
+    m_busy_poll_usec = usec;
+    for(int i = 0; i < m_links.size(); i++) {
+        if(!m_links[i]->SetBusyPoll(usec, LINK_RX_BUDGET)) {
+            std::cerr << "WARNING: Busy polling not supported on "
+                << m_links[i]->IfName() << std::endl;
+        }
+    }
+
+    m_reactor.SetSpin(usec);
+}
+
+/**
+ * Select the pacing method of Links with a rate.
+ *
+ * Must be called before transmission starts. Applies to the existing Links
+ * and to those added by a later reconfiguration.
+ *
+ * @param txtime Whether to pass departure times to the kernel, using
+ * SO_TXTIME. Otherwise, frames are paced in user space.
+ * @see Link::SetRate()
+ */
+void LinkManager::SetPacing(bool txtime) {
+
+    m_pacing_txtime = txtime;
+    for(int i = 0; i < m_links.size(); i++) {
+        if(m_links[i]->BypassFd() >= 0 || !m_specs[i].m_rate) {
+            continue;
+        }
+        if(!m_links[i]->SetRate(m_specs[i].m_rate, txtime)) {
+            std::cerr << "WARNING: SO_TXTIME not supported on "
+                << m_links[i]->IfName() << ", pacing in user space"
+                << std::endl;
+        }
+    }
+}
+
+/**
+ * Select the distribution of packets over the Links.
+ *
+ * With SCHEDULER_ECT, probes are sent on all Links every
+ * LINK_PROBE_INTERVAL_MSEC to measure their delays. The remote aggregator must
+ * support probes. With SCHEDULER_ADAPTIVE, reports are sent as well, and
+ * packets are replicated on all Links until the first reports are answered,
+ * see LinkManager::UpdateRedundancy(). The remote aggregator must support
+ * reports. Must be called before transmission starts.
+ *
+ * @param scheduler The policy.
+ * @see LinkManager::EarliestLinks()
+ */
+void LinkManager::SetScheduler(LinkScheduler scheduler) {
+
+    m_scheduler = scheduler;
+    if(scheduler == SCHEDULER_REPLICATE) {
+        return;
+    }
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_interval.tv_sec  = LINK_PROBE_INTERVAL_MSEC / 1000;
+    its.it_interval.tv_nsec = (LINK_PROBE_INTERVAL_MSEC % 1000) * 1000000;
+    its.it_value.tv_nsec    = 1;
+    timerfd_settime(m_probe_fd, 0, &its, nullptr);
+    assert_perror(errno);
+}
+
+/**
+ * Set the delivery target of the adaptive scheduler.
+ *
+ * @param target Share of packets to be delivered, despite the loss of the
+ * Links, between 0 and 1.
+ * @see SCHEDULER_ADAPTIVE
+ */
+void LinkManager::SetRedundancyTarget(double target) {
+    m_redundancy_target = target;
+}
+
+/**
+ * Enable prioritization of pure TCP ACKs.
+ *
+ * Pure ACKs bypass the reordering of their Tunnel's PacketPool on the remote
+ * side, see ALAGG_FLAG_UNORDERED, and are sent on the Links' priority sockets,
+ * ahead of data queued on the same Link.
+ *
+ * @param enable Whether pure ACKs are prioritized.
+ * @see Link::PrioSocket()
+ */
+void LinkManager::SetAckPriority(bool enable) {
+    m_ack_priority = enable;
+}
+
+/**
+ * Enable thinning of pure TCP ACKs.
+ *
+ * Pure ACKs are held in their Tunnel's AckFilter, and superseded ACKs are
+ * dropped. Held ACKs are sent before the next packet of their flow, or by
+ * LinkManager::FlushAcks(), which must be called at the end of every burst of
+ * packets sent.
+ *
+ * @param enable Whether pure ACKs are thinned.
+ * @see AckFilter
+ */
+void LinkManager::SetAckThinning(bool enable) {
+    m_ack_thinning = enable;
+}
+
+/**
+ * Enable retransmission of lost packets.
+ *
+ * Packets sent in order are kept in their Tunnel's RetransmitBuffers. Packets
+ * found missing by the reordering of a Tunnel's PacketPools are reported to
+ * the remote aggregator, see LinkManager::SendNack(), which sends them again
+ * if they still arrive in time, see LinkManager::OnNack(). The remote
+ * aggregator must enable retransmission as well. Must be called before
+ * reception and transmission start.
+ *
+ * @param enable Whether lost packets are retransmitted.
+ * @see ALAGG_FLAG_NACK
+ */
+void LinkManager::SetArq(bool enable) {
+
+    m_arq = enable;
+    for(int i = 0; i < m_tunnels.size(); i++) {
+        Tunnel *tunnel = m_tunnels[i];
+        if(!enable) {
+            tunnel->SetNack(nullptr);
+            continue;
+        }
+        tunnel->SetNack([this, tunnel](int cls, alagg_seq_t first,
+                                       uint64_t missing) {
+            SendNack(tunnel, cls, first, missing);
+        });
+    }
+}
+
+/**
+ * Enable the CRC32C trailer of frames.
+ *
+ * Every frame sent carries a CRC32C, and frames received with a mismatching
+ * one are dropped before they are taken for a packet, so corruption on the
+ * path is not delivered to the client, and a good copy of the packet received
+ * on another Link is still accepted. The remote aggregator must enable
+ * checksums as well. Must be called before reception and transmission start.
+ *
+ * @param enable Whether frames carry a CRC32C.
+ * @see Link::SetChecksum()
+ */
+void LinkManager::SetChecksum(bool enable) {
+
+    m_checksum = enable;
+    for(int i = 0; i < m_links.size(); i++) {
+        m_links[i]->SetChecksum(enable);
+    }
+}
+
+/**
+ * Enable compression of packets sent on slow Links.
+ *
+ * Packets are compressed into LZ4 blocks before they are sent on Links whose
+ * line rate is below the threshold, see Link::LineRate(), unless they look
+ * incompressible, or compression does not make them smaller. Packets of
+ * Tunnels with a Cipher are never compressed. Compressed packets are flagged
+ * ALAGG_FLAG_COMPRESSED, so the remote aggregator must support compression,
+ * but need not enable it. Must be called before transmission starts.
+ *
+ * @param mbps Line rate in Mbit/s below which Links compress packets, 0 to
+ * disable compression.
+ * @see LinkManager::Compress()
+ */
+void LinkManager::SetCompression(int mbps) {
+
+    m_compress_bps = (uint64_t) mbps * 1000000;
+    for(int i = 0; i < m_links.size(); i++) {
+        m_links[i]->SetCompression(m_compress_bps);
+    }
+}
+
+/**
+ * Set the policy of the queue of packets waiting for delivery.
+ *
+ * Once LINK_RX_QUEUE_LEN packets are queued, either the packet popped from a
+ * PacketPool, or the oldest packet queued is dropped. Packets exceeding the
+ * BufferBudget are always dropped as they are popped.
+ *
+ * @param policy Packet dropped by a full queue, drop_tail by default.
+ * @see LinkManager::RxDrops()
+ */
+void LinkManager::SetRxQueuePolicy(safe_queue_policy policy) {
+    SetLimit(LINK_RX_QUEUE_LEN, policy);
+}
+
+/**
+ * Start the Link reception thread.
+ *
+ * All Links that are up are registered with the reception thread's Reactor,
+ * including their kernel bypass, if any, as well as the LinkMonitor. The
+ * thread is named "alagg-link-rx".
+ *
+ * @param cpus CPUs the reception thread is pinned to, empty if unpinned.
+ * @see LinkManager::recv_on_links()
+ */
+void LinkManager::StartRecvThread(std::vector<int> const & cpus) {
+
+    for(int i = 0; i < m_links.size(); i++) {
+        RegisterLink(m_links[i]);
+    }
+    WatchLinks();
+
+    m_rx_running = true;
+    SetThread(recv_on_links, this, PipedThread::exec_repeat);
+    set_thread_name(NativeHandle(), "alagg-link-rx");
+    set_thread_affinity(NativeHandle(), cpus);
+}
+
+/**
+ * Drive Link communication by a UringEngine.
+ *
+ * A multishot receive is kept outstanding on every Link, drawing from a group
+ * of buffers on the Link's NUMA node, and transmissions are queued to the
+ * engine. Kernel bypasses of Links are polled, and transmit on their own.
+ * Packets that become ready while handling a completion are handed to the
+ * deliver function right away, everything else (i.e. packets flushed by a
+ * Timer) is pushed to the SafeQueue as usual.
+ * Must be called from the thread running the engine.
+ *
+ * @param engine The UringEngine to be used.
+ * @param deliver Function taking over delivery of packets.
+ * @see UringEngine
+ */
+void LinkManager::UseEngine(UringEngine * engine,
+                            std::function<void(Buffer *)> deliver) {
+
+    m_engine = engine;
+    m_deliver = deliver;
+    m_deliver_thread = std::this_thread::get_id();
+
+    for(int i = 0; i < m_links.size(); i++) {
+        RegisterLink(m_links[i]);
+    }
+    WatchLinks();
+}
+
+/**
+ * Replace the set of Links.
+ *
+ * Links whose configuration is unchanged are kept, and continue without
+ * interruption. New Links are created, and Links no longer configured are
+ * removed. Tunnels are matched by name, and their destinations are kept, so
+ * adding or removing tunnels requires a restart. The new set is applied by the
+ * reception thread, or right away if there is none, i.e. with a UringEngine,
+ * which must be run by the calling thread.
+ *
+ * @param tunnels Vector of the tunnels' configurations.
+ * @see LinkManager::ApplyPending()
+ */
+void LinkManager::Reconfigure(std::vector<TunnelConfig> const & tunnels) {
+
+    std::vector<TunnelConfig> known;
+    for(int i = 0; i < tunnels.size(); i++) {
+        int j;
+        for(j = 0; j < m_tunnels.size(); j++) {
+            if(m_tunnels[j]->Name() == tunnels[i].m_name) {
+                break;
+            }
+        }
+        if(j == m_tunnels.size()) {
+            std::cerr << "WARNING: New tunnel " << tunnels[i].m_name
+                << " requires a restart" << std::endl;
+            continue;
+        }
+        known.push_back(tunnels[i]);
+        known.back().m_id = m_tunnels[j]->Id();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_pending_lock);
+        m_pending = make_specs(known);
+        m_has_pending = true;
+    }
+
+    if(!m_rx_running) {
+        ApplyPending();
+        return;
+    }
+
+    uint64_t one = 1;
+    if(write(m_ctl_fd, &one, sizeof(one)) < 0) {
+        perror("write()");
+    }
+    errno = 0;
+}
+
+/**
+ * Apply a pending reconfiguration.
+ *
+ * Runs in the thread receiving on the Links, so Links can be registered and
+ * removed safely. Transmission is only blocked while the vector of Links is
+ * swapped. Links on missing interfaces are skipped.
+ *
+ * @see LinkManager::Reconfigure()
+ */
+void LinkManager::ApplyPending() {
+
+    std::vector<LinkSpec> specs;
+    {
+        std::lock_guard<std::mutex> lock(m_pending_lock);
+        if(!m_has_pending) {
+            return;
+        }
+        specs.swap(m_pending);
+        m_has_pending = false;
+    }
+
+    std::vector<Link *> links;
+    std::vector<LinkSpec> kept_specs;
+    std::vector<Link *> added;
+    std::vector<bool> kept(m_links.size(), false);
+
+    // Keep unchanged Links, create new ones
+    for(int i = 0; i < specs.size(); i++) {
+        int j;
+        for(j = 0; j < m_specs.size(); j++) {
+            if(!kept[j] && m_specs[j] == specs[i]) {
+                break;
+            }
+        }
+        Link *link;
+        if(j < m_specs.size()) {
+            kept[j] = true;
+            link = m_links[j];
+        } else {
+            link = CreateLink(specs[i]);
+            if(!link) {
+                continue;
+            }
+            added.push_back(link);
+        }
+        links.push_back(link);
+        kept_specs.push_back(specs[i]);
+    }
+
+    // Grow the reception buffers to fit the new Links' frames
+    int rx_buf_size = m_rx_buf_size;
+    for(int i = 0; i < added.size(); i++) {
+        rx_buf_size = std::max(rx_buf_size, added[i]->MaxFrameSize());
+    }
+    if(rx_buf_size > m_rx_buf_size) {
+        m_rx_buf_size = rx_buf_size;
+        for(int i = 0; i < links.size(); i++) {
+            links[i]->SetRxBufSize(m_rx_buf_size);
+        }
+    } else {
+        for(int i = 0; i < added.size(); i++) {
+            added[i]->SetRxBufSize(m_rx_buf_size);
+        }
+    }
+
+    for(int i = 0; i < added.size(); i++) {
+        std::cout << "Link " << added[i]->IfName() << " added to tunnel "
+            << m_tunnel_ids[added[i]->Tunnel()]->Name() << std::endl;
+        if(m_busy_poll_usec > 0) {
+            added[i]->SetBusyPoll(m_busy_poll_usec, LINK_RX_BUDGET);
+        }
+        RegisterLink(added[i]);
+    }
+
+    // Swap the Links, transmission continues on the new set
+    std::vector<Link *> old;
+    {
+        std::lock_guard<std::mutex> lock(m_links_lock);
+        old.swap(m_links);
+        m_links = links;
+        m_specs = kept_specs;
+    }
+
+    // Remove Links no longer configured
+    for(int i = 0; i < old.size(); i++) {
+        if(kept[i]) {
+            continue;
+        }
+        std::cout << "Link " << old[i]->IfName() << " removed from tunnel "
+            << m_tunnel_ids[old[i]->Tunnel()]->Name() << std::endl;
+        UnregisterLink(old[i]);
+        epoll_ctl(m_tx_epfd, EPOLL_CTL_DEL, old[i]->Socket(), nullptr);
+        errno = 0;
+        delete old[i];
+    }
+}
+
+/**
+ * Handle a frame received on a Link.
+ *
+ * Frames failing the CRC32C check are dropped first, see Link::Verify().
+ * Frames of packets already received on any Link of the Tunnel are discarded
+ * right away, based on the ReplayWindow of the packet's traffic class.
+ * Otherwise, the frame is copied, since the reception buffer is reused
+ * afterwards. Fragments are handed to the Link's Defragmenter, and only
+ * complete packets are marked in the ReplayWindow and added to the PacketPool
+ * of their class, see Tunnel::Add(). Since the copy is allocated by the
+ * receiving thread, it is placed on that thread's NUMA node.
+ *
+ * Packets of Tunnels with a Cipher are decrypted and authenticated before they
+ * are marked in the ReplayWindow, so forged packets cannot advance it.
+ * Compressed packets are decompressed likewise. Packets failing
+ * authentication or decompression are counted as corrupt, see
+ * Link::Corrupt().
+ *
+ * Complete packets and duplicates are counted on the Link, telling how many
+ * packets it received and how many of them it delivered first, which is
+ * reported to the remote aggregator, see Link::OnReport().
+ *
+ * Frames flagged ALAGG_FLAG_UNORDERED are deduplicated in the Tunnel's
+ * unordered ReplayWindow instead, and delivered right away. Probes and reports
+ * are handled by the Link, NACKs by LinkManager::OnNack(). On encrypted
+ * Tunnels, they are opened first, and dropped if they are not authentic or of
+ * another session than the remote aggregator's known one, see
+ * Tunnel::ControlEncryption().
+ *
+ * @param link Link the frame was received on.
+ * @param frame Pointer to the received frame.
+ * @param len Size of the frame.
+ */
+void LinkManager::RecvFrame(Link * link, unsigned char const * frame, int len) {
+
+    // Corrupt frames, if checksums are enabled
+    len = link->Verify(frame, len);
+    if(len < (int) sizeof(AlaggHeader)) {
+        return;
+    }
+
+    // Frames of other tunnels, if not dropped by the socket filter
+    AlaggHeader const * header = (AlaggHeader const *) frame;
+    if(header->m_tunnel != link->Tunnel()) {
+        return;
+    }
+    Tunnel *tunnel = m_tunnel_ids[header->m_tunnel];
+    alagg_seq_t seq = header->m_seq;
+
+    // Session handshakes
+    if(header->m_flags & ALAGG_FLAG_SYNC) {
+        OnSync(link, tunnel, frame, len);
+        return;
+    }
+
+    // Control frames of encrypted Tunnels must be authentic, and of the
+    // remote aggregator's known session
+    unsigned char opened[sizeof(AlaggHeader) + ALAGG_CONTROL_MAX];
+    Cipher *control = tunnel->ControlEncryption();
+    if(control && (header->m_flags & (ALAGG_FLAG_PROBE | ALAGG_FLAG_REPORT
+                                      | ALAGG_FLAG_NACK))) {
+        if(header->m_epoch != tunnel->PeerEpoch()) {
+            return;
+        }
+        int size = len - (int) sizeof(AlaggHeader) - CIPHER_OVERHEAD;
+        if(size < 0 || size > ALAGG_CONTROL_MAX
+                || control->Open(*header, frame + sizeof(AlaggHeader),
+                                 len - sizeof(AlaggHeader),
+                                 opened + sizeof(AlaggHeader)) < 0) {
+            link->CountCorrupt();
+            return;
+        }
+        memcpy(opened, frame, sizeof(AlaggHeader));
+        frame = opened;
+        len = sizeof(AlaggHeader) + size;
+    }
+
+    // Delay measurement
+    if(header->m_flags & ALAGG_FLAG_PROBE) {
+        link->OnProbe(frame, len);
+        return;
+    }
+
+    // Loss measurement
+    if(header->m_flags & ALAGG_FLAG_REPORT) {
+        link->OnReport(frame, len);
+        return;
+    }
+
+    // Retransmission requests
+    if(header->m_flags & ALAGG_FLAG_NACK) {
+        if(m_arq) {
+            OnNack(frame, len);
+        }
+        return;
+    }
+
+    // Packets of another session than the remote aggregator's known one are
+    // dropped, since their sequence numbers are not known. They make the
+    // Tunnel request the remote aggregator's current session, which is only
+    // switched to by the answer, see LinkManager::OnSync().
+    if(header->m_epoch != tunnel->PeerEpoch()) {
+        if(tunnel->RequestSync()) {
+            ArmSync();
+        }
+        return;
+    }
+
+    // Prioritized packets bypass reordering
+    if(header->m_flags & ALAGG_FLAG_UNORDERED) {
+        Cipher *cipher = tunnel->Encryption();
+        Buffer *b;
+        if(cipher) {
+            if(tunnel->UnorderedReplay().Seen(seq)) {
+                link->CountDuplicate();
+                return;
+            }
+            b = new Buffer(std::max<int>(len - sizeof(AlaggHeader)
+                                         - CIPHER_OVERHEAD, 0));
+            if(cipher->Open(*header, frame + sizeof(AlaggHeader),
+                            len - sizeof(AlaggHeader), b->data()) < 0) {
+                link->CountCorrupt();
+                delete b;
+                return;
+            }
+        } else {
+            b = new Buffer(frame + sizeof(AlaggHeader), frame + len);
+        }
+        if(!tunnel->UnorderedReplay().Mark(seq)) {
+            link->CountDuplicate();
+            delete b;
+            return;
+        }
+        tunnel->Bypass(b);
+        return;
+    }
+
+    // Packets of unknown traffic classes
+    int cls = header->m_class;
+    if(cls && !tunnel->Class(cls)) {
+        return;
+    }
+
+    // Reject duplicates before allocating
+    if(tunnel->Replay(cls).Seen(seq)) {
+        link->CountDuplicate();
+        if(!(header->m_flags & ALAGG_FLAG_MF)) {
+            link->CountRx(false);
+        }
+        return;
+    }
+
+    AlaggPacket *packet = (AlaggPacket *) malloc(len);
+    memcpy(packet, frame, len);
+
+    // Reassemble fragments, the buffer is taken over
+    packet = link->Defrag().Add(packet, &len);
+    if(!packet) {
+        return;
+    }
+
+    // Decrypt, before the sequence number is trusted
+    if(tunnel->Encryption()) {
+        packet = Decrypt(tunnel, packet, &len);
+        if(!packet) {
+            link->CountCorrupt();
+            return;
+        }
+    }
+
+    if(packet->m_header.m_flags & ALAGG_FLAG_COMPRESSED) {
+        packet = Decompress(packet, &len);
+        if(!packet) {
+            link->CountCorrupt();
+            return;
+        }
+    }
+
+    // Completed on another Link during reassembly
+    if(!tunnel->Replay(cls).Mark(seq)) {
+        link->CountDuplicate();
+        link->CountRx(false);
+        free(packet);
+        return;
+    }
+
+    link->CountRx(true);
+    tunnel->Add(cls, packet, len);
+}
+
+/**
+ * Decrypt a received packet.
+ *
+ * @param tunnel Tunnel of the packet, which must have a Cipher.
+ * @param packet The encrypted packet. Ownership is taken.
+ * @param len Size of the packet, updated to the size of the decrypted packet.
+ * @returns The decrypted packet, or nullptr if the packet is not authentic.
+ * @see Cipher::Open()
+ */
+AlaggPacket * LinkManager::Decrypt(Tunnel * tunnel, AlaggPacket * packet,
+                                   int * len) {
+
+    int size = *len - (int) sizeof(AlaggHeader) - CIPHER_OVERHEAD;
+    AlaggPacket *plain = (AlaggPacket *) malloc(sizeof(AlaggHeader)
+                                                + std::max(size, 0));
+    memcpy(plain, packet, sizeof(AlaggHeader));
+    size = tunnel->Encryption()->Open(packet->m_header,
+            (unsigned char const *) packet + sizeof(AlaggHeader),
+            *len - sizeof(AlaggHeader),
+            (unsigned char *) plain + sizeof(AlaggHeader));
+    free(packet);
+    if(size < 0) {
+        free(plain);
+        return nullptr;
+    }
+    *len = sizeof(AlaggHeader) + size;
+    return plain;
+}
+
+/**
+ * Decompress a received packet.
+ *
+ * @param packet The packet, flagged ALAGG_FLAG_COMPRESSED. Ownership is taken.
+ * @param len Size of the packet, updated to the size of the decompressed
+ * packet.
+ * @returns The decompressed packet, or nullptr if the packet is malformed.
+ * @see lz4_decompress()
+ */
+AlaggPacket * LinkManager::Decompress(AlaggPacket * packet, int * len) {
+
+    AlaggPacket *plain = (AlaggPacket *) malloc(sizeof(AlaggHeader)
+                                                + MAX_PKT_SIZE);
+    memcpy(plain, packet, sizeof(AlaggHeader));
+    int size = lz4_decompress(
+            (unsigned char const *) packet + sizeof(AlaggHeader),
+            *len - sizeof(AlaggHeader),
+            (unsigned char *) plain + sizeof(AlaggHeader), MAX_PKT_SIZE);
+    free(packet);
+    if(size < 0) {
+        free(plain);
+        return nullptr;
+    }
+    plain->m_header.m_flags &= ~ALAGG_FLAG_COMPRESSED;
+    *len = sizeof(AlaggHeader) + size;
+    return (AlaggPacket *) realloc(plain, *len);
+}
+
+/**
+ * Compress the packet being sent.
+ *
+ * The packet is compressed once, when it is sent on the first Link that
+ * compresses, and the result is reused for the other Links. Packets that look
+ * incompressible, see lz4_compressible(), or that do not shrink are sent
+ * unmodified. Must be called with the Links locked.
+ *
+ * @param payload Pointer to the packet.
+ * @param size Size of the packet.
+ * @returns True if the packet is to be sent compressed, see
+ * LinkManager::m_compressed, false otherwise.
+ */
+bool LinkManager::Compress(unsigned char const * payload, int size) {
+
+    if( m_compressed_len < 0 ) {
+        m_compressed_len = 0;
+        if( lz4_compressible( payload, size ) ) {
+            m_compressed.resize( size );
+            m_compressed_len = lz4_compress( payload, size,
+                                             m_compressed.data(), size - 1 );
+        }
+    }
+    return m_compressed_len > 0;
+}
+
+/**
+ * Transmit a frame on a Link.
+ *
+ * The frame is queued to the UringEngine if one is used, and sent right away
+ * otherwise, or if the engine has no slot to fit it. Links with a kernel
+ * bypass always transmit on their own. The frame is gathered from the header,
+ * the payload and the trailer, if any, see Link::Trailer(). The payload is not
+ * copied before.
+ *
+ * Regular frames that do not fit into the Link's socket buffer, or that are
+ * held back by pacing, are queued on the Link, and the Link is watched for
+ * writability or the pacing timer is armed. Frames queued behind them are not
+ * handed to the engine, so they stay in order. Frames of paced Links are never
+ * handed to the engine, which cannot pass departure times. Priority frames are
+ * never queued, they are dropped if their socket buffer is full.
+ *
+ * @param link Link to transmit on.
+ * @param header Header of the frame.
+ * @param payload Pointer to the payload.
+ * @param len Size of the payload.
+ * @param priority Whether to transmit on the Link's priority socket. Ignored
+ * by Links with a kernel bypass.
+ */
+void LinkManager::Transmit(Link * link, AlaggHeader const & header,
+                           void const * payload, int len, bool priority) {
+
+    if(m_engine && link->BypassFd() < 0 && !link->Paced()
+            && (priority || link->TxQueued() == 0)) {
+        unsigned char trailer[ALAGG_TRAILER_MAX];
+        struct iovec iov[3];
+        iov[0].iov_base = (void *) &header;
+        iov[0].iov_len  = sizeof(AlaggHeader);
+        iov[1].iov_base = (void *) payload;
+        iov[1].iov_len  = len;
+        iov[2].iov_base = trailer;
+        iov[2].iov_len  = link->Trailer(header, payload, len, trailer);
+        int sock = priority ? link->PrioSocket() : link->Socket();
+        if(m_engine->Send(sock, iov, iov[2].iov_len ? 3 : 2) >= 0) {
+            return;
+        }
+    }
+
+    if(link->BypassFd() >= 0) {
+        link->SendFrame(header, payload, len);
+        return;
+    }
+    if(priority) {
+        link->SendPrioFrame(header, payload, len);
+        return;
+    }
+
+    // First frame queued, wait for the socket or the pacing
+    link->QueueFrame(header, payload, len);
+    if(link->TxQueued() == 1) {
+        uint64_t due = link->PacedUntil();
+        if(due) {
+            ArmPacing(due);
+        } else {
+            WatchTx(link);
+        }
+    }
+}
+
+/**
+ * Transmit the frames queued on a Link.
+ *
+ * If frames are left, the Link is watched for writability, or the pacing
+ * timer is armed for the next frame that is due.
+ *
+ * @param link The Link.
+ */
+void LinkManager::FlushTx(Link * link) {
+
+    if(link->FlushTxQueue()) {
+        return;
+    }
+    uint64_t due = link->PacedUntil();
+    if(due) {
+        ArmPacing(due);
+    } else {
+        WatchTx(link);
+    }
+}
+
+/**
+ * Arm the pacing timer, unless it expires earlier already.
+ *
+ * @param nsec Monotonic time in nanoseconds at which a paced frame is due.
+ */
+void LinkManager::ArmPacing(uint64_t nsec) {
+
+    if(m_pacing_armed_nsec && m_pacing_armed_nsec <= nsec) {
+        return;
+    }
+    m_pacing_armed_nsec = nsec;
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec  = nsec / 1000000000;
+    its.it_value.tv_nsec = nsec % 1000000000;
+    timerfd_settime(m_pacing_fd, TFD_TIMER_ABSTIME, &its, nullptr);
+    errno = 0;
+}
+
+/**
+ * Watch a Link with queued frames for writability.
+ *
+ * The Link's socket is registered one-shot with the transmission epoll
+ * instance, and must be watched again after every event.
+ *
+ * @param link The Link.
+ * @see LinkManager::TxFd()
+ */
+void LinkManager::WatchTx(Link * link) {
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLOUT | EPOLLONESHOT;
+    ev.data.fd = link->Socket();
+    if(epoll_ctl(m_tx_epfd, EPOLL_CTL_MOD, link->Socket(), &ev) < 0
+            && errno == ENOENT) {
+        epoll_ctl(m_tx_epfd, EPOLL_CTL_ADD, link->Socket(), &ev);
+    }
+    errno = 0;
+}
 
 /**
- * Link reception chain
+ * Transmit the frames queued on writable Links.
  *
- * Polls on the aggregated links for reception readiness, and receives on links
- * in a round-robin fashion.
- * If an outdated packet is received on a Link, it is dropped and another
- * reception attempt is made on the same Link. This avoids degeneration of a
- * Link's 'freshness'.
+ * To be called by the transmitting thread whenever LinkManager::TxFd() becomes
+ * readable. Links that cannot send all of their queued frames are watched
+ * again. Once the pacing timer expires, all Links whose frames are held by
+ * pacing are served. Once the probe timer expires, probes are sent, and once
+ * the handshake timer expires, handshakes are.
  *
- * @param t Back-reference to the calling instance of LinkManager
- * @see PacketPool
+ * @see Link::FlushTxQueue()
  */
-void LinkManager::recv_on_links(LinkManager *t) {
+void LinkManager::OnTxReady() {
 
-    AlaggPacket *packet;
-    int byte_rcvd;
-    int idx;
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    int n;
+    do {
+        n = epoll_wait(m_tx_epfd, events, REACTOR_MAX_EVENTS, 0);
+        errno = 0;
 
-    // Poll on links
-    int nfds_rdy = poll(t->m_link_pfds, t->m_link_nfds, -1);
+        std::lock_guard<std::mutex> lock(m_links_lock);
+        for(int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
 
-    // Used for round-robin
-    static unsigned int link_index = 0;
-
-    // Allocate new buffer
-    unsigned char *raw_buf = (unsigned char *) malloc(BUF_SIZE);
+            if(fd == m_probe_fd) {
+                uint64_t expirations;
+                if(read(m_probe_fd, &expirations, sizeof(expirations)) > 0) {
+                    SendProbes();
+                }
+                errno = 0;
+                continue;
+            }
 
-    // Loop over Links
-    for( int i = 0; i < t->m_links.size(); i++ ) {
+            if(fd == m_sync_fd) {
+                uint64_t expirations;
+                if(read(m_sync_fd, &expirations, sizeof(expirations)) > 0) {
+                    SendSyncs();
+                }
+                errno = 0;
+                continue;
+            }
 
-        // Check if link ready. If not, ask next link.
-        if(!(t->m_link_pfds[link_index].revents & LINK_POLL_EVENTS)) {
-                link_index = (link_index+1) % t->m_links.size();
+            if(fd == m_pacing_fd) {
+                uint64_t expirations;
+                if(read(m_pacing_fd, &expirations, sizeof(expirations)) > 0) {
+                    m_pacing_armed_nsec = 0;
+                    for(int j = 0; j < m_links.size(); j++) {
+                        Link *link = m_links[j];
+                        if(link->TxQueued() && link->Paced()
+                                && !link->TxTime()) {
+                            FlushTx(link);
+                        }
+                    }
+                }
+                errno = 0;
                 continue;
+            }
+
+            for(int j = 0; j < m_links.size(); j++) {
+                if(m_links[j]->Socket() == fd) {
+                    FlushTx(m_links[j]);
+                    break;
+                }
+            }
         }
+    } while(n == REACTOR_MAX_EVENTS);
+}
 
-        /*
-         * Keep receiving on a link until a valid packet is received or no data
-         * is available (EAGAIN, EWOULDBLOCK)
-         */
+/**
+ * Send a probe on every Link that is up.
+ *
+ * With SCHEDULER_ADAPTIVE, a report request is sent after the Link's frames as
+ * well, and the Tunnels' redundancy is updated. Must be called with the Links
+ * locked.
+ *
+ * @see Link::SendProbe()
+ * @see Link::OnReport()
+ */
+void LinkManager::SendProbes() {
 
-        do {
-            byte_rcvd = recv( t->m_links[link_index]->Socket(),
-                    raw_buf,
-                    BUF_SIZE, 0 );
-            if( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) {
-                // No data avilable, continue on next link
-                errno = 0;
-                break;
+    for(int i = 0; i < m_links.size(); i++) {
+        Link *link = m_links[i];
+        if(!link->Up()) {
+            continue;
+        }
+        link->SendProbe();
+
+        if(m_scheduler == SCHEDULER_ADAPTIVE) {
+            AlaggHeader header = link->TxHeader();
+            header.m_flags = ALAGG_FLAG_REPORT;
+            AlaggReport report;
+            memset(&report, 0, sizeof(report));
+            report.m_tx_packets = link->TxPackets();
+            unsigned char sealed[sizeof(report) + CIPHER_OVERHEAD];
+            int size = link->SealControl(header, &report, sizeof(report),
+                                         sealed);
+            if(size >= 0) {
+                Transmit(link, header, sealed, size, false);
             }
-            assert_perror(errno);
+        }
+    }
 
-            if( byte_rcvd == 0 ) {
-                // Shouldn't happen
-                std::cerr << "ERROR: Received 0 bytes" << std::endl;
-                break;
+    if(m_scheduler == SCHEDULER_ADAPTIVE) {
+        uint64_t now = now_nsec();
+        if(m_redundancy_nsec && now > m_redundancy_nsec) {
+            for(int t = 0; t < m_tunnels.size(); t++) {
+                UpdateRedundancy(m_tunnels[t], now - m_redundancy_nsec);
+            }
+        }
+        m_redundancy_nsec = now;
+    }
+}
 
-            } else {
+/**
+ * Report missing packets to the remote aggregator.
+ *
+ * The NACK is sent on the priority sockets of all Links of the Tunnel carrying
+ * the traffic class that are up, so it is not held back by data, and arrives
+ * unless all Links lose it. NACKs of encrypted Tunnels are sealed, see
+ * Link::SealControl(). Called by the receiving thread, from the reordering of
+ * the class's PacketPool.
+ *
+ * @param tunnel The Tunnel.
+ * @param cls Id of the traffic class.
+ * @param first Sequence number of the first packet reported.
+ * @param missing Bitmap of the missing packets, see AlaggNack.
+ * @see PacketPool::OnGap()
+ */
+void LinkManager::SendNack(Tunnel * tunnel, int cls, alagg_seq_t first,
+                           uint64_t missing) {
 
-                /*
-                 * Packet received
-                 */
+    AlaggNack nack;
+    nack.m_first   = first;
+    nack.m_missing = missing;
 
-                packet = (AlaggPacket *) raw_buf;
+    for(int i = 0; i < m_links.size(); i++) {
+        Link *link = m_links[i];
+        if(link->Tunnel() != tunnel->Id() || !link->Up()
+                || !link->Carries(cls)) {
+            continue;
+        }
+        AlaggHeader header = link->TxHeader();
+        header.m_flags = ALAGG_FLAG_NACK;
+        header.m_class = cls;
+        unsigned char sealed[sizeof(nack) + CIPHER_OVERHEAD];
+        int size = link->SealControl(header, &nack, sizeof(nack), sealed);
+        if(size >= 0) {
+            link->SendControlFrame(header, sealed, size);
+        }
+    }
+}
 
-                // Debug
-                // print_buffer(buf.data(), buf.size());
+/**
+ * Retransmit packets reported missing by the remote aggregator.
+ *
+ * The packets are taken from the RetransmitBuffer of their traffic class, and
+ * sent once on the priority socket of the Link carrying the class with the
+ * lowest one-way delay, see Link::OneWayDelay(). Packets that would arrive
+ * after the remote aggregator flushed them, i.e. sent longer ago than the
+ * class's reorder timeout less the Link's delay, are not sent again. Neither
+ * are packets exceeding the Link's MTU, whose fragments would interleave with
+ * the fragments of regular frames. Called by the receiving thread.
+ *
+ * @param frame Pointer to the received frame, flagged ALAGG_FLAG_NACK.
+ * @param len Size of the frame.
+ */
+void LinkManager::OnNack(unsigned char const * frame, int len) {
 
-                // Push the packet to the PacketPool
-                t->Add(packet, byte_rcvd);
-                link_index = (link_index+1) % t->m_links.size();
-                return;
-            }
-        } while(true);
+    if(len < (int) (sizeof(AlaggHeader) + sizeof(AlaggNack))) {
+        return;
+    }
+    AlaggHeader const * header = (AlaggHeader const *) frame;
+    Tunnel *tunnel = m_tunnel_ids[header->m_tunnel];
+    int cls = header->m_class;
+    if(cls && !tunnel->Class(cls)) {
+        return;
+    }
+    AlaggNack nack;
+    memcpy(&nack, frame + sizeof(AlaggHeader), sizeof(nack));
+
+    // Fastest Link carrying the class
+    Link *fastest = nullptr;
+    for(int i = 0; i < m_links.size(); i++) {
+        Link *l = m_links[i];
+        if(l->Tunnel() != tunnel->Id() || !l->Up() || !l->Carries(cls)) {
+            continue;
+        }
+        if(!fastest || (l->OneWayDelay() && (!fastest->OneWayDelay()
+                        || l->OneWayDelay() < fastest->OneWayDelay()))) {
+            fastest = l;
+        }
+    }
+    if(!fastest) {
+        return;
+    }
 
-        link_index = (link_index+1) % t->m_links.size();
+    uint64_t now = now_nsec();
+    uint64_t budget = tunnel->ReorderTimeout(cls) * 1000000ULL;
+    if(budget <= fastest->OneWayDelay()) {
+        return;
     }
+    budget -= fastest->OneWayDelay();
+    uint64_t sent_after = now > budget ? now - budget : 0;
 
-    // No packet could be received, free the allocated buffer
-    free(raw_buf);
+    Buffer buf;
+    for(int i = 0; i < ALAGG_NACK_SPAN; i++) {
+        if(!(nack.m_missing & (1ULL << i))) {
+            continue;
+        }
+        alagg_seq_t seq = (nack.m_first + i) % ALAGG_MAX_SEQ;
+        if(!tunnel->Retransmits(cls).Take(seq, sent_after, buf)
+                || buf.size() > fastest->MaxPayload()) {
+            continue;
+        }
+        AlaggHeader out = fastest->TxHeader();
+        out.m_seq = seq;
+        out.m_class = cls;
+        fastest->SendControlFrame(out, buf.data(), buf.size());
+    }
 }
 
 /**
- * LinkManager class constructor.
+ * Send handshakes to the remote aggregators.
+ *
+ * A handshake is sent for every Tunnel that requests the remote aggregator's
+ * session, or owes an answer to its request, on the priority sockets of all
+ * Links of the Tunnel that are up. Handshakes of encrypted Tunnels are sealed,
+ * so the challenges and sequence numbers are authenticated. Must be called
+ * with the Links locked.
  *
- * Initializes the aggregated links and starts the Link reception thread.
+ * @see ALAGG_FLAG_SYNC
+ * @see Tunnel::Sync()
+ */
+void LinkManager::SendSyncs() {
+
+    for(int t = 0; t < m_tunnels.size(); t++) {
+        Tunnel *tunnel = m_tunnels[t];
+        uint64_t echo = tunnel->TakeSyncReply();
+        if(!tunnel->SyncRequested() && !echo) {
+            continue;
+        }
+
+        AlaggSync sync;
+        memset(&sync, 0, sizeof(sync));
+        int size = tunnel->Sync(sync, echo);
+        unsigned char const * payload = (unsigned char const *) &sync;
+
+        AlaggHeader header;
+        memset(&header, 0, sizeof(header));
+        header.m_tunnel = tunnel->Id();
+        header.m_flags = ALAGG_FLAG_SYNC;
+        header.m_epoch = m_epoch;
+        if(tunnel->Encryption()) {
+            m_sealed.resize(size + CIPHER_OVERHEAD);
+            size = tunnel->Encryption()->Seal(header, payload, size,
+                                              m_sealed.data());
+            if(size < 0) {
+                continue;
+            }
+            payload = m_sealed.data();
+        }
+
+        for(int i = 0; i < m_links.size(); i++) {
+            Link *link = m_links[i];
+            if(link->Tunnel() != tunnel->Id() || !link->Up()) {
+                continue;
+            }
+            AlaggHeader out = link->TxHeader();
+            out.m_flags = ALAGG_FLAG_SYNC;
+            out.m_class = 0;
+            out.m_seq = 0;
+            link->SendControlFrame(out, payload, size);
+        }
+    }
+}
+
+/**
+ * Handle a handshake of the remote aggregator.
  *
- * @param peer_addresses Vector of the link peers' addresses as string.
- * @param if_names Vector of the interface names associated with the peers, as
- * strings.
+ * An answer echoing the challenge of the Tunnel's pending request switches to
+ * the remote aggregator's session, see Tunnel::AcceptSync(). A request is
+ * answered right away. A handshake of another session than the known one
+ * makes the Tunnel request the remote aggregator's current session, but never
+ * switches to it by itself, so replayed handshakes of old sessions are
+ * harmless. Likewise, the salt of an encrypted handshake is only adopted by
+ * the Cipher once the handshake answered the challenge, see Cipher::Trust().
+ * Called by the receiving thread.
  *
- * @see Link
- * @see SafeQueue
- * @see PipedThread
- * @see PacketPool
+ * @param link The Link the handshake was received on.
+ * @param tunnel The Tunnel of the Link.
+ * @param frame Pointer to the received frame, flagged ALAGG_FLAG_SYNC.
+ * @param len Size of the frame.
+ * @see Tunnel::AcceptSync()
  */
-LinkManager::LinkManager(std::vector<std::string> peer_addresses,
-                         std::vector<std::string> if_names)
-                         : PacketPool(ALAGG_REORDER_TTL)
-                         , m_tx_seq(1) {
+void LinkManager::OnSync(Link * link, Tunnel * tunnel,
+                         unsigned char const * frame, int len) {
 
-    // Initialize links
-    for( int i = 0; i < peer_addresses.size(); i++ ) {
-        m_links.push_back( new Link(if_names[i], peer_addresses[i]) );
+    AlaggHeader const * header = (AlaggHeader const *) frame;
+    unsigned char const * payload = frame + sizeof(AlaggHeader);
+    len -= sizeof(AlaggHeader);
+
+    AlaggSync sync;
+    memset(&sync, 0, sizeof(sync));
+    Buffer opened;
+    unsigned char const * sealed = payload;
+    if(tunnel->Encryption()) {
+        opened.resize(std::max<int>(len - CIPHER_OVERHEAD, 0));
+        len = tunnel->Encryption()->OpenSync(*header, payload,
+                                             len, opened.data());
+        if(len < 0) {
+            link->CountCorrupt();
+            return;
+        }
+        payload = opened.data();
+    }
+    int head = offsetof(AlaggSync, m_seqs);
+    if(len < head) {
+        return;
     }
+    memcpy(&sync, payload, head);
+    if(sync.m_count > ALAGG_MAX_CLASS + 2
+            || len < head + sync.m_count * (int) sizeof(alagg_seq_t)) {
+        return;
+    }
+    memcpy(sync.m_seqs, payload + head, sync.m_count * sizeof(alagg_seq_t));
 
-    // Start the reception thread
-    SetThread(recv_on_links, this, PipedThread::exec_repeat);
+    // A new session of the remote aggregator accepts the control frames'
+    // salt only by its counters, so they start over
+    bool arm = false;
+    uint16_t known = tunnel->PeerEpoch();
+    if(sync.m_echo && tunnel->AcceptSync(header->m_epoch, sync)
+            && tunnel->Encryption()) {
+        tunnel->Encryption()->Trust(sealed);
+        if(header->m_epoch != known) {
+            tunnel->ControlEncryption()->Restart();
+        }
+    }
+    if(header->m_epoch != tunnel->PeerEpoch()) {
+        arm |= tunnel->RequestSync();
+    }
+    if(sync.m_challenge) {
+        tunnel->OweSync(sync.m_challenge);
+        arm = true;
+    }
+    if(arm) {
+        ArmSync();
+    }
+}
+
+/**
+ * Send handshakes right away, and every LINK_SYNC_INTERVAL_MSEC after.
+ *
+ * Handshakes are only sent while any Tunnel needs them, see
+ * LinkManager::SendSyncs().
+ */
+void LinkManager::ArmSync() {
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_nsec = 1;
+    its.it_interval.tv_sec = LINK_SYNC_INTERVAL_MSEC / 1000;
+    its.it_interval.tv_nsec = (LINK_SYNC_INTERVAL_MSEC % 1000) * 1000000;
+    timerfd_settime(m_sync_fd, 0, &its, nullptr);
+}
+
+/**
+ * Update the number of Links a Tunnel's packets are sent on.
+ *
+ * The Tunnel's Links that are up are ranked by their share of first arrivals
+ * at the remote aggregator, so copies are sent on the Links delivering first,
+ * then by their loss and their delay. The number of copies is the least
+ * number of Links by rank whose combined loss meets the delivery target, see
+ * LinkManager::SetRedundancyTarget(). Links whose loss is not measured yet
+ * count as lossy, so packets are replicated on all Links until they are.
+ *
+ * Every Link carrying a copy must fit the Tunnel's offered load within
+ * LINK_REDUNDANCY_LOAD of its line rate, which may reduce the copies below the
+ * delivery target. If even the first Link does not fit the load, single
+ * copies are striped over all Links, see LinkManager::EarliestLinks(). Must be
+ * called with the Links locked.
+ *
+ * @param tunnel The Tunnel.
+ * @param interval_nsec Time since the previous update in nanoseconds.
+ */
+void LinkManager::UpdateRedundancy(Tunnel * tunnel, uint64_t interval_nsec) {
+
+    // Offered load, smoothed over two intervals
+    uint64_t bps = tunnel->TakeTxBytes() * 8 * 1000000000 / interval_nsec;
+    uint64_t offered = (tunnel->OfferedRate() + bps) / 2;
+    tunnel->SetOfferedRate(offered);
 
-    // Construct struct pollfd[] for polling, and set the related events.
-    m_link_pfds = (struct pollfd *)
-        malloc(m_links.size() * sizeof(struct pollfd));
+    // Rank the Links on a snapshot of their measurements
+    struct Ranked {
+        Link    *m_link;
+        double   m_first;
+        double   m_loss;
+        uint64_t m_owd;
+    };
+    std::vector<Ranked> links;
     for(int i = 0; i < m_links.size(); i++) {
-        m_link_pfds[i].fd = m_links[i]->Socket();
-        m_link_pfds[i].events = LINK_POLL_EVENTS;
+        Link *link = m_links[i];
+        if(link->Tunnel() == tunnel->Id() && link->Up()) {
+            links.push_back({ link, link->FirstShare(), link->Loss(),
+                              link->OneWayDelay() });
+        }
+    }
+    if(links.empty()) {
+        return;
+    }
+    std::stable_sort(links.begin(), links.end(),
+            [](Ranked const & a, Ranked const & b) {
+                if(a.m_first != b.m_first) {
+                    return a.m_first > b.m_first;
+                }
+                if(a.m_loss != b.m_loss) {
+                    return a.m_loss < b.m_loss;
+                }
+                return a.m_owd < b.m_owd;
+            });
+    for(int i = 0; i < links.size(); i++) {
+        links[i].m_link->SetRank(i);
+    }
+
+    // Copies needed to meet the delivery target
+    int copies = links.size();
+    double miss = 1;
+    for(int i = 0; i < links.size(); i++) {
+        miss *= links[i].m_loss;
+        if(1 - miss >= m_redundancy_target) {
+            copies = i + 1;
+            break;
+        }
+    }
+
+    // Copies the Links can carry
+    int fit = 0;
+    while(fit < links.size() && links[fit].m_link->LineRate()
+            * LINK_REDUNDANCY_LOAD >= offered) {
+        fit++;
+    }
+
+    if(fit == 0) {
+        tunnel->SetRedundancy(1, true);
+    } else {
+        tunnel->SetRedundancy(std::min(copies, fit), false);
+    }
+}
+
+/**
+ * Check whether transmission should pause.
+ *
+ * Since packets are replicated on all Links of their Tunnel, a congested Link
+ * only drops its copies. Transmission should pause once every Link that is up
+ * is congested in any Tunnel, since its packets would be lost entirely.
+ *
+ * @returns True if all Links of a Tunnel hold at least LINK_TX_QUEUE_HIGH
+ * queued frames, false otherwise.
+ */
+bool LinkManager::TxBlocked() const {
+
+    std::lock_guard<std::mutex> lock(m_links_lock);
+    for(int t = 0; t < m_tunnels.size(); t++) {
+        int up = 0, congested = 0;
+        for(int i = 0; i < m_links.size(); i++) {
+            Link const *link = m_links[i];
+            if(link->Tunnel() != m_tunnels[t]->Id() || !link->Up()) {
+                continue;
+            }
+            up++;
+            if(link->TxQueued() >= LINK_TX_QUEUE_HIGH) {
+                congested++;
+            }
+        }
+        if(up > 0 && congested == up) {
+            return true;
+        }
     }
-    m_link_nfds = m_links.size();
+    return false;
 }
 
 /**
  * LinkManager class desctructor.
  *
- * Deallocates the associated Link objects.
+ * Deallocates the associated Link and Tunnel objects.
  *
  * @see Link
  */
@@ -130,44 +1709,400 @@ LinkManager::~LinkManager() {
     for(int i = 0; i < m_links.size(); i++) {
         delete m_links[i];
     }
+    for(int i = 0; i < m_tunnels.size(); i++) {
+        delete m_tunnels[i];
+    }
+    close(m_ctl_fd);
+    close(m_tx_epfd);
+    close(m_pacing_fd);
+    close(m_probe_fd);
+    close(m_sync_fd);
+}
+
+/**
+ * Classify a packet into a Tunnel.
+ *
+ * The packet belongs to the first Tunnel whose firewall mark matches, or else
+ * to the Tunnel with the longest destination prefix matching the packet's IPv4
+ * destination address. With a single Tunnel, all packets belong to it.
+ *
+ * @param data Pointer to the IP packet.
+ * @param size Size of the packet.
+ * @param mark Firewall mark of the packet.
+ * @returns The Tunnel, or nullptr if the packet matches no Tunnel.
+ */
+Tunnel * LinkManager::Classify(unsigned char const * data, int size,
+                               uint32_t mark) const {
+
+    if(m_tunnels.size() == 1) {
+        return m_tunnels[0];
+    }
+
+    if(mark) {
+        for(int i = 0; i < m_tunnels.size(); i++) {
+            if(m_tunnels[i]->FwMark() == mark) {
+                return m_tunnels[i];
+            }
+        }
+    }
+
+    if(size < IP_HEADER_OFFSET + IP_HEADER_DST_ADDR_OFFSET + IP_ADDR_LEN) {
+        return nullptr;
+    }
+    uint32_t daddr;
+    memcpy(&daddr, data + IP_HEADER_OFFSET + IP_HEADER_DST_ADDR_OFFSET,
+           IP_ADDR_LEN);
+    for(int i = 0; i < m_routes.size(); i++) {
+        if(m_routes[i].first.Contains(daddr)) {
+            return m_routes[i].second;
+        }
+    }
+
+    return nullptr;
 }
 
 /**
  * Link transmission.
  *
- * Send a packet via the aggregated links.
+ * Send a packet via the aggregated links of its Tunnel, according to its
+ * traffic class, see LinkManager::SendOn() and Tunnel::Classify().
+ *
+ * Pure TCP ACKs are prioritized and thinned, if enabled. Thinned ACKs are held
+ * in the Tunnel's AckFilter, and sent before any other packet of their flow.
+ *
+ * @param data Pointer to the packet to be sent.
+ * @param size Size of the packet.
+ * @param mark Firewall mark of the packet, used for classification.
+ * @returns 0, or -1 if the packet exceeds MAX_PKT_SIZE or matches no Tunnel.
+ * @see LinkManager::Classify()
+ * @see LinkManager::SetAckPriority()
+ * @see LinkManager::SetAckThinning()
+ */
+int LinkManager::Send(void const * data, int size, uint32_t mark) {
+
+    if(size > MAX_PKT_SIZE) {
+        std::cerr << "ERROR: Packet of " << size
+            << " bytes exceeds maximum packet size" << std::endl;
+        return -1;
+    }
+
+    unsigned char const * payload = (unsigned char const *) data;
+    Tunnel *tunnel = Classify(payload, size, mark);
+    if(!tunnel) {
+        return -1;
+    }
+
+    int cls = tunnel->Classify(payload, size, mark);
+    if(!m_ack_priority && !m_ack_thinning) {
+        SendOn(tunnel, cls, payload, size, false);
+        return 0;
+    }
+
+    bool ack = AckFilter::IsPureAck(payload, size);
+    if(m_ack_thinning) {
+        if(ack) {
+            tunnel->Acks().Add(payload, size);
+        } else {
+            tunnel->Acks().Release(payload, size);
+        }
+        SendAcks(tunnel);
+        if(ack) {
+            return 0;
+        }
+    }
+
+    SendOn(tunnel, cls, payload, size, ack && m_ack_priority);
+    return 0;
+}
+
+/**
+ * Send the ACKs output by a Tunnel's AckFilter.
+ *
+ * The ACKs' firewall marks are not kept, so they are classified by their DSCP
+ * values only.
+ *
+ * @param tunnel The Tunnel.
+ */
+void LinkManager::SendAcks(Tunnel * tunnel) {
+
+    std::vector<Buffer *> const & out = tunnel->Acks().Out();
+    for(int i = 0; i < out.size(); i++) {
+        int cls = tunnel->Classify(out[i]->data(), out[i]->size(), 0);
+        SendOn(tunnel, cls, out[i]->data(), out[i]->size(), m_ack_priority);
+        delete out[i];
+    }
+    tunnel->Acks().ClearOut();
+}
+
+/**
+ * Send the ACKs held for thinning.
+ *
+ * Called at the end of every burst of packets sent, so ACKs are held no
+ * longer than the burst.
+ *
+ * @see LinkManager::SetAckThinning()
+ */
+void LinkManager::FlushAcks() {
+
+    if(!m_ack_thinning) {
+        return;
+    }
+    for(int i = 0; i < m_tunnels.size(); i++) {
+        m_tunnels[i]->Acks().Flush();
+        SendAcks(m_tunnels[i]);
+    }
+}
+
+/**
+ * Send a packet on the Links of a Tunnel.
+ *
+ * Frames are built from the Link's header template and the packet, which is
+ * transmitted in place, e.g. right from the netfilter queue's buffer.
+ *
+ * Packets exceeding a Link's MTU are split into fragments carrying the same
+ * sequence number, and reassembled by the receiving Link's Defragmenter. Since
+ * every Link is fragmented according to its own MTU, jumbo-capable links carry
+ * large packets unfragmented. Links that are down are skipped.
+ *
+ * Unordered packets are numbered in the Tunnel's unordered sequence space and
+ * sent on the Links' priority sockets. They are never fragmented, Links they
+ * do not fit are skipped.
+ *
+ * With SCHEDULER_ECT, other packets are sent on a single Link only, see
+ * LinkManager::EarliestLinks(). With SCHEDULER_ADAPTIVE, they are sent on the
+ * Links ranked below the Tunnel's redundancy, or on a single Link like with
+ * SCHEDULER_ECT while the Tunnel is striping, see
+ * LinkManager::UpdateRedundancy(). Unordered packets are replicated
+ * regardless.
+ *
+ * Packets of a TrafficClass are numbered in the class's sequence space, and
+ * sent on the Links carrying the class only, see Link::Carries(). They are
+ * replicated on all of them, or sent on the TrafficClass::Copies() Links they
+ * are expected to arrive first on, regardless of the scheduler.
+ *
+ * Packets of Tunnels with a Cipher are encrypted before they are sent, see
+ * Tunnel::Encryption(). Packets too large to be encrypted are dropped. With
+ * ARQ enabled, ordered packets are kept for retransmission, see
+ * LinkManager::SetArq().
  *
- * @param buf Buffer object containing the packet to be sent.
- * @returns The return value of the underlying send() call.
+ * @param tunnel The Tunnel.
+ * @param cls Id of the packet's traffic class, ignored for unordered packets.
+ * @param payload Pointer to the packet to be sent.
+ * @param size Size of the packet.
+ * @param unordered Whether the packet bypasses reordering, see
+ * ALAGG_FLAG_UNORDERED.
  * @see Link
+ * @see Link::TxHeader()
+ * @see Defragmenter
  */
-int LinkManager::Send(Buffer const * buf) {
+void LinkManager::SendOn(Tunnel * tunnel, int cls,
+                         unsigned char const * payload, int size,
+                         bool unordered) {
 
-    int packet_size = sizeof(AlaggPacket) + buf->size();
-    AlaggPacket *packet = (AlaggPacket *) malloc(packet_size);
+    if( unordered ) {
+        cls = 0;
+    }
+    TrafficClass const *tc = tunnel->Class(cls);
+    alagg_seq_t seq = unordered ? tunnel->NextUnorderedTxSeq()
+                                : tunnel->NextTxSeq(cls);
+
+    // Encrypt once for all Links, fragments and retransmissions
+    if( tunnel->Encryption() ) {
+        if( size + CIPHER_OVERHEAD > MAX_PKT_SIZE ) {
+            return;
+        }
+        AlaggHeader header;
+        memset( &header, 0, sizeof(header) );
+        header.m_tunnel = tunnel->Id();
+        header.m_class = cls;
+        header.m_seq = seq;
+        header.m_flags = unordered ? ALAGG_FLAG_UNORDERED : 0;
+        header.m_epoch = m_epoch;
+        m_sealed.resize( size + CIPHER_OVERHEAD );
+        size = tunnel->Encryption()->Seal( header, payload, size,
+                                           m_sealed.data() );
+        if( size < 0 ) {
+            return;
+        }
+        payload = m_sealed.data();
+    }
+
+    if( m_arq && !unordered ) {
+        tunnel->Retransmits(cls).Store( seq, payload, size, now_nsec() );
+    }
+
+    // Compressed once the first slow Link sends the packet
+    m_compressed_len = tunnel->Encryption() ? 0 : -1;
+
+    std::lock_guard<std::mutex> lock(m_links_lock);
+
+    if( tc && tc->Copies() ) {
+        uint64_t now = now_nsec();
+        Link *links[CLASS_MAX_COPIES];
+        int n = EarliestLinks( tunnel, cls, size, now, links, tc->Copies() );
+        for( int i = 0; i < n; i++ ) {
+            links[i]->Schedule( size, now );
+            SendFrames( links[i], cls, seq, payload, size );
+        }
+        return;
+    }
+
+    if( !tc && !unordered && m_scheduler != SCHEDULER_REPLICATE ) {
+        uint64_t now = now_nsec();
+        tunnel->CountTx( size );
+
+        if( m_scheduler == SCHEDULER_ADAPTIVE && !tunnel->Striping() ) {
+            bool sent = false;
+            for( int i = 0; i < m_links.size(); i++ ) {
+                Link *link = m_links[i];
+                if( link->Tunnel() != tunnel->Id() || !link->Up()
+                        || link->Rank() >= tunnel->Redundancy() ) {
+                    continue;
+                }
+                link->Schedule( size, now );
+                SendFrames( link, 0, seq, payload, size );
+                sent = true;
+            }
+            // The ranked Links went down since the last update
+            if( sent ) {
+                return;
+            }
+        }
 
-    // Construct packet
-    bzero(packet, packet_size);
-    memcpy(packet->m_payload, buf->data(), buf->size());
-    packet->m_header.m_eth_header.ether_type = ETH_P_ALAGG;
-    packet->m_header.m_seq = NextTxSeq();
+        Link *link;
+        if( EarliestLinks( tunnel, 0, size, now, &link, 1 ) ) {
+            link->Schedule( size, now );
+            SendFrames( link, 0, seq, payload, size );
+        }
+        return;
+    }
 
     // Loop over links
     for( int i = 0; i < m_links.size(); i++ ) {
-        // Prepare ethernet header
-        memcpy( packet->m_header.m_eth_header.ether_shost,
-                m_links[i]->OwnAddr().Addr().data(),
-                MAC_ADDRLEN );
-        memcpy( packet->m_header.m_eth_header.ether_dhost,
-                m_links[i]->PeerAddr().Addr().data(),
-                MAC_ADDRLEN );
+        Link *link = m_links[i];
+        if( link->Tunnel() != tunnel->Id() || !link->Up()
+                || !link->Carries(cls) ) {
+            continue;
+        }
+
+        if( unordered ) {
+            if( size <= link->MaxPayload() ) {
+                AlaggHeader header = link->TxHeader();
+                header.m_seq = seq;
+                header.m_flags = ALAGG_FLAG_UNORDERED;
+                Transmit( link, header, payload, size, true );
+            }
+            continue;
+        }
 
-        send( m_links[i]->Socket(), packet, packet_size, 0 );
-        errno = 0; assert_perror(errno);
+        SendFrames( link, cls, seq, payload, size );
     }
+}
 
-    free(packet);
-    return 0;
+/**
+ * Send a packet on a Link.
+ *
+ * Packets are compressed first if the Link compresses, see
+ * LinkManager::Compress(). Packets exceeding the Link's MTU are fragmented.
+ * The packet is counted on the Link, see Link::TxPackets(). Must be called
+ * with the Links locked.
+ *
+ * @param link The Link.
+ * @param cls Id of the packet's traffic class.
+ * @param seq Sequence number of the packet.
+ * @param payload Pointer to the packet.
+ * @param size Size of the packet.
+ */
+void LinkManager::SendFrames(Link * link, int cls, alagg_seq_t seq,
+                             unsigned char const * payload, int size) {
+
+    AlaggHeader header = link->TxHeader();
+    header.m_seq = seq;
+    header.m_class = cls;
+    link->CountTx();
+
+    if( link->Compresses() && Compress( payload, size ) ) {
+        payload = m_compressed.data();
+        size = m_compressed_len;
+        header.m_flags = ALAGG_FLAG_COMPRESSED;
+        link->CountCompressed();
+    }
+
+    if( size <= link->MaxPayload() ) {
+        Transmit( link, header, payload, size, false );
+        return;
+    }
+
+    // Fragment the packet according to the link's MTU
+    int frag_payload = link->MaxPayload();
+    for( int off = 0; off < size; off += frag_payload ) {
+        int len = std::min(frag_payload, size - off);
+        header.m_frag_off = off;
+        header.m_flags = (header.m_flags & ~ALAGG_FLAG_MF)
+                       | ((off + len < size) ? ALAGG_FLAG_MF : 0);
+        Transmit( link, header, payload + off, len, false );
+    }
+}
+
+/**
+ * Choose the Links a packet is expected to arrive first on.
+ *
+ * The arrival time combines the Link's backlog, the packet's transmission
+ * time at the Link's line rate and the Link's measured one-way delay, see
+ * Link::ExpectedArrival(). Since packets take the Link they arrive first on,
+ * they arrive about in order, and the remote PacketPool holds few of them,
+ * while every Link is kept busy. Links holding LINK_TX_QUEUE_HIGH queued
+ * frames are only chosen if all Links do, so fast Links do not overflow their
+ * queues. Must be called with the Links locked.
+ *
+ * @param tunnel Tunnel of the packet.
+ * @param cls Id of the packet's traffic class. Only Links carrying the class
+ * are chosen.
+ * @param size Size of the packet.
+ * @param now Current monotonic time in nanoseconds.
+ * @param links Array the Links are stored in, earliest first.
+ * @param max Number of Links to be chosen, at most CLASS_MAX_COPIES.
+ * @returns The number of Links chosen, less than max if fewer Links of the
+ * Tunnel are up.
+ */
+int LinkManager::EarliestLinks(Tunnel * tunnel, int cls, int size,
+                               uint64_t now, Link ** links, int max) const {
+
+    uint64_t keys[CLASS_MAX_COPIES];
+    int n = 0;
+    max = std::min(max, CLASS_MAX_COPIES);
+
+    for( int i = 0; i < m_links.size(); i++ ) {
+        Link *link = m_links[i];
+        if( link->Tunnel() != tunnel->Id() || !link->Up()
+                || !link->Carries(cls) ) {
+            continue;
+        }
+
+        // Congested Links sort after all others
+        uint64_t key = link->ExpectedArrival( size, now );
+        if( link->TxQueued() >= LINK_TX_QUEUE_HIGH ) {
+            key |= (uint64_t) 1 << 63;
+        }
+
+        // Insert in order, replacing the latest Link if all are taken
+        int j;
+        if( n < max ) {
+            j = n++;
+        } else if( key < keys[max - 1] ) {
+            j = max - 1;
+        } else {
+            continue;
+        }
+        while( j > 0 && keys[j - 1] > key ) {
+            keys[j] = keys[j - 1];
+            links[j] = links[j - 1];
+            j--;
+        }
+        keys[j] = key;
+        links[j] = link;
+    }
+    return n;
 }
 
 /**
@@ -175,24 +2110,43 @@ int LinkManager::Send(Buffer const * buf) {
  *
  * Hook function to receive on the aggregated links. Note that actual link
  * reception is perform by LinkManager::recv_on_links(). After received packets
- * traverse the PacketPool, they are pushed to a SafeQueue object and then ready
- * for further processing.
- * This function simply performs SafeQueue::Pop() routine.
+ * traverse their Tunnel's PacketPool, they are pushed to a SafeQueue object and
+ * then ready for further processing.
+ * This function pops a single packet.
  *
  * @returns Pointer to a the Buffer objects containing the received packet, or
  * nullptr, if the the SafeQueue is empty.
+ * @see LinkManager::Recv(Buffer **, int)
  * @see SafeQueue
  * @see PacketPool
  */
 Buffer const * LinkManager::Recv() {
-    if(Empty()) {
+    Buffer *buf;
+    if(Recv(&buf, 1) == 0) {
         return nullptr;
-    } else {
-        Buffer *buf = Front();
-        Pop();
-        // Read a byte from the pipe stream
-        EmptyPipe();
-        return buf;
     }
+    return buf;
+}
+
+/**
+ * Batched link reception.
+ *
+ * Like LinkManager::Recv(), but pops all ready packets up to a maximum at
+ * once, taking the SafeQueue's lock and reading the pipe only once.
+ *
+ * @param bufs Array to be filled with pointers to the received packets.
+ * @param max Maximum number of packets to be received.
+ * @returns The number of packets received, 0 if the SafeQueue is empty.
+ */
+int LinkManager::Recv(Buffer ** bufs, int max) {
+
+    int n = PopBatch(bufs, max);
+    if(n > 0) {
+        EmptyPipe(n);
+    }
+    for(int i = 0; i < n; i++) {
+        BufferBudget::Release(bufs[i]->size());
+    }
+    return n;
 }
 
@@ -8,20 +8,59 @@
 #include "piped_thread.hh"
 #include "safe_queue.hh"
 #include "link.hh"
-#include "packet_pool.hh"
+#include "xdp_link.hh"
+#include "tunnel.hh"
+#include "config.hh"
+#include "uring_engine.hh"
+#include "reactor.hh"
+#include "link_monitor.hh"
 #include "common.hh"
+#include "buffer_budget.hh"
 
+#include <atomic>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <string.h>
-#include <poll.h>
 
 /**
- * Definition of poll events used to poll on link status.
- *
- * These include any data reception.
+ * Maximum number of frames received on a Link before the other Links are
+ * served.
+ */
+#define LINK_RX_BUDGET 64
+
+/**
+ * Number of buffers provided to the UringEngine for Link reception.
+ */
+#define LINK_URING_BUFS 256
+
+/**
+ * Maximum number of packets queued for delivery. Does not exceed the capacity
+ * of the notification pipe, at least a page, so notifying never fails.
+ */
+#define LINK_RX_QUEUE_LEN 4096
+
+/**
+ * Share of a Link's line rate the copies of a Tunnel's packets may occupy,
+ * before the adaptive scheduler sends fewer copies.
  */
-#define LINK_POLL_EVENTS (POLLIN | POLLRDNORM | POLLRDBAND | POLLPRI)
+#define LINK_REDUNDANCY_LOAD 0.8
+
+/**
+ * Policies distributing the packets of a Tunnel over its Links.
+ */
+enum LinkScheduler {
+    // Every packet is sent on all Links
+    SCHEDULER_REPLICATE,
+    // Every packet is sent on the Link it is expected to arrive first on
+    SCHEDULER_ECT,
+    // Every packet is sent on as many Links as needed to reach a delivery
+    // target, or striped like SCHEDULER_ECT under high load
+    SCHEDULER_ADAPTIVE
+};
 
 /**
  * LinkManager class
@@ -29,76 +68,351 @@
  * The LinkManager class handles the aggregated links, which are stored as
  * instances of Link. The implementation is multi-threaded. Once the class is
  * constructed, a new PipedThread is spawned that continuously calls
- * LinkManager::recv_on_links().
+ * LinkManager::recv_on_links(), which waits for readable Links using a
+ * Reactor.
+ *
+ * Every Link belongs to a Tunnel. Once a packet is received, it is pushed to
+ * its Tunnel's PacketPool, via PacketPool::Add(). The PacketPool will push it
+ * to a SafeQueue, or defer the packet if it was received out-of-order and push
+ * it at a later time. After a packet was pushed to the SafeQueue, the pipe
+ * openend by PipedThread will be notified. All Tunnels share the SafeQueue,
+ * the reception thread and the Reactor. Packets to be sent are classified into
+ * Tunnels by firewall mark and destination address, see
+ * LinkManager::Classify().
+ *
+ * Frames that do not fit into a Link's socket buffer are queued on the Link,
+ * see Link::QueueFrame(), and sent once the socket becomes writable. Writable
+ * Links are signalled by an epoll instance, see LinkManager::TxFd(), which is
+ * to be watched by the transmitting thread, and LinkManager::TxBlocked()
+ * tells when transmission should pause, since packets would be dropped on all
+ * Links of a Tunnel. Links with a rate are paced, see Link::SetRate(), and
+ * frames held by their pacing are released by a timer watched through the
+ * same epoll instance.
+ *
+ * By default, packets are replicated on all Links of their Tunnel. With the
+ * earliest completion time scheduler, see LinkManager::SetScheduler(), every
+ * packet is sent on a single Link instead, chosen by the estimated arrival
+ * time of the packet, see Link::ExpectedArrival(). The Links' delays are
+ * measured by probes, sent by a timer watched through the transmission epoll
+ * instance. The adaptive scheduler sends every packet on as few Links as
+ * needed to meet a delivery target, based on the Links' loss measured by
+ * reports sent by the same timer, see LinkManager::UpdateRedundancy().
+ * Packets of a Tunnel's traffic classes follow the policy of their class
+ * instead, see TrafficClass.
+ *
+ * Frames can be protected by a CRC32C, see LinkManager::SetChecksum(), and
+ * packets sent on slow Links can be compressed, see
+ * LinkManager::SetCompression().
  *
- * Once a packet is received, it is pushed to the PacketPool, via
- * PacketPool::Add(). The PacketPool will push it to a SafeQueue, or defer the
- * packet if it was received out-of-order and push it at a later time.
- * After a packet was pushed to the SafeQueue, the pipe openend by PipedThread
- * will be notified.
+ * Lost packets can be sent again upon request of the remote aggregator, see
+ * LinkManager::SetArq().
  *
- * LinkManager inherits from three classes
+ * Pure TCP ACKs can be prioritized and thinned, see LinkManager::SetAckPriority()
+ * and LinkManager::SetAckThinning().
+ *
+ * Alternatively, reception can be driven by a UringEngine, see
+ * LinkManager::UseEngine(). No reception thread is used in that case.
+ *
+ * Packets queued for delivery are bounded by LINK_RX_QUEUE_LEN and, like the
+ * packets held by the PacketPools, by the BufferBudget, see
+ * LinkManager::SetRxQueuePolicy().
+ *
+ * Every frame carries the epoch of the LinkManager's session, drawn at random
+ * when it is constructed. Packets of another epoch than the remote
+ * aggregator's known one, e.g. after it restarted, are dropped, and its
+ * current session is requested by a handshake with a fresh challenge. Once
+ * the answer echoes the challenge, the Tunnel starts over at the new session's
+ * sequence numbers instead of waiting for the old ones. Handshakes are sent by
+ * a timer watched through the transmission epoll instance, see
+ * LinkManager::SendSyncs().
+ *
+ * Links are monitored via a LinkMonitor. Links whose interface goes down or
+ * loses carrier are skipped for transmission and, unless a UringEngine is
+ * used, removed from the reception Reactor, until the carrier returns. Links
+ * can also be added and removed at runtime, see LinkManager::Reconfigure().
+ *
+ * LinkManager inherits from two classes
  *   - SafeQueue, thread safe queue to which packets are pushed after reception
  *   - PipedThread, performing link reception and pipe notification
- *   - PacketPool, temporary pool of out-of-order packets
  *
  * @see Link
+ * @see Tunnel
  * @see SafeQueue
  * @see PipedThread
- * @see PacketPool
  */
 class LinkManager
         : public SafeQueue<Buffer *>
-        , public PipedThread
-        , public PacketPool {
+        , public PipedThread {
+
+    /**
+     * Configuration of a single Link.
+     */
+    struct LinkSpec {
+        int         m_tunnel;
+        std::string m_peer;
+        std::string m_if_name;
+        int         m_mtu;
+        std::string m_backend;
+        int         m_queue;
+        int         m_rate;
+        uint32_t    m_classes;
+
+        bool operator==( LinkSpec const & o ) const {
+            return m_tunnel == o.m_tunnel
+                && m_peer == o.m_peer && m_if_name == o.m_if_name
+                && m_mtu == o.m_mtu && m_backend == o.m_backend
+                && m_queue == o.m_queue && m_rate == o.m_rate
+                && m_classes == o.m_classes;
+        }
+    };
 
-    // Vector of Links to be aggregated
+    // Tunnels, in configuration order and indexed by id
+    std::vector<Tunnel *> m_tunnels;
+    std::vector<Tunnel *> m_tunnel_ids;
+    // Destination prefixes of all Tunnels, longest first
+    std::vector<std::pair<IpPrefix, Tunnel *>> m_routes;
+
+    // Vector of Links to be aggregated, and their configuration
     std::vector<Link *>  m_links;
-    // Used for asynchronous I/O on Client and Link reception
-    struct pollfd       *m_link_pfds;
-    nfds_t               m_link_nfds;
+    std::vector<LinkSpec> m_specs;
+    // Protects m_links against replacement while transmitting
+    mutable std::mutex   m_links_lock;
+
+    // Carrier monitoring
+    LinkMonitor          m_monitor;
+    // Signals a pending reconfiguration to the reception thread
+    int                  m_ctl_fd;
+    std::vector<LinkSpec> m_pending;
+    bool                 m_has_pending;
+    std::mutex           m_pending_lock;
+    bool                 m_rx_running;
+
+    // Event loop of the reception thread
+    Reactor              m_reactor;
+    // Size of the reception buffers, fitting the largest frame of any Link
+    int                  m_rx_buf_size;
+    // Busy polling time of the Links in microseconds, 0 if disabled
+    int                  m_busy_poll_usec;
+
+    // epoll instance signalling Links with queued frames that are writable
+    int                  m_tx_epfd;
+    // Timer of paced Links' queues, armed for the earliest due frame
+    int                  m_pacing_fd;
+    uint64_t             m_pacing_armed_nsec;
+    // Whether paced Links use SO_TXTIME
+    bool                 m_pacing_txtime;
+
+    // Distribution of packets over the Links, and the timer of probes
+    LinkScheduler        m_scheduler;
+    int                  m_probe_fd;
+    // Delivery target of the adaptive scheduler, and its last update
+    double               m_redundancy_target;
+    uint64_t             m_redundancy_nsec;
+
+    // Handling of pure TCP ACKs
+    bool                 m_ack_priority;
+    bool                 m_ack_thinning;
+    // Retransmission of packets reported missing
+    bool                 m_arq;
+    // Whether frames carry a CRC32C trailer
+    bool                 m_checksum;
+    // Packet encrypted by the transmitting thread, see Tunnel::Encryption()
+    Buffer               m_sealed;
+    // Line rate below which Links compress packets in bit/s, 0 if disabled
+    uint64_t             m_compress_bps;
+    // Packet being sent, compressed for slow Links on first use. The size is
+    // 0 if the packet is not compressed, -1 if not tried yet.
+    Buffer               m_compressed;
+    int                  m_compressed_len;
+
+    // Packets dropped from delivery over the BufferBudget
+    std::atomic<uint64_t> m_rx_overflows;
+
+    // Epoch of this session, carried by every frame, and the timer of
+    // handshakes, see ALAGG_FLAG_SYNC
+    uint16_t             m_epoch;
+    int                  m_sync_fd;
 
-    // Transmission sequence number
-    alagg_seq_t          m_tx_seq;
+    // I/O engine used instead of the reception thread, if any
+    UringEngine         *m_engine;
+    // Delivery of packets popped in the engine's thread
+    std::function<void(Buffer *)> m_deliver;
+    std::thread::id      m_deliver_thread;
 
     static void recv_on_links(LinkManager *t);
+    static std::vector<LinkSpec> make_specs(
+            std::vector<TunnelConfig> const & tunnels);
 
-    /**
-     * Tx sequence number incrementation.
-     *
-     * @returns The next tx sequence number to be used
-     */
-    alagg_seq_t NextTxSeq() { return (m_tx_seq++ % USHRT_MAX); }
+    Link * CreateLink(LinkSpec const & spec);
+    void RegisterLink(Link * link);
+    void UnregisterLink(Link * link);
+    void WatchLinks();
+    void OnLinkEvent(int if_index, bool up);
+    void ApplyPending();
+    void RecvOnLink(Link * link, bool bypass);
+    void RecvFrame(Link * link, unsigned char const * frame, int len);
+    static AlaggPacket * Decrypt(Tunnel * tunnel, AlaggPacket * packet,
+                                 int * len);
+    static AlaggPacket * Decompress(AlaggPacket * packet, int * len);
+    bool Compress(unsigned char const * payload, int size);
+    Tunnel * Classify(unsigned char const * data, int size,
+                      uint32_t mark) const;
+    void Transmit(Link * link, AlaggHeader const & header,
+                  void const * payload, int len, bool priority);
+    void SendOn(Tunnel * tunnel, int cls, unsigned char const * payload,
+                int size, bool unordered);
+    void SendAcks(Tunnel * tunnel);
+    void SendFrames(Link * link, int cls, alagg_seq_t seq,
+                    unsigned char const * payload, int size);
+    int EarliestLinks(Tunnel * tunnel, int cls, int size, uint64_t now,
+                      Link ** links, int max) const;
+    void SendProbes();
+    void SendNack(Tunnel * tunnel, int cls, alagg_seq_t first,
+                  uint64_t missing);
+    void OnNack(unsigned char const * frame, int len);
+    void SendSyncs();
+    void OnSync(Link * link, Tunnel * tunnel, unsigned char const * frame,
+                int len);
+    void ArmSync();
+    void UpdateRedundancy(Tunnel * tunnel, uint64_t interval_nsec);
+    void WatchTx(Link * link);
+    void FlushTx(Link * link);
+    void ArmPacing(uint64_t nsec);
 
     /**
-     * Pushes a packet to SafeQueue, and notifies the pipe.
+     * Pushes a packet popped from a Tunnel's PacketPool to SafeQueue, and
+     * notifies the pipe.
+     *
+     * Packets popped in the thread of a UringEngine are delivered right away,
+     * unless earlier packets are still queued. Packets exceeding the
+     * BufferBudget are dropped, and a full queue drops packets by its policy.
      *
      * @param b Packet buffer to be pushed.
      * @see SafeQueue
      * @see PipedThread
      */
     void PopPacketFromPool(Buffer * b) {
-        Push(b);
-        NotifyPipe();
+        if(m_deliver && std::this_thread::get_id() == m_deliver_thread
+                && Empty()) {
+            m_deliver(b);
+            return;
+        }
+        if(!BufferBudget::Acquire(b->size())) {
+            m_rx_overflows++;
+            delete b;
+            return;
+        }
+        Buffer *dropped = nullptr;
+        if(Push(b, dropped)) {
+            NotifyPipe();
+        }
+        if(dropped) {
+            BufferBudget::Release(dropped->size());
+            delete dropped;
+        }
     }
 
     public:
 
-    LinkManager(std::vector<std::string> peer_addresses,
-                std::vector<std::string> if_names);
+    LinkManager(std::vector<TunnelConfig> const & tunnels,
+                bool rx_thread = true);
     ~LinkManager();
 
+    void SetBusyPoll(int usec);
+    void SetPacing(bool txtime);
+    void SetScheduler(LinkScheduler scheduler);
+    void SetRedundancyTarget(double target);
+    void SetAckPriority(bool enable);
+    void SetAckThinning(bool enable);
+    void SetArq(bool enable);
+    void SetChecksum(bool enable);
+    void SetCompression(int mbps);
+    void SetRxQueuePolicy(safe_queue_policy policy);
+    void StartRecvThread(std::vector<int> const & cpus = std::vector<int>());
+    void UseEngine(UringEngine * engine,
+                   std::function<void(Buffer *)> deliver);
+    void Reconfigure(std::vector<TunnelConfig> const & tunnels);
+
     // Link communication
-    int Send(Buffer const * buf);
+    int Send(void const * data, int size, uint32_t mark);
+
+    /**
+     * Link transmission of a Buffer.
+     *
+     * @param buf Buffer object containing the packet to be sent.
+     * @param mark Firewall mark of the packet, used for classification.
+     * @returns The return value of LinkManager::Send().
+     */
+    int Send(Buffer const * buf, uint32_t mark = 0) {
+        return Send(buf->data(), buf->size(), mark);
+    }
+    void FlushAcks();
+    void OnTxReady();
+    bool TxBlocked() const;
+
+    /**
+     * Getter for the file descriptor signalling writable Links.
+     *
+     * The file descriptor becomes readable when Links with queued frames can
+     * transmit again, see LinkManager::OnTxReady().
+     *
+     * @returns The file descriptor of an epoll instance.
+     */
+    int const TxFd() const { return m_tx_epfd; }
     Buffer const * Recv();
+    int Recv(Buffer ** bufs, int max);
+
+    /**
+     * Getter for the number of packets dropped from delivery.
+     *
+     * @returns The number of packets dropped by the full queue or over the
+     * BufferBudget.
+     */
+    uint64_t RxDrops() { return Drops() + m_rx_overflows; }
 
     /**
      * Getter for the links.
      *
+     * Links may be removed by a later reconfiguration, so the returned Links
+     * are only to be used before reception is started. Use
+     * LinkManager::ForEachLink() afterwards.
+     *
      * @returns A vector of Link objects, containing the aggregated links.
      * @see Link
      */
-    std::vector<Link *> const Links() const { return m_links; }
+    std::vector<Link *> const Links() const {
+        std::lock_guard<std::mutex> lock(m_links_lock);
+        return m_links;
+    }
+
+    /**
+     * Getter for the tunnels.
+     *
+     * @returns A vector of the Tunnels, in configuration order.
+     * @see Tunnel
+     */
+    std::vector<Tunnel *> const & Tunnels() const { return m_tunnels; }
+
+    /**
+     * Call a function for every Link, safe against concurrent
+     * reconfiguration.
+     *
+     * @param f Function called with every Link.
+     */
+    void ForEachLink(std::function<void(Link const *)> f) const {
+        std::lock_guard<std::mutex> lock(m_links_lock);
+        for(int i = 0; i < m_links.size(); i++) {
+            f(m_links[i]);
+        }
+    }
+
+    /**
+     * Take the spin and idle statistics of the reception thread.
+     *
+     * @returns The statistics accumulated since the previous call.
+     * @see Reactor::TakeStats()
+     */
+    Reactor::Stats RxStats() { return m_reactor.TakeStats(); }
 };
 
 #endif /* _LINK_MANAGER_HH_ */
@@ -0,0 +1,82 @@
+#include <string.h>
+#include <unistd.h>
+
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "link_monitor.hh"
+
+/**
+ * LinkMonitor class constructor
+ *
+ * Opens a netlink socket subscribed to the link multicast group.
+ */
+LinkMonitor::LinkMonitor() {
+
+    errno = 0;
+    m_socket = socket( AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC,
+            NETLINK_ROUTE );
+    assert_perror(errno);
+
+    struct sockaddr_nl snl;
+    memset( &snl, 0, sizeof(snl) );
+    snl.nl_family = AF_NETLINK;
+    snl.nl_groups = RTMGRP_LINK;
+    bind( m_socket, (struct sockaddr *) &snl, sizeof(snl) );
+    assert_perror(errno);
+}
+
+/**
+ * LinkMonitor class destructor
+ *
+ * Closes the netlink socket.
+ */
+LinkMonitor::~LinkMonitor() {
+    close(m_socket);
+}
+
+/**
+ * Receive all pending link events.
+ *
+ * @param handler Handler called for every link event.
+ * @returns True if all events were received, false if events were lost
+ * because the socket's buffer overflowed. The state of all interfaces should
+ * be read again in that case.
+ */
+bool LinkMonitor::Recv( Handler const & handler ) {
+
+    char buf[LINK_MONITOR_BUF_SIZE]
+        __attribute__ ((aligned(__alignof__(struct nlmsghdr))));
+    bool complete = true;
+
+    for(;;) {
+        int len = recv( m_socket, buf, sizeof(buf), 0 );
+        if( len < 0 ) {
+            if( errno == ENOBUFS ) {
+                complete = false;
+                errno = 0;
+                continue;
+            }
+            // No more data available
+            errno = 0;
+            return complete;
+        }
+
+        for( struct nlmsghdr *nh = (struct nlmsghdr *) buf;
+                NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len) ) {
+
+            if( nh->nlmsg_type != RTM_NEWLINK
+                    && nh->nlmsg_type != RTM_DELLINK ) {
+                continue;
+            }
+
+            struct ifinfomsg *ifi = (struct ifinfomsg *) NLMSG_DATA(nh);
+            bool up = nh->nlmsg_type == RTM_NEWLINK
+                   && (ifi->ifi_flags & IFF_UP)
+                   && (ifi->ifi_flags & IFF_RUNNING);
+            handler( ifi->ifi_index, up );
+        }
+    }
+}
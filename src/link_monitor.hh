@@ -0,0 +1,60 @@
+/** @file link_monitor.hh
+ * LinkMonitor class definition
+ */
+
+#ifndef _LINK_MONITOR_HH_
+#define _LINK_MONITOR_HH_
+
+#include <functional>
+
+#include "common.hh"
+
+/**
+ * Size of the buffer receiving rtnetlink messages in bytes.
+ */
+#define LINK_MONITOR_BUF_SIZE 8192
+
+/**
+ * LinkMonitor class
+ *
+ * Subscribes to rtnetlink link events, reporting interfaces that go up or
+ * down, gain or lose carrier, or are removed.
+ *
+ * The netlink socket is non-blocking and meant to be waited on by an event
+ * loop, which calls LinkMonitor::Recv() once it is readable.
+ *
+ * @see LinkManager
+ */
+class LinkMonitor {
+
+    public:
+
+    /**
+     * Handler of link events. Called with the interface index and whether the
+     * interface is up and has carrier.
+     */
+    typedef std::function<void(int, bool)> Handler;
+
+    private:
+
+    // rtnetlink socket
+    int m_socket;
+
+    LinkMonitor( LinkMonitor const & ) = delete;
+    LinkMonitor & operator=( LinkMonitor const & ) = delete;
+
+    public:
+
+    LinkMonitor();
+    ~LinkMonitor();
+
+    /**
+     * Getter for the netlink socket.
+     * @returns The socket's file descriptor.
+     */
+    int const Fd() const { return m_socket; }
+
+    bool Recv( Handler const & handler );
+};
+
+#endif /* _LINK_MONITOR_HH_ */
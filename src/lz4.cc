@@ -0,0 +1,311 @@
+#include <string.h>
+
+#include "lz4.hh"
+
+/**
+ * Minimum length of a match.
+ */
+#define LZ4_MIN_MATCH 4
+
+/**
+ * Number of bits of the match finder's hash.
+ */
+#define LZ4_HASH_LOG 12
+
+/**
+ * Matches must start at least this many bytes before the end of the input.
+ */
+#define LZ4_MFLIMIT 12
+
+/**
+ * Number of bytes at the end of the input that are always literals.
+ */
+#define LZ4_LAST_LITERALS 5
+
+/**
+ * Largest input, so positions fit into the match finder's 16 bit entries.
+ */
+#define LZ4_MAX_INPUT 0xffff
+
+/**
+ * Number of bytes sampled by lz4_compressible().
+ */
+#define LZ4_SAMPLE_LEN 512
+
+/**
+ * Read 4 bytes from an unaligned address.
+ *
+ * @param p Pointer to the bytes.
+ * @returns The bytes as a 32 bit word.
+ */
+static inline uint32_t read32( unsigned char const * p ) {
+    uint32_t v;
+    memcpy( &v, p, sizeof(v) );
+    return v;
+}
+
+/**
+ * Hash 4 bytes for the match finder.
+ *
+ * @param v The bytes, see read32().
+ * @returns Index into the match finder's table.
+ */
+static inline uint32_t hash4( uint32_t v ) {
+    return (v * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+/**
+ * Write the extension bytes of a literal or match length.
+ *
+ * @param op Output position.
+ * @param oend End of the output.
+ * @param len Remainder of the length, after the 15 stored in the token.
+ * @returns The output position after the length, or nullptr if it does not
+ * fit.
+ */
+static unsigned char * put_len( unsigned char * op, unsigned char * oend,
+                                int len ) {
+    while( len >= 255 ) {
+        if( op >= oend ) {
+            return nullptr;
+        }
+        *op++ = 255;
+        len -= 255;
+    }
+    if( op >= oend ) {
+        return nullptr;
+    }
+    *op++ = len;
+    return op;
+}
+
+/**
+ * Write a sequence of literals, followed by a match unless it is the last
+ * sequence.
+ *
+ * @param op Output position.
+ * @param oend End of the output.
+ * @param lit Pointer to the literals.
+ * @param lit_len Number of literals.
+ * @param offset Distance of the match, 0 for the last sequence.
+ * @param match_len Length of the match.
+ * @returns The output position after the sequence, or nullptr if it does not
+ * fit.
+ */
+static unsigned char * put_sequence( unsigned char * op, unsigned char * oend,
+                                     unsigned char const * lit, int lit_len,
+                                     int offset, int match_len ) {
+
+    if( op >= oend ) {
+        return nullptr;
+    }
+    unsigned char *token = op++;
+    int ml = match_len - LZ4_MIN_MATCH;
+    *token = (lit_len >= 15 ? 15 : lit_len) << 4;
+    if( offset ) {
+        *token |= ml >= 15 ? 15 : ml;
+    }
+
+    if( lit_len >= 15 && !(op = put_len( op, oend, lit_len - 15 )) ) {
+        return nullptr;
+    }
+    if( oend - op < lit_len ) {
+        return nullptr;
+    }
+    memcpy( op, lit, lit_len );
+    op += lit_len;
+
+    if( !offset ) {
+        return op;
+    }
+    if( oend - op < 2 ) {
+        return nullptr;
+    }
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    if( ml >= 15 ) {
+        return put_len( op, oend, ml - 15 );
+    }
+    return op;
+}
+
+/**
+ * Estimate whether data is worth compressing.
+ *
+ * The Renyi entropy of the byte values of a sample from the start of the data
+ * is estimated from their collisions. Data of more than 7 bits per byte, such
+ * as compressed or encrypted data, is rejected before any compression is
+ * attempted.
+ *
+ * @param in Pointer to the data.
+ * @param len Size of the data.
+ * @returns True if the data is likely compressible, false otherwise.
+ */
+bool lz4_compressible( unsigned char const * in, int len ) {
+
+    int n = len < LZ4_SAMPLE_LEN ? len : LZ4_SAMPLE_LEN;
+    if( n < LZ4_MFLIMIT + 1 ) {
+        return false;
+    }
+
+    uint16_t counts[256];
+    memset( counts, 0, sizeof(counts) );
+    for( int i = 0; i < n; i++ ) {
+        counts[in[i]]++;
+    }
+    uint64_t collisions = 0;
+    for( int i = 0; i < 256; i++ ) {
+        collisions += counts[i] * counts[i];
+    }
+
+    // 2^-H2 = collisions / n^2 must exceed 2^-7
+    return collisions * 128 > (uint64_t) n * n;
+}
+
+/**
+ * Compress data into an LZ4 block.
+ *
+ * A greedy single-pass match finder is used, trading ratio for speed like
+ * the reference implementation's fast mode.
+ *
+ * @param in Pointer to the data, at most 65535 bytes.
+ * @param len Size of the data.
+ * @param out Buffer the block is stored in.
+ * @param max Size of the buffer.
+ * @returns The size of the block, or 0 if it does not fit into the buffer.
+ */
+int lz4_compress( unsigned char const * in, int len,
+                  unsigned char * out, int max ) {
+
+    if( len > LZ4_MAX_INPUT ) {
+        return 0;
+    }
+
+    unsigned char *op = out;
+    unsigned char *oend = out + max;
+    int anchor = 0;
+
+    if( len > LZ4_MFLIMIT ) {
+        uint16_t table[1 << LZ4_HASH_LOG];
+        memset( table, 0, sizeof(table) );
+        int limit = len - LZ4_MFLIMIT;
+        int match_limit = len - LZ4_LAST_LITERALS;
+
+        for( int ip = 1; ip < limit; ) {
+            uint32_t v = read32( in + ip );
+            uint32_t h = hash4( v );
+            int ref = table[h];
+            table[h] = ip;
+            if( read32( in + ref ) != v ) {
+                ip++;
+                continue;
+            }
+
+            // Extend the match backwards and forwards
+            while( ip > anchor && ref > 0 && in[ip - 1] == in[ref - 1] ) {
+                ip--;
+                ref--;
+            }
+            int match_len = LZ4_MIN_MATCH;
+            while( ip + match_len < match_limit
+                    && in[ip + match_len] == in[ref + match_len] ) {
+                match_len++;
+            }
+
+            op = put_sequence( op, oend, in + anchor, ip - anchor,
+                               ip - ref, match_len );
+            if( !op ) {
+                return 0;
+            }
+            ip += match_len;
+            anchor = ip;
+            if( ip < limit ) {
+                table[hash4( read32( in + ip - 2 ) )] = ip - 2;
+            }
+        }
+    }
+
+    op = put_sequence( op, oend, in + anchor, len - anchor, 0, 0 );
+    return op ? op - out : 0;
+}
+
+/**
+ * Decompress an LZ4 block.
+ *
+ * Malformed blocks are rejected, never reading or writing out of bounds.
+ *
+ * @param in Pointer to the block.
+ * @param len Size of the block.
+ * @param out Buffer the data is stored in.
+ * @param max Size of the buffer.
+ * @returns The size of the data, or -1 if the block is malformed or the data
+ * does not fit into the buffer.
+ */
+int lz4_decompress( unsigned char const * in, int len,
+                    unsigned char * out, int max ) {
+
+    unsigned char const *ip = in;
+    unsigned char const *iend = in + len;
+    unsigned char *op = out;
+    unsigned char *oend = out + max;
+
+    while( ip < iend ) {
+        int token = *ip++;
+
+        // Literals
+        int lit_len = token >> 4;
+        if( lit_len == 15 ) {
+            int b;
+            do {
+                if( ip >= iend ) {
+                    return -1;
+                }
+                b = *ip++;
+                lit_len += b;
+            } while( b == 255 );
+        }
+        if( iend - ip < lit_len || oend - op < lit_len ) {
+            return -1;
+        }
+        memcpy( op, ip, lit_len );
+        ip += lit_len;
+        op += lit_len;
+
+        // The last sequence has no match
+        if( ip == iend ) {
+            break;
+        }
+
+        // Match
+        if( iend - ip < 2 ) {
+            return -1;
+        }
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if( offset == 0 || offset > op - out ) {
+            return -1;
+        }
+        int match_len = token & 15;
+        if( match_len == 15 ) {
+            int b;
+            do {
+                if( ip >= iend ) {
+                    return -1;
+                }
+                b = *ip++;
+                match_len += b;
+            } while( b == 255 );
+        }
+        match_len += LZ4_MIN_MATCH;
+        if( oend - op < match_len ) {
+            return -1;
+        }
+        unsigned char const *ref = op - offset;
+        for( int i = 0; i < match_len; i++ ) {
+            op[i] = ref[i];
+        }
+        op += match_len;
+    }
+
+    return op - out;
+}
@@ -0,0 +1,16 @@
+/** @file lz4.hh
+ * LZ4 block format helpers
+ */
+
+#ifndef _LZ4_HH_
+#define _LZ4_HH_
+
+#include <cstdint>
+
+bool lz4_compressible( unsigned char const * in, int len );
+int lz4_compress( unsigned char const * in, int len,
+                  unsigned char * out, int max );
+int lz4_decompress( unsigned char const * in, int len,
+                    unsigned char * out, int max );
+
+#endif /* _LZ4_HH_ */
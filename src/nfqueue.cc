@@ -5,6 +5,7 @@
 #include <fcntl.h>
 
 #include "nfqueue.hh"
+#include "checksum.hh"
 
 /**
  * The id of the netfilter queue that will be used.
@@ -16,7 +17,10 @@
  *
  * This function is called when a packet is handle via nfq_handle_packet(). We
  * simply receive packet, store it in the NfqCbArgs structure, and tell the
- * kernel to drop it.
+ * kernel to drop it. The packet's firewall mark is stored for classification.
+ * GSO packets are received unsegmented, and their transport checksum may not
+ * have been computed yet. It is completed here, since the packet leaves the
+ * host without any further checksum offloading.
  *
  * @param nfq Nfqueue handle
  * @param pkt Nfqueue packet data
@@ -43,6 +47,12 @@ int NfqHandler::NfqCallbackFun( struct nfq_q_handle *nfq,
         std::cerr << "ERROR: could not receive payload" << std::endl;
     }
     args->m_packet_len = ret;
+    args->m_packet_mark = nfq_get_nfmark(nfa);
+
+    // Complete offloaded checksums
+    if( ret > 0 && (nfq_get_skbinfo(nfa) & NFQA_SKB_CSUMNOTREADY) ) {
+        csum_l4_complete( args->mp_packet, ret );
+    }
 
     // We tell the kernel to drop the packet here
     return nfq_set_verdict( nfq, id, NF_DROP, 0, NULL);
@@ -84,11 +94,18 @@ NfqHandler::NfqHandler()
     }
 
     // Set packet copy mode
-    if( nfq_set_mode(m_nfq_q_handle, NFQNL_COPY_PACKET, 0xffff) == -1 ) {
+    if( nfq_set_mode(m_nfq_q_handle, NFQNL_COPY_PACKET, MAX_PKT_SIZE) == -1 ) {
         std::cerr << "ERROR: could not set packet copy mode" << std::endl;
         exit(1);
     }
 
+    // Receive GSO packets unsegmented, if supported by the kernel
+    if( nfq_set_queue_flags(m_nfq_q_handle,
+                NFQA_CFG_F_GSO, NFQA_CFG_F_GSO) == -1 ) {
+        std::cerr << "WARNING: could not enable GSO, packets are segmented"
+            << std::endl;
+    }
+
     // Get netlink handle
     m_nfq_nl_handle = nfq_nfnlh(m_nfq_handle);
     if(!m_nfq_nl_handle) {
@@ -122,13 +139,29 @@ int NfqHandler::GetPacket( unsigned char **packet ) {
 
     int ret = recv( m_nfq_nl_fd, m_nfq_buffer, sizeof(m_nfq_buffer), 0 );
     if( ret > 0 ) {
-        nfq_handle_packet( m_nfq_handle,
-                m_nfq_buffer,
-                ret );
-
-        *packet = m_nfq_cb_args.mp_packet;
-        return m_nfq_cb_args.m_packet_len;
+        return HandleMessage( m_nfq_buffer, ret, packet );
     }
 
     return 0;
 }
+
+/**
+ * Extract a packet from a message received on the netfilter queue's socket.
+ *
+ * Used when the message was received by other means than
+ * NfqHandler::GetPacket(), e.g. by the UringEngine.
+ *
+ * @param msg Pointer to the received netlink message.
+ * @param len Size of the message.
+ * @param packet Pointer to the buffer to be filled with the packet data. It
+ * points into the message.
+ * @returns The size of the received packet.
+ */
+int NfqHandler::HandleMessage( char * msg, int len, unsigned char **packet ) {
+
+    m_nfq_cb_args.m_packet_len = 0;
+    nfq_handle_packet( m_nfq_handle, msg, len );
+
+    *packet = m_nfq_cb_args.mp_packet;
+    return m_nfq_cb_args.m_packet_len;
+}
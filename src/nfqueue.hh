@@ -26,12 +26,14 @@ class NfqHandler {
      * Arguments passed to the nfqueue callback function.
      *
      * The function will store the received packet in the buffer pointed to by
-     * mp_packet and set m_packet_len according to the packets size. This way,
-     * the packet is passed to upper layers of the application.
+     * mp_packet and set m_packet_len according to the packets size, and
+     * m_packet_mark to its firewall mark. This way, the packet is passed to
+     * upper layers of the application.
      */
     struct NfqCbArgs {
         unsigned char *mp_packet;
         int            m_packet_len;
+        uint32_t       m_packet_mark;
     };
 
     // Nfqueue handles
@@ -62,6 +64,14 @@ class NfqHandler {
     }
 
     int GetPacket( unsigned char **packet_buffer );
+    int HandleMessage( char * msg, int len, unsigned char **packet_buffer );
+
+    /**
+     * Getter for the firewall mark of the most recently received packet.
+     *
+     * @returns The packet's mark, 0 if unmarked.
+     */
+    uint32_t const PacketMark() const { return m_nfq_cb_args.m_packet_mark; }
 
     /**
      * Getter function for the file descriptor associated with the netfilter
@@ -1,5 +1,20 @@
+#include "buffer_budget.hh"
 #include "packet_pool.hh"
 
+/**
+ * PacketPool class destructor
+ *
+ * Frees the packets held, returning them to the BufferBudget.
+ */
+PacketPool::~PacketPool() {
+    for(int i = 0; i < m_packets.size(); i++) {
+        if(m_packets[i]) {
+            BufferBudget::Release(m_packets[i].m_size);
+            free(m_packets[i].m_pkt);
+        }
+    }
+}
+
 /**
  * Overload the classes subscript operator.
  *
@@ -49,7 +64,8 @@ alagg_seq_t PacketPool::SeqDistance(alagg_seq_t const from_seq,
  * Any packets in the pool are with a sequence number lesser than the given one
  * are flushed (in order).
  * In addition, any further in-sequence packets are already present in the pool,
- * are flushed as well.
+ * are flushed as well. The flushed slots are removed at once, so flushing
+ * takes linear time.
  *
  * @param t Back-reference to calling PacketPool instance
  * @param seq Sequence number up to which is to be flushed
@@ -57,62 +73,116 @@ alagg_seq_t PacketPool::SeqDistance(alagg_seq_t const from_seq,
  */
 void PacketPool::Flush(PacketPool *t, const alagg_seq_t seq) {
 
-    Packet p;
-
     // Do nothing if sequence number is out of range
-    if(SeqDistance(t->m_rx_seq, seq) > t->m_packets.size())
+    size_t n = SeqDistance(t->m_rx_seq, seq);
+    if(n > t->m_packets.size())
         return;
 
-    // Flush until given given sequence number
-    while(t->m_rx_seq < seq) {
+    // Flush until given sequence number, and any successive, present packets
+    while(n < t->m_packets.size() && t->m_packets[n])
+        n++;
+    for(size_t i = 0; i < n; i++) {
+        if(t->m_packets[i])
+            t->Pop(t->m_packets[i]);
+    }
 
-        p = (*t)[(t->m_rx_seq+1) % ALAGG_MAX_SEQ];
+    // Remove popped elements at once
+    t->m_packets.erase(t->m_packets.begin(), t->m_packets.begin() + n);
+    t->m_rx_seq = (t->m_rx_seq + n) % ALAGG_MAX_SEQ;
+}
 
-        // Packet present?
-        if(p) {
+/**
+ * Timer callback flushing the pool for all deadlines that passed.
+ *
+ * Restarts the Timer for the next deadline, if any.
+ *
+ * @param t Back-reference to calling PacketPool instance
+ * @see PacketPool::Defer()
+ */
+void PacketPool::FlushCb(PacketPool *t) {
 
-            // Pop it, without the AlaggHeader
-            Buffer *buf = new Buffer();
-            buf->assign(((unsigned char *)p.m_pkt)+sizeof(AlaggHeader),
-                        ((unsigned char *)p.m_pkt)+p.m_size);
-            free(p.m_pkt);
-            t->PopPacketFromPool(buf);
-        }
+    std::lock_guard<std::mutex> lock(t->m_ppool_lock);
 
-        // Remove popped element
-        t->m_packets.erase(t->m_packets.begin());
-        t->m_rx_seq++;
+    uint64_t now = now_nsec();
+    while(!t->m_deadlines.empty() && t->m_deadlines.front().first <= now) {
+        t->Flush(t, t->m_deadlines.front().second);
+        t->m_deadlines.pop_front();
     }
 
-    // Continue popping any successive, present packets
-    p = (*t)[(t->m_rx_seq+1) % ALAGG_MAX_SEQ];
-    while(p) {
+    if(t->m_deadlines.empty()) {
+        t->m_timer_pending = false;
+        return;
+    }
+    uint64_t wait = t->m_deadlines.front().first - now;
+    Timer((wait + 999999) / 1000000, FlushCb, t);
+}
 
-        // Pop it, without the AlaggHeader
-        Buffer *buf = new Buffer();
-        buf->assign(((unsigned char *)p.m_pkt)+sizeof(AlaggHeader),
-                    ((unsigned char *)p.m_pkt)+p.m_size);
-        free(p.m_pkt);
-        t->PopPacketFromPool(buf);
+/**
+ * Pop a stored packet, without the AlaggHeader.
+ *
+ * The packet is freed, and returned to the BufferBudget.
+ *
+ * @param p Packet to be popped. Its slot is to be removed by the caller.
+ */
+void PacketPool::Pop(Packet const & p) {
 
-        // Remove popped element
-        t->m_packets.erase(t->m_packets.begin());
-        t->m_rx_seq++;
+    Buffer *buf = new Buffer();
+    buf->assign(((unsigned char *)p.m_pkt)+sizeof(AlaggHeader),
+                ((unsigned char *)p.m_pkt)+p.m_size);
+    free(p.m_pkt);
+    BufferBudget::Release(p.m_size);
+    PopPacketFromPool(buf);
+}
 
-        p = (*t)[(t->m_rx_seq+1) % ALAGG_MAX_SEQ];
+/**
+ * Give up on the oldest packets, so a packet fits into the window.
+ *
+ * The rx sequence number is advanced so the packet is PACKET_POOL_WINDOW
+ * sequence numbers ahead. Packets present before are popped, missing ones are
+ * skipped and counted, see PacketPool::Skipped().
+ *
+ * @param seq Sequence number of the packet, beyond the window.
+ */
+void PacketPool::Shift(alagg_seq_t const seq) {
+
+    alagg_seq_t skip = SeqDistance(m_rx_seq, seq) - PACKET_POOL_WINDOW;
+    for(alagg_seq_t d = 0; d < skip; d++) {
+        if(d < m_packets.size() && m_packets[d])
+            Pop(m_packets[d]);
+        else
+            m_skipped++;
     }
+    m_packets.erase(m_packets.begin(), m_packets.begin()
+                    + std::min<size_t>(skip, m_packets.size()));
+    m_rx_seq = (m_rx_seq + skip) % ALAGG_MAX_SEQ;
+
+    // Continue with any successive, present packets
+    Flush(this, m_rx_seq);
 }
 
 /**
- * Wrapper for Timer callbacks that just locks the mutex and flushes.
+ * Defer the flush for an out-of-order packet by the pool's timeout.
  *
- * @param t Back-reference to calling PacketPool instance
- * @param seq Sequence number up to which is to be flushed
+ * The deadline is queued, and served by the pending Timer, or a new one if
+ * none is pending. Once PACKET_POOL_WINDOW deadlines are queued, the latest
+ * one is extended to the packet instead, flushing it slightly early.
+ *
+ * @param seq Sequence number of the packet.
+ * @see PacketPool::FlushCb()
  */
-void PacketPool::FlushCb(PacketPool *t, const alagg_seq_t seq) {
+void PacketPool::Defer(alagg_seq_t const seq) {
 
-    std::lock_guard<std::mutex> lock(t->m_ppool_lock);
-    t->Flush(t, seq);
+    uint64_t deadline = now_nsec() + (uint64_t) m_timeout_msec * 1000000;
+    if(m_deadlines.size() >= PACKET_POOL_WINDOW) {
+        m_deadlines.back().second = seq;
+    } else {
+        m_deadlines.push_back(std::make_pair(deadline, seq));
+    }
+
+    if(!m_timer_pending) {
+        m_timer_pending = true;
+        Timer(m_timeout_msec, FlushCb, this);
+    }
 }
 
 /**
@@ -139,6 +209,39 @@ bool PacketPool::IsRecent( alagg_seq_t const seq ) const {
             || (seq < m_rx_seq && (m_rx_seq - seq) > (ALAGG_MAX_SEQ/2)) );
 }
 
+/**
+ * Report the packets missing before an out-of-order packet.
+ *
+ * Packets reported before are skipped, so every missing packet is reported
+ * once, and at most ALAGG_NACK_SPAN packets are reported at a time. Packets
+ * are reported once ALAGG_NACK_REORDER later sequence numbers are covered by
+ * the pool.
+ *
+ * @param seq Sequence number of the out-of-order packet, stored already.
+ * @see PacketPool::OnGap()
+ */
+void PacketPool::ReportGap(alagg_seq_t const seq) {
+
+    alagg_seq_t dist = SeqDistance(m_rx_seq, seq);
+    alagg_seq_t from = 1;
+    if(IsRecent(m_nacked_seq)) {
+        from = SeqDistance(m_rx_seq, m_nacked_seq) + 1;
+    }
+    if(from + ALAGG_NACK_REORDER > dist)
+        return;
+    alagg_seq_t to = std::min<int>(dist - ALAGG_NACK_REORDER,
+                                   from + ALAGG_NACK_SPAN - 1);
+
+    uint64_t missing = 0;
+    for(int d = from; d <= to; d++) {
+        if(!m_packets[d-1])
+            missing |= 1ULL << (d - from);
+    }
+    m_nacked_seq = (m_rx_seq + to) % ALAGG_MAX_SEQ;
+    if(missing)
+        OnGap((m_rx_seq + from) % ALAGG_MAX_SEQ, missing);
+}
+
 /**
  * Add a packet to the PacketPool.
  *
@@ -147,9 +250,11 @@ bool PacketPool::IsRecent( alagg_seq_t const seq ) const {
  * Furthermore, it is checked whether the packet's sequence number matches the
  * expected on (rx sequence number + 1).
  * If so, the Flush() routine is called immediately.
- * Otherwise, i.e. the packet is out-of-order, a new Timer object is created,
- * deferring the call to Flush() for m_timeout_msec milliseconds. This gives the
- * missing packet(s) a window to be still received, re-ordered, and delivered.
+ * Otherwise, i.e. the packet is out-of-order, the call to Flush() is deferred
+ * for m_timeout_msec milliseconds, see Defer(). This gives the missing
+ * packet(s) a window to be still received, re-ordered, and delivered.
+ * The missing packets are reported via OnGap(), so they may be sent again.
+ * Out-of-order packets exceeding the BufferBudget are dropped.
  *
  * @param p Pointer to the AlaggPacket to be added.
  * @param size Size of the packet.
@@ -165,23 +270,62 @@ void PacketPool::Add(AlaggPacket * p, int const size) {
         return;
     }
 
+    // Keep the packet within the window
+    if(SeqDistance(m_rx_seq, p->m_header.m_seq) > PACKET_POOL_WINDOW) {
+        Shift(p->m_header.m_seq);
+    }
+
     // Have packet already
     if((*this)[p->m_header.m_seq]) {
         free(p);
         return;
     }
 
+    // Packets in sequence are popped right away, so they always fit
+    bool in_order = p->m_header.m_seq == ((m_rx_seq+1) % ALAGG_MAX_SEQ);
+    if(!BufferBudget::Acquire(size, in_order)) {
+        free(p);
+        m_overflows++;
+        return;
+    }
+
     // Store packet
     (*this)[p->m_header.m_seq].Set(p, size);
     assert((*this)[p->m_header.m_seq]);
 
     /*
      * If the packet is in sequence, flush the pool immediately.
-     * Otherwise, set a Timer to call Flush
+     * Otherwise, defer the call to Flush
      */
-    if(p->m_header.m_seq == ((m_rx_seq+1) % ALAGG_MAX_SEQ)) {
+    if(in_order) {
         Flush(this, ((m_rx_seq+1) % ALAGG_MAX_SEQ));
     } else {
-        Timer(m_timeout_msec, FlushCb, this, p->m_header.m_seq);
+        ReportGap(p->m_header.m_seq);
+        Defer(p->m_header.m_seq);
+    }
+}
+
+/**
+ * Reset the PacketPool, e.g. for a new session of the remote aggregator.
+ *
+ * Packets held are dropped, returning them to the BufferBudget, and pending
+ * flushes are cancelled.
+ *
+ * @param seq Sequence number preceding the first one expected, taken as the
+ * new rx sequence number.
+ */
+void PacketPool::Reset(alagg_seq_t const seq) {
+
+    std::lock_guard<std::mutex> lock(m_ppool_lock);
+
+    for(int i = 0; i < m_packets.size(); i++) {
+        if(m_packets[i]) {
+            BufferBudget::Release(m_packets[i].m_size);
+            free(m_packets[i].m_pkt);
+        }
     }
+    m_packets.clear();
+    m_deadlines.clear();
+    m_rx_seq = seq;
+    m_nacked_seq = seq;
 }
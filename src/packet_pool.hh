@@ -12,8 +12,16 @@
 #include <cstdint>
 #include <functional>
 #include <algorithm>
+#include <deque>
 #include <mutex>
 
+/**
+ * Maximum distance of a packet's sequence number from the PacketPool's rx
+ * sequence number. Packets further ahead make the pool give up on the oldest
+ * missing packets, see PacketPool::Shift().
+ */
+#define PACKET_POOL_WINDOW 8192
+
 /**
  * PacketPool class
  *
@@ -30,7 +38,12 @@
  * If an added packet is out-of-order, it is added to the pool and it's delivery
  * is deferred. A timer is started for the packet. As soon as it times out, all
  * packets up to the sequence number of the original out-of-order packets are
- * delivered.
+ * delivered. A single Timer is pending per pool at a time, serving the
+ * deadlines of all out-of-order packets in turn.
+ *
+ * The pool covers at most PACKET_POOL_WINDOW sequence numbers, and the
+ * packets it holds are taken from the BufferBudget. Packets exceeding the
+ * budget are dropped, and counted, see PacketPool::Overflows().
  *
  * @see Link
  * @see Timer
@@ -75,6 +88,20 @@ class PacketPool {
     // Rx sequence number
     alagg_seq_t m_rx_seq;
 
+    // Last sequence number reported missing, see PacketPool::OnGap()
+    alagg_seq_t m_nacked_seq;
+
+    // Flush deadlines of out-of-order packets in nanoseconds, and their
+    // sequence numbers
+    std::deque<std::pair<uint64_t, alagg_seq_t>> m_deadlines;
+    // Whether a Timer serving the deadlines is pending
+    bool m_timer_pending;
+
+    // Packets dropped over the BufferBudget, and missing packets given up on
+    // to keep the window
+    uint64_t m_overflows;
+    uint64_t m_skipped;
+
     // Protect access to the packet pool
     std::mutex m_ppool_lock;
 
@@ -82,8 +109,27 @@ class PacketPool {
     static alagg_seq_t SeqDistance(alagg_seq_t const from_seq,
                                    alagg_seq_t const to_seq);
     static void Flush(PacketPool *t, const alagg_seq_t seq);
-    static void FlushCb(PacketPool *t, const alagg_seq_t seq);
+    static void FlushCb(PacketPool *t);
+    void Pop(Packet const & p);
+    void Shift(alagg_seq_t const seq);
+    void Defer(alagg_seq_t const seq);
     virtual void PopPacketFromPool(Buffer * b);
+    void ReportGap(alagg_seq_t const seq);
+
+    protected:
+
+    /**
+     * Handle packets found missing.
+     *
+     * Called whenever an out-of-order packet reveals packets that were not
+     * reported missing yet. Does nothing, may be overloaded by child classes
+     * to request retransmissions.
+     *
+     * @param first Sequence number of the first packet reported.
+     * @param missing Bitmap of the missing packets, bit i reporting the packet
+     * first + i.
+     */
+    virtual void OnGap(alagg_seq_t first, uint64_t missing) {}
 
     public:
 
@@ -97,10 +143,40 @@ class PacketPool {
      */
     PacketPool(uint32_t timeout_msec)
                : m_timeout_msec(timeout_msec)
-               , m_rx_seq(0) {}
+               , m_rx_seq(0)
+               , m_nacked_seq(0)
+               , m_timer_pending(false)
+               , m_overflows(0)
+               , m_skipped(0) {}
+
+    virtual ~PacketPool();
+
+    /**
+     * Getter for the timeout of out-of-order packets.
+     *
+     * @returns Time in milliseconds for which out-of-order packets are
+     * deferred.
+     */
+    uint32_t const Timeout() const { return m_timeout_msec; }
+
+    /**
+     * Getter for the number of packets dropped over the BufferBudget.
+     *
+     * @returns The number of out-of-order packets dropped.
+     */
+    uint64_t const Overflows() const { return m_overflows; }
+
+    /**
+     * Getter for the number of missing packets given up on to keep the
+     * window.
+     *
+     * @returns The number of sequence numbers skipped.
+     */
+    uint64_t const Skipped() const { return m_skipped; }
 
     bool IsRecent( alagg_seq_t const seq ) const;
     void Add(AlaggPacket * p, int const size);
+    void Reset(alagg_seq_t const seq);
 };
 
 #endif /* _PACKET_POOL_HH_ */
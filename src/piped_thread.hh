@@ -9,6 +9,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 
+#include <algorithm>
 #include <thread>
 
 #include "common.hh"
@@ -209,6 +210,15 @@ class PipedThread {
         m_thread = std::thread(target<F, A>, fun, args, this);
     }
 
+    /**
+     * Getter for the thread's native handle.
+     *
+     * @returns The pthread handle, e.g. to set the thread's affinity.
+     */
+    pthread_t NativeHandle() {
+        return m_thread.native_handle();
+    }
+
     /**
      * Wait for the thread to finish.
      */
@@ -225,6 +235,25 @@ class PipedThread {
         assert(n == MSG_LEN);
     }
 
+    /**
+     * Read several MSG_DONE from the pipe at once.
+     *
+     * Messages may still be on their way, if their packets were taken from
+     * the queue right after being pushed, so reading is repeated until all of
+     * them arrived.
+     *
+     * @param count Number of messages to be read.
+     */
+    void EmptyPipe(int count) const {
+        char c[64 * MSG_LEN];
+        while(count > 0) {
+            int len = std::min(count, 64) * MSG_LEN;
+            int n = read(m_pipe.m_rx, c, len);
+            assert(n > 0 && n % MSG_LEN == 0);
+            count -= n / MSG_LEN;
+        }
+    }
+
     /**
      * Getter for the communication pipe's transmission end file descriptor.
      *
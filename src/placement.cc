@@ -0,0 +1,128 @@
+#include <iostream>
+#include <fstream>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "placement.hh"
+
+/**
+ * Pin a thread to a set of CPUs.
+ *
+ * @param thread The thread to be pinned.
+ * @param cpus CPUs the thread may run on. If empty, the thread is left
+ * unpinned.
+ * @returns True on success, false otherwise.
+ */
+bool set_thread_affinity( pthread_t thread, std::vector<int> const & cpus ) {
+
+    if( cpus.empty() ) {
+        return true;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for( int i = 0; i < cpus.size(); i++ ) {
+        if( cpus[i] < 0 || cpus[i] >= CPU_SETSIZE ) {
+            std::cerr << "WARNING: Invalid CPU " << cpus[i] << std::endl;
+            return false;
+        }
+        CPU_SET(cpus[i], &set);
+    }
+
+    int err = pthread_setaffinity_np( thread, sizeof(set), &set );
+    if( err ) {
+        std::cerr << "WARNING: Could not set thread affinity: "
+            << strerror(err) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Name a thread.
+ *
+ * Names show up in tools like top and ps. They are truncated to 15
+ * characters.
+ *
+ * @param thread The thread to be named.
+ * @param name The thread's name.
+ */
+void set_thread_name( pthread_t thread, std::string const & name ) {
+
+    pthread_setname_np( thread, name.substr(0, 15).c_str() );
+}
+
+/**
+ * Get the NUMA node of a network interface.
+ *
+ * The node is read from sysfs.
+ *
+ * @param ifname Name of the interface.
+ * @returns The NUMA node the interface's device is attached to, or
+ * NUMA_NODE_ANY if it is unknown, e.g. for virtual interfaces.
+ */
+int if_numa_node( std::string const & ifname ) {
+
+    std::ifstream in( "/sys/class/net/" + ifname + "/device/numa_node" );
+    int node = NUMA_NODE_ANY;
+    errno = 0;
+
+    if( !(in >> node) || node < 0 ) {
+        return NUMA_NODE_ANY;
+    }
+
+    return node;
+}
+
+/**
+ * Allocate memory on a NUMA node.
+ *
+ * The memory is mapped anonymously and bound to the node using a preferred
+ * policy, so allocation falls back to other nodes if the node runs out of
+ * memory. The memory is zero-initialized.
+ *
+ * @param size Size of the memory in bytes.
+ * @param node NUMA node to allocate on, or NUMA_NODE_ANY.
+ * @returns Pointer to the memory, or nullptr on failure. Must be released
+ * using numa_free().
+ */
+void * numa_alloc( size_t size, int node ) {
+
+    void *addr = mmap( nullptr, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( addr == MAP_FAILED ) {
+        perror("mmap()");
+        errno = 0;
+        return nullptr;
+    }
+
+    if( node != NUMA_NODE_ANY && node < 8 * sizeof(unsigned long) ) {
+        unsigned long mask = 1UL << node;
+        if( syscall( SYS_mbind, addr, size, MPOL_PREFERRED, &mask,
+                    8 * sizeof(mask), 0 ) < 0 ) {
+            // Not fatal, the memory is just not placed
+            errno = 0;
+        }
+    }
+
+    return addr;
+}
+
+/**
+ * Release memory allocated by numa_alloc().
+ *
+ * @param addr Pointer to the memory, may be nullptr.
+ * @param size Size of the memory in bytes, as passed to numa_alloc().
+ */
+void numa_free( void * addr, size_t size ) {
+
+    if( addr ) {
+        munmap( addr, size );
+    }
+}
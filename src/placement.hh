@@ -0,0 +1,29 @@
+/** @file placement.hh
+ * Thread and memory placement functionalities.
+ *
+ * Threads of the data path can be pinned to CPUs and named, and buffers can be
+ * allocated on the NUMA node of the network interface they are used with.
+ */
+
+#ifndef _PLACEMENT_HH_
+#define _PLACEMENT_HH_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+
+/**
+ * NUMA node of memory allocated wherever the kernel chooses.
+ */
+#define NUMA_NODE_ANY (-1)
+
+bool set_thread_affinity( pthread_t thread, std::vector<int> const & cpus );
+void set_thread_name( pthread_t thread, std::string const & name );
+
+int if_numa_node( std::string const & ifname );
+void * numa_alloc( size_t size, int node );
+void numa_free( void * addr, size_t size );
+
+#endif /* _PLACEMENT_HH_ */
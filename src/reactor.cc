@@ -0,0 +1,249 @@
+#include <iostream>
+#include <string.h>
+#include <unistd.h>
+
+#include <time.h>
+#include <sys/timerfd.h>
+
+#include "reactor.hh"
+
+/**
+ * Reactor class constructor
+ *
+ * Creates the epoll instance. Spinning is disabled.
+ */
+Reactor::Reactor()
+        : m_spin_nsec(0)
+        , m_stat_spin_nsec(0)
+        , m_stat_idle_nsec(0)
+        , m_stat_spin_hits(0)
+        , m_stat_spin_misses(0) {
+
+    errno = 0;
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+    assert_perror(errno);
+}
+
+/**
+ * Reactor class destructor
+ *
+ * Closes the epoll instance. Registered file descriptors are left open.
+ */
+Reactor::~Reactor() {
+    close(m_epfd);
+}
+
+/**
+ * Register a file descriptor.
+ *
+ * The file descriptor is registered edge-triggered.
+ *
+ * @param fd File descriptor.
+ * @param events epoll events of interest, e.g. EPOLLIN.
+ * @param handler Handler to be called when any of the events are signalled.
+ */
+void Reactor::Add( int fd, uint32_t events, Handler handler ) {
+
+    if( fd >= m_handlers.size() ) {
+        m_handlers.resize( fd + 1 );
+    }
+    m_handlers[fd] = handler;
+
+    struct epoll_event ev;
+    memset( &ev, 0, sizeof(ev) );
+    ev.events = events | EPOLLET;
+    ev.data.fd = fd;
+    errno = 0;
+    epoll_ctl( m_epfd, EPOLL_CTL_ADD, fd, &ev );
+    assert_perror(errno);
+}
+
+/**
+ * Change the events of interest of a registered file descriptor.
+ *
+ * @param fd File descriptor.
+ * @param events New epoll events of interest.
+ */
+void Reactor::Modify( int fd, uint32_t events ) {
+
+    struct epoll_event ev;
+    memset( &ev, 0, sizeof(ev) );
+    ev.events = events | EPOLLET;
+    ev.data.fd = fd;
+    errno = 0;
+    epoll_ctl( m_epfd, EPOLL_CTL_MOD, fd, &ev );
+    assert_perror(errno);
+}
+
+/**
+ * Unregister a file descriptor.
+ *
+ * Events of the file descriptor that were already retrieved are not
+ * dispatched anymore.
+ *
+ * @param fd File descriptor.
+ */
+void Reactor::Remove( int fd ) {
+
+    epoll_ctl( m_epfd, EPOLL_CTL_DEL, fd, nullptr );
+    errno = 0;
+
+    if( fd < m_handlers.size() ) {
+        m_handlers[fd] = nullptr;
+    }
+}
+
+/**
+ * Register a periodic timer.
+ *
+ * @param period_msec Period of the timer in milliseconds.
+ * @param handler Handler to be called whenever the timer expires.
+ * @returns The timer's file descriptor.
+ */
+int Reactor::AddTimer( uint32_t period_msec, std::function<void()> handler ) {
+
+    errno = 0;
+    int fd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+    assert_perror(errno);
+
+    struct itimerspec its;
+    its.it_interval.tv_sec  = period_msec / 1000;
+    its.it_interval.tv_nsec = (period_msec % 1000) * 1000000;
+    its.it_value = its.it_interval;
+    timerfd_settime( fd, 0, &its, nullptr );
+    assert_perror(errno);
+
+    Add( fd, EPOLLIN, [fd, handler](uint32_t) {
+        uint64_t expirations;
+        if( read( fd, &expirations, sizeof(expirations) ) > 0 ) {
+            handler();
+        }
+        errno = 0;
+    });
+
+    return fd;
+}
+
+/**
+ * Call the handler of a file descriptor.
+ *
+ * @param fd File descriptor.
+ * @param events Signalled events.
+ */
+void Reactor::Dispatch( int fd, uint32_t events ) {
+
+    if( fd >= m_handlers.size() || !m_handlers[fd] ) {
+        return;
+    }
+
+    // The handler may register further file descriptors, so call a copy
+    Handler h = m_handlers[fd];
+    h(events);
+}
+
+/**
+ * Take the spin and idle statistics.
+ *
+ * The statistics are reset, so every call returns the statistics accumulated
+ * since the previous one. Safe to be called from any thread.
+ *
+ * @returns The statistics.
+ */
+Reactor::Stats Reactor::TakeStats() {
+
+    Stats stats;
+    stats.m_spin_nsec   = m_stat_spin_nsec.exchange(0);
+    stats.m_idle_nsec   = m_stat_idle_nsec.exchange(0);
+    stats.m_spin_hits   = m_stat_spin_hits.exchange(0);
+    stats.m_spin_misses = m_stat_spin_misses.exchange(0);
+    return stats;
+}
+
+/**
+ * Retrieve events from the epoll instance.
+ *
+ * @param timeout_msec Maximum time to wait in milliseconds.
+ * @returns The number of retrieved events.
+ */
+int Reactor::Wait( int timeout_msec ) {
+
+    int n = epoll_wait( m_epfd, m_events, REACTOR_MAX_EVENTS, timeout_msec );
+    if( n < 0 ) {
+        if( errno != EINTR ) {
+            perror("epoll_wait()");
+            exit(1);
+        }
+        errno = 0;
+        n = 0;
+    }
+
+    return n;
+}
+
+/**
+ * Spin for events.
+ *
+ * Retrieves events without blocking until an event occurs or the spin budget
+ * is exhausted.
+ *
+ * @returns The number of retrieved events, 0 if the budget was exhausted.
+ */
+int Reactor::Spin() {
+
+    uint64_t start = now_nsec();
+    uint64_t now;
+    int n;
+
+    do {
+        n = Wait(0);
+        now = now_nsec();
+    } while( n == 0 && now - start < m_spin_nsec );
+
+    m_stat_spin_nsec.fetch_add( now - start, std::memory_order_relaxed );
+    if( n > 0 ) {
+        m_stat_spin_hits.fetch_add( 1, std::memory_order_relaxed );
+    } else {
+        m_stat_spin_misses.fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    return n;
+}
+
+/**
+ * Wait for events and dispatch them.
+ *
+ * If file descriptors were marked via Reactor::Ready(), they are dispatched
+ * without waiting. Otherwise, the Reactor spins for its spin budget before it
+ * blocks.
+ *
+ * @param timeout_msec Maximum time to wait in milliseconds, -1 waits
+ * indefinitely.
+ * @returns The number of dispatched events.
+ */
+int Reactor::Poll( int timeout_msec ) {
+
+    m_dispatching.clear();
+    m_dispatching.swap(m_ready);
+
+    int n;
+    if( !m_dispatching.empty() || timeout_msec == 0 ) {
+        n = Wait(0);
+    } else {
+        n = m_spin_nsec ? Spin() : 0;
+        if( n == 0 ) {
+            uint64_t start = now_nsec();
+            n = Wait(timeout_msec);
+            m_stat_idle_nsec.fetch_add( now_nsec() - start,
+                    std::memory_order_relaxed );
+        }
+    }
+
+    for( int i = 0; i < n; i++ ) {
+        Dispatch( m_events[i].data.fd, m_events[i].events );
+    }
+    for( int i = 0; i < m_dispatching.size(); i++ ) {
+        Dispatch( m_dispatching[i], EPOLLIN );
+    }
+
+    return n + m_dispatching.size();
+}
@@ -0,0 +1,128 @@
+/** @file reactor.hh
+ * Reactor class definition
+ */
+
+#ifndef _REACTOR_HH_
+#define _REACTOR_HH_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <sys/epoll.h>
+
+#include "common.hh"
+
+/**
+ * Maximum number of events retrieved by a single epoll_wait() call.
+ */
+#define REACTOR_MAX_EVENTS 64
+
+/**
+ * Reactor class
+ *
+ * An event loop based on epoll. File descriptors are registered
+ * edge-triggered, each with its own handler, which is called with the
+ * signalled events.
+ *
+ * Since events are only signalled once, handlers are expected to consume all
+ * available data. To keep a single busy file descriptor from starving the
+ * others, a handler may instead stop after a budget and call
+ * Reactor::Ready(), which dispatches the file descriptor again in the next
+ * iteration without waiting.
+ *
+ * In low-latency mode, see Reactor::SetSpin(), the Reactor spins on
+ * non-blocking epoll_wait() calls for a budget of time before it blocks. The
+ * time spent spinning and blocked is accounted, to weigh the CPU spent
+ * against the latency gained.
+ *
+ * Both the LinkManager's reception thread and the LinkAggregator's main loop
+ * run a Reactor.
+ */
+class Reactor {
+
+    public:
+
+    /**
+     * Handler of events on a file descriptor. Called with the signalled epoll
+     * events.
+     */
+    typedef std::function<void(uint32_t)> Handler;
+
+    /**
+     * Spin and idle statistics of a Reactor.
+     */
+    struct Stats {
+        // Time spent spinning in nanoseconds
+        uint64_t m_spin_nsec;
+        // Time spent blocked in nanoseconds
+        uint64_t m_idle_nsec;
+        // Number of spins ended by an event
+        uint64_t m_spin_hits;
+        // Number of spins that fell back to blocking
+        uint64_t m_spin_misses;
+    };
+
+    private:
+
+    // epoll instance
+    int                       m_epfd;
+    // Handlers, indexed by file descriptor
+    std::vector<Handler>      m_handlers;
+    // File descriptors to be dispatched in the next iteration
+    std::vector<int>          m_ready;
+    // File descriptors dispatched in the current iteration
+    std::vector<int>          m_dispatching;
+    // Events retrieved by epoll_wait()
+    struct epoll_event        m_events[REACTOR_MAX_EVENTS];
+
+    // Spin budget in nanoseconds, 0 if disabled
+    uint64_t                  m_spin_nsec;
+    // Statistics, taken from other threads
+    std::atomic<uint64_t>     m_stat_spin_nsec;
+    std::atomic<uint64_t>     m_stat_idle_nsec;
+    std::atomic<uint64_t>     m_stat_spin_hits;
+    std::atomic<uint64_t>     m_stat_spin_misses;
+
+    Reactor( Reactor const & ) = delete;
+    Reactor & operator=( Reactor const & ) = delete;
+
+    void Dispatch( int fd, uint32_t events );
+    int Wait( int timeout_msec );
+    int Spin();
+
+    public:
+
+    Reactor();
+    ~Reactor();
+
+    void Add( int fd, uint32_t events, Handler handler );
+    void Modify( int fd, uint32_t events );
+    void Remove( int fd );
+    int AddTimer( uint32_t period_msec, std::function<void()> handler );
+
+    /**
+     * Dispatch a file descriptor again in the next iteration.
+     *
+     * @param fd File descriptor, whose handler stopped before consuming all
+     * available data.
+     */
+    void Ready( int fd ) { m_ready.push_back(fd); }
+
+    /**
+     * Set the spin budget.
+     *
+     * Must be set before the Reactor is polled.
+     *
+     * @param usec Time to spin before blocking in microseconds. 0 disables
+     * spinning.
+     */
+    void SetSpin( int usec ) { m_spin_nsec = (uint64_t) usec * 1000; }
+
+    Stats TakeStats();
+
+    int Poll( int timeout_msec );
+};
+
+#endif /* _REACTOR_HH_ */
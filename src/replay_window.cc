@@ -0,0 +1,121 @@
+#include "replay_window.hh"
+
+/**
+ * ReplayWindow class constructor
+ *
+ * Creates an empty window. The highest sequence number starts at an unwrapped
+ * value that corresponds to sequence number 0 and leaves room for sequence
+ * numbers below it.
+ */
+ReplayWindow::ReplayWindow()
+        : m_top( (uint64_t) ALAGG_MAX_SEQ * 65536 )
+        , m_strict( false ) {
+
+    for( int i = 0; i < REPLAY_WINDOW_WORDS; i++ ) {
+        m_words[i].store( 0, std::memory_order_relaxed );
+    }
+}
+
+/**
+ * Calculate the signed distance of a sequence number to the highest one.
+ *
+ * Sequence numbers wrap at ALAGG_MAX_SEQ. The distance is the shorter one of
+ * both directions.
+ *
+ * @param top Highest marked sequence number, unwrapped.
+ * @param seq Sequence number.
+ * @returns The distance, positive if seq is ahead of top.
+ */
+int ReplayWindow::Delta( uint64_t top, alagg_seq_t seq ) {
+
+    int d = ((int) seq - (int) (top % ALAGG_MAX_SEQ)) % ALAGG_MAX_SEQ;
+    if( d < 0 ) {
+        d += ALAGG_MAX_SEQ;
+    }
+    if( d > ALAGG_MAX_SEQ / 2 ) {
+        d -= ALAGG_MAX_SEQ;
+    }
+    return d;
+}
+
+/**
+ * Check whether a sequence number was marked.
+ *
+ * @param seq Sequence number.
+ * @returns True if the sequence number was marked, or in strict mode if it is
+ * older than the window. False otherwise.
+ */
+bool ReplayWindow::Seen( alagg_seq_t seq ) {
+
+    uint64_t top = m_top.load( std::memory_order_acquire );
+    int d = Delta( top, seq );
+
+    if( d > 0 ) {
+        return false;
+    }
+    if( -d >= REPLAY_WINDOW_SIZE ) {
+        return m_strict;
+    }
+
+    uint64_t useq = top + d;
+    return Word(useq).load( std::memory_order_relaxed ) & Bit(useq);
+}
+
+/**
+ * Mark a sequence number.
+ *
+ * Sequence numbers ahead of the window slide it forward, clearing the bits of
+ * the sequence numbers skipped. Must not be called concurrently.
+ *
+ * @param seq Sequence number.
+ * @returns True if the sequence number was newly marked, or is older than the
+ * window and not in strict mode. False otherwise.
+ */
+bool ReplayWindow::Mark( alagg_seq_t seq ) {
+
+    uint64_t top = m_top.load( std::memory_order_relaxed );
+    int d = Delta( top, seq );
+
+    if( d > 0 ) {
+        // Slide the window, clearing the skipped sequence numbers
+        if( d >= REPLAY_WINDOW_SIZE ) {
+            for( int i = 0; i < REPLAY_WINDOW_WORDS; i++ ) {
+                m_words[i].store( 0, std::memory_order_relaxed );
+            }
+        } else {
+            for( uint64_t u = top + 1; u <= top + d; u++ ) {
+                Word(u).fetch_and( ~Bit(u), std::memory_order_relaxed );
+            }
+        }
+        top += d;
+        Word(top).fetch_or( Bit(top), std::memory_order_relaxed );
+        m_top.store( top, std::memory_order_release );
+        return true;
+    }
+
+    if( -d >= REPLAY_WINDOW_SIZE ) {
+        return !m_strict;
+    }
+
+    uint64_t useq = top + d;
+    uint64_t old = Word(useq).fetch_or( Bit(useq), std::memory_order_relaxed );
+    return !(old & Bit(useq));
+}
+
+/**
+ * Forget all sequence numbers, e.g. for a new session of the remote
+ * aggregator.
+ *
+ * Must not be called concurrently with ReplayWindow::Mark().
+ *
+ * @param seq Sequence number preceding the first one expected, taken as the
+ * highest one marked.
+ */
+void ReplayWindow::Reset( alagg_seq_t seq ) {
+
+    for( int i = 0; i < REPLAY_WINDOW_WORDS; i++ ) {
+        m_words[i].store( 0, std::memory_order_relaxed );
+    }
+    m_top.store( (uint64_t) ALAGG_MAX_SEQ * 65536 + seq,
+                 std::memory_order_release );
+}
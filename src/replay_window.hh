@@ -0,0 +1,94 @@
+/** @file replay_window.hh
+ * ReplayWindow class definition
+ */
+
+#ifndef _REPLAY_WINDOW_HH_
+#define _REPLAY_WINDOW_HH_
+
+#include <atomic>
+#include <cstdint>
+
+#include "common.hh"
+#include "link.hh"
+
+/**
+ * Number of 64 bit words of the ReplayWindow's bitmap.
+ */
+#define REPLAY_WINDOW_WORDS 64
+
+/**
+ * Number of sequence numbers tracked by the ReplayWindow.
+ */
+#define REPLAY_WINDOW_SIZE (REPLAY_WINDOW_WORDS * 64)
+
+/**
+ * ReplayWindow class
+ *
+ * Tracks which of the most recent sequence numbers were received, in the style
+ * of an IPsec anti-replay window. With redundant links, most received frames
+ * carry a sequence number that was already received on another link. Checking
+ * the window rejects them before any allocation or locking.
+ *
+ * Sequence numbers are unwrapped relative to the highest one marked so far,
+ * and stored in a bitmap of REPLAY_WINDOW_SIZE bits, which slides along with
+ * the highest sequence number. Sequence numbers older than the window are
+ * reported as unseen, leaving the decision to the PacketPool. In strict mode,
+ * used for authenticated packets, they are rejected instead, see
+ * ReplayWindow::SetStrict().
+ *
+ * The bitmap and the highest sequence number are atomics, so the window can be
+ * checked without locking while it is marked.
+ *
+ * @see LinkManager
+ * @see PacketPool
+ */
+class ReplayWindow {
+
+    // Highest marked sequence number, unwrapped
+    std::atomic<uint64_t> m_top;
+    // Bitmap of marked sequence numbers, indexed by unwrapped sequence number
+    std::atomic<uint64_t> m_words[REPLAY_WINDOW_WORDS];
+    // Whether sequence numbers older than the window are rejected
+    bool                  m_strict;
+
+    ReplayWindow( ReplayWindow const & ) = delete;
+    ReplayWindow & operator=( ReplayWindow const & ) = delete;
+
+    static int Delta( uint64_t top, alagg_seq_t seq );
+
+    /**
+     * Get the bitmap word of an unwrapped sequence number.
+     *
+     * @param useq Unwrapped sequence number.
+     * @returns Reference to the word.
+     */
+    std::atomic<uint64_t> & Word( uint64_t useq ) {
+        return m_words[(useq / 64) % REPLAY_WINDOW_WORDS];
+    }
+
+    /**
+     * Get the bit of an unwrapped sequence number within its word.
+     *
+     * @param useq Unwrapped sequence number.
+     * @returns Mask of the bit.
+     */
+    static uint64_t Bit( uint64_t useq ) { return 1ULL << (useq % 64); }
+
+    public:
+
+    ReplayWindow();
+
+    bool Seen( alagg_seq_t seq );
+    bool Mark( alagg_seq_t seq );
+    void Reset( alagg_seq_t seq );
+
+    /**
+     * Set whether sequence numbers older than the window are rejected, rather
+     * than left to the PacketPool. Must be set before the window is used.
+     *
+     * @param strict True to reject them, false to accept them.
+     */
+    void SetStrict( bool strict ) { m_strict = strict; }
+};
+
+#endif /* _REPLAY_WINDOW_HH_ */
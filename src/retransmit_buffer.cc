@@ -0,0 +1,61 @@
+#include "retransmit_buffer.hh"
+
+/**
+ * RetransmitBuffer class constructor
+ *
+ * Creates an empty buffer.
+ */
+RetransmitBuffer::RetransmitBuffer()
+        : m_entries(RETRANSMIT_BUFFER_SIZE)
+        , m_taken(0) {
+
+    for( int i = 0; i < m_entries.size(); i++ ) {
+        m_entries[i].m_valid = false;
+    }
+}
+
+/**
+ * Store a copy of a sent packet.
+ *
+ * @param seq Sequence number of the packet.
+ * @param data Pointer to the packet.
+ * @param size Size of the packet.
+ * @param now Current monotonic time in nanoseconds.
+ */
+void RetransmitBuffer::Store( alagg_seq_t seq, unsigned char const * data,
+                              int size, uint64_t now ) {
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    Entry &e = m_entries[seq % RETRANSMIT_BUFFER_SIZE];
+    e.m_seq     = seq;
+    e.m_tx_nsec = now;
+    e.m_valid   = true;
+    e.m_data.assign( data, data + size );
+}
+
+/**
+ * Take a stored packet for retransmission.
+ *
+ * Every packet is taken at most once, since further requests are duplicates
+ * sent on other Links, or too late anyway.
+ *
+ * @param seq Sequence number of the packet.
+ * @param sent_after Monotonic time in nanoseconds the packet must have been
+ * sent after, so the retransmission still arrives in time.
+ * @param out Buffer the packet is copied to.
+ * @returns True if the packet was taken, false if it was replaced, taken
+ * already or sent too long ago.
+ */
+bool RetransmitBuffer::Take( alagg_seq_t seq, uint64_t sent_after,
+                             Buffer & out ) {
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    Entry &e = m_entries[seq % RETRANSMIT_BUFFER_SIZE];
+    if( !e.m_valid || e.m_seq != seq || e.m_tx_nsec < sent_after ) {
+        return false;
+    }
+    e.m_valid = false;
+    out.assign( e.m_data.begin(), e.m_data.end() );
+    m_taken.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
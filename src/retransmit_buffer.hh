@@ -0,0 +1,70 @@
+/** @file retransmit_buffer.hh
+ * RetransmitBuffer class definition
+ */
+
+#ifndef _RETRANSMIT_BUFFER_HH_
+#define _RETRANSMIT_BUFFER_HH_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "common.hh"
+#include "link.hh"
+
+/**
+ * Number of recently sent packets kept by the RetransmitBuffer.
+ */
+#define RETRANSMIT_BUFFER_SIZE 1024
+
+/**
+ * RetransmitBuffer class
+ *
+ * Keeps copies of the most recently sent packets of a sequence space, so
+ * packets reported missing by the remote aggregator can be sent again, see
+ * ALAGG_FLAG_NACK. Packets are stored in a ring indexed by their sequence
+ * number, so every packet replaces the one sent RETRANSMIT_BUFFER_SIZE packets
+ * before it. The copies' storage is reused, so no memory is allocated once
+ * every slot was used for a packet of the largest size.
+ *
+ * Packets are stored by the transmitting thread and taken by the thread
+ * receiving the reports, so the buffer is locked.
+ *
+ * @see LinkManager
+ */
+class RetransmitBuffer {
+
+    /**
+     * A stored packet.
+     */
+    struct Entry {
+        alagg_seq_t m_seq;
+        uint64_t    m_tx_nsec;
+        bool        m_valid;
+        Buffer      m_data;
+    };
+
+    std::vector<Entry>    m_entries;
+    std::mutex            m_lock;
+    // Number of packets taken for retransmission
+    std::atomic<uint64_t> m_taken;
+
+    public:
+
+    RetransmitBuffer();
+
+    void Store( alagg_seq_t seq, unsigned char const * data, int size,
+                uint64_t now );
+    bool Take( alagg_seq_t seq, uint64_t sent_after, Buffer & out );
+
+    /**
+     * Getter for the number of packets taken for retransmission.
+     * @returns The number of packets.
+     */
+    uint64_t const Taken() const {
+        return m_taken.load(std::memory_order_relaxed);
+    }
+};
+
+#endif /* _RETRANSMIT_BUFFER_HH_ */
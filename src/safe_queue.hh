@@ -5,6 +5,7 @@
 #ifndef _SAFE_QUEUE_HH_
 #define _SAFE_QUEUE_HH_
 
+#include <cstdint>
 #include <queue>
 #include <mutex>
 
@@ -12,6 +13,8 @@
  * SafeQueue class
  *
  * A regular Queue class utilizing mutexes to facilitate multi-thread safety.
+ * The queue may be bounded, see SafeQueue::SetLimit(), dropping objects
+ * according to its policy once full.
  */
 template<typename T>
 class SafeQueue {
@@ -26,14 +29,43 @@ class SafeQueue {
         except_isempty = 0
     };
 
+    /**
+     * Policies of a full queue.
+     */
+    enum safe_queue_policy {
+        // Drop the object pushed
+        drop_tail = 0,
+        // Drop the oldest object to make room for the one pushed
+        drop_oldest
+    };
+
     // Underlying queue object
     std::queue<T> m_queue;
     std::mutex m_mutex;
+    // Maximum number of objects, 0 if unbounded, and the policy once full
+    size_t m_limit;
+    safe_queue_policy m_policy;
+    // Number of objects dropped
+    uint64_t m_drops;
 
     /**
      * SafeQueue class constructor.
      */
-    SafeQueue() {}
+    SafeQueue() : m_limit(0), m_policy(drop_tail), m_drops(0) {}
+
+    /**
+     * Bound the queue.
+     *
+     * @param limit Maximum number of objects, 0 if unbounded.
+     * @param policy Object dropped once the queue is full.
+     */
+    void SetLimit(size_t limit, safe_queue_policy policy) {
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_limit = limit;
+        m_policy = policy;
+    }
 
     /**
      * Push an object to the queue.
@@ -47,6 +79,35 @@ class SafeQueue {
         m_queue.push(val);
     }
 
+    /**
+     * Push an object to a bounded queue.
+     *
+     * If the queue is full, either the object or the oldest object is
+     * dropped, depending on the queue's policy, and counted.
+     *
+     * @param val Object to be pushed.
+     * @param dropped Set to the object dropped, if any.
+     * @returns True if the queue grew, false if an object was dropped.
+     */
+    bool Push(const T& val, T& dropped) {
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if(m_limit && m_queue.size() >= m_limit) {
+            m_drops++;
+            if(m_policy == drop_tail) {
+                dropped = val;
+                return false;
+            }
+            dropped = m_queue.front();
+            m_queue.pop();
+            m_queue.push(val);
+            return false;
+        }
+        m_queue.push(val);
+        return true;
+    }
+
     /**
      * Pop an object from the queue.
      */
@@ -59,6 +120,23 @@ class SafeQueue {
         m_queue.pop();
     }
 
+    /**
+     * Pop several objects from the queue at once.
+     *
+     * @param out Array the objects are stored in.
+     * @param max Maximum number of objects to be popped.
+     * @returns The number of objects popped, 0 if the queue is empty.
+     */
+    size_t PopBatch(T * out, size_t max) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t n = 0;
+        while(n < max && !m_queue.empty()) {
+            out[n++] = m_queue.front();
+            m_queue.pop();
+        }
+        return n;
+    }
+
     /**
      * Access the front of the queue.
      *
@@ -96,6 +174,18 @@ class SafeQueue {
 
         return m_queue.size();
     }
+
+    /**
+     * Get the number of objects dropped by a full queue.
+     *
+     * @returns The number of objects dropped.
+     */
+    uint64_t Drops() {
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        return m_drops;
+    }
 };
 
 #endif /* _SAFE_QUEUE_HH_ */
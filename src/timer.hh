@@ -8,6 +8,9 @@
 #include <cstdint>
 #include <chrono>
 #include <thread>
+#include <vector>
+
+#include "placement.hh"
 
 /**
  * Timer class.
@@ -15,12 +18,23 @@
  * A simple class that is initialized with a callback function and it's
  * arguments, as well as a timeout.
  * A detached thread is spawned, sleeping for the specified time, then calling
- * the callback function.
+ * the callback function. Timer threads are named "alagg-timer" and run on the
+ * CPUs set by Timer::SetAffinity().
  */
 class Timer {
 
     std::thread m_t;
 
+    /**
+     * CPUs timer threads are pinned to.
+     *
+     * @returns Reference to the CPUs, empty if unpinned.
+     */
+    static std::vector<int> & Cpus() {
+        static std::vector<int> cpus;
+        return cpus;
+    }
+
     /**
      * Sleep until the timeout occurs.
      *
@@ -30,6 +44,9 @@ class Timer {
      */
     template<typename F, typename... A>
     static void t(uint32_t msec, F fun, A... args) {
+        // Placement
+        set_thread_name(pthread_self(), "alagg-timer");
+        set_thread_affinity(pthread_self(), Cpus());
         // Sleep
         std::this_thread::sleep_for(std::chrono::milliseconds(msec));
         // Callback
@@ -38,6 +55,18 @@ class Timer {
 
     public:
 
+    /**
+     * Set the CPUs timer threads are pinned to.
+     *
+     * Applies to timers created afterwards. Must be set before any timers are
+     * created.
+     *
+     * @param cpus CPUs the timer threads may run on, empty if unpinned.
+     */
+    static void SetAffinity(std::vector<int> const & cpus) {
+        Cpus() = cpus;
+    }
+
     /**
      * Timer class constructor
      *
@@ -0,0 +1,23 @@
+#include "traffic_class.hh"
+
+/**
+ * TrafficClass class constructor
+ *
+ * @param config Configuration of the class. The number of copies is limited
+ * to CLASS_MAX_COPIES.
+ * @param id Id of the class, its position in the tunnel's configuration
+ * starting at 1.
+ * @param pop Function taking the packets popped from the class's PacketPool.
+ */
+TrafficClass::TrafficClass(ClassConfig const & config, int id,
+                           std::function<void(Buffer *)> pop)
+                           : PacketPool(config.m_reorder_msec)
+                           , m_name(config.m_name)
+                           , m_id(id)
+                           , m_fwmark(config.m_fwmark)
+                           , m_dscps(config.m_dscps)
+                           , m_copies(std::min(config.m_copies,
+                                               CLASS_MAX_COPIES))
+                           , m_tx_seq(1)
+                           , m_pop(pop) {
+}
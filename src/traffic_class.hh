@@ -0,0 +1,161 @@
+/** @file traffic_class.hh
+ * TrafficClass class definition
+ */
+
+#ifndef _TRAFFIC_CLASS_HH_
+#define _TRAFFIC_CLASS_HH_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "common.hh"
+#include "config.hh"
+#include "link.hh"
+#include "packet_pool.hh"
+#include "replay_window.hh"
+#include "retransmit_buffer.hh"
+
+/**
+ * Maximum number of Links a packet of a TrafficClass is sent on, unless it is
+ * sent on all Links.
+ */
+#define CLASS_MAX_COPIES 8
+
+/**
+ * TrafficClass class
+ *
+ * A traffic class carries the packets of a Tunnel matching its firewall mark
+ * or DSCP values, e.g. voice or bulk transfers. Every class has its own
+ * sequence space: It numbers the packets it transmits, and reorders and
+ * deduplicates the packets it receives in its own PacketPool and
+ * ReplayWindow, with its own reorder timeout. So packets of one class are not
+ * held back by packets of another class missing.
+ *
+ * Packets of a class are sent on a given number of the class's Links, the
+ * ones they are expected to arrive first on, or on all of them.
+ *
+ * Packets are told apart by the class id in the AlaggHeader. Class 0 is the
+ * Tunnel's default class, which is handled by the Tunnel itself.
+ *
+ * @see Tunnel
+ * @see PacketPool
+ * @see ReplayWindow
+ */
+class TrafficClass : public PacketPool {
+
+    std::string           m_name;
+    int                   m_id;
+    uint32_t              m_fwmark;
+    uint64_t              m_dscps;
+    int                   m_copies;
+
+    // Transmission sequence number
+    alagg_seq_t           m_tx_seq;
+    // Sequence numbers of packets received on any of the tunnel's Links
+    ReplayWindow          m_replay;
+    // Packets sent recently, for retransmission
+    RetransmitBuffer      m_retransmits;
+
+    // Delivery of packets popped from the pool
+    std::function<void(Buffer *)> m_pop;
+    // Report of missing packets, if enabled
+    std::function<void(alagg_seq_t, uint64_t)> m_nack;
+
+    /**
+     * Hand a packet popped from the pool to the delivery function.
+     *
+     * @param b Packet buffer to be delivered.
+     */
+    void PopPacketFromPool(Buffer * b) override { m_pop(b); }
+
+    /**
+     * Hand missing packets to the report function, if set.
+     *
+     * @param first Sequence number of the first packet reported.
+     * @param missing Bitmap of the missing packets.
+     */
+    void OnGap(alagg_seq_t first, uint64_t missing) override {
+        if(m_nack) {
+            m_nack(first, missing);
+        }
+    }
+
+    public:
+
+    TrafficClass(ClassConfig const & config, int id,
+                 std::function<void(Buffer *)> pop);
+
+    /**
+     * Getter for the class's name.
+     * @returns The name.
+     */
+    std::string const & Name() const { return m_name; }
+
+    /**
+     * Getter for the class id carried in the AlaggHeader.
+     * @returns The id, starting at 1.
+     */
+    int const Id() const { return m_id; }
+
+    /**
+     * Getter for the number of Links every packet is sent on.
+     * @returns The number of copies, 0 if packets are sent on all Links.
+     */
+    int const Copies() const { return m_copies; }
+
+    /**
+     * Check whether a packet belongs to the class.
+     *
+     * @param dscp DSCP value of the packet.
+     * @param mark Firewall mark of the packet.
+     * @returns True if the mark or the DSCP value matches, false otherwise.
+     */
+    bool const Matches( uint8_t dscp, uint32_t mark ) const {
+        return (m_fwmark && mark == m_fwmark)
+            || (m_dscps & ((uint64_t) 1 << (dscp & 0x3f)));
+    }
+
+    /**
+     * Getter for the ReplayWindow.
+     * @returns The class's ReplayWindow.
+     */
+    ReplayWindow & Replay() { return m_replay; }
+
+    /**
+     * Getter for the RetransmitBuffer.
+     * @returns The class's RetransmitBuffer.
+     */
+    RetransmitBuffer & Retransmits() { return m_retransmits; }
+
+    /**
+     * Set the function reporting missing packets.
+     *
+     * Must be set before reception starts.
+     *
+     * @param nack Function taking the first sequence number and the bitmap of
+     * missing packets, see AlaggNack.
+     */
+    void SetNack(std::function<void(alagg_seq_t, uint64_t)> nack) {
+        m_nack = nack;
+    }
+
+    /**
+     * Getter for the tx sequence number.
+     * @returns The tx sequence number used next.
+     */
+    alagg_seq_t const TxSeq() const { return m_tx_seq; }
+
+    /**
+     * Tx sequence number incrementation.
+     *
+     * @returns The next tx sequence number to be used
+     */
+    alagg_seq_t NextTxSeq() {
+        alagg_seq_t seq = m_tx_seq;
+        m_tx_seq = (m_tx_seq + 1) % ALAGG_MAX_SEQ;
+        return seq;
+    }
+};
+
+#endif /* _TRAFFIC_CLASS_HH_ */
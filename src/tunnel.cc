@@ -0,0 +1,230 @@
+#include <cstddef>
+#include <random>
+
+#include "tunnel.hh"
+
+/**
+ * Get the sequence number preceding the first one expected of a session.
+ *
+ * @param sync Handshake of the session.
+ * @param i Index of the sequence number, see AlaggSync.
+ * @returns The sequence number, ALAGG_MAX_SEQ - 1 wrapping to the first
+ * sequence number 0 if the handshake lacks it, since every session starts at
+ * 1.
+ */
+static alagg_seq_t sync_prev_seq(AlaggSync const & sync, int i) {
+    alagg_seq_t next = i < sync.m_count ? sync.m_seqs[i] : 1;
+    return (next + ALAGG_MAX_SEQ - 1) % ALAGG_MAX_SEQ;
+}
+
+/**
+ * Draw the challenge of a request for the remote aggregator's session.
+ *
+ * @returns A random challenge, never 0, which stands for no request.
+ */
+static uint64_t draw_challenge() {
+    std::random_device rd;
+    uint64_t challenge;
+    do {
+        challenge = ((uint64_t) rd() << 32) | rd();
+    } while(!challenge);
+    return challenge;
+}
+
+/**
+ * Tunnel class constructor
+ *
+ * @param config Configuration of the tunnel. The tunnel's Links are created by
+ * the LinkManager.
+ * @param pop Function taking the packets popped from the tunnel's PacketPool,
+ * and from the PacketPools of its traffic classes.
+ */
+Tunnel::Tunnel(TunnelConfig const & config,
+               std::function<void(Buffer *)> pop)
+               : PacketPool(ALAGG_REORDER_TTL)
+               , m_name(config.m_name)
+               , m_id(config.m_id)
+               , m_destinations(config.m_destinations)
+               , m_fwmark(config.m_fwmark)
+               , m_tx_seq(1)
+               , m_tx_unordered_seq(1)
+               , m_cipher(nullptr)
+               , m_control_cipher(nullptr)
+               , m_peer_epoch(0)
+               , m_sync_challenge(draw_challenge())
+               , m_sync_echo(0)
+               , m_tx_bytes(0)
+               , m_offered_bps(0)
+               , m_redundancy(1)
+               , m_striping(false)
+               , m_pop(pop) {
+    for(int i = 0; i < config.m_classes.size(); i++) {
+        m_classes.push_back(new TrafficClass(config.m_classes[i], i + 1, pop));
+    }
+
+    // Authenticated sequence numbers older than the windows are replays
+    if(!config.m_key.empty()) {
+        m_cipher = new Cipher(config.m_key);
+        m_control_cipher = new Cipher(config.m_key);
+        m_replay.SetStrict(true);
+        m_unordered_replay.SetStrict(true);
+        for(int i = 0; i < m_classes.size(); i++) {
+            m_classes[i]->Replay().SetStrict(true);
+        }
+    }
+}
+
+/**
+ * Tunnel class destructor
+ *
+ * Deallocates the traffic classes and the Ciphers.
+ */
+Tunnel::~Tunnel() {
+    delete m_cipher;
+    delete m_control_cipher;
+    for(int i = 0; i < m_classes.size(); i++) {
+        delete m_classes[i];
+    }
+}
+
+/**
+ * Classify a packet into a traffic class.
+ *
+ * The packet belongs to the first class matching its firewall mark or the
+ * DSCP value of its IPv4 or IPv6 header, see TrafficClass::Matches().
+ *
+ * @param data Pointer to the IP packet.
+ * @param size Size of the packet.
+ * @param mark Firewall mark of the packet.
+ * @returns The id of the class, or 0 for the default class.
+ */
+int Tunnel::Classify(unsigned char const * data, int size,
+                     uint32_t mark) const {
+
+    if(m_classes.empty() || size < IP_HEADER_TOS_OFFSET + 2) {
+        return 0;
+    }
+
+    uint8_t tos = (data[IP_HEADER_OFFSET] >> 4) == 6
+        ? (data[IP_HEADER_OFFSET] << 4)
+            | (data[IP_HEADER_OFFSET + IP_HEADER_TOS_OFFSET] >> 4)
+        : data[IP_HEADER_OFFSET + IP_HEADER_TOS_OFFSET];
+    for(int i = 0; i < m_classes.size(); i++) {
+        if(m_classes[i]->Matches(tos >> 2, mark)) {
+            return m_classes[i]->Id();
+        }
+    }
+    return 0;
+}
+
+/**
+ * Add a received packet to the PacketPool of a traffic class.
+ *
+ * @param cls Id of the class, which must exist.
+ * @param p Pointer to the packet. Ownership is taken.
+ * @param size Size of the packet.
+ * @see PacketPool::Add()
+ */
+void Tunnel::Add(int cls, AlaggPacket * p, int size) {
+    if(cls) {
+        m_classes[cls - 1]->Add(p, size);
+    } else {
+        PacketPool::Add(p, size);
+    }
+}
+
+/**
+ * Set the function reporting missing packets, for the tunnel and all of its
+ * traffic classes.
+ *
+ * Must be set before reception starts.
+ *
+ * @param nack Function taking the id of the class, the first sequence number
+ * and the bitmap of missing packets, see AlaggNack.
+ * @see PacketPool::OnGap()
+ */
+void Tunnel::SetNack(std::function<void(int, alagg_seq_t, uint64_t)> nack) {
+    m_nack = nack;
+    for(int i = 0; i < m_classes.size(); i++) {
+        int cls = m_classes[i]->Id();
+        m_classes[i]->SetNack([nack, cls](alagg_seq_t first,
+                                          uint64_t missing) {
+            nack(cls, first, missing);
+        });
+    }
+}
+
+/**
+ * Request the remote aggregator's session.
+ *
+ * Called by the receiving thread, once a frame of another session than the
+ * known one is received.
+ *
+ * @returns True if a request was started, false if one is pending already.
+ */
+bool Tunnel::RequestSync() {
+
+    if(m_sync_challenge) {
+        return false;
+    }
+    m_sync_challenge = draw_challenge();
+    return true;
+}
+
+/**
+ * Accept the answer to a request for the remote aggregator's session.
+ *
+ * The answer must echo the challenge of the pending request, so replayed
+ * answers are ignored. If the session is new, the PacketPools and
+ * ReplayWindows of all classes and of the unordered packets start over at the
+ * session's next sequence numbers. Called by the receiving thread.
+ *
+ * @param epoch Epoch of the remote aggregator's session.
+ * @param sync Handshake answering the request.
+ * @returns True if the answer was accepted, false otherwise.
+ */
+bool Tunnel::AcceptSync(uint16_t epoch, AlaggSync const & sync) {
+
+    if(!m_sync_challenge || sync.m_echo != m_sync_challenge) {
+        return false;
+    }
+    m_sync_challenge = 0;
+    if(epoch == m_peer_epoch) {
+        return true;
+    }
+
+    m_unordered_replay.Reset(sync_prev_seq(sync, 0));
+    Reset(sync_prev_seq(sync, 1));
+    m_replay.Reset(sync_prev_seq(sync, 1));
+    for(int i = 0; i < m_classes.size(); i++) {
+        m_classes[i]->Reset(sync_prev_seq(sync, i + 2));
+        m_classes[i]->Replay().Reset(sync_prev_seq(sync, i + 2));
+    }
+    m_peer_epoch = epoch;
+    return true;
+}
+
+/**
+ * Describe the tunnel's session for a handshake.
+ *
+ * Called by the transmitting thread.
+ *
+ * @param sync Handshake filled with the challenge of the pending request, the
+ * challenge answered and the next sequence numbers of the unordered packets
+ * and of all classes.
+ * @param echo Challenge of the remote aggregator's request answered, 0 if
+ * none.
+ * @returns The size of the handshake.
+ */
+int Tunnel::Sync(AlaggSync & sync, uint64_t echo) const {
+
+    sync.m_challenge = m_sync_challenge;
+    sync.m_echo = echo;
+    sync.m_count = m_classes.size() + 2;
+    sync.m_seqs[0] = m_tx_unordered_seq;
+    sync.m_seqs[1] = m_tx_seq;
+    for(int i = 0; i < m_classes.size(); i++) {
+        sync.m_seqs[i + 2] = m_classes[i]->TxSeq();
+    }
+    return offsetof(AlaggSync, m_seqs) + sync.m_count * sizeof(alagg_seq_t);
+}
@@ -0,0 +1,408 @@
+/** @file tunnel.hh
+ * Tunnel class definition
+ */
+
+#ifndef _TUNNEL_HH_
+#define _TUNNEL_HH_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "ack_filter.hh"
+#include "cipher.hh"
+#include "common.hh"
+#include "config.hh"
+#include "link.hh"
+#include "packet_pool.hh"
+#include "replay_window.hh"
+#include "retransmit_buffer.hh"
+#include "traffic_class.hh"
+
+/**
+ * Tunnel class
+ *
+ * A tunnel carries the traffic of its destination prefixes, or of its firewall
+ * mark, to a single remote aggregator. Every tunnel has its own sequence
+ * space: It numbers the packets it transmits, and reorders and deduplicates
+ * the packets it receives in its own PacketPool and ReplayWindow.
+ *
+ * With the adaptive scheduler, packets are sent on the Tunnel's first
+ * Tunnel::Redundancy() Links by Link::Rank(), or striped over its Links, see
+ * Tunnel::Striping().
+ *
+ * Packets matching one of the tunnel's TrafficClasses are numbered, reordered
+ * and sent according to the class instead, see Tunnel::Classify(). The
+ * tunnel's own sequence space, PacketPool and ReplayWindow form the default
+ * class 0.
+ *
+ * With ARQ enabled, packets found missing by the PacketPools are reported to
+ * the remote aggregator, which sends them again from its RetransmitBuffers,
+ * see Tunnel::SetNack().
+ *
+ * With a pre-shared key, the tunnel's packets are encrypted and authenticated
+ * by its Cipher, see Tunnel::Encryption(), and probes, reports and NACKs by
+ * a Cipher of their own, see Tunnel::ControlEncryption(). Its ReplayWindows
+ * are strict then, rejecting authenticated sequence numbers older than the
+ * window.
+ *
+ * The tunnel tracks the session of the remote aggregator by its epoch. Once a
+ * handshake reveals a new session, the PacketPools and ReplayWindows start
+ * over at the remote aggregator's sequence numbers, see Tunnel::AcceptSync()
+ * and ALAGG_FLAG_SYNC.
+ *
+ * Pure TCP ACKs may bypass the PacketPool, see ALAGG_FLAG_UNORDERED. They are
+ * numbered in a separate sequence space, deduplicated in a ReplayWindow of
+ * their own, and thinned in the tunnel's AckFilter before transmission.
+ *
+ * Packets are told apart by the tunnel id in the AlaggHeader. The Links of all
+ * tunnels are handled by a single LinkManager, sharing its threads, and
+ * packets popped from a tunnel's PacketPool are handed to a common delivery
+ * function.
+ *
+ * @see LinkManager
+ * @see PacketPool
+ * @see ReplayWindow
+ */
+class Tunnel : public PacketPool {
+
+    std::string           m_name;
+    int                   m_id;
+    std::vector<IpPrefix> m_destinations;
+    uint32_t              m_fwmark;
+
+    // Transmission sequence number
+    alagg_seq_t           m_tx_seq;
+    // Sequence numbers of packets received on any of the tunnel's Links
+    ReplayWindow          m_replay;
+    // Packets sent recently, for retransmission
+    RetransmitBuffer      m_retransmits;
+
+    // Sequence space of packets bypassing the PacketPool
+    alagg_seq_t           m_tx_unordered_seq;
+    ReplayWindow          m_unordered_replay;
+
+    // ACKs held for thinning
+    AckFilter             m_acks;
+
+    // Encryption of the packets, and of probes, reports and NACKs, if a key
+    // is configured
+    Cipher               *m_cipher;
+    Cipher               *m_control_cipher;
+
+    // Epoch of the remote aggregator's session, 0 if unknown
+    uint16_t              m_peer_epoch;
+    // Challenge of the pending request for the remote aggregator's session,
+    // 0 if none, and the challenge of the remote aggregator's request to be
+    // answered, 0 if none
+    std::atomic<uint64_t> m_sync_challenge;
+    std::atomic<uint64_t> m_sync_echo;
+
+    // Traffic classes, indexed by id - 1
+    std::vector<TrafficClass *> m_classes;
+
+    // Bytes of ordered packets sent since taken, and their smoothed rate
+    uint64_t              m_tx_bytes;
+    uint64_t              m_offered_bps;
+    // Number of Links every packet is sent on, or striping if load is high
+    int                   m_redundancy;
+    bool                  m_striping;
+
+    // Delivery of packets popped from the pool
+    std::function<void(Buffer *)> m_pop;
+    // Report of missing packets, if enabled
+    std::function<void(int, alagg_seq_t, uint64_t)> m_nack;
+
+    /**
+     * Hand a packet popped from the pool to the delivery function.
+     *
+     * @param b Packet buffer to be delivered.
+     */
+    void PopPacketFromPool(Buffer * b) override { m_pop(b); }
+
+    /**
+     * Hand missing packets of the default class to the report function, if
+     * set.
+     *
+     * @param first Sequence number of the first packet reported.
+     * @param missing Bitmap of the missing packets.
+     */
+    void OnGap(alagg_seq_t first, uint64_t missing) override {
+        if(m_nack) {
+            m_nack(0, first, missing);
+        }
+    }
+
+    public:
+
+    Tunnel(TunnelConfig const & config, std::function<void(Buffer *)> pop);
+    ~Tunnel();
+
+    int Classify(unsigned char const * data, int size, uint32_t mark) const;
+    void Add(int cls, AlaggPacket * p, int size);
+    void SetNack(std::function<void(int, alagg_seq_t, uint64_t)> nack);
+    bool RequestSync();
+    bool AcceptSync(uint16_t epoch, AlaggSync const & sync);
+    int Sync(AlaggSync & sync, uint64_t echo) const;
+
+    /**
+     * Getter for the tunnel's name.
+     * @returns The name.
+     */
+    std::string const & Name() const { return m_name; }
+
+    /**
+     * Getter for the tunnel id carried in the AlaggHeader.
+     * @returns The id.
+     */
+    int const Id() const { return m_id; }
+
+    /**
+     * Getter for the destination prefixes.
+     * @returns A vector of the prefixes carried by the tunnel.
+     */
+    std::vector<IpPrefix> const & Destinations() const {
+        return m_destinations;
+    }
+
+    /**
+     * Getter for the firewall mark.
+     * @returns The mark carried by the tunnel, 0 if unused.
+     */
+    uint32_t const FwMark() const { return m_fwmark; }
+
+    /**
+     * Getter for the traffic classes.
+     * @returns A vector of the classes, indexed by id - 1.
+     */
+    std::vector<TrafficClass *> const & Classes() const { return m_classes; }
+
+    /**
+     * Getter for a traffic class.
+     * @param cls Id of the class.
+     * @returns The class, or nullptr for the default class or an unknown id.
+     */
+    TrafficClass * Class(int cls) const {
+        return cls > 0 && cls <= m_classes.size() ? m_classes[cls - 1]
+                                                   : nullptr;
+    }
+
+    /**
+     * Getter for the ReplayWindow.
+     * @returns The tunnel's ReplayWindow.
+     */
+    ReplayWindow & Replay() { return m_replay; }
+
+    /**
+     * Getter for the ReplayWindow of a traffic class.
+     * @param cls Id of the class, which must exist.
+     * @returns The class's ReplayWindow, the tunnel's for the default class.
+     */
+    ReplayWindow & Replay(int cls) {
+        return cls ? m_classes[cls - 1]->Replay() : m_replay;
+    }
+
+    /**
+     * Getter for the RetransmitBuffer of a traffic class.
+     * @param cls Id of the class, which must exist.
+     * @returns The class's RetransmitBuffer, the tunnel's for the default
+     * class.
+     */
+    RetransmitBuffer & Retransmits(int cls) {
+        return cls ? m_classes[cls - 1]->Retransmits() : m_retransmits;
+    }
+
+    /**
+     * Getter for the reorder timeout of a traffic class.
+     * @param cls Id of the class, which must exist.
+     * @returns Time in milliseconds out-of-order packets of the class are
+     * held at most.
+     */
+    uint32_t const ReorderTimeout(int cls) const {
+        return cls ? m_classes[cls - 1]->Timeout() : Timeout();
+    }
+
+    /**
+     * Getter for the number of packets retransmitted.
+     * @returns The number of packets of all classes taken for
+     * retransmission.
+     */
+    uint64_t const Retransmitted() const {
+        uint64_t n = m_retransmits.Taken();
+        for(int i = 0; i < m_classes.size(); i++) {
+            n += m_classes[i]->Retransmits().Taken();
+        }
+        return n;
+    }
+
+    /**
+     * Getter for the number of packets dropped over the BufferBudget.
+     * @returns The number of out-of-order packets of all classes dropped by
+     * the PacketPools.
+     */
+    uint64_t const BudgetDrops() const {
+        uint64_t n = Overflows();
+        for(int i = 0; i < m_classes.size(); i++) {
+            n += m_classes[i]->Overflows();
+        }
+        return n;
+    }
+
+    /**
+     * Getter for the number of missing packets given up on to keep the
+     * PacketPools' windows.
+     * @returns The number of sequence numbers of all classes skipped.
+     */
+    uint64_t const WindowSkips() const {
+        uint64_t n = Skipped();
+        for(int i = 0; i < m_classes.size(); i++) {
+            n += m_classes[i]->Skipped();
+        }
+        return n;
+    }
+
+    /**
+     * Getter for the ReplayWindow of packets bypassing the PacketPool.
+     * @returns The tunnel's ReplayWindow of unordered packets.
+     */
+    ReplayWindow & UnorderedReplay() { return m_unordered_replay; }
+
+    /**
+     * Getter for the Cipher.
+     * @returns The tunnel's Cipher, or nullptr if its packets are not
+     * encrypted.
+     */
+    Cipher * Encryption() const { return m_cipher; }
+
+    /**
+     * Getter for the Cipher of probes, reports and NACKs.
+     * @returns The tunnel's Cipher of control frames, or nullptr if they are
+     * not encrypted.
+     */
+    Cipher * ControlEncryption() const { return m_control_cipher; }
+
+    /**
+     * Getter for the epoch of the remote aggregator's session.
+     * @returns The epoch, 0 if the session is unknown.
+     */
+    uint16_t const PeerEpoch() const { return m_peer_epoch; }
+
+    /**
+     * Check whether the remote aggregator's session is requested.
+     * @returns True until a request is answered.
+     */
+    bool const SyncRequested() const { return m_sync_challenge != 0; }
+
+    /**
+     * Mark a request of the remote aggregator to be answered.
+     * @param challenge Challenge of the request, echoed by the answer.
+     */
+    void OweSync(uint64_t challenge) { m_sync_echo = challenge; }
+
+    /**
+     * Take a pending answer to the remote aggregator.
+     * @returns The challenge to be echoed, 0 if no request is to be answered.
+     */
+    uint64_t TakeSyncReply() { return m_sync_echo.exchange(0); }
+
+    /**
+     * Getter for the AckFilter.
+     * @returns The tunnel's AckFilter.
+     */
+    AckFilter & Acks() { return m_acks; }
+
+    /**
+     * Hand a packet to the delivery function, bypassing the pool.
+     *
+     * @param b Packet buffer to be delivered.
+     */
+    void Bypass(Buffer * b) { m_pop(b); }
+
+    /**
+     * Count a packet sent, see Tunnel::TakeTxBytes().
+     * @param size Size of the packet.
+     */
+    void CountTx( int size ) { m_tx_bytes += size; }
+
+    /**
+     * Take the number of bytes sent.
+     * @returns The bytes counted since the previous call.
+     */
+    uint64_t TakeTxBytes() {
+        uint64_t bytes = m_tx_bytes;
+        m_tx_bytes = 0;
+        return bytes;
+    }
+
+    /**
+     * Getter for the smoothed rate of packets sent.
+     * @returns The rate in bit/s.
+     */
+    uint64_t const OfferedRate() const { return m_offered_bps; }
+
+    /**
+     * Setter for the smoothed rate of packets sent.
+     * @param bps The rate in bit/s.
+     */
+    void SetOfferedRate( uint64_t bps ) { m_offered_bps = bps; }
+
+    /**
+     * Getter for the number of Links every packet is sent on.
+     * @returns The number of copies of every packet.
+     */
+    int const Redundancy() const { return m_redundancy; }
+
+    /**
+     * Check whether packets are striped over the Links, rather than being
+     * sent on a fixed set of Links.
+     * @returns True if striping, false otherwise.
+     */
+    bool const Striping() const { return m_striping; }
+
+    /**
+     * Set the distribution of packets over the Links.
+     *
+     * @param redundancy Number of Links every packet is sent on.
+     * @param striping Whether single copies are striped over all Links.
+     */
+    void SetRedundancy( int redundancy, bool striping ) {
+        m_redundancy = redundancy;
+        m_striping = striping;
+    }
+
+    /**
+     * Tx sequence number incrementation.
+     *
+     * @returns The next tx sequence number to be used
+     */
+    alagg_seq_t NextTxSeq() {
+        alagg_seq_t seq = m_tx_seq;
+        m_tx_seq = (m_tx_seq + 1) % ALAGG_MAX_SEQ;
+        return seq;
+    }
+
+    /**
+     * Tx sequence number incrementation of a traffic class.
+     *
+     * @param cls Id of the class, which must exist.
+     * @returns The next tx sequence number to be used
+     */
+    alagg_seq_t NextTxSeq(int cls) {
+        return cls ? m_classes[cls - 1]->NextTxSeq() : NextTxSeq();
+    }
+
+    /**
+     * Tx sequence number incrementation of packets bypassing the pool.
+     *
+     * @returns The next unordered tx sequence number to be used
+     */
+    alagg_seq_t NextUnorderedTxSeq() {
+        alagg_seq_t seq = m_tx_unordered_seq;
+        m_tx_unordered_seq = (m_tx_unordered_seq + 1) % ALAGG_MAX_SEQ;
+        return seq;
+    }
+};
+
+#endif /* _TUNNEL_HH_ */
@@ -0,0 +1,716 @@
+#include <iostream>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "uring_engine.hh"
+
+/**
+ * UringEngine class constructor
+ *
+ * Sets up the ring, the registered file table and the registered transmission
+ * buffer region. If the kernel lacks support for any of these, the engine is
+ * left unusable, which can be checked via UringEngine::Ok().
+ *
+ * @param tx_slot_size Size of the small transmission slots. This should fit
+ * the largest frame sent on any Link.
+ */
+UringEngine::UringEngine( int tx_slot_size )
+        : m_fd(-1)
+        , m_ring(MAP_FAILED)
+        , m_sqes((struct io_uring_sqe *) MAP_FAILED)
+        , m_to_submit(0)
+        , m_fixed_files(0)
+        , m_nfixed(0)
+        , m_tx_region((unsigned char *) MAP_FAILED)
+        , m_tx_drops(0)
+        , m_ok(false) {
+
+    struct io_uring_params p;
+
+    // Create the ring, the cooperative task running flag is optional
+    memset( &p, 0, sizeof(p) );
+    p.flags = IORING_SETUP_COOP_TASKRUN;
+    m_fd = syscall( __NR_io_uring_setup, URING_ENTRIES, &p );
+    if( m_fd < 0 ) {
+        memset( &p, 0, sizeof(p) );
+        m_fd = syscall( __NR_io_uring_setup, URING_ENTRIES, &p );
+    }
+    if( m_fd < 0 ) {
+        perror("io_uring_setup()");
+        errno = 0;
+        return;
+    }
+    if( !(p.features & IORING_FEAT_SINGLE_MMAP) ) {
+        std::cerr << "ERROR: io_uring lacks single mmap support" << std::endl;
+        return;
+    }
+
+    // Map the submission and completion rings, as well as the SQEs
+    m_ring_size = std::max( p.sq_off.array + p.sq_entries * sizeof(unsigned),
+            p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe) );
+    m_ring = mmap( nullptr, m_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING );
+    m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    m_sqes = (struct io_uring_sqe *) mmap( nullptr, m_sqes_size,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            m_fd, IORING_OFF_SQES );
+    if( m_ring == MAP_FAILED || m_sqes == MAP_FAILED ) {
+        perror("mmap()");
+        errno = 0;
+        return;
+    }
+
+    unsigned char *ring = (unsigned char *) m_ring;
+    m_sq_head    = (unsigned *) (ring + p.sq_off.head);
+    m_sq_tail    = (unsigned *) (ring + p.sq_off.tail);
+    m_sq_mask    = *(unsigned *) (ring + p.sq_off.ring_mask);
+    m_sq_entries = p.sq_entries;
+    m_sq_array   = (unsigned *) (ring + p.sq_off.array);
+    m_cq_head    = (unsigned *) (ring + p.cq_off.head);
+    m_cq_tail    = (unsigned *) (ring + p.cq_off.tail);
+    m_cq_mask    = *(unsigned *) (ring + p.cq_off.ring_mask);
+    m_cqes       = (struct io_uring_cqe *) (ring + p.cq_off.cqes);
+
+    // SQEs are always submitted in order of their index
+    for( unsigned i = 0; i < m_sq_entries; i++ ) {
+        m_sq_array[i] = i;
+    }
+
+    // Register an empty file table, files are added on demand
+    std::vector<int> fds(URING_MAX_FILES, -1);
+    if( syscall( __NR_io_uring_register, m_fd, IORING_REGISTER_FILES,
+                fds.data(), URING_MAX_FILES ) < 0 ) {
+        perror("io_uring_register(IORING_REGISTER_FILES)");
+        errno = 0;
+        return;
+    }
+
+    // Register the transmission slots
+    m_tx[0].m_slot_size = tx_slot_size;
+    m_tx[1].m_slot_size = BUF_SIZE;
+    size_t small_size = (size_t) tx_slot_size * URING_TX_SLOTS;
+    size_t large_size = (size_t) BUF_SIZE * URING_TX_LARGE_SLOTS;
+    m_tx_region_size = small_size + large_size;
+    m_tx_region = (unsigned char *) mmap( nullptr, m_tx_region_size,
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( m_tx_region == MAP_FAILED ) {
+        perror("mmap()");
+        errno = 0;
+        return;
+    }
+    m_tx[0].m_base = m_tx_region;
+    m_tx[1].m_base = m_tx_region + small_size;
+    for( int i = URING_TX_SLOTS - 1; i >= 0; i-- ) {
+        m_tx[0].m_free.push_back(i);
+    }
+    for( int i = URING_TX_LARGE_SLOTS - 1; i >= 0; i-- ) {
+        m_tx[1].m_free.push_back(i);
+    }
+
+    struct iovec iov[2];
+    iov[0].iov_base = m_tx[0].m_base;
+    iov[0].iov_len  = small_size;
+    iov[1].iov_base = m_tx[1].m_base;
+    iov[1].iov_len  = large_size;
+    if( syscall( __NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS,
+                iov, 2 ) < 0 ) {
+        perror("io_uring_register(IORING_REGISTER_BUFFERS)");
+        errno = 0;
+        return;
+    }
+
+    m_ok = true;
+}
+
+/**
+ * UringEngine class destructor
+ *
+ * Closes the ring and releases all mappings.
+ */
+UringEngine::~UringEngine() {
+
+    for( int i = 0; i < m_groups.size(); i++ ) {
+        numa_free( m_groups[i].m_ring, m_groups[i].m_ring_size );
+        numa_free( m_groups[i].m_bufs,
+                (size_t) m_groups[i].m_buf_size * m_groups[i].m_count );
+    }
+    if( m_tx_region != MAP_FAILED ) {
+        munmap( m_tx_region, m_tx_region_size );
+    }
+    if( m_sqes != MAP_FAILED ) {
+        munmap( m_sqes, m_sqes_size );
+    }
+    if( m_ring != MAP_FAILED ) {
+        munmap( m_ring, m_ring_size );
+    }
+    if( m_fd >= 0 ) {
+        close(m_fd);
+    }
+}
+
+/**
+ * Submit queued SQEs and optionally wait for completions.
+ *
+ * @param to_submit Number of SQEs to submit.
+ * @param min_complete Number of completions to wait for.
+ * @returns The number of submitted SQEs.
+ */
+int UringEngine::Enter( unsigned to_submit, unsigned min_complete ) {
+
+    int ret = syscall( __NR_io_uring_enter, m_fd, to_submit, min_complete,
+            min_complete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0 );
+    if( ret < 0 ) {
+        if( errno != EINTR && errno != EAGAIN && errno != EBUSY ) {
+            perror("io_uring_enter()");
+            exit(1);
+        }
+        errno = 0;
+        return 0;
+    }
+
+    m_to_submit -= ret;
+    return ret;
+}
+
+/**
+ * Get the next free SQE.
+ *
+ * If the submission queue is full, queued SQEs are submitted first. The
+ * returned SQE is cleared and accounted for the next submission.
+ *
+ * @returns A pointer to the SQE, or nullptr if the queue is full.
+ */
+struct io_uring_sqe * UringEngine::GetSqe() {
+
+    unsigned tail = *m_sq_tail;
+    unsigned head = __atomic_load_n( m_sq_head, __ATOMIC_ACQUIRE );
+
+    if( tail - head >= m_sq_entries ) {
+        Submit();
+        head = __atomic_load_n( m_sq_head, __ATOMIC_ACQUIRE );
+        if( tail - head >= m_sq_entries ) {
+            return nullptr;
+        }
+    }
+
+    struct io_uring_sqe *sqe = &m_sqes[tail & m_sq_mask];
+    memset( sqe, 0, sizeof(*sqe) );
+    __atomic_store_n( m_sq_tail, tail + 1, __ATOMIC_RELEASE );
+    m_to_submit++;
+    return sqe;
+}
+
+/**
+ * Get the registered file index of a file descriptor.
+ *
+ * Unregistered file descriptors are added to the file table.
+ *
+ * @param fd File descriptor.
+ * @returns The fixed file index, or -1 if the table is full.
+ */
+int UringEngine::FixedIndex( int fd ) {
+
+    if( fd < m_fixed_files.size() && m_fixed_files[fd] >= 0 ) {
+        return m_fixed_files[fd];
+    }
+    int idx;
+    if( !m_free_fixed.empty() ) {
+        idx = m_free_fixed.back();
+    } else if( m_nfixed < URING_MAX_FILES ) {
+        idx = m_nfixed;
+    } else {
+        return -1;
+    }
+
+    struct io_uring_files_update up;
+    memset( &up, 0, sizeof(up) );
+    up.offset = idx;
+    up.fds = (uint64_t) &fd;
+    if( syscall( __NR_io_uring_register, m_fd, IORING_REGISTER_FILES_UPDATE,
+                &up, 1 ) != 1 ) {
+        perror("io_uring_register(IORING_REGISTER_FILES_UPDATE)");
+        errno = 0;
+        return -1;
+    }
+
+    if( fd >= m_fixed_files.size() ) {
+        m_fixed_files.resize( fd + 1, -1 );
+    }
+    m_fixed_files[fd] = idx;
+    if( idx == m_nfixed ) {
+        m_nfixed++;
+    } else {
+        m_free_fixed.pop_back();
+    }
+    return idx;
+}
+
+/**
+ * Add a group of provided buffers for multishot receives.
+ *
+ * @param count Number of buffers, must be a power of two.
+ * @param buf_size Size of each buffer. Received messages exceeding this size
+ * are truncated.
+ * @param node NUMA node to allocate the buffers and their ring on.
+ * @returns The group id to be passed to UringEngine::AddRecv().
+ */
+int UringEngine::AddBufferGroup( int count, int buf_size, int node ) {
+
+    assert( count > 0 && (count & (count - 1)) == 0 );
+
+    BufGroup g;
+    g.m_buf_size  = buf_size;
+    g.m_count     = count;
+    g.m_ring_size = count * sizeof(struct io_uring_buf);
+    g.m_ring = (struct io_uring_buf_ring *) numa_alloc( g.m_ring_size, node );
+    g.m_bufs = (unsigned char *) numa_alloc( (size_t) buf_size * count, node );
+    if( !g.m_ring || !g.m_bufs ) {
+        exit(1);
+    }
+
+    int group = m_groups.size();
+    struct io_uring_buf_reg reg;
+    memset( &reg, 0, sizeof(reg) );
+    reg.ring_addr    = (uint64_t) g.m_ring;
+    reg.ring_entries = count;
+    reg.bgid         = group;
+    if( syscall( __NR_io_uring_register, m_fd, IORING_REGISTER_PBUF_RING,
+                &reg, 1 ) < 0 ) {
+        perror("io_uring_register(IORING_REGISTER_PBUF_RING)");
+        exit(1);
+    }
+    m_groups.push_back(g);
+
+    // Provide all buffers
+    for( int i = 0; i < count; i++ ) {
+        RecycleBuffer( group, i );
+    }
+
+    return group;
+}
+
+/**
+ * Return a provided buffer to its group.
+ *
+ * @param group Buffer group id.
+ * @param bid Buffer id within the group.
+ */
+void UringEngine::RecycleBuffer( int group, int bid ) {
+
+    BufGroup &g = m_groups[group];
+
+    // The ring tail overlays the first buffer's reserved field, so buffers are
+    // filled in field by field. The ring is accessed as a plain array, since
+    // the flexible array member of io_uring_buf_ring is laid out differently
+    // in C++.
+    struct io_uring_buf *bufs = (struct io_uring_buf *) g.m_ring;
+    uint16_t *tail = &bufs[0].resv;
+    struct io_uring_buf *buf = &bufs[*tail & (g.m_count - 1)];
+    buf->addr = (uint64_t) (g.m_bufs + (size_t) bid * g.m_buf_size);
+    buf->len  = g.m_buf_size;
+    buf->bid  = bid;
+    __atomic_store_n( tail, (uint16_t) (*tail + 1), __ATOMIC_RELEASE );
+}
+
+/**
+ * Keep a multishot receive outstanding on a socket.
+ *
+ * @param fd Socket file descriptor.
+ * @param group Buffer group to receive into.
+ * @param handler Handler called for every received message.
+ */
+void UringEngine::AddRecv( int fd, int group, RecvHandler handler ) {
+
+    Receiver r;
+    r.m_fixed   = FixedIndex(fd);
+    r.m_group   = group;
+    r.m_handler = handler;
+    if( r.m_fixed < 0 ) {
+        std::cerr << "ERROR: could not register fd " << fd << std::endl;
+        exit(1);
+    }
+
+    int idx;
+    if( !m_free_receivers.empty() ) {
+        idx = m_free_receivers.back();
+        m_free_receivers.pop_back();
+        m_receivers[idx] = r;
+    } else {
+        idx = m_receivers.size();
+        m_receivers.push_back(r);
+    }
+    ArmRecv( idx );
+}
+
+/**
+ * Keep a multishot poll for readability outstanding on a file descriptor.
+ *
+ * The handler is expected to consume the available data.
+ *
+ * @param fd File descriptor.
+ * @param handler Handler called whenever the file descriptor is readable.
+ */
+void UringEngine::AddPoll( int fd, PollHandler handler ) {
+
+    Poller p;
+    p.m_fd      = fd;
+    p.m_handler = handler;
+
+    int idx;
+    if( !m_free_pollers.empty() ) {
+        idx = m_free_pollers.back();
+        m_free_pollers.pop_back();
+        m_pollers[idx] = p;
+    } else {
+        idx = m_pollers.size();
+        m_pollers.push_back(p);
+    }
+    ArmPoll( idx );
+}
+
+/**
+ * Stop receiving on and polling a file descriptor.
+ *
+ * Outstanding requests on the file descriptor are canceled, and completions
+ * still arriving for them are discarded. The slots of the receivers and
+ * pollers are freed by their last completion. The file descriptor is removed
+ * from the file table, and may be closed afterwards.
+ *
+ * @param fd File descriptor.
+ */
+void UringEngine::Remove( int fd ) {
+
+    int fixed = -1;
+    if( fd < m_fixed_files.size() ) {
+        fixed = m_fixed_files[fd];
+    }
+
+    for( int i = 0; i < m_receivers.size(); i++ ) {
+        if( fixed >= 0 && m_receivers[i].m_fixed == fixed ) {
+            m_receivers[i].m_handler = nullptr;
+        }
+    }
+    for( int i = 0; i < m_pollers.size(); i++ ) {
+        if( m_pollers[i].m_fd == fd ) {
+            m_pollers[i].m_handler = nullptr;
+        }
+    }
+
+    // Cancel outstanding requests
+    struct io_uring_sqe *sqe = GetSqe();
+    if( sqe ) {
+        sqe->opcode       = IORING_OP_ASYNC_CANCEL;
+        sqe->fd           = (fixed >= 0) ? fixed : fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL
+            | ((fixed >= 0) ? IORING_ASYNC_CANCEL_FD_FIXED : 0);
+        sqe->user_data    = (uint64_t) op_cancel << 32;
+    }
+    Submit();
+
+    // Release the file table slot
+    if( fixed >= 0 ) {
+        int none = -1;
+        struct io_uring_files_update up;
+        memset( &up, 0, sizeof(up) );
+        up.offset = fixed;
+        up.fds = (uint64_t) &none;
+        syscall( __NR_io_uring_register, m_fd, IORING_REGISTER_FILES_UPDATE,
+                &up, 1 );
+        errno = 0;
+        m_fixed_files[fd] = -1;
+        m_free_fixed.push_back(fixed);
+    }
+}
+
+/**
+ * Queue a multishot receive for a Receiver.
+ *
+ * If the submission queue is full, the Receiver is re-armed by the next
+ * iteration of UringEngine::Run().
+ *
+ * @param idx Index of the Receiver.
+ */
+void UringEngine::ArmRecv( int idx ) {
+
+    struct io_uring_sqe *sqe = GetSqe();
+    if( !sqe ) {
+        m_rearm_recv.push_back(idx);
+        return;
+    }
+
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->flags     = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->fd        = m_receivers[idx].m_fixed;
+    sqe->buf_group = m_receivers[idx].m_group;
+    sqe->user_data = ((uint64_t) op_recv << 32) | idx;
+}
+
+/**
+ * Queue a multishot poll for a Poller.
+ *
+ * If the submission queue is full, the Poller is re-armed by the next
+ * iteration of UringEngine::Run().
+ *
+ * @param idx Index of the Poller.
+ */
+void UringEngine::ArmPoll( int idx ) {
+
+    struct io_uring_sqe *sqe = GetSqe();
+    if( !sqe ) {
+        m_rearm_poll.push_back(idx);
+        return;
+    }
+
+    sqe->opcode        = IORING_OP_POLL_ADD;
+    sqe->fd            = m_pollers[idx].m_fd;
+    sqe->len           = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data     = ((uint64_t) op_poll << 32) | idx;
+}
+
+/**
+ * Queue a transmission.
+ *
+ * The data is copied to a registered transmission slot, and a fixed write is
+ * queued. It is submitted along with other queued SQEs by the next call to
+ * UringEngine::Submit() or UringEngine::Run().
+ * If all slots are in use, the data is dropped, just like a non-blocking
+ * socket would do.
+ *
+ * @param fd Socket file descriptor.
+ * @param buf Pointer to the data.
+ * @param len Size of the data.
+ * @returns The number of bytes queued, or -1 if the data was dropped.
+ */
+int UringEngine::Send( int fd, void const * buf, int len ) {
+
+    struct iovec iov;
+    iov.iov_base = (void *) buf;
+    iov.iov_len  = len;
+    return Send( fd, &iov, 1 );
+}
+
+/**
+ * Queue a transmission gathered from several pieces.
+ *
+ * The pieces are copied to a single registered transmission slot, like
+ * UringEngine::Send() does for contiguous data.
+ *
+ * @param fd Socket file descriptor.
+ * @param iov Pieces of the data.
+ * @param iovcnt Number of pieces.
+ * @returns The number of bytes queued, or -1 if the data was dropped.
+ */
+int UringEngine::Send( int fd, struct iovec const * iov, int iovcnt ) {
+
+    int len = 0;
+    for( int i = 0; i < iovcnt; i++ ) {
+        len += iov[i].iov_len;
+    }
+
+    int pool;
+    if( len <= m_tx[0].m_slot_size ) {
+        pool = 0;
+    } else if( len <= m_tx[1].m_slot_size ) {
+        pool = 1;
+    } else {
+        m_tx_drops++;
+        return -1;
+    }
+
+    TxPool &tx = m_tx[pool];
+    if( tx.m_free.empty() ) {
+        Submit();
+        m_tx_drops++;
+        return -1;
+    }
+
+    struct io_uring_sqe *sqe = GetSqe();
+    if( !sqe ) {
+        m_tx_drops++;
+        return -1;
+    }
+
+    int slot = tx.m_free.back();
+    tx.m_free.pop_back();
+    unsigned char *data = tx.m_base + (size_t) slot * tx.m_slot_size;
+    for( int i = 0, off = 0; i < iovcnt; off += iov[i].iov_len, i++ ) {
+        memcpy( data + off, iov[i].iov_base, iov[i].iov_len );
+    }
+
+    int fixed = FixedIndex(fd);
+    sqe->opcode    = IORING_OP_WRITE_FIXED;
+    sqe->flags     = (fixed >= 0) ? IOSQE_FIXED_FILE : 0;
+    sqe->fd        = (fixed >= 0) ? fixed : fd;
+    sqe->addr      = (uint64_t) data;
+    sqe->len       = len;
+    sqe->buf_index = pool;
+    sqe->user_data = ((uint64_t) op_write << 32) | (pool << 16) | slot;
+
+    return len;
+}
+
+/**
+ * Submit all queued SQEs without waiting for completions.
+ */
+void UringEngine::Submit() {
+
+    if( m_to_submit ) {
+        Enter( m_to_submit, 0 );
+    }
+}
+
+/**
+ * Dispatch a completion.
+ *
+ * @param cqe The completion.
+ */
+void UringEngine::HandleCqe( struct io_uring_cqe const & cqe ) {
+
+    uint32_t op  = cqe.user_data >> 32;
+    uint32_t idx = cqe.user_data & 0xffffffff;
+
+    switch( op ) {
+
+        case op_recv: {
+            // Handlers may add and remove receivers, so call a copy
+            RecvHandler handler = m_receivers[idx].m_handler;
+            int group = m_receivers[idx].m_group;
+            if( cqe.flags & IORING_CQE_F_BUFFER ) {
+                int bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+                BufGroup &g = m_groups[group];
+                unsigned char *buf = g.m_bufs + (size_t) bid * g.m_buf_size;
+                if( cqe.res > 0 && handler ) {
+                    handler( buf, cqe.res );
+                }
+                RecycleBuffer( group, bid );
+            } else if( cqe.res == -EINVAL ) {
+                std::cerr << "ERROR: io_uring multishot receive not supported"
+                    << std::endl;
+                exit(1);
+            } else if( cqe.res < 0 && cqe.res != -ENOBUFS
+                    && cqe.res != -ECANCELED ) {
+                std::cerr << "ERROR: io_uring receive: "
+                    << strerror(-cqe.res) << std::endl;
+            }
+            if( !(cqe.flags & IORING_CQE_F_MORE) ) {
+                if( m_receivers[idx].m_handler ) {
+                    ArmRecv(idx);
+                } else {
+                    m_free_receivers.push_back(idx);
+                }
+            }
+            break;
+        }
+
+        case op_poll: {
+            PollHandler handler = m_pollers[idx].m_handler;
+            if( cqe.res > 0 && handler ) {
+                handler();
+            }
+            if( !(cqe.flags & IORING_CQE_F_MORE) ) {
+                if( m_pollers[idx].m_handler ) {
+                    ArmPoll(idx);
+                } else {
+                    m_free_pollers.push_back(idx);
+                }
+            }
+            break;
+        }
+
+        case op_cancel: {
+            // Canceled requests complete on their own
+            break;
+        }
+
+        case op_write: {
+            // Failed transmissions are dropped, like LinkManager::Send() does
+            if( cqe.res < 0 ) {
+                m_tx_drops++;
+            }
+            m_tx[(idx >> 16) & 0xffff].m_free.push_back( idx & 0xffff );
+            break;
+        }
+    }
+}
+
+/**
+ * Re-arm the Receivers and Pollers which could not be armed for lack of an
+ * SQE.
+ *
+ * Receivers and Pollers removed meanwhile are freed instead. Those failing
+ * again stay queued.
+ */
+void UringEngine::Rearm() {
+
+    std::vector<int> recv, poll;
+    recv.swap(m_rearm_recv);
+    poll.swap(m_rearm_poll);
+
+    for( int i = 0; i < recv.size(); i++ ) {
+        if( m_receivers[recv[i]].m_handler ) {
+            ArmRecv(recv[i]);
+        } else {
+            m_free_receivers.push_back(recv[i]);
+        }
+    }
+    for( int i = 0; i < poll.size(); i++ ) {
+        if( m_pollers[poll[i]].m_handler ) {
+            ArmPoll(poll[i]);
+        } else {
+            m_free_pollers.push_back(poll[i]);
+        }
+    }
+}
+
+/**
+ * Set the handler called after every batch of completions.
+ *
+ * The handler is called once all available completions were dispatched,
+ * before the queued SQEs are submitted, e.g. to flush work accumulated by the
+ * completion handlers.
+ *
+ * @param handler Handler, or nullptr to remove it.
+ */
+void UringEngine::SetFlushHandler( PollHandler handler ) {
+    m_flush = handler;
+}
+
+/**
+ * Run the engine.
+ *
+ * Every iteration submits all queued SQEs, waits for at least one completion,
+ * and dispatches all available completions. Handlers may queue further SQEs,
+ * which are submitted in the next iteration. While Receivers or Pollers wait
+ * for re-arming, the engine does not block waiting for completions. This
+ * function does not return.
+ *
+ * @see UringEngine::SetFlushHandler()
+ */
+void UringEngine::Run() {
+
+    for(;;) {
+        Rearm();
+        bool pending = !m_rearm_recv.empty() || !m_rearm_poll.empty();
+        Enter( m_to_submit, pending ? 0 : 1 );
+
+        unsigned head = *m_cq_head;
+        unsigned tail = __atomic_load_n( m_cq_tail, __ATOMIC_ACQUIRE );
+        while( head != tail ) {
+            struct io_uring_cqe cqe = m_cqes[head & m_cq_mask];
+            head++;
+            __atomic_store_n( m_cq_head, head, __ATOMIC_RELEASE );
+            HandleCqe(cqe);
+        }
+
+        if( m_flush ) {
+            m_flush();
+        }
+    }
+}
@@ -0,0 +1,213 @@
+/** @file uring_engine.hh
+ * UringEngine class definition
+ */
+
+#ifndef _URING_ENGINE_HH_
+#define _URING_ENGINE_HH_
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "common.hh"
+#include "placement.hh"
+
+/**
+ * Number of submission queue entries of the ring.
+ */
+#define URING_ENTRIES 256
+
+/**
+ * Maximum number of files registered with the ring.
+ */
+#define URING_MAX_FILES 64
+
+/**
+ * Number of transmission slots for frames of up to the small slot size.
+ */
+#define URING_TX_SLOTS 256
+
+/**
+ * Number of transmission slots for packets of up to BUF_SIZE.
+ */
+#define URING_TX_LARGE_SLOTS 64
+
+/**
+ * UringEngine class
+ *
+ * An I/O engine based on io_uring, driving the whole data path from a single
+ * thread. The ring is set up using the raw system calls.
+ *
+ * Receivers keep a multishot receive outstanding on their socket, drawing from
+ * a ring of provided buffers. Every completion is handed to the receiver's
+ * handler, and the buffer is recycled afterwards. Sockets are registered as
+ * fixed files.
+ * Transmissions are copied to slots of a registered buffer region and queued as
+ * fixed writes. Queued submissions are flushed in a single io_uring_enter()
+ * call, which also waits for the next completions.
+ *
+ * File descriptors that are merely to be watched for readability, e.g. pipes,
+ * are polled using multishot polls.
+ *
+ * The slots of removed receivers and pollers are reused once their last
+ * completion arrived, so adding and removing file descriptors at runtime does
+ * not grow the engine.
+ */
+class UringEngine {
+
+    public:
+
+    /**
+     * Handler of received data. Called with a pointer to the data and its
+     * size.
+     */
+    typedef std::function<void(unsigned char *, int)> RecvHandler;
+
+    /**
+     * Handler of a readable file descriptor.
+     */
+    typedef std::function<void()> PollHandler;
+
+    private:
+
+    /**
+     * Kinds of submissions, stored in the upper half of an SQE's user data.
+     */
+    enum uring_op {
+        op_recv   = 1,
+        op_poll   = 2,
+        op_write  = 3,
+        op_cancel = 4
+    };
+
+    /**
+     * A group of provided buffers, used by multishot receives.
+     */
+    struct BufGroup {
+        struct io_uring_buf_ring *m_ring;
+        size_t                    m_ring_size;
+        unsigned char            *m_bufs;
+        int                       m_buf_size;
+        int                       m_count;
+    };
+
+    /**
+     * A socket kept under multishot reception.
+     */
+    struct Receiver {
+        int         m_fixed;
+        int         m_group;
+        RecvHandler m_handler;
+    };
+
+    /**
+     * A file descriptor watched by a multishot poll.
+     */
+    struct Poller {
+        int         m_fd;
+        PollHandler m_handler;
+    };
+
+    /**
+     * A pool of equally sized transmission slots within the registered buffer
+     * region.
+     */
+    struct TxPool {
+        unsigned char   *m_base;
+        int              m_slot_size;
+        std::vector<int> m_free;
+    };
+
+    // Ring file descriptor and mappings
+    int                   m_fd;
+    void                 *m_ring;
+    size_t                m_ring_size;
+    struct io_uring_sqe  *m_sqes;
+    size_t                m_sqes_size;
+
+    // Submission queue
+    unsigned             *m_sq_head;
+    unsigned             *m_sq_tail;
+    unsigned              m_sq_mask;
+    unsigned              m_sq_entries;
+    unsigned             *m_sq_array;
+    unsigned              m_to_submit;
+
+    // Completion queue
+    unsigned             *m_cq_head;
+    unsigned             *m_cq_tail;
+    unsigned              m_cq_mask;
+    struct io_uring_cqe  *m_cqes;
+
+    // Registered resources
+    std::vector<int>      m_fixed_files;
+    int                   m_nfixed;
+    std::vector<int>      m_free_fixed;
+    std::vector<BufGroup> m_groups;
+    TxPool                m_tx[2];
+    unsigned char        *m_tx_region;
+    size_t                m_tx_region_size;
+
+    std::vector<Receiver> m_receivers;
+    std::vector<int>      m_free_receivers;
+    std::vector<Poller>   m_pollers;
+    std::vector<int>      m_free_pollers;
+    PollHandler           m_flush;
+
+    // Receivers and Pollers waiting for an SQE to be re-armed
+    std::vector<int>      m_rearm_recv;
+    std::vector<int>      m_rearm_poll;
+
+    // Number of transmissions dropped or failed
+    uint64_t              m_tx_drops;
+
+    bool                  m_ok;
+
+    UringEngine( UringEngine const & ) = delete;
+    UringEngine & operator=( UringEngine const & ) = delete;
+
+    int Enter( unsigned to_submit, unsigned min_complete );
+    struct io_uring_sqe * GetSqe();
+    int FixedIndex( int fd );
+    void ArmRecv( int idx );
+    void ArmPoll( int idx );
+    void Rearm();
+    void RecycleBuffer( int group, int bid );
+    void HandleCqe( struct io_uring_cqe const & cqe );
+
+    public:
+
+    UringEngine( int tx_slot_size );
+    ~UringEngine();
+
+    /**
+     * Check whether the ring was set up successfully.
+     *
+     * @returns True if the engine is usable, false otherwise.
+     */
+    bool const Ok() const { return m_ok; }
+
+    int AddBufferGroup( int count, int buf_size, int node = NUMA_NODE_ANY );
+    void AddRecv( int fd, int group, RecvHandler handler );
+    void AddPoll( int fd, PollHandler handler );
+    void Remove( int fd );
+    void SetFlushHandler( PollHandler handler );
+
+    int Send( int fd, void const * buf, int len );
+    int Send( int fd, struct iovec const * iov, int iovcnt );
+    void Submit();
+    void Run();
+
+    /**
+     * Getter for the number of transmissions dropped.
+     *
+     * @returns The number of transmissions dropped for lack of a slot, or
+     * failed on completion.
+     */
+    uint64_t const TxDrops() const { return m_tx_drops; }
+};
+
+#endif /* _URING_ENGINE_HH_ */
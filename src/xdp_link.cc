@@ -0,0 +1,489 @@
+#include <iostream>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+
+#include "xdp_link.hh"
+
+/**
+ * Construct a BPF instruction.
+ *
+ * @param code Opcode.
+ * @param dst Destination register.
+ * @param src Source register.
+ * @param off Signed offset.
+ * @param imm Signed immediate constant.
+ * @returns The instruction.
+ */
+static struct bpf_insn bpf_insn( uint8_t code, uint8_t dst, uint8_t src,
+                                 int16_t off, int32_t imm ) {
+    struct bpf_insn insn;
+    insn.code    = code;
+    insn.dst_reg = dst;
+    insn.src_reg = src;
+    insn.off     = off;
+    insn.imm     = imm;
+    return insn;
+}
+
+/**
+ * Issue a bpf() system call.
+ *
+ * @param cmd Command.
+ * @param attr Attributes of the command.
+ * @returns The return value of the system call.
+ */
+static int sys_bpf( int cmd, union bpf_attr * attr ) {
+    return syscall( __NR_bpf, cmd, attr, sizeof(*attr) );
+}
+
+/**
+ * XdpLink class constructor
+ *
+ * Constructs the underlying Link, then loads and attaches the XDP program and
+ * sets up the AF_XDP socket. On failure, Ok() returns false and the XdpLink is
+ * to be replaced by a Link.
+ *
+ * @param ifname Name of the interface to be bound to.
+ * @param mac_addr_str String containing the peer's MAC address.
+ * @param mtu MTU to be used on the link. If 0, the interface's MTU is used.
+ * MTUs exceeding the size of a UMEM frame are reduced.
+ * @param queue Device queue to be bound to.
+ * @param tunnel Id of the tunnel carried.
+ */
+XdpLink::XdpLink( std::string const ifname,
+                  std::string const mac_addr_str,
+                  int const mtu,
+                  int const queue,
+                  int const tunnel )
+        : Link(ifname, mac_addr_str, mtu, tunnel)
+        , m_queue(queue)
+        , m_prog_fd(-1)
+        , m_map_fd(-1)
+        , m_bpf_link_fd(-1)
+        , m_native(false)
+        , m_xsk(-1)
+        , m_umem(nullptr)
+        , m_zerocopy(false)
+        , m_ok(false) {
+
+    memset( &m_rx, 0, sizeof(m_rx) );
+    memset( &m_tx, 0, sizeof(m_tx) );
+    memset( &m_fill, 0, sizeof(m_fill) );
+    memset( &m_comp, 0, sizeof(m_comp) );
+
+    // Frames must fit into a UMEM frame
+    int max_mtu = XSK_FRAME_SIZE - XSK_HEADROOM - sizeof(struct ether_header);
+    if( m_mtu > max_mtu ) {
+        std::cerr << "WARNING: Reducing MTU of " << m_if_name << " to "
+            << max_mtu << " for AF_XDP" << std::endl;
+        m_mtu = max_mtu;
+    }
+
+    if( queue < 0 || queue >= XSK_MAX_QUEUES ) {
+        std::cerr << "ERROR: Invalid queue " << queue << " on " << m_if_name
+            << std::endl;
+        return;
+    }
+
+    m_ok = LoadProgram() && SetupSocket() && AttachProgram();
+    errno = 0;
+}
+
+/**
+ * XdpLink class destructor
+ *
+ * Detaches the XDP program and releases the AF_XDP socket and UMEM.
+ */
+XdpLink::~XdpLink() {
+
+    if( m_bpf_link_fd >= 0 ) {
+        close(m_bpf_link_fd);
+    }
+    if( m_prog_fd >= 0 ) {
+        close(m_prog_fd);
+    }
+    if( m_map_fd >= 0 ) {
+        close(m_map_fd);
+    }
+
+    UnmapRing(m_rx);
+    UnmapRing(m_tx);
+    UnmapRing(m_fill);
+    UnmapRing(m_comp);
+    if( m_xsk >= 0 ) {
+        close(m_xsk);
+    }
+    numa_free( m_umem, (size_t) XSK_NUM_FRAMES * XSK_FRAME_SIZE );
+}
+
+/**
+ * Load the XDP program.
+ *
+ * Creates the socket map and loads a program equivalent to
+ *
+ *     if( data + ETH_HLEN > data_end
+ *             || eth->h_proto != htons(ETH_P_ALAGG) )
+ *         return XDP_PASS;
+ *     return bpf_redirect_map( &xsks, ctx->rx_queue_index, XDP_PASS );
+ *
+ * Frames on queues without a socket in the map are passed as well.
+ *
+ * @returns True on success, false otherwise.
+ */
+bool XdpLink::LoadProgram() {
+
+    union bpf_attr attr;
+
+    // Socket map, indexed by queue
+    memset( &attr, 0, sizeof(attr) );
+    attr.map_type    = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size    = sizeof(uint32_t);
+    attr.value_size  = sizeof(uint32_t);
+    attr.max_entries = XSK_MAX_QUEUES;
+    m_map_fd = sys_bpf( BPF_MAP_CREATE, &attr );
+    if( m_map_fd < 0 ) {
+        perror("bpf(BPF_MAP_CREATE)");
+        return false;
+    }
+
+    // ETH_P_ALAGG reads the same in either byte order
+    static_assert( (ETH_P_ALAGG >> 8) == (ETH_P_ALAGG & 0xff),
+            "ETH_P_ALAGG must be byte order independent" );
+
+    struct bpf_insn prog[] = {
+        // r2 = ctx->data, r3 = ctx->data_end
+        bpf_insn( BPF_LDX | BPF_MEM | BPF_W, 2, 1, 0, 0 ),
+        bpf_insn( BPF_LDX | BPF_MEM | BPF_W, 3, 1, 4, 0 ),
+        // if( r2 + ETH_HLEN > r3 ) goto pass
+        bpf_insn( BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0 ),
+        bpf_insn( BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, ETH_HLEN ),
+        bpf_insn( BPF_JMP | BPF_JGT | BPF_X, 4, 3, 8, 0 ),
+        // if( eth->h_proto != ETH_P_ALAGG ) goto pass
+        bpf_insn( BPF_LDX | BPF_MEM | BPF_H, 5, 2, 12, 0 ),
+        bpf_insn( BPF_JMP | BPF_JNE | BPF_K, 5, 0, 6, ETH_P_ALAGG ),
+        // return bpf_redirect_map( map, ctx->rx_queue_index, XDP_PASS )
+        bpf_insn( BPF_LDX | BPF_MEM | BPF_W, 2, 1, 16, 0 ),
+        bpf_insn( BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0,
+                m_map_fd ),
+        bpf_insn( 0, 0, 0, 0, 0 ),
+        bpf_insn( BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS ),
+        bpf_insn( BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map ),
+        bpf_insn( BPF_JMP | BPF_EXIT, 0, 0, 0, 0 ),
+        // pass: return XDP_PASS
+        bpf_insn( BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS ),
+        bpf_insn( BPF_JMP | BPF_EXIT, 0, 0, 0, 0 ),
+    };
+
+    static char const license[] = "GPL";
+    char log[4096] = "";
+
+    memset( &attr, 0, sizeof(attr) );
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns     = (uint64_t) prog;
+    attr.insn_cnt  = sizeof(prog) / sizeof(prog[0]);
+    attr.license   = (uint64_t) license;
+    attr.log_buf   = (uint64_t) log;
+    attr.log_size  = sizeof(log);
+    attr.log_level = 1;
+    m_prog_fd = sys_bpf( BPF_PROG_LOAD, &attr );
+    if( m_prog_fd < 0 ) {
+        perror("bpf(BPF_PROG_LOAD)");
+        std::cerr << log << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Attach the XDP program to the interface.
+ *
+ * Native mode is tried first, generic mode second. The program is detached
+ * once its attachment is closed.
+ *
+ * @returns True on success, false otherwise.
+ */
+bool XdpLink::AttachProgram() {
+
+    uint32_t const modes[] = { XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE };
+
+    for( int i = 0; i < 2; i++ ) {
+        union bpf_attr attr;
+        memset( &attr, 0, sizeof(attr) );
+        attr.link_create.prog_fd        = m_prog_fd;
+        attr.link_create.target_ifindex = m_if_index;
+        attr.link_create.attach_type    = BPF_XDP;
+        attr.link_create.flags          = modes[i];
+        m_bpf_link_fd = sys_bpf( BPF_LINK_CREATE, &attr );
+        if( m_bpf_link_fd >= 0 ) {
+            m_native = modes[i] == XDP_FLAGS_DRV_MODE;
+            return true;
+        }
+    }
+
+    perror("bpf(BPF_LINK_CREATE)");
+    return false;
+}
+
+/**
+ * Map one of the socket's rings.
+ *
+ * @param ring Ring to be set up.
+ * @param off Offsets of the ring's members, as reported by the kernel.
+ * @param desc_size Size of a single descriptor.
+ * @param pgoff Offset identifying the ring to mmap().
+ * @returns True on success, false otherwise.
+ */
+bool XdpLink::MapRing( Ring & ring, struct xdp_ring_offset const & off,
+                       size_t desc_size, off_t pgoff ) {
+
+    ring.m_map_size = off.desc + XSK_RING_SIZE * desc_size;
+    ring.m_map = mmap( nullptr, ring.m_map_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, m_xsk, pgoff );
+    if( ring.m_map == MAP_FAILED ) {
+        perror("mmap()");
+        ring.m_map = nullptr;
+        return false;
+    }
+
+    unsigned char *base = (unsigned char *) ring.m_map;
+    ring.m_producer = (uint32_t *) (base + off.producer);
+    ring.m_consumer = (uint32_t *) (base + off.consumer);
+    ring.m_flags    = (uint32_t *) (base + off.flags);
+    ring.m_descs    = base + off.desc;
+    ring.m_mask     = XSK_RING_SIZE - 1;
+
+    return true;
+}
+
+/**
+ * Unmap one of the socket's rings.
+ *
+ * @param ring Ring to be unmapped, may not be mapped.
+ */
+void XdpLink::UnmapRing( Ring & ring ) {
+
+    if( ring.m_map ) {
+        munmap( ring.m_map, ring.m_map_size );
+        ring.m_map = nullptr;
+    }
+}
+
+/**
+ * Set up the AF_XDP socket.
+ *
+ * Registers the UMEM, maps the rings, binds the socket to the queue and
+ * inserts it into the socket map. All reception frames are handed to the
+ * kernel through the fill ring.
+ *
+ * @returns True on success, false otherwise.
+ */
+bool XdpLink::SetupSocket() {
+
+    m_xsk = socket( AF_XDP, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    if( m_xsk < 0 ) {
+        perror("socket(AF_XDP)");
+        return false;
+    }
+
+    // UMEM on the device's NUMA node
+    size_t umem_size = (size_t) XSK_NUM_FRAMES * XSK_FRAME_SIZE;
+    m_umem = (unsigned char *) numa_alloc( umem_size, m_numa_node );
+    if( !m_umem ) {
+        return false;
+    }
+
+    struct xdp_umem_reg reg;
+    memset( &reg, 0, sizeof(reg) );
+    reg.addr       = (uint64_t) m_umem;
+    reg.len        = umem_size;
+    reg.chunk_size = XSK_FRAME_SIZE;
+    reg.headroom   = 0;
+    if( setsockopt( m_xsk, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg) ) < 0 ) {
+        perror("setsockopt(XDP_UMEM_REG)");
+        return false;
+    }
+
+    int ring_size = XSK_RING_SIZE;
+    int const rings[] = { XDP_UMEM_FILL_RING, XDP_UMEM_COMPLETION_RING,
+                          XDP_RX_RING, XDP_TX_RING };
+    for( int i = 0; i < 4; i++ ) {
+        if( setsockopt( m_xsk, SOL_XDP, rings[i],
+                    &ring_size, sizeof(ring_size) ) < 0 ) {
+            perror("setsockopt(XDP_*_RING)");
+            return false;
+        }
+    }
+
+    struct xdp_mmap_offsets off;
+    socklen_t optlen = sizeof(off);
+    if( getsockopt( m_xsk, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen ) < 0 ) {
+        perror("getsockopt(XDP_MMAP_OFFSETS)");
+        return false;
+    }
+
+    if( !MapRing( m_rx, off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING )
+            || !MapRing( m_tx, off.tx, sizeof(struct xdp_desc),
+                XDP_PGOFF_TX_RING )
+            || !MapRing( m_fill, off.fr, sizeof(uint64_t),
+                XDP_UMEM_PGOFF_FILL_RING )
+            || !MapRing( m_comp, off.cr, sizeof(uint64_t),
+                XDP_UMEM_PGOFF_COMPLETION_RING ) ) {
+        return false;
+    }
+
+    // The first half of the UMEM is used for reception
+    uint64_t *fill = (uint64_t *) m_fill.m_descs;
+    for( uint32_t i = 0; i < XSK_RING_SIZE; i++ ) {
+        fill[i] = (uint64_t) i * XSK_FRAME_SIZE;
+    }
+    __atomic_store_n( m_fill.m_producer, XSK_RING_SIZE, __ATOMIC_RELEASE );
+
+    // The second half for transmission
+    for( uint32_t i = XSK_RING_SIZE; i < XSK_NUM_FRAMES; i++ ) {
+        m_tx_free.push_back( (uint64_t) i * XSK_FRAME_SIZE );
+    }
+
+    // Bind, preferring zero-copy
+    struct sockaddr_xdp sxdp;
+    memset( &sxdp, 0, sizeof(sxdp) );
+    sxdp.sxdp_family   = AF_XDP;
+    sxdp.sxdp_ifindex  = m_if_index;
+    sxdp.sxdp_queue_id = m_queue;
+    sxdp.sxdp_flags    = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+    m_zerocopy = bind( m_xsk, (struct sockaddr *) &sxdp, sizeof(sxdp) ) == 0;
+    if( !m_zerocopy ) {
+        sxdp.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+        if( bind( m_xsk, (struct sockaddr *) &sxdp, sizeof(sxdp) ) < 0 ) {
+            perror("bind(AF_XDP)");
+            return false;
+        }
+    }
+
+    // Redirect the queue's frames to the socket
+    uint32_t key = m_queue;
+    uint32_t value = m_xsk;
+    union bpf_attr attr;
+    memset( &attr, 0, sizeof(attr) );
+    attr.map_fd = m_map_fd;
+    attr.key    = (uint64_t) &key;
+    attr.value  = (uint64_t) &value;
+    if( sys_bpf( BPF_MAP_UPDATE_ELEM, &attr ) < 0 ) {
+        perror("bpf(BPF_MAP_UPDATE_ELEM)");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Receive frames from the reception ring.
+ *
+ * Frames are handed to the handler straight from the UMEM, and returned to the
+ * kernel through the fill ring afterwards.
+ *
+ * @param budget Maximum number of frames to be received.
+ * @param handler Handler called for every frame.
+ * @returns The number of frames received.
+ */
+int XdpLink::RecvFrames( int budget, FrameHandler const & handler ) {
+
+    uint32_t prod = __atomic_load_n( m_rx.m_producer, __ATOMIC_ACQUIRE );
+    uint32_t cons = *m_rx.m_consumer;
+    uint32_t fill = *m_fill.m_producer;
+    struct xdp_desc *descs = (struct xdp_desc *) m_rx.m_descs;
+    uint64_t *fill_descs = (uint64_t *) m_fill.m_descs;
+    int n;
+
+    for( n = 0; n < budget && cons != prod; n++, cons++ ) {
+        struct xdp_desc const & desc = descs[cons & m_rx.m_mask];
+        handler( m_umem + desc.addr, desc.len );
+
+        // Recycle the frame, the fill ring never overflows since it has as
+        // many entries as there are reception frames
+        fill_descs[fill++ & m_fill.m_mask] =
+            desc.addr & ~((uint64_t) XSK_FRAME_SIZE - 1);
+    }
+
+    if( n > 0 ) {
+        __atomic_store_n( m_rx.m_consumer, cons, __ATOMIC_RELEASE );
+        __atomic_store_n( m_fill.m_producer, fill, __ATOMIC_RELEASE );
+
+        if( *m_fill.m_flags & XDP_RING_NEED_WAKEUP ) {
+            recvfrom( m_xsk, nullptr, 0, MSG_DONTWAIT, nullptr, nullptr );
+            errno = 0;
+        }
+    }
+
+    return n;
+}
+
+/**
+ * Return completed transmission frames to the free list.
+ */
+void XdpLink::ReapCompletions() {
+
+    uint32_t prod = __atomic_load_n( m_comp.m_producer, __ATOMIC_ACQUIRE );
+    uint32_t cons = *m_comp.m_consumer;
+    uint64_t *descs = (uint64_t *) m_comp.m_descs;
+
+    for( ; cons != prod; cons++ ) {
+        m_tx_free.push_back( descs[cons & m_comp.m_mask] );
+    }
+
+    __atomic_store_n( m_comp.m_consumer, cons, __ATOMIC_RELEASE );
+}
+
+/**
+ * Transmit a frame through the transmission ring.
+ *
+ * The header, the payload and the trailer, if any, are copied into a free UMEM
+ * frame, and the kernel is woken up if required. If no frame is free, the
+ * frame is dropped.
+ *
+ * @param header Header of the frame.
+ * @param payload Pointer to the payload.
+ * @param len Size of the payload.
+ * @returns The size of the frame, or -1 if it was dropped.
+ */
+int XdpLink::SendFrame( AlaggHeader const & header,
+                        void const * payload, int len ) {
+
+    ReapCompletions();
+    unsigned char trailer[ALAGG_TRAILER_MAX];
+    int trailer_len = Trailer( header, payload, len, trailer );
+    int size = sizeof(AlaggHeader) + len + trailer_len;
+    if( m_tx_free.empty() || size > XSK_FRAME_SIZE ) {
+        return -1;
+    }
+
+    uint64_t addr = m_tx_free.back();
+    m_tx_free.pop_back();
+    unsigned char *frame = m_umem + addr;
+    memcpy( frame, &header, sizeof(AlaggHeader) );
+    memcpy( frame + sizeof(AlaggHeader), payload, len );
+    memcpy( frame + sizeof(AlaggHeader) + len, trailer, trailer_len );
+
+    // The ring never overflows since it has as many entries as there are
+    // transmission frames
+    uint32_t prod = *m_tx.m_producer;
+    struct xdp_desc *descs = (struct xdp_desc *) m_tx.m_descs;
+    struct xdp_desc & desc = descs[prod & m_tx.m_mask];
+    desc.addr    = addr;
+    desc.len     = size;
+    desc.options = 0;
+    __atomic_store_n( m_tx.m_producer, prod + 1, __ATOMIC_RELEASE );
+
+    if( *m_tx.m_flags & XDP_RING_NEED_WAKEUP ) {
+        sendto( m_xsk, nullptr, 0, MSG_DONTWAIT, nullptr, 0 );
+        errno = 0;
+    }
+
+    return size;
+}
@@ -0,0 +1,158 @@
+/** @file xdp_link.hh
+ * XdpLink class definition
+ */
+
+#ifndef _XDP_LINK_HH_
+#define _XDP_LINK_HH_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <linux/if_xdp.h>
+
+#include "link.hh"
+
+/**
+ * Size of a UMEM frame in bytes.
+ *
+ * A frame holds a single received or transmitted ethernet frame. Zero-copy
+ * drivers require frames to be page sized.
+ */
+#define XSK_FRAME_SIZE 4096
+
+/**
+ * Headroom the kernel reserves in front of received frames in bytes.
+ */
+#define XSK_HEADROOM 256
+
+/**
+ * Number of UMEM frames. The first half is used for reception, the second half
+ * for transmission.
+ */
+#define XSK_NUM_FRAMES 4096
+
+/**
+ * Number of descriptors of each AF_XDP ring.
+ */
+#define XSK_RING_SIZE (XSK_NUM_FRAMES / 2)
+
+/**
+ * Maximum number of device queues XDP links can be bound to.
+ */
+#define XSK_MAX_QUEUES 64
+
+/**
+ * XdpLink class
+ *
+ * A Link receiving and transmitting frames through an AF_XDP socket, bypassing
+ * the kernel's network stack.
+ *
+ * The socket is bound to a single queue of the device and shares a region of
+ * memory (UMEM) with the kernel. Frames are exchanged by passing descriptors of
+ * UMEM frames through four single-producer/single-consumer rings: The fill and
+ * reception ring for received frames, the transmission and completion ring for
+ * transmitted frames.
+ *
+ * A small XDP program, loaded using the raw bpf() system call, redirects
+ * frames of type ETH_P_ALAGG received on the bound queue to the socket. All
+ * other frames, as well as Alagg frames on other queues, pass on to the
+ * kernel, where the inherited AF_PACKET socket receives the latter.
+ *
+ * The program is attached in native mode if the driver supports it, in generic
+ * mode otherwise, e.g. on veth. The socket is bound in zero-copy mode if the
+ * driver supports it, in copy mode otherwise.
+ *
+ * Since frames must fit into a UMEM frame, the MTU is limited to
+ * XSK_FRAME_SIZE - XSK_HEADROOM minus the ethernet header.
+ */
+class XdpLink : public Link {
+
+    /**
+     * A ring shared with the kernel.
+     */
+    struct Ring {
+        uint32_t *m_producer;
+        uint32_t *m_consumer;
+        uint32_t *m_flags;
+        void     *m_descs;
+        void     *m_map;
+        size_t    m_map_size;
+        uint32_t  m_mask;
+    };
+
+    // Device queue bound to
+    int                   m_queue;
+
+    // XDP program, its socket map and its attachment
+    int                   m_prog_fd;
+    int                   m_map_fd;
+    int                   m_bpf_link_fd;
+    bool                  m_native;
+
+    // AF_XDP socket and UMEM
+    int                   m_xsk;
+    unsigned char        *m_umem;
+    bool                  m_zerocopy;
+
+    Ring                  m_rx;
+    Ring                  m_tx;
+    Ring                  m_fill;
+    Ring                  m_comp;
+
+    // UMEM addresses of free transmission frames
+    std::vector<uint64_t> m_tx_free;
+
+    bool                  m_ok;
+
+    bool LoadProgram();
+    bool AttachProgram();
+    bool SetupSocket();
+    bool MapRing( Ring & ring, struct xdp_ring_offset const & off,
+                  size_t desc_size, off_t pgoff );
+    void UnmapRing( Ring & ring );
+    void ReapCompletions();
+
+    public:
+
+    XdpLink( std::string const ifname,
+             std::string const mac_addr_str,
+             int const mtu,
+             int const queue,
+             int const tunnel = 0 );
+    ~XdpLink();
+
+    /**
+     * Check whether the AF_XDP socket was set up successfully.
+     *
+     * @returns True if the link is usable, false otherwise.
+     */
+    bool const Ok() const { return m_ok; }
+
+    /**
+     * Check whether the socket is bound in zero-copy mode.
+     *
+     * @returns True in zero-copy mode, false in copy mode.
+     */
+    bool const ZeroCopy() const { return m_zerocopy; }
+
+    /**
+     * Check whether the XDP program is attached in native mode.
+     *
+     * @returns True in native mode, false in generic mode.
+     */
+    bool const Native() const { return m_native; }
+
+    /**
+     * Getter for the AF_XDP socket.
+     *
+     * @returns The AF_XDP socket's file descriptor.
+     */
+    int const BypassFd() const override { return m_xsk; }
+
+    int RecvFrames( int budget, FrameHandler const & handler ) override;
+    int SendFrame( AlaggHeader const & header,
+                   void const * payload, int len ) override;
+};
+
+#endif /* _XDP_LINK_HH_ */